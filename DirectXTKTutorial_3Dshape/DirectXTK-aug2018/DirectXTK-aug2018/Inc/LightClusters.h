@@ -0,0 +1,96 @@
+//--------------------------------------------------------------------------------------
+// File: LightClusters.h
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#if defined(_XBOX_ONE) && defined(_TITLE)
+#include <d3d11_x.h>
+#else
+#include <d3d11_1.h>
+#endif
+
+#include <DirectXMath.h>
+
+#include <memory>
+#include <stdint.h>
+
+
+namespace DirectX
+{
+    // Shader parameters for looking up the cluster of a pixel, as Shaders/LightClusters.fxh expects them.
+    struct LightClustersConstants
+    {
+        XMFLOAT4 tileAndDepthScale;     // clusters per pixel in x and y, then the log2 depth scale and bias
+        XMUINT4 clusterCounts;          // clusters in x, y, and z, then the number of lights
+    };
+
+
+    // Bins point and spot lights into a grid of clusters that divides the view frustum into screen tiles and
+    // exponentially spaced depth slices, and uploads the lights, each cluster's range of light indices, and the
+    // indices themselves as structured buffers. Pixel shaders then light each pixel with only the lights of its
+    // cluster, using the functions in Shaders/LightClusters.fxh, so any number of local lights costs one upload
+    // per frame rather than a light selection per draw. Lights are given in world space, and clusters are built
+    // for a perspective projection with the viewport at the origin of the render target.
+    //
+    // Of the built-in effects only NormalMapEffect reads the clusters, through SetLightClusters. BasicEffect,
+    // SkinnedEffect, and the other lit effects still have three directional lights; custom shaders can include
+    // Shaders/LightClusters.fxh to use the clusters.
+    class LightClusters
+    {
+    public:
+        explicit LightClusters(_In_ ID3D11Device* device,
+                               uint32_t clustersX = 16, uint32_t clustersY = 9, uint32_t clustersZ = 24);
+
+        LightClusters(LightClusters&& moveFrom) noexcept;
+        LightClusters& operator= (LightClusters&& moveFrom) noexcept;
+
+        LightClusters(LightClusters const&) = delete;
+        LightClusters& operator= (LightClusters const&) = delete;
+
+        virtual ~LightClusters();
+
+        // Lays out the clusters for a perspective projection and a viewport size in pixels. Depth slices span
+        // nearZ to farZ, which may be a smaller range than the projection's; lights beyond it are ignored.
+        void XM_CALLCONV SetProjection(FXMMATRIX projection, float viewportWidth, float viewportHeight, float nearZ, float farZ);
+
+        // Lights. Colors are premultiplied by intensity, and fall off smoothly to zero at the range. Spot light
+        // angles are half angles in radians, from full intensity inside innerAngle to zero outside outerAngle.
+        void XM_CALLCONV AddPointLight(FXMVECTOR position, float range, FXMVECTOR color);
+        void XM_CALLCONV AddSpotLight(FXMVECTOR position, FXMVECTOR direction, float range, float innerAngle, float outerAngle, GXMVECTOR color);
+
+        void __cdecl ClearLights();
+
+        size_t __cdecl GetLightCount() const;
+
+        // Assigns the lights to clusters for a view matrix, then uploads the lights and the cluster lists.
+        void XM_CALLCONV Update(_In_ ID3D11DeviceContext* deviceContext, FXMMATRIX view);
+
+        // Assigns the lights to clusters without uploading them, for inspecting the binning on the CPU.
+        void XM_CALLCONV Bin(FXMMATRIX view);
+
+        // Cluster layout, indexed as (z * clustersY + y) * clustersX + x, with y counting tiles from the top.
+        size_t __cdecl GetClusterCount() const;
+        const uint32_t* __cdecl GetClusterLights(size_t cluster, _Out_ size_t* count) const;
+        size_t __cdecl GetLightIndexCount() const;
+
+        LightClustersConstants __cdecl GetShaderConstants() const;
+
+        // StructuredBuffer<ClusterLight>, StructuredBuffer<uint2> of offset and count per cluster, and
+        // StructuredBuffer<uint> of light indices, valid after Update.
+        ID3D11ShaderResourceView* __cdecl GetLightBuffer() const;
+        ID3D11ShaderResourceView* __cdecl GetClusterBuffer() const;
+        ID3D11ShaderResourceView* __cdecl GetLightIndexBuffer() const;
+
+    private:
+        // Private implementation.
+        class Impl;
+
+        std::unique_ptr<Impl> pImpl;
+    };
+}
@@ -18,8 +18,10 @@
 #include <DirectXMath.h>
 #include <DirectXCollision.h>
 
+#include <atomic>
 #include <memory>
 #include <functional>
+#include <map>
 #include <set>
 #include <string>
 #include <vector>
@@ -33,8 +35,12 @@ namespace DirectX
 {
     class IEffect;
     class IEffectFactory;
+    class IEffectMatrices;
     class CommonStates;
     class ModelMesh;
+    class ModelBufferPool;
+    class MeshBVH;
+    class TransparentQueue;
 
     //----------------------------------------------------------------------------------
     // Each mesh part is a submesh with a single effect
@@ -57,11 +63,21 @@ namespace DirectX
         std::shared_ptr<std::vector<D3D11_INPUT_ELEMENT_DESC>>  vbDecl;
         bool                                                    isAlpha;
 
+        // Simplified index data drawn with the same vertex buffer, from Model::GenerateLODs
+        struct LevelOfDetail
+        {
+            uint32_t                                indexCount;
+            uint32_t                                startIndex;
+            Microsoft::WRL::ComPtr<ID3D11Buffer>    indexBuffer;
+        };
+
+        std::vector<LevelOfDetail>                              lods;
+
         typedef std::vector<std::unique_ptr<ModelMeshPart>> Collection;
 
-        // Draw mesh part with custom effect
+        // Draw mesh part with custom effect (level 0 is the full detail index data, level n uses lods[n - 1])
         void __cdecl Draw(_In_ ID3D11DeviceContext* deviceContext, _In_ IEffect* ieffect, _In_ ID3D11InputLayout* iinputLayout,
-            _In_opt_ std::function<void __cdecl()> setCustomState = nullptr) const;
+            _In_opt_ std::function<void __cdecl()> setCustomState = nullptr, size_t lod = 0) const;
 
         void __cdecl DrawInstanced(_In_ ID3D11DeviceContext* deviceContext, _In_ IEffect* ieffect, _In_ ID3D11InputLayout* iinputLayout,
             uint32_t instanceCount, uint32_t startInstanceLocation = 0,
@@ -89,57 +105,328 @@ namespace DirectX
         std::wstring                name;
         bool                        ccw;
         bool                        pmalpha;
+        float                       lodScreenCoverage;
+        uint32_t                    boneIndex;          // Skeleton bone the mesh is attached to, if any
+        std::vector<uint32_t>       boneInfluences;     // Skeleton bone for each blend index of skinned vertices
+        std::shared_ptr<MeshBVH>    bvh;                // Triangle hierarchy for CPU ray and collision queries, from Model::CreateBVHs or the loaders
 
         typedef std::vector<std::shared_ptr<ModelMesh>> Collection;
 
         // Setup states for drawing mesh
         void __cdecl PrepareForRendering(_In_ ID3D11DeviceContext* deviceContext, const CommonStates& states, bool alpha = false, bool wireframe = false) const;
 
+        // Level-of-detail selection. Level 0 is drawn while the bounding sphere covers at least lodScreenCoverage
+        // of the viewport height, and each successive level takes over at half the previous threshold.
+        size_t __cdecl GetLODCount() const;
+        size_t XM_CALLCONV SelectLOD(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection) const;
+
+        // Frustum test of the mesh bounds placed by world, against the view frustum of view and projection
+        bool XM_CALLCONV IsVisible(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection) const;
+
         // Draw the mesh
         void XM_CALLCONV Draw(_In_ ID3D11DeviceContext* deviceContext, FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection,
                               bool alpha = false, _In_opt_ std::function<void __cdecl()> setCustomState = nullptr) const;
     };
 
 
+    //----------------------------------------------------------------------------------
+    // An animation clip holds keyframes for the bones of a skeleton, as parallel arrays grouped by bone
+    class ModelAnimationClip
+    {
+    public:
+        ModelAnimationClip() noexcept;
+
+        std::wstring            name;
+        float                   startTime;
+        float                   endTime;
+
+        // The keys of bone b are [keyOffsets[b], keyOffsets[b + 1]), in increasing time
+        std::vector<uint32_t>   keyOffsets;
+        std::vector<float>      keyTimes;
+        std::vector<XMFLOAT3>   keyScales;
+        std::vector<XMFLOAT4>   keyRotations;
+        std::vector<XMFLOAT3>   keyTranslations;
+
+        struct Keyframe
+        {
+            uint32_t    boneIndex;
+            float       time;
+            XMFLOAT3    scale;
+            XMFLOAT4    rotation;
+            XMFLOAT3    translation;
+        };
+
+        // Replace the keys with those given, in any order, for a skeleton of boneCount bones
+        void __cdecl SetKeyframes(_In_reads_(count) const Keyframe* keys, size_t count, size_t boneCount);
+
+        typedef std::vector<ModelAnimationClip> Collection;
+    };
+
+
+    //----------------------------------------------------------------------------------
+    // A skeleton is the bone hierarchy of a model, as parallel arrays in which every parent comes before its
+    // children, so that poses are computed in one linear pass
+    class ModelSkeleton
+    {
+    public:
+        static const uint32_t c_Invalid = uint32_t(-1);
+
+        std::vector<std::wstring>   boneNames;
+        std::vector<uint32_t>       parentIndices;          // c_Invalid for root bones
+        std::vector<XMFLOAT4X4>     bindPoseTransforms;     // Relative to the parent bone
+        std::vector<XMFLOAT4X4>     invBindPoseTransforms;  // Inverse of the absolute bind pose
+
+        size_t __cdecl GetBoneCount() const { return parentIndices.size(); }
+
+        // Compute the absolute transform of each bone in the bind pose
+        void __cdecl GetBindPose(_Out_writes_(GetBoneCount()) XMMATRIX* boneTransforms) const;
+
+        // Compute the absolute transform of each bone at time in clip, interpolating between keys. The time wraps around
+        // the clip if loop is set, and is clamped to it otherwise. Bones without keys keep their bind pose.
+        void __cdecl Evaluate(const ModelAnimationClip& clip, float time, bool loop, _Out_writes_(GetBoneCount()) XMMATRIX* boneTransforms) const;
+
+        // Evaluate many instances of the skeleton at once, writing GetBoneCount() transforms per instance
+        void __cdecl Evaluate(_In_reads_(count) const ModelAnimationClip* const* clips, _In_reads_(count) const float* times, size_t count, bool loop,
+                              _Out_writes_(count * GetBoneCount()) XMMATRIX* boneTransforms) const;
+
+        // Compute the bone palette of a skinned mesh for SkinnedEffect::SetBoneTransforms, one per entry of mesh.boneInfluences
+        void __cdecl ComputeBonePalette(const ModelMesh& mesh, _In_reads_(GetBoneCount()) const XMMATRIX* boneTransforms,
+                                        _Out_writes_(mesh.boneInfluences.size()) XMMATRIX* palette) const;
+    };
+
+
+    //----------------------------------------------------------------------------------
+    // Processing done by CreateFromCMO, CreateFromSDKMESH, and CreateFromVBO on the vertex and index data of the file,
+    // before its buffers are created. Each option runs the same pass as the matching Model method, which has to read
+    // back the buffers of a model that is already loaded.
+    struct ModelLoaderOptions
+    {
+        size_t              lodLevels;              // Simplified levels of Model::GenerateLODs (0 for none)
+        float               lodRatio;
+        bool                computeTangentFrames;   // Model::ComputeTangentFrames, run before the levels of detail
+        bool                recomputeNormals;
+        bool                createBVHs;             // ModelMesh::bvh for each mesh, as Model::CreateBVHs
+        ModelBufferPool*    bufferPool;             // Shared buffers to place the data in, instead of buffers per model
+
+        ModelLoaderOptions() noexcept :
+            lodLevels(0), lodRatio(0.5f), computeTangentFrames(false), recomputeNormals(false), createBVHs(false), bufferPool(nullptr) {}
+    };
+
+
     //----------------------------------------------------------------------------------
     // A model consists of one or more meshes
     class Model
     {
     public:
+        Model() noexcept;
         virtual ~Model();
 
-        ModelMesh::Collection   meshes;
-        std::wstring            name;
+        ModelMesh::Collection           meshes;
+        ModelSkeleton                   skeleton;
+        ModelAnimationClip::Collection  animationClips;
+        std::wstring                    name;
+
+        // Skip meshes whose bounds are outside the view frustum in Draw (off by default)
+        bool                            frustumCulling;
+
+        // Visibility counters, accumulated by Draw with frustumCulling set and by CullInstances
+        struct CullingStatistics
+        {
+            size_t  meshesTested;
+            size_t  meshesVisible;
+        };
 
-        // Draw all the meshes in the model
+        CullingStatistics __cdecl GetCullingStatistics() const { return { mMeshesTested.value.load(), mMeshesVisible.value.load() }; }
+        void __cdecl ResetCullingStatistics() { mMeshesTested.value = 0; mMeshesVisible.value = 0; }
+
+        // Draw all the meshes in the model. Per-draw scratch is kept on the stack, so drawing does not change the model,
+        // but it does set up the effects of its parts, so concurrent draws of one model still need synchronizing.
         void XM_CALLCONV Draw(_In_ ID3D11DeviceContext* deviceContext, const CommonStates& states, FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection,
                               bool wireframe = false, _In_opt_ std::function<void __cdecl()> setCustomState = nullptr) const;
 
+        // Draw the opaque parts of the model, and queue the meshes with alpha parts so they can be drawn sorted together
+        // with those of other models by TransparentQueue::Draw
+        void XM_CALLCONV Draw(_In_ ID3D11DeviceContext* deviceContext, const CommonStates& states, FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection,
+                              TransparentQueue& transparentQueue,
+                              bool wireframe = false, _In_opt_ std::function<void __cdecl()> setCustomState = nullptr) const;
+
+        // Draw all the meshes once per world matrix in instanceWorlds, with one draw call per part. Instancing effects
+        // replace the part effects, and are given an identity world matrix: their vertex shaders must read each
+        // instance transform from the InstMatrix elements added to the input layout (see InstanceInputElements), as
+        // BasicEffect and NormalMapEffect do once SetInstancingEnabled is set. A single effect draws every part with
+        // the same material; to keep per-part materials, pass a callback that returns the instancing effect for each
+        // part. Not thread-safe, as the model owns the instance buffer and the instanced input layouts, which are
+        // cached per vertex declaration and vertex shader until Modified is called.
+        void XM_CALLCONV DrawInstanced(_In_ ID3D11DeviceContext* deviceContext, const CommonStates& states,
+                                       _In_reads_(instanceCount) const XMFLOAT4X4* instanceWorlds, size_t instanceCount,
+                                       FXMMATRIX view, CXMMATRIX projection, _In_ IEffect* instancingEffect,
+                                       bool wireframe = false, _In_opt_ std::function<void __cdecl()> setCustomState = nullptr);
+        void XM_CALLCONV DrawInstanced(_In_ ID3D11DeviceContext* deviceContext, const CommonStates& states,
+                                       _In_reads_(instanceCount) const XMFLOAT4X4* instanceWorlds, size_t instanceCount,
+                                       FXMMATRIX view, CXMMATRIX projection,
+                                       std::function<IEffect* __cdecl(const ModelMeshPart& part)> getInstancingEffect,
+                                       bool wireframe = false, _In_opt_ std::function<void __cdecl()> setCustomState = nullptr);
+
+        // Per-instance input elements appended to the vertex declaration by DrawInstanced: input slot 1 holds the first
+        // three rows of each transposed world matrix, as InstMatrix 0 to 2.
+        static const D3D11_INPUT_ELEMENT_DESC InstanceInputElements[3];
+
        // Notify model that effects, parts list, or mesh list has changed
-        void __cdecl Modified() { mEffectCache.clear(); }
+        void __cdecl Modified() { mEffectCache.clear(); mDrawPackets.clear(); mInstancedInputLayouts.clear(); }
+
+        // Build a flat list of draw packets, with opaque parts grouped by state, effect, and input layout, which Draw
+        // then replays setting only the state that differs from the previous part. Call again after Modified.
+        void __cdecl Compile();
+        bool __cdecl IsCompiled() const { return !mDrawPackets.empty(); }
 
         // Update all effects used by the model
         void __cdecl UpdateEffects(_In_ std::function<void __cdecl(IEffect*)> setEffect);
 
+        // Frustum test of many model instances at once, setting visible[i] if any mesh of models[i] placed by
+        // worlds[i] is in view. Returns the number of visible instances.
+        static size_t XM_CALLCONV CullInstances(FXMMATRIX view, CXMMATRIX projection,
+                                                _In_reads_(count) const Model* const* models, _In_reads_(count) const XMFLOAT4X4* worlds, size_t count,
+                                                _Out_writes_(count) bool* visible);
+
+        // Generate simplified levels of detail for all triangle list mesh parts, each keeping about 'ratio' of the
+        // triangles of the previous level. Reads back the vertex and index buffers, so prefer ModelLoaderOptions.
+        void __cdecl GenerateLODs(_In_ ID3D11DeviceContext* deviceContext, size_t levels = 3, float ratio = 0.5f);
+
+        // Generate tangents for all triangle list mesh parts with texture coordinates, adding a TANGENT element to vertex
+        // buffers that lack one (and optionally recomputing normals). Recreates the input layouts of affected parts.
+        // Reads back the vertex and index buffers, so prefer ModelLoaderOptions.
+        void __cdecl ComputeTangentFrames(_In_ ID3D11DeviceContext* deviceContext, bool recomputeNormals = false);
+
+        // Move the vertex and index data of the mesh parts of all the models into a few large buffers, one set per vertex
+        // stride and index format, so consecutive parts rarely need the buffers rebound. Each buffer is kept under
+        // maxBufferSize bytes. Call after GenerateLODs and ComputeTangentFrames. Reads back the vertex and index buffers,
+        // so prefer loading into a ModelBufferPool.
+        static const size_t c_DefaultSharedBufferSize = 64 * 1024 * 1024;
+
+        static void __cdecl ShareBuffers(_In_ ID3D11DeviceContext* deviceContext, _In_reads_(count) Model* const* models, size_t count,
+                                         size_t maxBufferSize = c_DefaultSharedBufferSize);
+        void __cdecl ShareBuffers(_In_ ID3D11DeviceContext* deviceContext, size_t maxBufferSize = c_DefaultSharedBufferSize);
+
+        // Build a triangle hierarchy (ModelMesh::bvh) for each mesh, for picking and collision queries on the CPU.
+        // Reads back the vertex and index buffers, so prefer ModelLoaderOptions.
+        void __cdecl CreateBVHs(_In_ ID3D11DeviceContext* deviceContext);
+
         // Loads a model from a Visual Studio Starter Kit .CMO file
         static std::unique_ptr<Model> __cdecl CreateFromCMO(_In_ ID3D11Device* d3dDevice, _In_reads_bytes_(dataSize) const uint8_t* meshData, size_t dataSize,
-                                                            _In_ IEffectFactory& fxFactory, bool ccw = true, bool pmalpha = false);
+                                                            _In_ IEffectFactory& fxFactory, bool ccw = true, bool pmalpha = false,
+                                                            const ModelLoaderOptions& options = ModelLoaderOptions());
         static std::unique_ptr<Model> __cdecl CreateFromCMO(_In_ ID3D11Device* d3dDevice, _In_z_ const wchar_t* szFileName,
-                                                            _In_ IEffectFactory& fxFactory, bool ccw = true, bool pmalpha = false);
+                                                            _In_ IEffectFactory& fxFactory, bool ccw = true, bool pmalpha = false,
+                                                            const ModelLoaderOptions& options = ModelLoaderOptions());
 
        // Loads a model from a DirectX SDK .SDKMESH file
         static std::unique_ptr<Model> __cdecl CreateFromSDKMESH(_In_ ID3D11Device* d3dDevice, _In_reads_bytes_(dataSize) const uint8_t* meshData, _In_ size_t dataSize,
-                                                                _In_ IEffectFactory& fxFactory, bool ccw = false, bool pmalpha = false);
+                                                                _In_ IEffectFactory& fxFactory, bool ccw = false, bool pmalpha = false,
+                                                                const ModelLoaderOptions& options = ModelLoaderOptions());
         static std::unique_ptr<Model> __cdecl CreateFromSDKMESH(_In_ ID3D11Device* d3dDevice, _In_z_ const wchar_t* szFileName,
-                                                                _In_ IEffectFactory& fxFactory, bool ccw = false, bool pmalpha = false);
+                                                                _In_ IEffectFactory& fxFactory, bool ccw = false, bool pmalpha = false,
+                                                                const ModelLoaderOptions& options = ModelLoaderOptions());
+
+        // Loads an animation clip from a DirectX SDK .SDKMESH_ANIM file for a model loaded from .SDKMESH, matching its frames
+        // to the skeleton bones by name. Returns the index of the new clip in animationClips.
+        size_t __cdecl LoadSDKMESHAnimation(_In_reads_bytes_(dataSize) const uint8_t* animData, size_t dataSize);
+        size_t __cdecl LoadSDKMESHAnimation(_In_z_ const wchar_t* szFileName);
 
        // Loads a model from a .VBO file
         static std::unique_ptr<Model> __cdecl CreateFromVBO(_In_ ID3D11Device* d3dDevice, _In_reads_bytes_(dataSize) const uint8_t* meshData, _In_ size_t dataSize,
-                                                            _In_opt_ std::shared_ptr<IEffect> ieffect = nullptr, bool ccw = false, bool pmalpha = false);
+                                                            _In_opt_ std::shared_ptr<IEffect> ieffect = nullptr, bool ccw = false, bool pmalpha = false,
+                                                            const ModelLoaderOptions& options = ModelLoaderOptions());
         static std::unique_ptr<Model> __cdecl CreateFromVBO(_In_ ID3D11Device* d3dDevice, _In_z_ const wchar_t* szFileName,
-                                                            _In_opt_ std::shared_ptr<IEffect> ieffect = nullptr, bool ccw = false, bool pmalpha = false);
+                                                            _In_opt_ std::shared_ptr<IEffect> ieffect = nullptr, bool ccw = false, bool pmalpha = false,
+                                                            const ModelLoaderOptions& options = ModelLoaderOptions());
+
+        // Rewrites a .VBO file in the compressed version 2 layout, which CreateFromVBO detects and decodes. Vertex
+        // attributes are quantized to 16 bits (positions and texture coordinates within their bounds).
+        static void __cdecl CompressVBO(_In_reads_bytes_(dataSize) const uint8_t* meshData, size_t dataSize, std::vector<uint8_t>& compressedData);
+        static void __cdecl CompressVBO(_In_z_ const wchar_t* szFileName, _In_z_ const wchar_t* szCompressedFileName);
+
+        // Loads a model from a baked .BMDL file, which needs no parsing beyond validating its tables
+        static std::unique_ptr<Model> __cdecl CreateFromBMDL(_In_ ID3D11Device* d3dDevice, _In_reads_bytes_(dataSize) const uint8_t* meshData, size_t dataSize,
+                                                             _In_ IEffectFactory& fxFactory);
+        static std::unique_ptr<Model> __cdecl CreateFromBMDL(_In_ ID3D11Device* d3dDevice, _In_z_ const wchar_t* szFileName,
+                                                             _In_ IEffectFactory& fxFactory);
+
+        // Converts a .CMO, .SDKMESH, or .VBO file (chosen by extension, with the default winding and alpha mode of its
+        // loader) to the .BMDL format. Loads the model on the device of the context, which reads back its buffers.
+        // Skeletons, animation clips, and levels of detail are not stored.
+        static void __cdecl ConvertToBMDL(_In_ ID3D11DeviceContext* deviceContext, _In_z_ const wchar_t* szSourceFile, std::vector<uint8_t>& bmdlData);
+        static void __cdecl ConvertToBMDL(_In_ ID3D11DeviceContext* deviceContext, _In_z_ const wchar_t* szSourceFile, _In_z_ const wchar_t* szBMDLFile);
+
+    private:
+        // Packets hold their mesh, effect, and input layout, so none is freed while compiled. Draw checks that each
+        // mesh is still at its index, and throws if the model was changed without calling Modified.
+        struct DrawPacket
+        {
+            std::shared_ptr<ModelMesh>                  mesh;
+            const ModelMeshPart*                        part;
+            std::shared_ptr<IEffect>                    effect;
+            IEffectMatrices*                            matrices;
+            Microsoft::WRL::ComPtr<ID3D11InputLayout>   inputLayout;
+            size_t                                      meshIndex;
+        };
+
+        void XM_CALLCONV ComputeVisibility(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection, std::vector<uint8_t>& visibility) const;
+
+        void XM_CALLCONV DrawPackets(_In_ ID3D11DeviceContext* deviceContext, const CommonStates& states, FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection,
+                                     std::vector<uint8_t> const& visibility,
+                                     bool alpha, bool wireframe, std::function<void __cdecl()> const& setCustomState) const;
+
+        std::set<IEffect*>                  mEffectCache;
+        std::vector<DrawPacket>             mDrawPackets;
+
+        // Counted by const draws and CullInstances, which may run on several threads at once. std::atomic cannot be
+        // copied, so it is wrapped to keep Model copyable; a copy starts from the counts of its source.
+        struct Counter
+        {
+            Counter() noexcept : value(0) {}
+            Counter(Counter const& other) noexcept : value(other.value.load()) {}
+            Counter& operator=(Counter const& other) noexcept { value = other.value.load(); return *this; }
+
+            std::atomic<size_t> value;
+        };
+
+        mutable Counter                     mMeshesTested;
+        mutable Counter                     mMeshesVisible;
+
+        Microsoft::WRL::ComPtr<ID3D11Buffer>    mInstanceBuffer;
+        size_t                                  mInstanceCapacity;
+
+        // Keyed by the vertex declaration, which the key keeps alive, and the effect vertex shader bytecode.
+        std::map<std::pair<std::shared_ptr<std::vector<D3D11_INPUT_ELEMENT_DESC>>, const void*>, Microsoft::WRL::ComPtr<ID3D11InputLayout>> mInstancedInputLayouts;
+    };
+
+
+    //----------------------------------------------------------------------------------
+    // Large vertex and index buffers shared by many models, packed as Model::ShareBuffers does but filled by the
+    // loaders from the file data. The parts of models loaded with the pool in ModelLoaderOptions get no buffers of
+    // their own: CreateBuffers creates the pool buffers and points the parts at them, so call it before those models
+    // are compiled or drawn. Models may be loaded into one pool from several threads at once.
+    class ModelBufferPool
+    {
+    public:
+        explicit ModelBufferPool(size_t maxBufferSize = Model::c_DefaultSharedBufferSize);
+        ModelBufferPool(ModelBufferPool&& moveFrom) noexcept;
+        ModelBufferPool& operator= (ModelBufferPool&& moveFrom) noexcept;
+
+        ModelBufferPool(ModelBufferPool const&) = delete;
+        ModelBufferPool& operator= (ModelBufferPool const&) = delete;
+
+        virtual ~ModelBufferPool();
+
+        // Creates buffers for the data added since the last call. Models released in the meantime are skipped.
+        void __cdecl CreateBuffers(_In_ ID3D11Device* device);
+
+        // Private implementation, which the model loaders add their data to.
+        class Impl;
+
+        Impl* __cdecl GetImpl() const { return pImpl.get(); }
 
     private:
-        std::set<IEffect*>  mEffectCache;
+        std::unique_ptr<Impl> pImpl;
     };
 }
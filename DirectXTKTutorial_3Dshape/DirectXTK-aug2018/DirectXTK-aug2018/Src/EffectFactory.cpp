@@ -11,13 +11,120 @@
 #include "Effects.h"
 #include "DemandCreate.h"
 #include "SharedResourcePool.h"
+#include "FactoryCache.h"
 
 #include "DDSTextureLoader.h"
 #include "WICTextureLoader.h"
+#include "LoaderHelpers.h"
+
+#include <atomic>
 
 using namespace DirectX;
 using Microsoft::WRL::ComPtr;
 
+
+namespace
+{
+    // Video memory of a texture, from the size of each mip level of its description.
+    size_t GetTextureBytes(_In_ ID3D11ShaderResourceView* textureView)
+    {
+        ComPtr<ID3D11Resource> resource;
+        textureView->GetResource(resource.GetAddressOf());
+
+        D3D11_RESOURCE_DIMENSION dimension;
+        resource->GetType(&dimension);
+
+        size_t width = 1;
+        size_t height = 1;
+        size_t depth = 1;
+        size_t mipLevels = 1;
+        size_t arraySize = 1;
+        DXGI_FORMAT format = DXGI_FORMAT_UNKNOWN;
+
+        switch (dimension)
+        {
+            case D3D11_RESOURCE_DIMENSION_TEXTURE1D:
+            {
+                ComPtr<ID3D11Texture1D> texture;
+                if (FAILED(resource.As(&texture)))
+                    return 0;
+
+                D3D11_TEXTURE1D_DESC desc;
+                texture->GetDesc(&desc);
+
+                width = desc.Width;
+                mipLevels = desc.MipLevels;
+                arraySize = desc.ArraySize;
+                format = desc.Format;
+            }
+            break;
+
+            case D3D11_RESOURCE_DIMENSION_TEXTURE2D:
+            {
+                ComPtr<ID3D11Texture2D> texture;
+                if (FAILED(resource.As(&texture)))
+                    return 0;
+
+                D3D11_TEXTURE2D_DESC desc;
+                texture->GetDesc(&desc);
+
+                width = desc.Width;
+                height = desc.Height;
+                mipLevels = desc.MipLevels;
+                arraySize = desc.ArraySize;
+                format = desc.Format;
+            }
+            break;
+
+            case D3D11_RESOURCE_DIMENSION_TEXTURE3D:
+            {
+                ComPtr<ID3D11Texture3D> texture;
+                if (FAILED(resource.As(&texture)))
+                    return 0;
+
+                D3D11_TEXTURE3D_DESC desc;
+                texture->GetDesc(&desc);
+
+                width = desc.Width;
+                height = desc.Height;
+                depth = desc.Depth;
+                mipLevels = desc.MipLevels;
+                format = desc.Format;
+            }
+            break;
+
+            default:
+                return 0;
+        }
+
+        size_t bytes = 0;
+
+        for (size_t level = 0; level < mipLevels; ++level)
+        {
+            size_t levelBytes = 0;
+            if (FAILED(LoaderHelpers::GetSurfaceInfo(width, height, format, &levelBytes, nullptr, nullptr)))
+                return 0;
+
+            bytes += levelBytes * depth;
+
+            width = std::max<size_t>(width >> 1, 1);
+            height = std::max<size_t>(height >> 1, 1);
+            depth = std::max<size_t>(depth >> 1, 1);
+        }
+
+        return bytes * arraySize;
+    }
+
+
+    // Whether anything other than the factory holds a reference to a view.
+    bool IsReferenced(_In_ ID3D11ShaderResourceView* textureView)
+    {
+        textureView->AddRef();
+        return textureView->Release() > 1;
+    }
+}
+
+
 // Internal EffectFactory implementation class. Only one of these helpers is allocated
 // per D3D device, even if there are multiple public facing EffectFactory instances.
 class EffectFactory::Impl
@@ -28,7 +135,12 @@ public:
         mDevice(device),
         mSharing(true),
         mUseNormalMapEffect(true),
-        mForceSRGB(false)
+        mForceSRGB(false),
+        mFrame(0),
+        mReducedMaxSize(0),
+        mUnderPressure(false),
+        mBudget(0),
+        mResidencyStatistics{}
     {}
 
     std::shared_ptr<IEffect> CreateEffect(_In_ IEffectFactory* factory, _In_ const IEffectFactory::EffectInfo& info, _In_opt_ ID3D11DeviceContext* deviceContext);
@@ -39,6 +151,10 @@ public:
     void EnableNormalMapEffect(bool enabled) { mUseNormalMapEffect = enabled; }
     void EnableForceSRGB(bool forceSRGB) { mForceSRGB = forceSRGB; }
 
+    void SetTextureBudget(size_t budgetBytes, size_t reducedMaxSize);
+    void UpdateTextureResidency(uint64_t frame);
+    TextureResidencyStatistics GetTextureResidencyStatistics();
+
     static SharedResourcePool<ID3D11Device*, Impl> instancePool;
 
     wchar_t mPath[MAX_PATH];
@@ -46,8 +162,21 @@ public:
     ComPtr<ID3D11Device> mDevice;
 
 private:
-    typedef std::map< std::wstring, std::shared_ptr<IEffect> > EffectCache;
-    typedef std::map< std::wstring, ComPtr<ID3D11ShaderResourceView> > TextureCache;
+    // A cached texture, with its size and the last frame it was requested or referenced in.
+    struct ResidentTexture
+    {
+        ComPtr<ID3D11ShaderResourceView> view;
+        std::wstring name;
+        size_t bytes;
+        std::atomic<uint64_t> lastUsed;
+    };
+
+    std::shared_ptr<IEffect> CreateNewEffect(_In_ IEffectFactory* factory, _In_ const IEffectFactory::EffectInfo& info, _In_opt_ ID3D11DeviceContext* deviceContext);
+    void LoadTexture(_In_z_ const wchar_t* texture, _In_opt_ ID3D11DeviceContext* deviceContext, size_t maxsize, _Outptr_ ID3D11ShaderResourceView** textureView);
+    std::shared_ptr<ResidentTexture> AddResidentTexture(_In_z_ const wchar_t* texture, _In_ ID3D11ShaderResourceView* textureView, bool reduced);
+
+    typedef FactoryCache< std::shared_ptr<IEffect> > EffectCache;
+    typedef FactoryCache< std::shared_ptr<ResidentTexture> > TextureCache;
 
     EffectCache  mEffectCache;
     EffectCache  mEffectCacheSkinning;
@@ -59,7 +188,17 @@ private:
     bool mUseNormalMapEffect;
     bool mForceSRGB;
 
+    // Serializes WIC loads that use the device context, which is not thread-safe.
     std::mutex mutex;
+
+    // Texture residency, guarded by residencyMutex except for the values read while loading textures.
+    std::atomic<uint64_t> mFrame;
+    std::atomic<size_t> mReducedMaxSize;
+    std::atomic<bool> mUnderPressure;
+    size_t mBudget;
+    std::vector<std::shared_ptr<ResidentTexture>> mResidentTextures;
+    TextureResidencyStatistics mResidencyStatistics;
+    std::mutex residencyMutex;
 };
 
 
@@ -70,18 +209,42 @@ SharedResourcePool<ID3D11Device*, EffectFactory::Impl> EffectFactory::Impl::inst
 _Use_decl_annotations_
 std::shared_ptr<IEffect> EffectFactory::Impl::CreateEffect(IEffectFactory* factory, const IEffectFactory::EffectInfo& info, ID3D11DeviceContext* deviceContext)
 {
+    if (!mSharing || !info.name || !*info.name)
+    {
+        return CreateNewEffect(factory, info, deviceContext);
+    }
+
+    EffectCache* cache;
     if (info.enableSkinning)
     {
-        // SkinnedEffect
-        if (mSharing && info.name && *info.name)
-        {
-            auto it = mEffectCacheSkinning.find(info.name);
-            if (mSharing && it != mEffectCacheSkinning.end())
-            {
-                return it->second;
-            }
-        }
+        cache = &mEffectCacheSkinning;
+    }
+    else if (info.enableDualTexture)
+    {
+        cache = &mEffectCacheDualTexture;
+    }
+    else if (info.enableNormalMaps && mUseNormalMapEffect)
+    {
+        cache = &mEffectNormalMap;
+    }
+    else
+    {
+        cache = &mEffectCache;
+    }
+
+    return cache->GetOrCreate(info.name, [&]()
+    {
+        return CreateNewEffect(factory, info, deviceContext);
+    });
+}
 
+
+_Use_decl_annotations_
+std::shared_ptr<IEffect> EffectFactory::Impl::CreateNewEffect(IEffectFactory* factory, const IEffectFactory::EffectInfo& info, ID3D11DeviceContext* deviceContext)
+{
+    if (info.enableSkinning)
+    {
+        // SkinnedEffect
         auto effect = std::make_shared<SkinnedEffect>(mDevice.Get());
 
         effect->EnableDefaultLighting();
@@ -124,27 +287,11 @@ std::shared_ptr<IEffect> EffectFactory::Impl::CreateEffect(IEffectFactory* facto
             effect->SetBiasedVertexNormals(true);
         }
 
-        if (mSharing && info.name && *info.name)
-        {
-            std::lock_guard<std::mutex> lock(mutex);
-            EffectCache::value_type v(info.name, effect);
-            mEffectCacheSkinning.insert(v);
-        }
-
         return effect;
     }
     else if (info.enableDualTexture)
     {
         // DualTextureEffect
-        if (mSharing && info.name && *info.name)
-        {
-            auto it = mEffectCacheDualTexture.find(info.name);
-            if (mSharing && it != mEffectCacheDualTexture.end())
-            {
-                return it->second;
-            }
-        }
-
         auto effect = std::make_shared<DualTextureEffect>(mDevice.Get());
 
         // Dual texture effect doesn't support lighting (usually it's lightmaps)
@@ -177,27 +324,11 @@ std::shared_ptr<IEffect> EffectFactory::Impl::CreateEffect(IEffectFactory* facto
             effect->SetTexture2(srv.Get());
         }
 
-        if (mSharing && info.name && *info.name)
-        {
-            std::lock_guard<std::mutex> lock(mutex);
-            EffectCache::value_type v(info.name, effect);
-            mEffectCacheDualTexture.insert(v);
-        }
-
         return effect;
     }
     else if (info.enableNormalMaps && mUseNormalMapEffect)
     {
         // NormalMapEffect
-        if (mSharing && info.name && *info.name)
-        {
-            auto it = mEffectNormalMap.find(info.name);
-            if (mSharing && it != mEffectNormalMap.end())
-            {
-                return it->second;
-            }
-        }
-
         auto effect = std::make_shared<NormalMapEffect>(mDevice.Get());
 
         effect->EnableDefaultLighting();
@@ -263,27 +394,11 @@ std::shared_ptr<IEffect> EffectFactory::Impl::CreateEffect(IEffectFactory* facto
             effect->SetBiasedVertexNormals(true);
         }
 
-        if (mSharing && info.name && *info.name)
-        {
-            std::lock_guard<std::mutex> lock(mutex);
-            EffectCache::value_type v(info.name, effect);
-            mEffectNormalMap.insert(v);
-        }
-
         return effect;
     }
     else
     {
         // BasicEffect
-        if (mSharing && info.name && *info.name)
-        {
-            auto it = mEffectCache.find(info.name);
-            if (mSharing && it != mEffectCache.end())
-            {
-                return it->second;
-            }
-        }
-
         auto effect = std::make_shared<BasicEffect>(mDevice.Get());
 
         effect->EnableDefaultLighting();
@@ -333,13 +448,6 @@ std::shared_ptr<IEffect> EffectFactory::Impl::CreateEffect(IEffectFactory* facto
             effect->SetBiasedVertexNormals(true);
         }
 
-        if (mSharing && info.name && *info.name)
-        {
-            std::lock_guard<std::mutex> lock(mutex);
-            EffectCache::value_type v(info.name, effect);
-            mEffectCache.insert(v);
-        }
-
         return effect;
     }
 }
@@ -350,96 +458,232 @@ void EffectFactory::Impl::CreateTexture(const wchar_t* name, ID3D11DeviceContext
     if (!name || !textureView)
         throw std::exception("invalid arguments");
 
+    if (!mSharing || !*name)
+    {
+        LoadTexture(name, deviceContext, 0, textureView);
+        return;
+    }
+
+    auto texture = mTextureCache.GetOrCreate(name, [&]()
+    {
+        size_t maxsize = mUnderPressure ? mReducedMaxSize.load() : 0;
+
+        ComPtr<ID3D11ShaderResourceView> srv;
+        LoadTexture(name, deviceContext, maxsize, srv.GetAddressOf());
+
+        return AddResidentTexture(name, srv.Get(), maxsize != 0);
+    });
+
+    texture->lastUsed = mFrame.load();
+
+    ID3D11ShaderResourceView* srv = texture->view.Get();
+    srv->AddRef();
+    *textureView = srv;
+}
+
+
+_Use_decl_annotations_
+void EffectFactory::Impl::LoadTexture(const wchar_t* name, ID3D11DeviceContext* deviceContext, size_t maxsize, ID3D11ShaderResourceView** textureView)
+{
 #if defined(_XBOX_ONE) && defined(_TITLE)
     UNREFERENCED_PARAMETER(deviceContext);
 #endif
 
-    auto it = mTextureCache.find(name);
+    wchar_t fullName[MAX_PATH] = {};
+    wcscpy_s(fullName, mPath);
+    wcscat_s(fullName, name);
 
-    if (mSharing && it != mTextureCache.end())
-    {
-        ID3D11ShaderResourceView* srv = it->second.Get();
-        srv->AddRef();
-        *textureView = srv;
-    }
-    else
+    WIN32_FILE_ATTRIBUTE_DATA fileAttr = {};
+    if (!GetFileAttributesExW(fullName, GetFileExInfoStandard, &fileAttr))
     {
-        wchar_t fullName[MAX_PATH] = {};
-        wcscpy_s(fullName, mPath);
-        wcscat_s(fullName, name);
-
-        WIN32_FILE_ATTRIBUTE_DATA fileAttr = {};
+        // Try Current Working Directory (CWD)
+        wcscpy_s(fullName, name);
         if (!GetFileAttributesExW(fullName, GetFileExInfoStandard, &fileAttr))
         {
-            // Try Current Working Directory (CWD)
-            wcscpy_s(fullName, name);
-            if (!GetFileAttributesExW(fullName, GetFileExInfoStandard, &fileAttr))
-            {
-                DebugTrace("ERROR: EffectFactory could not find texture file '%ls'\n", name);
-                throw std::exception("CreateTexture");
-            }
+            DebugTrace("ERROR: EffectFactory could not find texture file '%ls'\n", name);
+            throw std::exception("CreateTexture");
         }
+    }
 
-        wchar_t ext[_MAX_EXT];
-        _wsplitpath_s(name, nullptr, 0, nullptr, 0, nullptr, 0, ext, _MAX_EXT);
+    wchar_t ext[_MAX_EXT];
+    _wsplitpath_s(name, nullptr, 0, nullptr, 0, nullptr, 0, ext, _MAX_EXT);
 
-        if (_wcsicmp(ext, L".dds") == 0)
+    if (_wcsicmp(ext, L".dds") == 0)
+    {
+        HRESULT hr = CreateDDSTextureFromFileEx(
+            mDevice.Get(), fullName, maxsize,
+            D3D11_USAGE_DEFAULT, D3D11_BIND_SHADER_RESOURCE, 0, 0,
+            mForceSRGB, nullptr, textureView);
+        if (FAILED(hr))
         {
-            HRESULT hr = CreateDDSTextureFromFileEx(
-                mDevice.Get(), fullName, 0,
-                D3D11_USAGE_DEFAULT, D3D11_BIND_SHADER_RESOURCE, 0, 0,
-                mForceSRGB, nullptr, textureView);
-            if (FAILED(hr))
-            {
-                DebugTrace("ERROR: CreateDDSTextureFromFile failed (%08X) for '%ls'\n", hr, fullName);
-                throw std::exception("CreateDDSTextureFromFile");
-            }
+            DebugTrace("ERROR: CreateDDSTextureFromFile failed (%08X) for '%ls'\n", hr, fullName);
+            throw std::exception("CreateDDSTextureFromFile");
         }
-    #if !defined(_XBOX_ONE) || !defined(_TITLE)
-        else if (deviceContext)
+    }
+#if !defined(_XBOX_ONE) || !defined(_TITLE)
+    else if (deviceContext)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        HRESULT hr = CreateWICTextureFromFileEx(
+            mDevice.Get(), deviceContext, fullName, maxsize,
+            D3D11_USAGE_DEFAULT, D3D11_BIND_SHADER_RESOURCE, 0, 0,
+            mForceSRGB ? WIC_LOADER_FORCE_SRGB : WIC_LOADER_DEFAULT, nullptr, textureView);
+        if (FAILED(hr))
         {
-            std::lock_guard<std::mutex> lock(mutex);
-            HRESULT hr = CreateWICTextureFromFileEx(
-                mDevice.Get(), deviceContext, fullName, 0,
-                D3D11_USAGE_DEFAULT, D3D11_BIND_SHADER_RESOURCE, 0, 0,
-                mForceSRGB ? WIC_LOADER_FORCE_SRGB : WIC_LOADER_DEFAULT, nullptr, textureView);
-            if (FAILED(hr))
-            {
-                DebugTrace("ERROR: CreateWICTextureFromFile failed (%08X) for '%ls'\n", hr, fullName);
-                throw std::exception("CreateWICTextureFromFile");
-            }
+            DebugTrace("ERROR: CreateWICTextureFromFile failed (%08X) for '%ls'\n", hr, fullName);
+            throw std::exception("CreateWICTextureFromFile");
+        }
+    }
+#endif
+    else
+    {
+        HRESULT hr = CreateWICTextureFromFileEx(
+            mDevice.Get(), fullName, maxsize,
+            D3D11_USAGE_DEFAULT, D3D11_BIND_SHADER_RESOURCE, 0, 0,
+            mForceSRGB ? WIC_LOADER_FORCE_SRGB : WIC_LOADER_DEFAULT, nullptr, textureView);
+        if (FAILED(hr))
+        {
+            DebugTrace("ERROR: CreateWICTextureFromFile failed (%08X) for '%ls'\n", hr, fullName);
+            throw std::exception("CreateWICTextureFromFile");
+        }
+    }
+}
+
+_Use_decl_annotations_
+std::shared_ptr<EffectFactory::Impl::ResidentTexture> EffectFactory::Impl::AddResidentTexture(const wchar_t* name, ID3D11ShaderResourceView* textureView, bool reduced)
+{
+    auto texture = std::make_shared<ResidentTexture>();
+    texture->view = textureView;
+    texture->name = name;
+    texture->bytes = GetTextureBytes(textureView);
+    texture->lastUsed = mFrame.load();
+
+    std::lock_guard<std::mutex> lock(residencyMutex);
+
+    mResidentTextures.push_back(texture);
+
+    mResidencyStatistics.residentBytes += texture->bytes;
+    ++mResidencyStatistics.residentTextures;
+
+    if (reduced)
+    {
+        ++mResidencyStatistics.reducedTextures;
+    }
+
+    return texture;
+}
+
+
+void EffectFactory::Impl::ReleaseCache()
+{
+    mEffectCache.Clear();
+    mEffectCacheSkinning.Clear();
+    mEffectCacheDualTexture.Clear();
+    mEffectNormalMap.Clear();
+    mTextureCache.Clear();
+
+    std::lock_guard<std::mutex> lock(residencyMutex);
+
+    mResidentTextures.clear();
+    mResidencyStatistics.residentBytes = 0;
+    mResidencyStatistics.residentTextures = 0;
+    mUnderPressure = false;
+}
+
+
+void EffectFactory::Impl::SetTextureBudget(size_t budgetBytes, size_t reducedMaxSize)
+{
+    std::lock_guard<std::mutex> lock(residencyMutex);
+
+    mBudget = budgetBytes;
+    mReducedMaxSize = reducedMaxSize;
+    mUnderPressure = budgetBytes != 0 && mResidencyStatistics.residentBytes > budgetBytes;
+}
+
+
+void EffectFactory::Impl::UpdateTextureResidency(uint64_t frame)
+{
+    std::lock_guard<std::mutex> lock(residencyMutex);
+
+    mFrame = frame;
+
+    bool overBudget = mBudget && mResidencyStatistics.residentBytes > mBudget;
+
+    if (overBudget)
+    {
+        // Cached effects keep their textures referenced, so effects that nothing else uses any more, such as
+        // those of destroyed models, are released first.
+        auto unused = [](const std::shared_ptr<IEffect>& effect) { return effect.use_count() == 1; };
+
+        mEffectCache.RemoveIf(unused);
+        mEffectCacheSkinning.RemoveIf(unused);
+        mEffectCacheDualTexture.RemoveIf(unused);
+        mEffectNormalMap.RemoveIf(unused);
+    }
+
+    // Textures that effects or the application still hold are in use, so only the others are candidates. Binding
+    // a view to the pipeline does not add a reference, so a texture only the pipeline uses is not protected.
+    std::vector<ResidentTexture*> candidates;
+    candidates.reserve(mResidentTextures.size());
+
+    for (auto it = mResidentTextures.cbegin(); it != mResidentTextures.cend(); ++it)
+    {
+        auto texture = it->get();
+
+        if (IsReferenced(texture->view.Get()))
+        {
+            texture->lastUsed = frame;
         }
-    #endif
         else
         {
-            HRESULT hr = CreateWICTextureFromFileEx(
-                mDevice.Get(), fullName, 0,
-                D3D11_USAGE_DEFAULT, D3D11_BIND_SHADER_RESOURCE, 0, 0,
-                mForceSRGB ? WIC_LOADER_FORCE_SRGB : WIC_LOADER_DEFAULT, nullptr, textureView);
-            if (FAILED(hr))
-            {
-                DebugTrace("ERROR: CreateWICTextureFromFile failed (%08X) for '%ls'\n", hr, fullName);
-                throw std::exception("CreateWICTextureFromFile");
-            }
+            candidates.push_back(texture);
         }
+    }
+
+    if (!overBudget)
+    {
+        mUnderPressure = false;
+        return;
+    }
+
+    std::stable_sort(candidates.begin(), candidates.end(), [](const ResidentTexture* a, const ResidentTexture* b)
+    {
+        return a->lastUsed < b->lastUsed;
+    });
+
+    std::set<const ResidentTexture*> evicted;
+
+    for (auto it = candidates.cbegin(); it != candidates.cend() && mResidencyStatistics.residentBytes > mBudget; ++it)
+    {
+        evicted.insert(*it);
 
-        if (mSharing && *name && it == mTextureCache.end())
+        mResidencyStatistics.residentBytes -= (*it)->bytes;
+        --mResidencyStatistics.residentTextures;
+        ++mResidencyStatistics.evictedTextures;
+    }
+
+    for (auto it = mResidentTextures.cbegin(); it != mResidentTextures.cend(); ++it)
+    {
+        if (evicted.find(it->get()) != evicted.end())
         {
-            std::lock_guard<std::mutex> lock(mutex);
-            TextureCache::value_type v(name, *textureView);
-            mTextureCache.insert(v);
+            mTextureCache.Remove((*it)->name.c_str(), *it);
         }
     }
+
+    mResidentTextures.erase(std::remove_if(mResidentTextures.begin(), mResidentTextures.end(), [&](const std::shared_ptr<ResidentTexture>& texture)
+    {
+        return evicted.find(texture.get()) != evicted.end();
+    }), mResidentTextures.end());
+
+    mUnderPressure = mResidencyStatistics.residentBytes > mBudget;
 }
 
-void EffectFactory::Impl::ReleaseCache()
+
+EffectFactory::TextureResidencyStatistics EffectFactory::Impl::GetTextureResidencyStatistics()
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    mEffectCache.clear();
-    mEffectCacheSkinning.clear();
-    mEffectCacheDualTexture.clear();
-    mEffectNormalMap.clear();
-    mTextureCache.clear();
+    std::lock_guard<std::mutex> lock(residencyMutex);
+
+    return mResidencyStatistics;
 }
 
 
@@ -501,6 +745,21 @@ void EffectFactory::EnableForceSRGB(bool forceSRGB)
     pImpl->EnableForceSRGB(forceSRGB);
 }
 
+void EffectFactory::SetTextureBudget(size_t budgetBytes, size_t reducedMaxSize)
+{
+    pImpl->SetTextureBudget(budgetBytes, reducedMaxSize);
+}
+
+void EffectFactory::UpdateTextureResidency(uint64_t frame)
+{
+    pImpl->UpdateTextureResidency(frame);
+}
+
+EffectFactory::TextureResidencyStatistics EffectFactory::GetTextureResidencyStatistics() const
+{
+    return pImpl->GetTextureResidencyStatistics();
+}
+
 void EffectFactory::SetDirectory(_In_opt_z_ const wchar_t* path)
 {
     if (path && *path != 0)
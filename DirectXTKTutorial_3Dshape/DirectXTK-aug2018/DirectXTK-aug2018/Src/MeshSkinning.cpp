@@ -0,0 +1,190 @@
+//--------------------------------------------------------------------------------------
+// File: MeshSkinning.cpp
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#include "pch.h"
+#include "MeshSkinning.h"
+#include "VertexTypes.h"
+#include "ParallelHelpers.h"
+#include "PlatformHelpers.h"
+
+using namespace DirectX;
+using DirectX::ParallelHelpers::ParallelFor;
+
+
+namespace
+{
+    // Meshes smaller than this are skinned on the calling thread only.
+    const size_t MinParallelChunk = 4096;
+
+    // Blend indices are 8 bits each.
+    const size_t MaxBones = 256;
+
+
+    inline float BlendWeight(uint32_t weights, int i)
+    {
+        return float((weights >> (i * 8)) & 0xff) * (1.f / 255.f);
+    }
+
+    inline uint32_t BlendIndex(uint32_t indices, int i)
+    {
+        return (indices >> (i * 8)) & 0xff;
+    }
+
+
+#if defined(_XM_AVX2_INTRINSICS_)
+    //----------------------------------------------------------------------------------
+    // Blends the bone matrices two rows at a time in 256-bit registers, and returns the rows separately.
+    template<int WeightCount>
+    inline XMMATRIX XM_CALLCONV BlendBones(_In_reads_(MaxBones) const XMMATRIX* bones, uint32_t indices, uint32_t weights)
+    {
+        auto bone = reinterpret_cast<const float*>(&bones[BlendIndex(indices, 0)]);
+
+        __m256 weight = _mm256_set1_ps(BlendWeight(weights, 0));
+        __m256 rows01 = _mm256_mul_ps(_mm256_loadu_ps(bone), weight);
+        __m256 rows23 = _mm256_mul_ps(_mm256_loadu_ps(bone + 8), weight);
+
+        for (int i = 1; i < WeightCount; ++i)
+        {
+            bone = reinterpret_cast<const float*>(&bones[BlendIndex(indices, i)]);
+
+            weight = _mm256_set1_ps(BlendWeight(weights, i));
+            rows01 = _mm256_fmadd_ps(_mm256_loadu_ps(bone), weight, rows01);
+            rows23 = _mm256_fmadd_ps(_mm256_loadu_ps(bone + 8), weight, rows23);
+        }
+
+        XMMATRIX m;
+        m.r[0] = _mm256_castps256_ps128(rows01);
+        m.r[1] = _mm256_extractf128_ps(rows01, 1);
+        m.r[2] = _mm256_castps256_ps128(rows23);
+        m.r[3] = _mm256_extractf128_ps(rows23, 1);
+        return m;
+    }
+#else
+    //----------------------------------------------------------------------------------
+    // Blends the bone matrices one row at a time.
+    template<int WeightCount>
+    inline XMMATRIX XM_CALLCONV BlendBones(_In_reads_(MaxBones) const XMMATRIX* bones, uint32_t indices, uint32_t weights)
+    {
+        auto& bone = bones[BlendIndex(indices, 0)];
+
+        XMVECTOR weight = XMVectorReplicate(BlendWeight(weights, 0));
+
+        XMMATRIX m;
+        m.r[0] = XMVectorMultiply(bone.r[0], weight);
+        m.r[1] = XMVectorMultiply(bone.r[1], weight);
+        m.r[2] = XMVectorMultiply(bone.r[2], weight);
+        m.r[3] = XMVectorMultiply(bone.r[3], weight);
+
+        for (int i = 1; i < WeightCount; ++i)
+        {
+            auto& next = bones[BlendIndex(indices, i)];
+
+            weight = XMVectorReplicate(BlendWeight(weights, i));
+            m.r[0] = XMVectorMultiplyAdd(next.r[0], weight, m.r[0]);
+            m.r[1] = XMVectorMultiplyAdd(next.r[1], weight, m.r[1]);
+            m.r[2] = XMVectorMultiplyAdd(next.r[2], weight, m.r[2]);
+            m.r[3] = XMVectorMultiplyAdd(next.r[3], weight, m.r[3]);
+        }
+
+        return m;
+    }
+#endif
+
+
+    //----------------------------------------------------------------------------------
+    template<int WeightCount>
+    void SkinRange(_In_reads_(end) const VertexPositionNormalTangentColorTextureSkinning* vertices, size_t begin, size_t end,
+                   _In_reads_(MaxBones) const XMMATRIX* bones,
+                   _Out_writes_(end) XMFLOAT3* positions, _Out_writes_opt_(end) XMFLOAT3* normals, _Out_writes_opt_(end) XMFLOAT4* tangents)
+    {
+        for (size_t j = begin; j < end; ++j)
+        {
+            auto& vertex = vertices[j];
+
+            XMMATRIX m = BlendBones<WeightCount>(bones, vertex.indices, vertex.weights);
+
+            XMStoreFloat3(&positions[j], XMVector3Transform(XMLoadFloat3(&vertex.position), m));
+
+            if (normals)
+            {
+                XMVECTOR normal = XMVector3TransformNormal(XMLoadFloat3(&vertex.normal), m);
+                XMStoreFloat3(&normals[j], XMVector3Normalize(normal));
+            }
+
+            if (tangents)
+            {
+                XMVECTOR tangent = XMLoadFloat4(&vertex.tangent);
+                XMVECTOR skinned = XMVector3Normalize(XMVector3TransformNormal(tangent, m));
+                XMStoreFloat4(&tangents[j], XMVectorSelect(tangent, skinned, g_XMSelect1110));
+            }
+        }
+    }
+}
+
+
+_Use_decl_annotations_
+void DirectX::SkinVertices(
+    const VertexPositionNormalTangentColorTextureSkinning* vertices,
+    size_t nVerts,
+    const XMMATRIX* bones,
+    size_t boneCount,
+    int weightsPerVertex,
+    XMFLOAT3* positions,
+    XMFLOAT3* normals,
+    XMFLOAT4* tangents)
+{
+    if (!vertices || !bones || !positions)
+        throw std::exception("Vertices, bones, and positions are required");
+
+    if ((weightsPerVertex != 1) &&
+        (weightsPerVertex != 2) &&
+        (weightsPerVertex != 4))
+    {
+        throw std::out_of_range("WeightsPerVertex must be 1, 2, or 4");
+    }
+
+    if (!boneCount || boneCount > MaxBones)
+        throw std::out_of_range("boneCount parameter out of range");
+
+    // Palettes smaller than the blend indices can address are padded with identity matrices, so a stray index
+    // can't read past the end, and the inner loop needs no bounds checks.
+    std::unique_ptr<XMMATRIX[], aligned_deleter> padded;
+
+    if (boneCount < MaxBones)
+    {
+        padded.reset(static_cast<XMMATRIX*>(_aligned_malloc(sizeof(XMMATRIX) * MaxBones, 16)));
+        if (!padded)
+            throw std::bad_alloc();
+
+        for (size_t i = 0; i < MaxBones; ++i)
+        {
+            padded[i] = (i < boneCount) ? bones[i] : XMMatrixIdentity();
+        }
+
+        bones = padded.get();
+    }
+
+    ParallelFor(nVerts, MinParallelChunk, [=](size_t begin, size_t end)
+    {
+        switch (weightsPerVertex)
+        {
+            case 1:
+                SkinRange<1>(vertices, begin, end, bones, positions, normals, tangents);
+                break;
+
+            case 2:
+                SkinRange<2>(vertices, begin, end, bones, positions, normals, tangents);
+                break;
+
+            default:
+                SkinRange<4>(vertices, begin, end, bones, positions, normals, tangents);
+                break;
+        }
+    });
+}
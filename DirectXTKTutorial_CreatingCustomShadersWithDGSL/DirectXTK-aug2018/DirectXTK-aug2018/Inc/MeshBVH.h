@@ -0,0 +1,123 @@
+//--------------------------------------------------------------------------------------
+// File: MeshBVH.h
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#if defined(_XBOX_ONE) && defined(_TITLE)
+#include <d3d11_x.h>
+#else
+#include <d3d11_1.h>
+#endif
+
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+
+#include <float.h>
+#include <memory>
+#include <vector>
+
+#include <stdint.h>
+
+
+namespace DirectX
+{
+    class ModelMesh;
+
+    //----------------------------------------------------------------------------------
+    // Identifies a source triangle: the part is an index into ModelMesh::meshParts (always 0 for data given to
+    // MeshBVH::Create), and the triangle counts from the start of that part's index data.
+    struct MeshBVHTriangle
+    {
+        uint32_t    part;
+        uint32_t    triangle;
+    };
+
+    // Contents of the vertex and index buffers drawn by one part of a mesh, for building its hierarchy on the CPU.
+    struct MeshBVHPartData
+    {
+        const uint8_t*  vertices;
+        size_t          vertexBytes;
+        const uint8_t*  indices;
+        size_t          indexBytes;
+    };
+
+    // Closest hit of a ray. The hit point is origin + distance * direction, and u and v are the barycentric
+    // weights of the second and third vertices of the triangle. A miss has a triangle of MeshBVH::c_Miss.
+    struct MeshBVHHit
+    {
+        uint32_t    part;
+        uint32_t    triangle;
+        float       distance;
+        float       u;
+        float       v;
+    };
+
+
+    //----------------------------------------------------------------------------------
+    // Bounding volume hierarchy over the triangles of a mesh, for ray picking and collision queries on the CPU.
+    // Queries are made in the space of the vertex positions, so transform rays and volumes by the inverse of the
+    // world matrix first. Skinned meshes are built in their bind pose.
+    class MeshBVH
+    {
+    public:
+        static const uint32_t c_Miss = uint32_t(-1);
+
+        MeshBVH(MeshBVH&& moveFrom) noexcept;
+        MeshBVH& operator= (MeshBVH&& moveFrom) noexcept;
+
+        MeshBVH(MeshBVH const&) = delete;
+        MeshBVH& operator= (MeshBVH const&) = delete;
+
+        virtual ~MeshBVH();
+
+        // Factory methods. Positions are read with the given byte stride, and indices describe a triangle list.
+        static std::unique_ptr<MeshBVH> __cdecl Create(_In_reads_(vertexCount) const XMFLOAT3* positions, size_t positionStride, size_t vertexCount,
+                                                       _In_reads_(indexCount) const uint16_t* indices, size_t indexCount);
+        static std::unique_ptr<MeshBVH> __cdecl Create(_In_reads_(vertexCount) const XMFLOAT3* positions, size_t positionStride, size_t vertexCount,
+                                                       _In_reads_(indexCount) const uint32_t* indices, size_t indexCount);
+
+        // Builds one hierarchy over the triangle list parts of a mesh, from the data of each part in the order of
+        // mesh.meshParts (as the model loaders keep it), or by reading back their buffers. Parts with other primitive
+        // types are skipped.
+        static std::unique_ptr<MeshBVH> __cdecl CreateFromMesh(const ModelMesh& mesh, _In_reads_(partCount) const MeshBVHPartData* parts, size_t partCount);
+        static std::unique_ptr<MeshBVH> __cdecl CreateFromMesh(_In_ ID3D11DeviceContext* deviceContext, const ModelMesh& mesh);
+
+        size_t __cdecl GetTriangleCount() const;
+        size_t __cdecl GetNodeCount() const;
+        BoundingBox __cdecl GetBounds() const;
+
+        // Finds the closest triangle hit by a ray within maxDistance, measured in multiples of the length of direction.
+        // Triangles are hit from either side.
+        bool XM_CALLCONV Intersects(FXMVECTOR origin, FXMVECTOR direction, _Out_ MeshBVHHit* hit, float maxDistance = FLT_MAX) const;
+
+        // Returns true if any triangle is hit within maxDistance, stopping at the first found (for occlusion tests).
+        bool XM_CALLCONV IntersectsAny(FXMVECTOR origin, FXMVECTOR direction, float maxDistance = FLT_MAX) const;
+
+        // Traces many rays together, four at a time, sharing the walk of the hierarchy. Coherent rays, such as those
+        // through neighboring pixels, are much faster than separate calls.
+        void __cdecl IntersectsPacket(_In_reads_(count) const XMFLOAT3* origins, _In_reads_(count) const XMFLOAT3* directions, size_t count,
+                                      _Out_writes_(count) MeshBVHHit* hits, float maxDistance = FLT_MAX) const;
+
+        // Overlap queries. The boolean forms stop at the first triangle found; the others replace the contents of
+        // triangles with every overlapping triangle, and return how many there are.
+        bool __cdecl Intersects(const BoundingSphere& sphere) const;
+        bool __cdecl Intersects(const BoundingBox& box) const;
+
+        size_t __cdecl Intersects(const BoundingSphere& sphere, std::vector<MeshBVHTriangle>& triangles) const;
+        size_t __cdecl Intersects(const BoundingBox& box, std::vector<MeshBVHTriangle>& triangles) const;
+
+    private:
+        MeshBVH() noexcept(false);
+
+        // Private implementation.
+        class Impl;
+
+        std::unique_ptr<Impl> pImpl;
+    };
+}
@@ -77,6 +77,9 @@ namespace DirectX
             );
 
             SetDebugObjectName(mConstantBuffer.Get(), "DirectXTK");
+
+            mShadowValid = false;
+            mDeferredWrites = false;
         }
 
 
@@ -94,6 +97,38 @@ namespace DirectX
             *static_cast<T*>(mappedResource.pData) = value;
 
             deviceContext->Unmap(mConstantBuffer.Get(), 0);
+
+            mShadowValid = false;
+
+            if (deviceContext->GetType() != D3D11_DEVICE_CONTEXT_IMMEDIATE)
+            {
+                mDeferredWrites = true;
+            }
+        }
+
+
+        // Writes new data into the constant buffer only if it differs from the data last written by this method,
+        // and returns whether it was written. Writes on deferred contexts are always made, since a dynamic buffer
+        // must be mapped before its first use in each command list. Once the buffer has been written on a deferred
+        // context, the immediate context can't tell when that write lands, as it takes effect whenever the command
+        // list is executed, so writes there are no longer elided either.
+        bool SetDataIfChanged(_In_ ID3D11DeviceContext* deviceContext, T const& value)
+        {
+            if (deviceContext->GetType() != D3D11_DEVICE_CONTEXT_IMMEDIATE)
+            {
+                SetData(deviceContext, value);
+                return true;
+            }
+
+            if (mShadowValid && !mDeferredWrites && ShadowEquals(value))
+                return false;
+
+            SetData(deviceContext, value);
+
+            memcpy(mShadow, &value, sizeof(T));
+            mShadowValid = true;
+
+            return true;
         }
     #endif
 
@@ -107,5 +142,32 @@ namespace DirectX
     private:
         // The underlying D3D object.
         Microsoft::WRL::ComPtr<ID3D11Buffer> mConstantBuffer;
+
+    #if !defined(_XBOX_ONE) || !defined(_TITLE)
+        // D3D requires constant buffer sizes to be a multiple of 16 bytes.
+        static_assert((sizeof(T) % 16) == 0, "Constant buffer size must be a multiple of 16 bytes");
+
+        // Compares against the shadow copy 16 bytes at a time, combining the lanes and testing once at the end.
+        bool ShadowEquals(T const& value) const
+        {
+            auto data = reinterpret_cast<const uint32_t*>(&value);
+
+            XMVECTOR equal = XMVectorTrueInt();
+
+            for (size_t i = 0; i < sizeof(T) / sizeof(uint32_t); i += 4)
+            {
+                equal = XMVectorAndInt(equal, XMVectorEqualInt(XMLoadInt4(&mShadow[i]), XMLoadInt4(&data[i])));
+            }
+
+            return XMVector4EqualInt(equal, XMVectorTrueInt());
+        }
+
+        // Copy of the data last written by SetDataIfChanged, valid until the buffer is written by other means.
+        uint32_t mShadow[sizeof(T) / sizeof(uint32_t)];
+        bool mShadowValid = false;
+
+        // Set once the buffer is written on a deferred context, which turns off elision until it is recreated.
+        bool mDeferredWrites = false;
+    #endif
     };
 }
@@ -0,0 +1,437 @@
+//--------------------------------------------------------------------------------------
+// File: ModelHelpers.h
+//
+// Helper functions for post-processing model mesh data on the CPU
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <DirectXCollision.h>
+#include <DirectXPackedVector.h>
+
+#include "DirectXHelpers.h"
+#include "LoaderHelpers.h"
+#include "Model.h"
+#include "PlatformHelpers.h"
+
+
+namespace DirectX
+{
+    namespace ModelHelpers
+    {
+        //--------------------------------------------------------------------------------------
+        // Copies the contents of a GPU buffer into system memory
+        //--------------------------------------------------------------------------------------
+        inline void ReadBackBuffer(_In_ ID3D11DeviceContext* deviceContext, _In_ ID3D11Buffer* buffer, std::vector<uint8_t>& data)
+        {
+            assert(deviceContext != nullptr && buffer != nullptr);
+
+            Microsoft::WRL::ComPtr<ID3D11Device> device;
+            deviceContext->GetDevice(&device);
+
+            D3D11_BUFFER_DESC desc = {};
+            buffer->GetDesc(&desc);
+
+            desc.BindFlags = 0;
+            desc.MiscFlags = 0;
+            desc.StructureByteStride = 0;
+            desc.CPUAccessFlags = D3D11_CPU_ACCESS_READ;
+            desc.Usage = D3D11_USAGE_STAGING;
+
+            Microsoft::WRL::ComPtr<ID3D11Buffer> staging;
+            ThrowIfFailed(
+                device->CreateBuffer(&desc, nullptr, staging.GetAddressOf())
+            );
+
+            SetDebugObjectName(staging.Get(), "DirectXTK:ModelHelpers");
+
+            deviceContext->CopyResource(staging.Get(), buffer);
+
+            D3D11_MAPPED_SUBRESOURCE mapped;
+            ThrowIfFailed(
+                deviceContext->Map(staging.Get(), 0, D3D11_MAP_READ, 0, &mapped)
+            );
+
+            auto ptr = static_cast<const uint8_t*>(mapped.pData);
+            data.assign(ptr, ptr + desc.ByteWidth);
+
+            deviceContext->Unmap(staging.Get(), 0);
+        }
+
+
+        //--------------------------------------------------------------------------------------
+        // Finds an element of the first input slot in a vertex declaration, returning its byte
+        // offset, or nullptr if not present. "SV_Position" and "POSITION" are treated as the same.
+        //--------------------------------------------------------------------------------------
+        inline const D3D11_INPUT_ELEMENT_DESC* FindVertexElement(std::vector<D3D11_INPUT_ELEMENT_DESC> const& decl, _In_z_ const char* semanticName, UINT semanticIndex, _Out_ uint32_t* offset)
+        {
+            assert(offset != nullptr);
+
+            bool isPosition = !_stricmp(semanticName, "SV_Position") || !_stricmp(semanticName, "POSITION");
+
+            uint32_t elementOffset = 0;
+
+            for (auto it = decl.cbegin(); it != decl.cend(); ++it)
+            {
+                if (it->InputSlot != 0)
+                    continue;
+
+                if (it->AlignedByteOffset != D3D11_APPEND_ALIGNED_ELEMENT)
+                    elementOffset = it->AlignedByteOffset;
+
+                bool match = isPosition
+                    ? (!_stricmp(it->SemanticName, "SV_Position") || !_stricmp(it->SemanticName, "POSITION"))
+                    : !_stricmp(it->SemanticName, semanticName);
+
+                if (match && it->SemanticIndex == semanticIndex)
+                {
+                    *offset = elementOffset;
+                    return &*it;
+                }
+
+                elementOffset += static_cast<uint32_t>(LoaderHelpers::BitsPerPixel(it->Format) / 8);
+            }
+
+            *offset = 0;
+            return nullptr;
+        }
+
+
+        //--------------------------------------------------------------------------------------
+        // Decodes a vertex element to floating-point, returning false for unsupported formats
+        //--------------------------------------------------------------------------------------
+        inline bool LoadVertexElement(_In_ const void* ptr, DXGI_FORMAT format, _Out_ XMVECTOR* result)
+        {
+            using namespace DirectX::PackedVector;
+
+            assert(result != nullptr);
+
+            switch (format)
+            {
+                case DXGI_FORMAT_R32G32B32A32_FLOAT:
+                    *result = XMLoadFloat4(static_cast<const XMFLOAT4*>(ptr));
+                    return true;
+
+                case DXGI_FORMAT_R32G32B32_FLOAT:
+                    *result = XMLoadFloat3(static_cast<const XMFLOAT3*>(ptr));
+                    return true;
+
+                case DXGI_FORMAT_R32G32_FLOAT:
+                    *result = XMLoadFloat2(static_cast<const XMFLOAT2*>(ptr));
+                    return true;
+
+                case DXGI_FORMAT_R16G16B16A16_FLOAT:
+                    *result = XMLoadHalf4(static_cast<const XMHALF4*>(ptr));
+                    return true;
+
+                case DXGI_FORMAT_R16G16_FLOAT:
+                    *result = XMLoadHalf2(static_cast<const XMHALF2*>(ptr));
+                    return true;
+
+                case DXGI_FORMAT_R16G16B16A16_SNORM:
+                    *result = XMLoadShortN4(static_cast<const XMSHORTN4*>(ptr));
+                    return true;
+
+                case DXGI_FORMAT_R16G16_SNORM:
+                    *result = XMLoadShortN2(static_cast<const XMSHORTN2*>(ptr));
+                    return true;
+
+                case DXGI_FORMAT_R8G8B8A8_UNORM:
+                    *result = XMLoadUByteN4(static_cast<const XMUBYTEN4*>(ptr));
+                    return true;
+
+                case DXGI_FORMAT_R8G8B8A8_SNORM:
+                    *result = XMLoadByteN4(static_cast<const XMBYTEN4*>(ptr));
+                    return true;
+
+                case DXGI_FORMAT_B8G8R8A8_UNORM:
+                    *result = XMVectorSwizzle<2, 1, 0, 3>(XMLoadUByteN4(static_cast<const XMUBYTEN4*>(ptr)));
+                    return true;
+
+                case DXGI_FORMAT_R10G10B10A2_UNORM:
+                    *result = XMLoadUDecN4(static_cast<const XMUDECN4*>(ptr));
+                    return true;
+
+                case DXGI_FORMAT_R11G11B10_FLOAT:
+                    *result = XMLoadFloat3PK(static_cast<const XMFLOAT3PK*>(ptr));
+                    return true;
+
+                default:
+                    *result = XMVectorZero();
+                    return false;
+            }
+        }
+
+
+        //--------------------------------------------------------------------------------------
+        // Encodes a vertex element from floating-point, returning false for unsupported formats
+        //--------------------------------------------------------------------------------------
+        inline bool XM_CALLCONV StoreVertexElement(_Out_ void* ptr, DXGI_FORMAT format, FXMVECTOR value)
+        {
+            using namespace DirectX::PackedVector;
+
+            switch (format)
+            {
+                case DXGI_FORMAT_R32G32B32A32_FLOAT:
+                    XMStoreFloat4(static_cast<XMFLOAT4*>(ptr), value);
+                    return true;
+
+                case DXGI_FORMAT_R32G32B32_FLOAT:
+                    XMStoreFloat3(static_cast<XMFLOAT3*>(ptr), value);
+                    return true;
+
+                case DXGI_FORMAT_R32G32_FLOAT:
+                    XMStoreFloat2(static_cast<XMFLOAT2*>(ptr), value);
+                    return true;
+
+                case DXGI_FORMAT_R16G16B16A16_FLOAT:
+                    XMStoreHalf4(static_cast<XMHALF4*>(ptr), value);
+                    return true;
+
+                case DXGI_FORMAT_R16G16_FLOAT:
+                    XMStoreHalf2(static_cast<XMHALF2*>(ptr), value);
+                    return true;
+
+                case DXGI_FORMAT_R16G16B16A16_SNORM:
+                    XMStoreShortN4(static_cast<XMSHORTN4*>(ptr), value);
+                    return true;
+
+                case DXGI_FORMAT_R16G16_SNORM:
+                    XMStoreShortN2(static_cast<XMSHORTN2*>(ptr), value);
+                    return true;
+
+                case DXGI_FORMAT_R8G8B8A8_UNORM:
+                    XMStoreUByteN4(static_cast<XMUBYTEN4*>(ptr), value);
+                    return true;
+
+                case DXGI_FORMAT_R8G8B8A8_SNORM:
+                    XMStoreByteN4(static_cast<XMBYTEN4*>(ptr), value);
+                    return true;
+
+                case DXGI_FORMAT_B8G8R8A8_UNORM:
+                    XMStoreUByteN4(static_cast<XMUBYTEN4*>(ptr), XMVectorSwizzle<2, 1, 0, 3>(value));
+                    return true;
+
+                case DXGI_FORMAT_R10G10B10A2_UNORM:
+                    XMStoreUDecN4(static_cast<XMUDECN4*>(ptr), value);
+                    return true;
+
+                case DXGI_FORMAT_R11G11B10_FLOAT:
+                    XMStoreFloat3PK(static_cast<XMFLOAT3PK*>(ptr), value);
+                    return true;
+
+                default:
+                    return false;
+            }
+        }
+
+
+        //--------------------------------------------------------------------------------------
+        // Unsigned formats can't hold negative values, so normals and tangents stored in them are
+        // scaled and biased into [0,1]. SDKMESH marks such meshes with BIASED_VERTEX_NORMALS.
+        //--------------------------------------------------------------------------------------
+        inline bool IsBiasedVertexFormat(DXGI_FORMAT format)
+        {
+            switch (format)
+            {
+                case DXGI_FORMAT_R8G8B8A8_UNORM:
+                case DXGI_FORMAT_B8G8R8A8_UNORM:
+                case DXGI_FORMAT_R10G10B10A2_UNORM:
+                case DXGI_FORMAT_R11G11B10_FLOAT:
+                    return true;
+
+                default:
+                    return false;
+            }
+        }
+
+
+        //--------------------------------------------------------------------------------------
+        // Decodes a normal or tangent element, removing the bias of unsigned formats
+        //--------------------------------------------------------------------------------------
+        inline bool LoadVertexDirection(_In_ const void* ptr, DXGI_FORMAT format, _Out_ XMVECTOR* result)
+        {
+            if (!LoadVertexElement(ptr, format, result))
+                return false;
+
+            if (IsBiasedVertexFormat(format))
+            {
+                *result = XMVectorMultiplyAdd(*result, g_XMTwo, g_XMNegativeOne);
+            }
+
+            return true;
+        }
+
+
+        //--------------------------------------------------------------------------------------
+        // Encodes a normal or tangent element, applying the bias of unsigned formats
+        //--------------------------------------------------------------------------------------
+        inline bool XM_CALLCONV StoreVertexDirection(_Out_ void* ptr, DXGI_FORMAT format, FXMVECTOR value)
+        {
+            if (IsBiasedVertexFormat(format))
+                return StoreVertexElement(ptr, format, XMVectorMultiplyAdd(value, g_XMOneHalf, g_XMOneHalf));
+
+            return StoreVertexElement(ptr, format, value);
+        }
+
+
+        //--------------------------------------------------------------------------------------
+        // Picks one of 'levels' levels of detail from the fraction of the viewport height covered by
+        // the bounding sphere. Level 0 is used down to screenCoverage, and each further level at half
+        // the coverage of the one before, as each halves the triangle count.
+        //--------------------------------------------------------------------------------------
+        inline size_t XM_CALLCONV SelectLevelOfDetail(const BoundingSphere& localBounds, FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection,
+                                                      size_t levels, float screenCoverage)
+        {
+            if (levels <= 1)
+                return 0;
+
+            BoundingSphere bounds;
+            localBounds.Transform(bounds, world);
+
+            // Fraction of the viewport height covered by the sphere, which is its radius in clip space over w.
+            float coverage = bounds.Radius * fabsf(XMVectorGetY(projection.r[1]));
+
+            if (XMVectorGetW(projection.r[2]) != 0.f)
+            {
+                XMVECTOR center = XMVector3Transform(XMLoadFloat3(&bounds.Center), view);
+                float w = XMVectorGetW(XMVector3Transform(center, projection));
+
+                // The camera is inside the bounds, so always use the most detailed level.
+                if (w <= bounds.Radius)
+                    return 0;
+
+                coverage /= w;
+            }
+
+            size_t lod = 0;
+            float threshold = screenCoverage;
+
+            while (coverage < threshold && lod + 1 < levels)
+            {
+                threshold *= 0.5f;
+                ++lod;
+            }
+
+            return lod;
+        }
+
+
+        //--------------------------------------------------------------------------------------
+        // Orders bones depth-first so every parent precedes its children, keeping siblings in their
+        // original order. parents[i] is the parent of bone i, or any value of count or more for a root.
+        //--------------------------------------------------------------------------------------
+        inline void SortBonesParentFirst(_In_reads_(count) const uint32_t* parents, size_t count, std::vector<uint32_t>& order)
+        {
+            std::vector<uint32_t> childOffsets(count + 1, 0);
+            std::vector<uint32_t> roots;
+
+            for (size_t i = 0; i < count; i++)
+            {
+                if (parents[i] < count)
+                    childOffsets[parents[i] + 1]++;
+                else
+                    roots.push_back(static_cast<uint32_t>(i));
+            }
+
+            for (size_t i = 0; i < count; i++)
+            {
+                childOffsets[i + 1] += childOffsets[i];
+            }
+
+            std::vector<uint32_t> children(childOffsets.back());
+            std::vector<uint32_t> fill(childOffsets.begin(), childOffsets.end() - 1);
+
+            for (size_t i = 0; i < count; i++)
+            {
+                if (parents[i] < count)
+                    children[fill[parents[i]]++] = static_cast<uint32_t>(i);
+            }
+
+            order.clear();
+            order.reserve(count);
+
+            std::vector<uint32_t> stack(roots.rbegin(), roots.rend());
+
+            while (!stack.empty())
+            {
+                uint32_t bone = stack.back();
+                stack.pop_back();
+
+                order.push_back(bone);
+
+                for (uint32_t j = childOffsets[bone + 1]; j > childOffsets[bone]; --j)
+                {
+                    stack.push_back(children[j - 1]);
+                }
+            }
+
+            // Bones in a cycle are never reached from a root.
+            if (order.size() != count)
+                throw std::exception("Bone hierarchy contains a cycle");
+        }
+
+
+        //--------------------------------------------------------------------------------------
+        // Loader pipeline. The model loaders keep the vertex and index data of each part on the
+        // CPU, run the passes chosen by ModelLoaderOptions on it, and only then create buffers.
+        // The Model methods of the same passes read the buffers of a loaded model back into the
+        // same form, so both run the same code.
+        //--------------------------------------------------------------------------------------
+        struct BufferData
+        {
+            const uint8_t*                          data;
+            size_t                                  size;
+            std::vector<uint8_t>                    storage;    // Empty when data points into the file being loaded
+            Microsoft::WRL::ComPtr<ID3D11Buffer>    buffer;     // Buffer the data was read back from or created as
+        };
+
+        // Refers to data that outlives the load, such as the file itself, without copying it.
+        inline std::shared_ptr<BufferData> ReferenceBufferData(_In_reads_bytes_(size) const void* data, size_t size)
+        {
+            auto result = std::make_shared<BufferData>();
+            result->data = static_cast<const uint8_t*>(data);
+            result->size = size;
+            return result;
+        }
+
+        inline std::shared_ptr<BufferData> MakeBufferData(std::vector<uint8_t>&& storage)
+        {
+            auto result = std::make_shared<BufferData>();
+            result->storage = std::move(storage);
+            result->data = result->storage.data();
+            result->size = result->storage.size();
+            return result;
+        }
+
+        // Parts drawn from the same buffer share its data.
+        struct PartData
+        {
+            std::shared_ptr<BufferData>     vertices;
+            std::shared_ptr<BufferData>     indices;
+            std::shared_ptr<BufferData>     lodIndices;     // All the levels of ModelMeshPart::lods, once generated
+        };
+
+        typedef std::map<const ModelMeshPart*, PartData> ModelData;
+
+        // Reads back the vertex and index buffers of every part of a model, once per buffer.
+        void ReadBackModelData(_In_ ID3D11DeviceContext* deviceContext, const Model& model, ModelData& data);
+
+        // Passes over the data of the parts, in place. Parts without data are left unchanged.
+        void GenerateLODs(Model& model, ModelData& data, size_t levels, float ratio);
+        void ComputeTangentFrames(_In_ ID3D11Device* device, Model& model, ModelData& data, bool recomputeNormals);
+        void CreateBVHs(Model& model, const ModelData& data);
+
+        // Creates a buffer from each piece of data that has none yet, and points the parts at them.
+        void CreateModelBuffers(_In_ ID3D11Device* device, Model& model, ModelData& data);
+
+        // Last step of every loader: runs the passes enabled by options, then creates the buffers or
+        // adds the data to options.bufferPool.
+        void FinishLoading(_In_ ID3D11Device* device, Model& model, ModelData& data, const ModelLoaderOptions& options);
+    }
+}
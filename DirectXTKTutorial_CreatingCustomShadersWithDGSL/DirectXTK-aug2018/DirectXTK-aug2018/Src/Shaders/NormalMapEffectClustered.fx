@@ -0,0 +1,141 @@
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+
+
+// Pixel shaders for NormalMapEffect that add the clustered point and spot lights of a LightClusters object to the
+// directional lights. Structured buffers need Shader Model 5.0, so these are compiled apart from the others.
+
+#include "NormalMapEffect.fx"
+#include "LightClusters.fxh"
+
+cbuffer LightClusterParameters : register(b1)
+{
+    float4 TileAndDepthScale        : packoffset(c0);
+    uint4  ClusterCounts            : packoffset(c1);
+};
+
+StructuredBuffer<ClusterLight> ClusterLights : register(t3);
+StructuredBuffer<uint2> ClusterRanges : register(t4);
+StructuredBuffer<uint> ClusterLightIndices : register(t5);
+
+
+struct PSInputPixelLightingTxPosition
+{
+    float2 TexCoord   : TEXCOORD0;
+    float4 PositionWS : TEXCOORD1;
+    float3 NormalWS   : TEXCOORD2;
+    float4 Diffuse    : COLOR0;
+    float4 PositionPS : SV_Position;
+};
+
+
+ColorPair ComputeAllLights(PSInputPixelLightingTxPosition pin, float3 eyeVector, float3 normal)
+{
+    ColorPair lightResult = ComputeLights(eyeVector, normal, 3);
+
+    uint cluster = GetLightCluster(pin.PositionPS, TileAndDepthScale, ClusterCounts);
+
+    ColorPair clusterResult = ComputeClusterLights(pin.PositionWS.xyz, eyeVector, normal, cluster,
+                                                   ClusterLights, ClusterRanges, ClusterLightIndices);
+
+    lightResult.Diffuse += clusterResult.Diffuse;
+    lightResult.Specular += clusterResult.Specular;
+
+    return lightResult;
+}
+
+
+// Pixel shader: pixel lighting + texture + clustered lights + no fog
+float4 PSClusteredLightingTxNoFog(PSInputPixelLightingTxPosition pin) : SV_Target0
+{
+    float3 eyeVector = normalize(EyePosition - pin.PositionWS.xyz);
+
+    // Before lighting, peturb the surface's normal by the one given in normal map.
+    float3 localNormal = BiasX2(NormalTexture.Sample(Sampler, pin.TexCoord).xyz);
+    float3 normal = PeturbNormal(localNormal, pin.PositionWS.xyz, pin.NormalWS, pin.TexCoord);
+
+    // Do lighting
+    ColorPair lightResult = ComputeAllLights(pin, eyeVector, normal);
+
+    // Get color from albedo texture
+    float4 color = Texture.Sample(Sampler, pin.TexCoord) * pin.Diffuse;
+    color.rgb *= lightResult.Diffuse;
+
+    // Apply specular, modulated by the intensity given in the specular map
+    float3 specIntensity = SpecularTexture.Sample(Sampler, pin.TexCoord);
+    AddSpecular(color, lightResult.Specular * specIntensity);
+
+    return color;
+}
+
+// Pixel shader: pixel lighting + texture + clustered lights
+float4 PSClusteredLightingTx(PSInputPixelLightingTxPosition pin) : SV_Target0
+{
+    float3 eyeVector = normalize(EyePosition - pin.PositionWS.xyz);
+
+    // Before lighting, peturb the surface's normal by the one given in normal map.
+    float3 localNormal = BiasX2(NormalTexture.Sample(Sampler, pin.TexCoord).xyz);
+    float3 normal = PeturbNormal(localNormal, pin.PositionWS.xyz, pin.NormalWS, pin.TexCoord);
+
+    // Do lighting
+    ColorPair lightResult = ComputeAllLights(pin, eyeVector, normal);
+
+    // Get color from albedo texture
+    float4 color = Texture.Sample(Sampler, pin.TexCoord) * pin.Diffuse;
+    color.rgb *= lightResult.Diffuse;
+
+    // Apply specular, modulated by the intensity given in the specular map
+    float3 specIntensity = SpecularTexture.Sample(Sampler, pin.TexCoord);
+    AddSpecular(color, lightResult.Specular * specIntensity);
+
+    ApplyFog(color, pin.PositionWS.w);
+    return color;
+}
+
+
+// Pixel shader: pixel lighting + texture + clustered lights + no fog + no specular
+float4 PSClusteredLightingTxNoFogSpec(PSInputPixelLightingTxPosition pin) : SV_Target0
+{
+    float3 eyeVector = normalize(EyePosition - pin.PositionWS.xyz);
+
+    // Before lighting, peturb the surface's normal by the one given in normal map.
+    float3 localNormal = BiasX2(NormalTexture.Sample(Sampler, pin.TexCoord).xyz);
+    float3 normal = PeturbNormal(localNormal, pin.PositionWS.xyz, pin.NormalWS, pin.TexCoord);
+
+    // Do lighting
+    ColorPair lightResult = ComputeAllLights(pin, eyeVector, normal);
+
+    // Get color from albedo texture
+    float4 color = Texture.Sample(Sampler, pin.TexCoord) * pin.Diffuse;
+    color.rgb *= lightResult.Diffuse;
+
+    // Apply specular
+    AddSpecular(color, lightResult.Specular);
+
+    return color;
+}
+
+// Pixel shader: pixel lighting + texture + clustered lights + no specular
+float4 PSClusteredLightingTxNoSpec(PSInputPixelLightingTxPosition pin) : SV_Target0
+{
+    float3 eyeVector = normalize(EyePosition - pin.PositionWS.xyz);
+
+    // Before lighting, peturb the surface's normal by the one given in normal map.
+    float3 localNormal = BiasX2(NormalTexture.Sample(Sampler, pin.TexCoord).xyz);
+    float3 normal = PeturbNormal(localNormal, pin.PositionWS.xyz, pin.NormalWS, pin.TexCoord);
+
+    // Do lighting
+    ColorPair lightResult = ComputeAllLights(pin, eyeVector, normal);
+
+    // Get color from albedo texture
+    float4 color = Texture.Sample(Sampler, pin.TexCoord) * pin.Diffuse;
+    color.rgb *= lightResult.Diffuse;
+
+    // Apply specular
+    AddSpecular(color, lightResult.Specular);
+
+    ApplyFog(color, pin.PositionWS.w);
+    return color;
+}
@@ -15,6 +15,7 @@
 #include "VertexTypes.h"
 #include "SharedResourcePool.h"
 #include "AlignedNew.h"
+#include "StateFilter.h"
 
 using namespace DirectX;
 using Microsoft::WRL::ComPtr;
@@ -561,16 +562,16 @@ void SpriteBatch::Impl::PrepareForRendering()
     auto rasterizerState = mRasterizerState ? mRasterizerState.Get() : mDeviceResources->stateObjects.CullCounterClockwise();
     auto samplerState = mSamplerState ? mSamplerState.Get() : mDeviceResources->stateObjects.LinearClamp();
 
-    deviceContext->OMSetBlendState(blendState, nullptr, 0xFFFFFFFF);
-    deviceContext->OMSetDepthStencilState(depthStencilState, 0);
-    deviceContext->RSSetState(rasterizerState);
-    deviceContext->PSSetSamplers(0, 1, &samplerState);
+    StateFilter::OMSetBlendState(deviceContext, blendState, nullptr, 0xFFFFFFFF);
+    StateFilter::OMSetDepthStencilState(deviceContext, depthStencilState, 0);
+    StateFilter::RSSetState(deviceContext, rasterizerState);
+    StateFilter::PSSetSamplers(deviceContext, 0, 1, &samplerState);
 
     // Set shaders.
-    deviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-    deviceContext->IASetInputLayout(mDeviceResources->inputLayout.Get());
-    deviceContext->VSSetShader(mDeviceResources->vertexShader.Get(), nullptr, 0);
-    deviceContext->PSSetShader(mDeviceResources->pixelShader.Get(), nullptr, 0);
+    StateFilter::IASetPrimitiveTopology(deviceContext, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    StateFilter::IASetInputLayout(deviceContext, mDeviceResources->inputLayout.Get());
+    StateFilter::VSSetShader(deviceContext, mDeviceResources->vertexShader.Get(), nullptr, 0);
+    StateFilter::PSSetShader(deviceContext, mDeviceResources->pixelShader.Get(), nullptr, 0);
 
     // Set the vertex and index buffer.
 #if !defined(_XBOX_ONE) || !defined(_TITLE)
@@ -578,10 +579,10 @@ void SpriteBatch::Impl::PrepareForRendering()
     UINT vertexStride = sizeof(VertexPositionColorTexture);
     UINT vertexOffset = 0;
 
-    deviceContext->IASetVertexBuffers(0, 1, &vertexBuffer, &vertexStride, &vertexOffset);
+    StateFilter::IASetVertexBuffers(deviceContext, 0, 1, &vertexBuffer, &vertexStride, &vertexOffset);
 #endif
 
-    deviceContext->IASetIndexBuffer(mDeviceResources->indexBuffer.Get(), DXGI_FORMAT_R16_UINT, 0);
+    StateFilter::IASetIndexBuffer(deviceContext, mDeviceResources->indexBuffer.Get(), DXGI_FORMAT_R16_UINT, 0);
 
     // Set the transform matrix.
     XMMATRIX transformMatrix = (mRotation == DXGI_MODE_ROTATION_UNSPECIFIED)
@@ -598,7 +599,7 @@ void SpriteBatch::Impl::PrepareForRendering()
 
     ID3D11Buffer* constantBuffer = mContextResources->constantBuffer.GetBuffer();
 
-    deviceContext->VSSetConstantBuffers(0, 1, &constantBuffer);
+    StateFilter::VSSetConstantBuffers(deviceContext, 0, 1, &constantBuffer);
 #endif
 
     // If this is a deferred D3D context, reset position so the first Map call will use D3D11_MAP_WRITE_DISCARD.
@@ -611,6 +612,7 @@ void SpriteBatch::Impl::PrepareForRendering()
     if (mSetCustomShaders)
     {
         mSetCustomShaders();
+        StateFilter::Invalidate(deviceContext);
     }
 }
 
@@ -725,7 +727,7 @@ void SpriteBatch::Impl::RenderBatch(ID3D11ShaderResourceView* texture, SpriteInf
     auto deviceContext = mContextResources->deviceContext.Get();
 
     // Draw using the specified texture.
-    deviceContext->PSSetShaderResources(0, 1, &texture);
+    StateFilter::PSSetShaderResources(deviceContext, 0, 1, &texture);
 
     XMVECTOR textureSize = GetTextureSize(texture);
     XMVECTOR inverseTextureSize = XMVectorReciprocal(textureSize);
@@ -783,6 +785,7 @@ void SpriteBatch::Impl::RenderBatch(ID3D11ShaderResourceView* texture, SpriteInf
 
 #if defined(_XBOX_ONE) && defined(_TITLE)
         deviceContext->IASetPlacementVertexBuffer(0, mContextResources->vertexBuffer.Get(), grfxMemory, sizeof(VertexPositionColorTexture));
+        StateFilter::InvalidateVertexBuffer(deviceContext, 0);
 #else
         deviceContext->Unmap(mContextResources->vertexBuffer.Get(), 0);
 #endif
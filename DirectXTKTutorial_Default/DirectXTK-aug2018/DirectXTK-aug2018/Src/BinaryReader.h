@@ -61,6 +61,9 @@ namespace DirectX
         // Lower level helper reads directly from the filesystem into memory.
         static HRESULT ReadEntireFile(_In_z_ wchar_t const* fileName, _Inout_ std::unique_ptr<uint8_t[]>& data, _Out_ size_t* dataSize);
 
+        // Maps a whole file read-only into the address space, avoiding the copy into a heap buffer.
+        static HRESULT MapEntireFile(_In_z_ wchar_t const* fileName, _Inout_ ScopedMappedView& data, _Out_ size_t* dataSize);
+
 
     private:
         // The data currently being read.
@@ -80,5 +80,9 @@ namespace DirectX
 
     typedef std::unique_ptr<void, handle_closer> ScopedHandle;
 
+    struct view_unmapper { void operator()(const void* p) noexcept { if (p) UnmapViewOfFile(p); } };
+
+    typedef std::unique_ptr<const uint8_t, view_unmapper> ScopedMappedView;
+
     inline HANDLE safe_handle(HANDLE h) noexcept { return (h == INVALID_HANDLE_VALUE) ? nullptr : h; }
 }
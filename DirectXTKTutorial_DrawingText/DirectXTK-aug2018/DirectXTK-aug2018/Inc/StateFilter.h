@@ -0,0 +1,92 @@
+//--------------------------------------------------------------------------------------
+// File: StateFilter.h
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#if defined(_XBOX_ONE) && defined(_TITLE)
+#include <d3d11_x.h>
+#else
+#include <d3d11_1.h>
+#endif
+
+#include <memory>
+
+
+namespace DirectX
+{
+    // Drops redundant state changes on a device context. While a StateFilter is attached to a context, the static
+    // setters below remember what each slot holds, and skip calls that would bind the same state again, or narrow
+    // ranges of slots to the ones that change. DirectXTK sets all of its pipeline state through these setters, so
+    // its models, primitives, sprites, effects, and post-processing share one view of the bound state. Without an
+    // attached filter the setters forward every call unchanged.
+    //
+    // State changed on the context by other means, such as ClearState, direct calls, command lists that do not
+    // restore state, or render targets that unbind shader resources, must be followed by Invalidate. DirectXTK
+    // invalidates after its custom state callbacks, and OMSetRenderTargets below forgets bound shader resources.
+    class StateFilter
+    {
+    public:
+        explicit StateFilter(_In_ ID3D11DeviceContext* deviceContext);
+        StateFilter(StateFilter&& moveFrom) noexcept;
+        StateFilter& operator= (StateFilter&& moveFrom) noexcept;
+
+        StateFilter(StateFilter const&) = delete;
+        StateFilter& operator= (StateFilter const&) = delete;
+
+        virtual ~StateFilter();
+
+        // Forgets the tracked state, so the next call for each slot is issued.
+        void __cdecl Invalidate();
+
+        // Calls issued to the context and calls dropped as redundant, since the last reset, typically per frame.
+        struct Statistics
+        {
+            size_t issued;
+            size_t filtered;
+        };
+
+        Statistics __cdecl GetStatistics() const;
+        void __cdecl ResetStatistics();
+
+        ID3D11DeviceContext* __cdecl GetDeviceContext() const;
+
+        // Setters, matching the ID3D11DeviceContext methods of the same names.
+        static void __cdecl OMSetBlendState(_In_ ID3D11DeviceContext* deviceContext, _In_opt_ ID3D11BlendState* blendState, _In_opt_ const float blendFactor[4], UINT sampleMask);
+        static void __cdecl OMSetDepthStencilState(_In_ ID3D11DeviceContext* deviceContext, _In_opt_ ID3D11DepthStencilState* depthStencilState, UINT stencilRef);
+        static void __cdecl OMSetRenderTargets(_In_ ID3D11DeviceContext* deviceContext, UINT numViews, _In_reads_opt_(numViews) ID3D11RenderTargetView* const* renderTargetViews, _In_opt_ ID3D11DepthStencilView* depthStencilView);
+        static void __cdecl RSSetState(_In_ ID3D11DeviceContext* deviceContext, _In_opt_ ID3D11RasterizerState* rasterizerState);
+
+        static void __cdecl IASetInputLayout(_In_ ID3D11DeviceContext* deviceContext, _In_opt_ ID3D11InputLayout* inputLayout);
+        static void __cdecl IASetPrimitiveTopology(_In_ ID3D11DeviceContext* deviceContext, D3D11_PRIMITIVE_TOPOLOGY topology);
+        static void __cdecl IASetVertexBuffers(_In_ ID3D11DeviceContext* deviceContext, UINT startSlot, UINT numBuffers, _In_reads_opt_(numBuffers) ID3D11Buffer* const* vertexBuffers, _In_reads_opt_(numBuffers) const UINT* strides, _In_reads_opt_(numBuffers) const UINT* offsets);
+        static void __cdecl IASetIndexBuffer(_In_ ID3D11DeviceContext* deviceContext, _In_opt_ ID3D11Buffer* indexBuffer, DXGI_FORMAT format, UINT offset);
+
+        static void __cdecl VSSetShader(_In_ ID3D11DeviceContext* deviceContext, _In_opt_ ID3D11VertexShader* vertexShader, _In_reads_opt_(numClassInstances) ID3D11ClassInstance* const* classInstances, UINT numClassInstances);
+        static void __cdecl VSSetConstantBuffers(_In_ ID3D11DeviceContext* deviceContext, UINT startSlot, UINT numBuffers, _In_reads_opt_(numBuffers) ID3D11Buffer* const* constantBuffers);
+
+        static void __cdecl PSSetShader(_In_ ID3D11DeviceContext* deviceContext, _In_opt_ ID3D11PixelShader* pixelShader, _In_reads_opt_(numClassInstances) ID3D11ClassInstance* const* classInstances, UINT numClassInstances);
+        static void __cdecl PSSetConstantBuffers(_In_ ID3D11DeviceContext* deviceContext, UINT startSlot, UINT numBuffers, _In_reads_opt_(numBuffers) ID3D11Buffer* const* constantBuffers);
+        static void __cdecl PSSetShaderResources(_In_ ID3D11DeviceContext* deviceContext, UINT startSlot, UINT numViews, _In_reads_opt_(numViews) ID3D11ShaderResourceView* const* shaderResourceViews);
+        static void __cdecl PSSetSamplers(_In_ ID3D11DeviceContext* deviceContext, UINT startSlot, UINT numSamplers, _In_reads_opt_(numSamplers) ID3D11SamplerState* const* samplers);
+
+        // Forgets the tracked state of a context, if it has a filter attached.
+        static void __cdecl Invalidate(_In_ ID3D11DeviceContext* deviceContext);
+
+        // Forget a single vertex buffer slot or the index buffer, after binding one by other means, such as the
+        // Xbox One placement buffer calls.
+        static void __cdecl InvalidateVertexBuffer(_In_ ID3D11DeviceContext* deviceContext, UINT slot);
+        static void __cdecl InvalidateIndexBuffer(_In_ ID3D11DeviceContext* deviceContext);
+
+    private:
+        // Private implementation.
+        class Impl;
+
+        std::unique_ptr<Impl> pImpl;
+    };
+}
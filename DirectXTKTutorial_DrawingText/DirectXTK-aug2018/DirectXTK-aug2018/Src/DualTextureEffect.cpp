@@ -172,7 +172,7 @@ void DualTextureEffect::Impl::Apply(_In_ ID3D11DeviceContext* deviceContext)
         texture2.Get(),
     };
 
-    deviceContext->PSSetShaderResources(0, 2, textures);
+    StateFilter::PSSetShaderResources(deviceContext, 0, 2, textures);
     
     // Set shaders and constant buffers.
     ApplyShaders(deviceContext, GetCurrentShaderPermutation());
@@ -220,6 +220,12 @@ void DualTextureEffect::GetVertexShaderBytecode(_Out_ void const** pShaderByteCo
 }
 
 
+void DualTextureEffect::CreateShaders(bool allPermutations)
+{
+    pImpl->CreateShaders(allPermutations ? -1 : pImpl->GetCurrentShaderPermutation());
+}
+
+
 // Camera settings.
 void XM_CALLCONV DualTextureEffect::SetWorld(FXMMATRIX value)
 {
@@ -255,6 +261,12 @@ void XM_CALLCONV DualTextureEffect::SetMatrices(FXMMATRIX world, CXMMATRIX view,
 }
 
 
+void DualTextureEffect::SetDerivedMatrices(const EffectDerivedMatrices& value)
+{
+    pImpl->matrices.SetDerived(pImpl->dirtyFlags, value, pImpl->constants.worldViewProj);
+}
+
+
 // Material settings.
 void XM_CALLCONV DualTextureEffect::SetDiffuseColor(FXMVECTOR value)
 {
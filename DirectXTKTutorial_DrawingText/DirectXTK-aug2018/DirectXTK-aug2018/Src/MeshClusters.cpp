@@ -0,0 +1,672 @@
+//--------------------------------------------------------------------------------------
+// File: MeshClusters.cpp
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#include "pch.h"
+#include "MeshClusters.h"
+#include "Model.h"
+#include "Effects.h"
+#include "DirectXHelpers.h"
+#include "ModelHelpers.h"
+#include "PlatformHelpers.h"
+#include "StateFilter.h"
+
+using namespace DirectX;
+using Microsoft::WRL::ComPtr;
+
+
+namespace
+{
+    // Cone half-angles whose cosine falls below this are too wide to ever be culled.
+    const float MinConeSpread = 0.1f;
+
+    // Sign of the determinant of the upper 3x3 of a matrix.
+    float XM_CALLCONV Determinant3x3Sign(FXMMATRIX m)
+    {
+        XMVECTOR det = XMVector3Dot(m.r[0], XMVector3Cross(m.r[1], m.r[2]));
+
+        return (XMVectorGetX(det) < 0) ? -1.f : 1.f;
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// MeshClusters::Impl
+//--------------------------------------------------------------------------------------
+
+class MeshClusters::Impl
+{
+public:
+    Impl() noexcept :
+        mIndexFormat(DXGI_FORMAT_R32_UINT),
+        mCCW(true)
+    {
+    }
+
+    template<typename TIndex>
+    void Initialize(const XMFLOAT3* positions, size_t positionStride, size_t vertexCount, const TIndex* indices, size_t indexCount, bool ccw, size_t maxVertices, size_t maxTriangles);
+
+    void CreateIndexBuffer(_In_ ID3D11Device* device);
+
+    template<typename TOutputFunc>
+    size_t XM_CALLCONV Cull(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection, TOutputFunc output) const;
+
+    std::vector<MeshCluster> mClusters;
+    std::vector<uint32_t> mIndices;
+    ComPtr<ID3D11Buffer> mIndexBuffer;
+    DXGI_FORMAT mIndexFormat;
+    bool mCCW;
+
+private:
+    template<typename TIndex, typename TPositionFunc>
+    void FinishCluster(std::vector<uint32_t> const& triangles, std::vector<uint32_t> const& vertices, const TIndex* indices, TPositionFunc position);
+};
+
+
+// Greedily grows clusters from a seed triangle, always adding the neighboring triangle
+// that brings in the fewest new vertices, until either limit would be exceeded.
+template<typename TIndex>
+void MeshClusters::Impl::Initialize(const XMFLOAT3* positions, size_t positionStride, size_t vertexCount, const TIndex* indices, size_t indexCount, bool ccw, size_t maxVertices, size_t maxTriangles)
+{
+    if (!positions || !vertexCount)
+        throw std::exception("Positions are required");
+
+    if (!indices || !indexCount)
+        throw std::exception("Indices are required");
+
+    if ((indexCount % 3) != 0)
+        throw std::exception("Expected triangular faces");
+
+    if (positionStride < sizeof(XMFLOAT3))
+        throw std::out_of_range("positionStride parameter out of range");
+
+    if (maxVertices < 3)
+        throw std::out_of_range("maxVertices parameter out of range");
+
+    if (maxTriangles < 1)
+        throw std::out_of_range("maxTriangles parameter out of range");
+
+    if (vertexCount >= UINT32_MAX || indexCount >= UINT32_MAX)
+        throw std::exception("Too many vertices or indices");
+
+    auto basePosition = reinterpret_cast<const uint8_t*>(positions);
+
+    auto position = [=](size_t index) -> XMVECTOR
+    {
+        return XMLoadFloat3(reinterpret_cast<const XMFLOAT3*>(basePosition + index * positionStride));
+    };
+
+    size_t triangleCount = indexCount / 3;
+
+    // Build the list of triangles using each vertex.
+    std::vector<uint32_t> adjacencyOffsets(vertexCount + 1, 0);
+
+    for (size_t i = 0; i < indexCount; i++)
+    {
+        if (indices[i] >= vertexCount)
+            throw std::out_of_range("Index not in vertices list");
+
+        adjacencyOffsets[indices[i] + 1]++;
+    }
+
+    for (size_t i = 0; i < vertexCount; i++)
+    {
+        adjacencyOffsets[i + 1] += adjacencyOffsets[i];
+    }
+
+    std::vector<uint32_t> adjacency(indexCount);
+
+    {
+        std::vector<uint32_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+
+        for (size_t i = 0; i < indexCount; i++)
+        {
+            adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+    }
+
+    mClusters.clear();
+    mIndices.clear();
+    mIndices.reserve(indexCount);
+    mIndexBuffer.Reset();
+    mIndexFormat = (sizeof(TIndex) == 2) ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+    mCCW = ccw;
+
+    std::vector<bool> emitted(triangleCount, false);
+
+    // Records the cluster each vertex was last added to, so membership tests are constant time.
+    std::vector<uint32_t> vertexCluster(vertexCount, UINT32_MAX);
+
+    std::vector<uint32_t> clusterTriangles;
+    std::vector<uint32_t> clusterVertices;
+
+    clusterTriangles.reserve(maxTriangles);
+    clusterVertices.reserve(maxVertices);
+
+    size_t seed = 0;
+
+    for (size_t remaining = triangleCount; remaining > 0; remaining--)
+    {
+        auto clusterId = static_cast<uint32_t>(mClusters.size());
+
+        auto newVertices = [&](size_t triangle) -> size_t
+        {
+            size_t count = 0;
+
+            for (size_t j = 0; j < 3; j++)
+            {
+                if (vertexCluster[indices[triangle * 3 + j]] != clusterId)
+                    count++;
+            }
+
+            return count;
+        };
+
+        // Look for the best triangle adjacent to the current cluster.
+        size_t best = SIZE_MAX;
+        size_t bestCount = SIZE_MAX;
+
+        for (auto vit = clusterVertices.cbegin(); vit != clusterVertices.cend() && bestCount > 0; ++vit)
+        {
+            for (uint32_t a = adjacencyOffsets[*vit]; a < adjacencyOffsets[*vit + 1]; a++)
+            {
+                uint32_t triangle = adjacency[a];
+
+                if (emitted[triangle])
+                    continue;
+
+                size_t count = newVertices(triangle);
+
+                if (count < bestCount)
+                {
+                    best = triangle;
+                    bestCount = count;
+
+                    if (!count)
+                        break;
+                }
+            }
+        }
+
+        // Otherwise start over from the next unused triangle.
+        if (best == SIZE_MAX)
+        {
+            while (emitted[seed])
+            {
+                seed++;
+            }
+
+            best = seed;
+            bestCount = newVertices(best);
+        }
+
+        // Close the current cluster if this triangle doesn't fit, and start the next one with it.
+        if (clusterTriangles.size() + 1 > maxTriangles || clusterVertices.size() + bestCount > maxVertices)
+        {
+            FinishCluster(clusterTriangles, clusterVertices, indices, position);
+
+            clusterTriangles.clear();
+            clusterVertices.clear();
+
+            clusterId = static_cast<uint32_t>(mClusters.size());
+        }
+
+        emitted[best] = true;
+        clusterTriangles.push_back(static_cast<uint32_t>(best));
+
+        for (size_t j = 0; j < 3; j++)
+        {
+            auto index = static_cast<uint32_t>(indices[best * 3 + j]);
+
+            if (vertexCluster[index] != clusterId)
+            {
+                vertexCluster[index] = clusterId;
+                clusterVertices.push_back(index);
+            }
+        }
+    }
+
+    if (!clusterTriangles.empty())
+    {
+        FinishCluster(clusterTriangles, clusterVertices, indices, position);
+    }
+}
+
+
+// Emits the indices of a cluster, and computes its bounding sphere and normal cone.
+template<typename TIndex, typename TPositionFunc>
+void MeshClusters::Impl::FinishCluster(std::vector<uint32_t> const& triangles, std::vector<uint32_t> const& vertices, const TIndex* indices, TPositionFunc position)
+{
+    MeshCluster cluster = {};
+
+    cluster.startIndex = static_cast<uint32_t>(mIndices.size());
+    cluster.indexCount = static_cast<uint32_t>(triangles.size() * 3);
+
+    for (auto it = triangles.cbegin(); it != triangles.cend(); ++it)
+    {
+        for (size_t j = 0; j < 3; j++)
+        {
+            mIndices.push_back(static_cast<uint32_t>(indices[*it * 3 + j]));
+        }
+    }
+
+    // Bounding sphere.
+    std::vector<XMFLOAT3> points(vertices.size());
+
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        XMStoreFloat3(&points[i], position(vertices[i]));
+    }
+
+    BoundingSphere::CreateFromPoints(cluster.boundingSphere, points.size(), points.data(), sizeof(XMFLOAT3));
+
+    // Normal cone, from the spread of the triangle normals around their average.
+    std::vector<XMFLOAT3> normals;
+    normals.reserve(triangles.size());
+
+    XMVECTOR axis = XMVectorZero();
+
+    for (auto it = triangles.cbegin(); it != triangles.cend(); ++it)
+    {
+        XMVECTOR p0 = position(indices[*it * 3]);
+        XMVECTOR p1 = position(indices[*it * 3 + 1]);
+        XMVECTOR p2 = position(indices[*it * 3 + 2]);
+
+        XMVECTOR normal = XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0));
+
+        // Degenerate triangles are never drawn, so they don't constrain the cone.
+        if (XMVector3NearEqual(normal, XMVectorZero(), g_XMEpsilon))
+            continue;
+
+        normal = XMVector3Normalize(normal);
+        axis = XMVectorAdd(axis, normal);
+
+        XMFLOAT3 n;
+        XMStoreFloat3(&n, normal);
+        normals.push_back(n);
+    }
+
+    cluster.coneCutoff = 2.f;
+    cluster.coneAxis = XMFLOAT3(0, 0, 0);
+
+    if (!normals.empty() && !XMVector3NearEqual(axis, XMVectorZero(), g_XMEpsilon))
+    {
+        axis = XMVector3Normalize(axis);
+
+        float minDot = 1.f;
+
+        for (auto it = normals.cbegin(); it != normals.cend(); ++it)
+        {
+            minDot = std::min(minDot, XMVectorGetX(XMVector3Dot(axis, XMLoadFloat3(&*it))));
+        }
+
+        if (minDot > MinConeSpread)
+        {
+            XMStoreFloat3(&cluster.coneAxis, axis);
+            cluster.coneCutoff = sqrtf(1.f - minDot * minDot);
+        }
+    }
+
+    mClusters.push_back(cluster);
+}
+
+
+void MeshClusters::Impl::CreateIndexBuffer(ID3D11Device* device)
+{
+    assert(device != nullptr);
+
+    D3D11_BUFFER_DESC desc = {};
+    desc.Usage = D3D11_USAGE_DEFAULT;
+    desc.BindFlags = D3D11_BIND_INDEX_BUFFER;
+
+    D3D11_SUBRESOURCE_DATA initData = {};
+
+    std::vector<uint16_t> shortIndices;
+
+    if (mIndexFormat == DXGI_FORMAT_R16_UINT)
+    {
+        shortIndices.reserve(mIndices.size());
+
+        for (auto it = mIndices.cbegin(); it != mIndices.cend(); ++it)
+        {
+            shortIndices.push_back(static_cast<uint16_t>(*it));
+        }
+
+        desc.ByteWidth = static_cast<UINT>(shortIndices.size() * sizeof(uint16_t));
+        initData.pSysMem = shortIndices.data();
+    }
+    else
+    {
+        desc.ByteWidth = static_cast<UINT>(mIndices.size() * sizeof(uint32_t));
+        initData.pSysMem = mIndices.data();
+    }
+
+    ThrowIfFailed(
+        device->CreateBuffer(&desc, &initData, mIndexBuffer.ReleaseAndGetAddressOf())
+    );
+
+    _Analysis_assume_(mIndexBuffer != 0);
+
+    SetDebugObjectName(mIndexBuffer.Get(), "DirectXTK:MeshClusters");
+}
+
+
+// Tests each cluster against the frustum planes and its normal cone, in object space.
+template<typename TOutputFunc>
+size_t XM_CALLCONV MeshClusters::Impl::Cull(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection, TOutputFunc output) const
+{
+    XMMATRIX worldView = XMMatrixMultiply(world, view);
+
+    // Extract the clip planes from the combined transform.
+    XMMATRIX clip = XMMatrixTranspose(XMMatrixMultiply(worldView, projection));
+
+    XMVECTOR planes[6] =
+    {
+        XMPlaneNormalize(XMVectorAdd(clip.r[3], clip.r[0])),
+        XMPlaneNormalize(XMVectorSubtract(clip.r[3], clip.r[0])),
+        XMPlaneNormalize(XMVectorAdd(clip.r[3], clip.r[1])),
+        XMPlaneNormalize(XMVectorSubtract(clip.r[3], clip.r[1])),
+        XMPlaneNormalize(clip.r[2]),
+        XMPlaneNormalize(XMVectorSubtract(clip.r[3], clip.r[2])),
+    };
+
+    // The camera position in object space, and which sign of the cross product faces away from it.
+    // Orthographic projections have no eye point, so only perspective views use the normal cones.
+    float projectionSign = XMVectorGetW(projection.r[2]);
+
+    bool coneCulling = (projectionSign != 0);
+
+    XMVECTOR eye = XMMatrixInverse(nullptr, worldView).r[3];
+
+    // Front faces have cross products pointing at the eye for a right-handed projection (w = -z) of a ccw mesh, and
+    // for a left-handed one of a cw mesh, so clusters whose axis points away from the eye are culled. Mirroring
+    // transforms, the other winding, and the other handedness each reverse that.
+    float backSign = -Determinant3x3Sign(worldView) * ((projectionSign < 0) ? -1.f : 1.f) * (mCCW ? 1.f : -1.f);
+
+    size_t visible = 0;
+
+    for (auto it = mClusters.cbegin(); it != mClusters.cend(); ++it)
+    {
+        XMVECTOR center = XMLoadFloat3(&it->boundingSphere.Center);
+        XMVECTOR radius = XMVectorReplicate(it->boundingSphere.Radius);
+
+        bool culled = false;
+
+        for (size_t i = 0; i < 6 && !culled; i++)
+        {
+            culled = XMVector4Less(XMPlaneDotCoord(planes[i], center), XMVectorNegate(radius));
+        }
+
+        if (!culled && coneCulling && it->coneCutoff <= 1.f)
+        {
+            XMVECTOR direction = XMVectorSubtract(center, eye);
+
+            XMVECTOR facing = XMVectorScale(XMVector3Dot(direction, XMLoadFloat3(&it->coneAxis)), backSign);
+            XMVECTOR limit = XMVectorMultiplyAdd(XMVector3Length(direction), XMVectorReplicate(it->coneCutoff), radius);
+
+            culled = XMVector4GreaterOrEqual(facing, limit);
+        }
+
+        if (!culled)
+        {
+            output(*it);
+            visible++;
+        }
+    }
+
+    return visible;
+}
+
+
+//--------------------------------------------------------------------------------------
+// MeshClusters
+//--------------------------------------------------------------------------------------
+
+// Public constructor.
+MeshClusters::MeshClusters() noexcept(false)
+    : pImpl(std::make_unique<Impl>())
+{
+}
+
+
+// Move constructor.
+MeshClusters::MeshClusters(MeshClusters&& moveFrom) noexcept
+    : pImpl(std::move(moveFrom.pImpl))
+{
+}
+
+
+// Move assignment.
+MeshClusters& MeshClusters::operator= (MeshClusters&& moveFrom) noexcept
+{
+    pImpl = std::move(moveFrom.pImpl);
+    return *this;
+}
+
+
+// Public destructor.
+MeshClusters::~MeshClusters()
+{
+}
+
+
+_Use_decl_annotations_
+std::unique_ptr<MeshClusters> MeshClusters::Create(
+    const XMFLOAT3* positions,
+    size_t positionStride,
+    size_t vertexCount,
+    const uint16_t* indices,
+    size_t indexCount,
+    bool ccw,
+    size_t maxVertices,
+    size_t maxTriangles)
+{
+    std::unique_ptr<MeshClusters> clusters(new MeshClusters());
+
+    clusters->pImpl->Initialize(positions, positionStride, vertexCount, indices, indexCount, ccw, maxVertices, maxTriangles);
+
+    return clusters;
+}
+
+
+_Use_decl_annotations_
+std::unique_ptr<MeshClusters> MeshClusters::Create(
+    const XMFLOAT3* positions,
+    size_t positionStride,
+    size_t vertexCount,
+    const uint32_t* indices,
+    size_t indexCount,
+    bool ccw,
+    size_t maxVertices,
+    size_t maxTriangles)
+{
+    std::unique_ptr<MeshClusters> clusters(new MeshClusters());
+
+    clusters->pImpl->Initialize(positions, positionStride, vertexCount, indices, indexCount, ccw, maxVertices, maxTriangles);
+
+    return clusters;
+}
+
+
+_Use_decl_annotations_
+std::unique_ptr<MeshClusters> MeshClusters::CreateFromMeshPart(
+    ID3D11DeviceContext* deviceContext,
+    const ModelMeshPart& part,
+    bool ccw,
+    size_t maxVertices,
+    size_t maxTriangles)
+{
+    assert(deviceContext != nullptr);
+
+    if (part.primitiveType != D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST)
+        throw std::exception("MeshClusters requires a triangle list");
+
+    if (!part.vbDecl || !part.vertexBuffer || !part.indexBuffer || !part.vertexStride)
+        throw std::exception("Model mesh part is missing buffers or vertex buffer input elements data");
+
+    uint32_t positionOffset;
+    auto positionElement = ModelHelpers::FindVertexElement(*part.vbDecl, "SV_Position", 0, &positionOffset);
+
+    if (!positionElement)
+        throw std::exception("Model mesh part has no position element");
+
+    if (positionElement->Format != DXGI_FORMAT_R32G32B32_FLOAT && positionElement->Format != DXGI_FORMAT_R32G32B32A32_FLOAT)
+        throw std::exception("MeshClusters requires 32-bit float positions");
+
+    std::vector<uint8_t> vertexData;
+    ModelHelpers::ReadBackBuffer(deviceContext, part.vertexBuffer.Get(), vertexData);
+
+    std::vector<uint8_t> indexData;
+    ModelHelpers::ReadBackBuffer(deviceContext, part.indexBuffer.Get(), indexData);
+
+    size_t vertexCount = vertexData.size() / part.vertexStride;
+
+    if (part.vertexOffset >= vertexCount || positionOffset + sizeof(XMFLOAT3) > part.vertexStride)
+        throw std::exception("Model mesh part vertex data is invalid");
+
+    auto positions = reinterpret_cast<const XMFLOAT3*>(vertexData.data() + size_t(part.vertexOffset) * part.vertexStride + positionOffset);
+
+    vertexCount -= part.vertexOffset;
+
+    std::unique_ptr<MeshClusters> clusters(new MeshClusters());
+
+    if (part.indexFormat == DXGI_FORMAT_R16_UINT)
+    {
+        if ((uint64_t(part.startIndex) + part.indexCount) * sizeof(uint16_t) > indexData.size())
+            throw std::exception("Model mesh part index data is invalid");
+
+        auto indices = reinterpret_cast<const uint16_t*>(indexData.data()) + part.startIndex;
+
+        clusters->pImpl->Initialize(positions, part.vertexStride, vertexCount, indices, part.indexCount, ccw, maxVertices, maxTriangles);
+    }
+    else
+    {
+        if ((uint64_t(part.startIndex) + part.indexCount) * sizeof(uint32_t) > indexData.size())
+            throw std::exception("Model mesh part index data is invalid");
+
+        auto indices = reinterpret_cast<const uint32_t*>(indexData.data()) + part.startIndex;
+
+        clusters->pImpl->Initialize(positions, part.vertexStride, vertexCount, indices, part.indexCount, ccw, maxVertices, maxTriangles);
+    }
+
+    ComPtr<ID3D11Device> device;
+    deviceContext->GetDevice(&device);
+
+    clusters->pImpl->CreateIndexBuffer(device.Get());
+
+    return clusters;
+}
+
+
+const std::vector<MeshCluster>& MeshClusters::GetClusters() const
+{
+    return pImpl->mClusters;
+}
+
+
+const std::vector<uint32_t>& MeshClusters::GetIndices() const
+{
+    return pImpl->mIndices;
+}
+
+
+_Use_decl_annotations_
+void MeshClusters::CreateIndexBuffer(ID3D11Device* device)
+{
+    pImpl->CreateIndexBuffer(device);
+}
+
+
+ID3D11Buffer* MeshClusters::GetIndexBuffer() const
+{
+    return pImpl->mIndexBuffer.Get();
+}
+
+
+DXGI_FORMAT MeshClusters::GetIndexFormat() const
+{
+    return pImpl->mIndexFormat;
+}
+
+
+// Culls clusters, merging consecutive visible clusters into a single range.
+size_t XM_CALLCONV MeshClusters::Cull(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection, std::vector<MeshClusterRange>& ranges) const
+{
+    ranges.clear();
+
+    return pImpl->Cull(world, view, projection, [&](MeshCluster const& cluster)
+    {
+        if (!ranges.empty() && ranges.back().startIndex + ranges.back().indexCount == cluster.startIndex)
+        {
+            ranges.back().indexCount += cluster.indexCount;
+        }
+        else
+        {
+            MeshClusterRange range = { cluster.startIndex, cluster.indexCount };
+            ranges.push_back(range);
+        }
+    });
+}
+
+
+// Culls clusters, gathering the indices of the visible ones into a compacted list.
+size_t XM_CALLCONV MeshClusters::Cull(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection, std::vector<uint32_t>& indices) const
+{
+    indices.clear();
+
+    auto& source = pImpl->mIndices;
+
+    return pImpl->Cull(world, view, projection, [&](MeshCluster const& cluster)
+    {
+        indices.insert(indices.end(), source.cbegin() + cluster.startIndex, source.cbegin() + cluster.startIndex + cluster.indexCount);
+    });
+}
+
+
+_Use_decl_annotations_
+void MeshClusters::Draw(
+    ID3D11DeviceContext* deviceContext,
+    const ModelMeshPart& part,
+    IEffect* ieffect,
+    ID3D11InputLayout* iinputLayout,
+    const std::vector<MeshClusterRange>& ranges,
+    std::function<void()> setCustomState) const
+{
+    if (!pImpl->mIndexBuffer)
+        throw std::exception("MeshClusters::CreateIndexBuffer must be called before drawing");
+
+    if (ranges.empty())
+        return;
+
+    StateFilter::IASetInputLayout(deviceContext, iinputLayout);
+
+    auto vb = part.vertexBuffer.Get();
+    UINT vbStride = part.vertexStride;
+    UINT vbOffset = 0;
+    StateFilter::IASetVertexBuffers(deviceContext, 0, 1, &vb, &vbStride, &vbOffset);
+
+    StateFilter::IASetIndexBuffer(deviceContext, pImpl->mIndexBuffer.Get(), pImpl->mIndexFormat, 0);
+
+    assert(ieffect != nullptr);
+    ieffect->Apply(deviceContext);
+
+    // Hook lets the caller replace our shaders or state settings with whatever else they see fit.
+    if (setCustomState)
+    {
+        setCustomState();
+        StateFilter::Invalidate(deviceContext);
+    }
+
+    // Draw the visible ranges.
+    StateFilter::IASetPrimitiveTopology(deviceContext, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+
+    for (auto it = ranges.cbegin(); it != ranges.cend(); ++it)
+    {
+        deviceContext->DrawIndexed(it->indexCount, it->startIndex, part.vertexOffset);
+    }
+}
@@ -0,0 +1,420 @@
+//--------------------------------------------------------------------------------------
+// File: MeshSimplify.cpp
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#include "pch.h"
+#include "MeshSimplify.h"
+
+#include <tuple>
+#include <unordered_map>
+
+using namespace DirectX;
+
+
+namespace
+{
+    // Relative weights of the attribute penalties against the geometric error.
+    const double NormalWeight = 0.5;
+    const double TextureCoordinateWeight = 1.0;
+
+
+    // Symmetric 4x4 matrix measuring the summed squared distance to a set of planes (Garland & Heckbert).
+    struct Quadric
+    {
+        double a00, a01, a02, a03;
+        double a11, a12, a13;
+        double a22, a23;
+        double a33;
+
+        Quadric() :
+            a00(0), a01(0), a02(0), a03(0),
+            a11(0), a12(0), a13(0),
+            a22(0), a23(0),
+            a33(0)
+        {
+        }
+
+        void AddPlane(double x, double y, double z, double d, double weight)
+        {
+            a00 += weight * x * x;  a01 += weight * x * y;  a02 += weight * x * z;  a03 += weight * x * d;
+            a11 += weight * y * y;  a12 += weight * y * z;  a13 += weight * y * d;
+            a22 += weight * z * z;  a23 += weight * z * d;
+            a33 += weight * d * d;
+        }
+
+        void Add(Quadric const& other)
+        {
+            a00 += other.a00;  a01 += other.a01;  a02 += other.a02;  a03 += other.a03;
+            a11 += other.a11;  a12 += other.a12;  a13 += other.a13;
+            a22 += other.a22;  a23 += other.a23;
+            a33 += other.a33;
+        }
+
+        double Error(double x, double y, double z) const
+        {
+            double result = a00 * x * x + 2 * a01 * x * y + 2 * a02 * x * z + 2 * a03 * x
+                          + a11 * y * y + 2 * a12 * y * z + 2 * a13 * y
+                          + a22 * z * z + 2 * a23 * z
+                          + a33;
+
+            return std::max(result, 0.0);
+        }
+    };
+
+
+    // A candidate collapse of one vertex onto another.
+    struct Collapse
+    {
+        double cost;
+        uint32_t from;
+        uint32_t to;
+
+        bool operator< (Collapse const& other) const { return cost < other.cost; }
+    };
+
+
+    inline uint64_t EdgeKey(uint32_t a, uint32_t b)
+    {
+        return (a < b) ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+    }
+
+
+    // Builds the list of triangles using each vertex.
+    void BuildAdjacency(std::vector<uint32_t> const& indices, size_t vertexCount, std::vector<uint32_t>& offsets, std::vector<uint32_t>& adjacency)
+    {
+        offsets.assign(vertexCount + 1, 0);
+
+        for (auto it = indices.cbegin(); it != indices.cend(); ++it)
+        {
+            offsets[*it + 1]++;
+        }
+
+        for (size_t i = 0; i < vertexCount; i++)
+        {
+            offsets[i + 1] += offsets[i];
+        }
+
+        adjacency.resize(indices.size());
+
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+
+        for (size_t i = 0; i < indices.size(); i++)
+        {
+            adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+        }
+    }
+}
+
+
+_Use_decl_annotations_
+void DirectX::SimplifyMesh(
+    const XMFLOAT3* positions,
+    const XMFLOAT3* normals,
+    const XMFLOAT2* textureCoordinates,
+    size_t vertexCount,
+    const uint32_t* indices,
+    size_t indexCount,
+    size_t targetIndexCount,
+    std::vector<uint32_t>& result)
+{
+    if ((indexCount % 3) != 0)
+        throw std::exception("Expected triangular faces");
+
+    if (vertexCount >= UINT32_MAX)
+        throw std::exception("Too many vertices");
+
+    result.assign(indices, indices + indexCount);
+
+    for (auto it = result.cbegin(); it != result.cend(); ++it)
+    {
+        if (*it >= vertexCount)
+            throw std::out_of_range("Index not in vertices list");
+    }
+
+    if (indexCount <= targetIndexCount)
+        return;
+
+    // Work in a unit-sized space, so the attribute penalties are independent of the model scale.
+    BoundingBox bounds;
+    BoundingBox::CreateFromPoints(bounds, vertexCount, positions, sizeof(XMFLOAT3));
+
+    double scale = std::max(std::max(bounds.Extents.x, bounds.Extents.y), bounds.Extents.z);
+    scale = (scale > 0) ? 1.0 / scale : 1.0;
+
+    auto position = [&](uint32_t index, double* p)
+    {
+        p[0] = positions[index].x * scale;
+        p[1] = positions[index].y * scale;
+        p[2] = positions[index].z * scale;
+    };
+
+    // Vertices on mesh borders, non-manifold edges, and attribute seams can't move.
+    std::vector<bool> locked(vertexCount, false);
+
+    {
+        std::unordered_map<uint64_t, uint32_t> edgeUse;
+        edgeUse.reserve(indexCount);
+
+        for (size_t i = 0; i < indexCount; i += 3)
+        {
+            for (size_t j = 0; j < 3; j++)
+            {
+                edgeUse[EdgeKey(result[i + j], result[i + (j + 1) % 3])]++;
+            }
+        }
+
+        for (auto it = edgeUse.cbegin(); it != edgeUse.cend(); ++it)
+        {
+            if (it->second != 2)
+            {
+                locked[uint32_t(it->first >> 32)] = true;
+                locked[uint32_t(it->first & 0xFFFFFFFF)] = true;
+            }
+        }
+
+        // Seams are where vertices were split to give the same position different attributes.
+        std::map<std::tuple<float, float, float>, uint32_t> firstAtPosition;
+
+        for (uint32_t i = 0; i < vertexCount; i++)
+        {
+            auto key = std::make_tuple(positions[i].x, positions[i].y, positions[i].z);
+            auto insert = firstAtPosition.insert(std::make_pair(key, i));
+
+            if (!insert.second)
+            {
+                locked[i] = true;
+                locked[insert.first->second] = true;
+            }
+        }
+    }
+
+    // Accumulate the area-weighted plane of each triangle into its vertices.
+    std::vector<Quadric> quadrics(vertexCount);
+    std::vector<double> areas(vertexCount, 0.0);
+
+    for (size_t i = 0; i < indexCount; i += 3)
+    {
+        double p0[3], p1[3], p2[3];
+        position(result[i], p0);
+        position(result[i + 1], p1);
+        position(result[i + 2], p2);
+
+        double e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+        double e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+
+        double n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+        double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+        if (length <= 0)
+            continue;
+
+        n[0] /= length;
+        n[1] /= length;
+        n[2] /= length;
+
+        double d = -(n[0] * p0[0] + n[1] * p0[1] + n[2] * p0[2]);
+        double area = length * 0.5;
+
+        for (size_t j = 0; j < 3; j++)
+        {
+            quadrics[result[i + j]].AddPlane(n[0], n[1], n[2], d, area);
+            areas[result[i + j]] += area / 3;
+        }
+    }
+
+    // Penalty for drawing the triangles around one vertex with the attributes of another.
+    auto attributeCost = [&](uint32_t from, uint32_t to) -> double
+    {
+        double cost = 0;
+
+        if (normals)
+        {
+            double dx = normals[from].x - normals[to].x;
+            double dy = normals[from].y - normals[to].y;
+            double dz = normals[from].z - normals[to].z;
+            cost += NormalWeight * (dx * dx + dy * dy + dz * dz);
+        }
+
+        if (textureCoordinates)
+        {
+            double du = textureCoordinates[from].x - textureCoordinates[to].x;
+            double dv = textureCoordinates[from].y - textureCoordinates[to].y;
+            cost += TextureCoordinateWeight * (du * du + dv * dv);
+        }
+
+        return cost * areas[from];
+    };
+
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> adjacency;
+    std::vector<Collapse> collapses;
+    std::vector<bool> touched;
+    std::vector<uint32_t> ring;
+
+    // Each pass collapses a batch of the cheapest independent edges.
+    while (result.size() > targetIndexCount)
+    {
+        BuildAdjacency(result, vertexCount, offsets, adjacency);
+
+        collapses.clear();
+
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            for (size_t j = 0; j < 3; j++)
+            {
+                uint32_t from = result[i + j];
+                uint32_t to = result[i + (j + 1) % 3];
+
+                // The other direction is added by the triangle on the opposite side of the edge.
+                if (locked[from])
+                    continue;
+
+                double p[3];
+                position(to, p);
+
+                Quadric q = quadrics[from];
+                q.Add(quadrics[to]);
+
+                Collapse collapse = { q.Error(p[0], p[1], p[2]) + attributeCost(from, to), from, to };
+                collapses.push_back(collapse);
+            }
+        }
+
+        std::sort(collapses.begin(), collapses.end());
+
+        // Each collapse removes two triangles.
+        size_t triangleCount = result.size() / 3;
+        size_t needed = (triangleCount - targetIndexCount / 3) / 2 + 1;
+        size_t applied = 0;
+
+        touched.assign(vertexCount, false);
+
+        for (auto it = collapses.cbegin(); it != collapses.cend() && applied < needed; ++it)
+        {
+            uint32_t from = it->from;
+            uint32_t to = it->to;
+
+            // Vertices next to an earlier collapse in this pass have stale adjacency.
+            if (touched[from] || touched[to])
+                continue;
+
+            // Gather the neighbors of the vertex being removed.
+            ring.clear();
+
+            for (uint32_t a = offsets[from]; a < offsets[from + 1]; a++)
+            {
+                for (size_t j = 0; j < 3; j++)
+                {
+                    uint32_t index = result[adjacency[a] * 3 + j];
+
+                    if (index != from && std::find(ring.cbegin(), ring.cend(), index) == ring.cend())
+                        ring.push_back(index);
+                }
+            }
+
+            // The endpoints must share exactly two neighbors, or the collapse would pinch the surface.
+            size_t shared = 0;
+
+            for (auto rit = ring.cbegin(); rit != ring.cend(); ++rit)
+            {
+                if (*rit == to)
+                    continue;
+
+                for (uint32_t a = offsets[to]; a < offsets[to + 1]; a++)
+                {
+                    auto t = &result[adjacency[a] * 3];
+
+                    if (t[0] == *rit || t[1] == *rit || t[2] == *rit)
+                    {
+                        shared++;
+                        break;
+                    }
+                }
+            }
+
+            if (shared != 2)
+                continue;
+
+            // Reject collapses that would flip a remaining triangle over.
+            bool flipped = false;
+
+            for (uint32_t a = offsets[from]; a < offsets[from + 1] && !flipped; a++)
+            {
+                auto t = &result[adjacency[a] * 3];
+
+                if (t[0] == to || t[1] == to || t[2] == to)
+                    continue;
+
+                XMVECTOR p0 = XMLoadFloat3(&positions[t[0]]);
+                XMVECTOR p1 = XMLoadFloat3(&positions[t[1]]);
+                XMVECTOR p2 = XMLoadFloat3(&positions[t[2]]);
+
+                XMVECTOR before = XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0));
+
+                XMVECTOR target = XMLoadFloat3(&positions[to]);
+                if (t[0] == from) p0 = target;
+                if (t[1] == from) p1 = target;
+                if (t[2] == from) p2 = target;
+
+                XMVECTOR after = XMVector3Cross(XMVectorSubtract(p1, p0), XMVectorSubtract(p2, p0));
+
+                flipped = XMVector3LessOrEqual(XMVector3Dot(before, after), XMVectorZero());
+            }
+
+            if (flipped)
+                continue;
+
+            // Move the triangles over to the target vertex; the two sharing the edge become degenerate.
+            for (uint32_t a = offsets[from]; a < offsets[from + 1]; a++)
+            {
+                auto t = &result[adjacency[a] * 3];
+
+                for (size_t j = 0; j < 3; j++)
+                {
+                    if (t[j] == from)
+                        t[j] = to;
+                }
+            }
+
+            quadrics[to].Add(quadrics[from]);
+            areas[to] += areas[from];
+
+            touched[from] = true;
+            touched[to] = true;
+
+            for (auto rit = ring.cbegin(); rit != ring.cend(); ++rit)
+            {
+                touched[*rit] = true;
+            }
+
+            applied++;
+        }
+
+        // Remove the degenerate triangles.
+        size_t count = 0;
+
+        for (size_t i = 0; i < result.size(); i += 3)
+        {
+            uint32_t i0 = result[i];
+            uint32_t i1 = result[i + 1];
+            uint32_t i2 = result[i + 2];
+
+            if (i0 == i1 || i1 == i2 || i2 == i0)
+                continue;
+
+            result[count++] = i0;
+            result[count++] = i1;
+            result[count++] = i2;
+        }
+
+        result.resize(count);
+
+        if (!applied)
+            break;
+    }
+}
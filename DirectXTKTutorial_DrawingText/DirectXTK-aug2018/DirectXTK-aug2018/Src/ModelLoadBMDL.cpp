@@ -0,0 +1,659 @@
+//--------------------------------------------------------------------------------------
+// File: ModelLoadBMDL.cpp
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#include "pch.h"
+#include "Model.h"
+
+#include "Effects.h"
+
+#include "DirectXHelpers.h"
+#include "PlatformHelpers.h"
+#include "BinaryReader.h"
+#include "ModelHelpers.h"
+
+#include "BMDL.h"
+
+using namespace DirectX;
+using Microsoft::WRL::ComPtr;
+
+namespace
+{
+    const char c_Magic[8] = { 'D', 'X', 'T', 'K', 'B', 'M', 'D', 'L' };
+
+    template<typename T>
+    const T* GetTable(const uint8_t* data, size_t dataSize, BMDL::Table const& table)
+    {
+        if (!table.Count)
+            return nullptr;
+
+        if (dataSize < table.Offset
+            || (dataSize < table.Offset + uint64_t(table.Count) * sizeof(T)))
+            throw std::exception("End of file");
+
+        return reinterpret_cast<const T*>(data + table.Offset);
+    }
+
+
+    const wchar_t* GetString(const uint8_t* data, size_t dataSize, uint32_t offset)
+    {
+        if (!offset)
+            return nullptr;
+
+        if (offset >= dataSize || (offset % sizeof(wchar_t)))
+            throw std::exception("Invalid string found");
+
+        auto str = reinterpret_cast<const wchar_t*>(data + offset);
+        size_t maxLength = (dataSize - offset) / sizeof(wchar_t);
+
+        if (wcsnlen(str, maxLength) >= maxLength)
+            throw std::exception("End of file");
+
+        return str;
+    }
+
+
+    //----------------------------------------------------------------------------------
+    // Records the material of every effect created while a model loads, and creates
+    // the effects without their textures, which the converter never needs.
+    class MaterialRecorder : public IEffectFactory
+    {
+    public:
+        struct Material
+        {
+            EffectInfo      info;
+            std::wstring    name;
+            std::wstring    textures[3];
+        };
+
+        explicit MaterialRecorder(_In_ ID3D11Device* device) : mFactory(device)
+        {
+        }
+
+        virtual std::shared_ptr<IEffect> __cdecl CreateEffect(_In_ const EffectInfo& info, _In_opt_ ID3D11DeviceContext* deviceContext) override
+        {
+            UNREFERENCED_PARAMETER(deviceContext);
+
+            Material material;
+            material.info = info;
+            material.info.name = nullptr;
+            material.info.diffuseTexture = nullptr;
+            material.info.specularTexture = nullptr;
+            material.info.normalTexture = nullptr;
+
+            auto effect = mFactory.CreateEffect(material.info, nullptr);
+
+            if (info.name)
+                material.name = info.name;
+            if (info.diffuseTexture)
+                material.textures[0] = info.diffuseTexture;
+            if (info.specularTexture)
+                material.textures[1] = info.specularTexture;
+            if (info.normalTexture)
+                material.textures[2] = info.normalTexture;
+
+            mMaterials.insert(std::make_pair(effect.get(), material));
+
+            return effect;
+        }
+
+        virtual void __cdecl CreateTexture(_In_z_ const wchar_t* name, _In_opt_ ID3D11DeviceContext* deviceContext, _Outptr_ ID3D11ShaderResourceView** textureView) override
+        {
+            mFactory.CreateTexture(name, deviceContext, textureView);
+        }
+
+        const Material* Find(_In_ IEffect* effect) const
+        {
+            auto it = mMaterials.find(effect);
+            return (it != mMaterials.end()) ? &it->second : nullptr;
+        }
+
+    private:
+        EffectFactory mFactory;
+        std::map<IEffect*, Material> mMaterials;
+    };
+
+
+    //----------------------------------------------------------------------------------
+    // Accumulates the file, keeping every table and buffer aligned.
+    class Writer
+    {
+    public:
+        std::vector<uint8_t> data;
+
+        uint32_t Append(_In_reads_bytes_(size) const void* ptr, size_t size)
+        {
+            data.resize((data.size() + BMDL::ALIGNMENT - 1) & ~size_t(BMDL::ALIGNMENT - 1));
+
+            if (data.size() + size > UINT32_MAX)
+                throw std::exception("BMDL file too large");
+
+            auto offset = static_cast<uint32_t>(data.size());
+            auto bytes = static_cast<const uint8_t*>(ptr);
+            data.insert(data.end(), bytes, bytes + size);
+
+            return offset;
+        }
+
+        template<typename T>
+        BMDL::Table AppendTable(std::vector<T> const& items)
+        {
+            BMDL::Table table = {};
+            table.Count = static_cast<uint32_t>(items.size());
+
+            if (table.Count)
+            {
+                table.Offset = Append(items.data(), items.size() * sizeof(T));
+            }
+
+            return table;
+        }
+    };
+
+
+    // Builds the string section, which follows the header so string offsets are known as soon as they are added.
+    class StringTable
+    {
+    public:
+        std::vector<wchar_t> chars;
+
+        uint32_t Add(std::wstring const& str)
+        {
+            if (str.empty())
+                return 0;
+
+            auto it = mOffsets.find(str);
+            if (it != mOffsets.end())
+                return it->second;
+
+            auto offset = static_cast<uint32_t>(sizeof(BMDL::Header) + chars.size() * sizeof(wchar_t));
+            chars.insert(chars.end(), str.c_str(), str.c_str() + str.size() + 1);
+
+            mOffsets.insert(std::make_pair(str, offset));
+
+            return offset;
+        }
+
+    private:
+        std::map<std::wstring, uint32_t> mOffsets;
+    };
+
+
+    uint32_t FindSemantic(_In_z_ const char* name)
+    {
+        for (uint32_t i = 0; i < _countof(BMDL::SEMANTIC_NAMES); ++i)
+        {
+            if (!_stricmp(name, BMDL::SEMANTIC_NAMES[i]))
+                return i;
+        }
+
+        DebugTrace("ERROR: ConvertToBMDL found unsupported vertex semantic '%s'\n", name);
+        throw std::exception("Unsupported vertex semantic");
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+_Use_decl_annotations_
+std::unique_ptr<Model> DirectX::Model::CreateFromBMDL(ID3D11Device* d3dDevice, const uint8_t* meshData, size_t dataSize, IEffectFactory& fxFactory)
+{
+    if (!d3dDevice || !meshData)
+        throw std::exception("Device and meshData cannot be null");
+
+    // File Header
+    if (dataSize < sizeof(BMDL::Header))
+        throw std::exception("End of file");
+    auto header = reinterpret_cast<const BMDL::Header*>(meshData);
+
+    if (memcmp(header->Magic, c_Magic, sizeof(c_Magic)) != 0)
+        throw std::exception("Not a BMDL file");
+
+    if (header->Version != BMDL::FILE_VERSION)
+        throw std::exception("Not a supported BMDL version");
+
+    if (dataSize < header->FileSize)
+        throw std::exception("End of file");
+
+    auto elementArray = GetTable<BMDL::InputElement>(meshData, dataSize, header->InputElements);
+    auto declArray = GetTable<BMDL::VertexDecl>(meshData, dataSize, header->VertexDecls);
+    auto materialArray = GetTable<BMDL::Material>(meshData, dataSize, header->Materials);
+    auto meshArray = GetTable<BMDL::Mesh>(meshData, dataSize, header->Meshes);
+    auto partArray = GetTable<BMDL::Part>(meshData, dataSize, header->Parts);
+    auto bufferArray = GetTable<BMDL::Buffer>(meshData, dataSize, header->Buffers);
+
+    // Vertex declarations
+    std::vector<std::shared_ptr<std::vector<D3D11_INPUT_ELEMENT_DESC>>> vbDecls;
+    vbDecls.reserve(header->VertexDecls.Count);
+
+    for (UINT j = 0; j < header->VertexDecls.Count; ++j)
+    {
+        auto& decl = declArray[j];
+
+        if (uint64_t(decl.FirstElement) + decl.ElementCount > header->InputElements.Count)
+            throw std::exception("Invalid vertex declaration found");
+
+        auto vbDecl = std::make_shared<std::vector<D3D11_INPUT_ELEMENT_DESC>>(decl.ElementCount);
+
+        for (UINT k = 0; k < decl.ElementCount; ++k)
+        {
+            auto& element = elementArray[decl.FirstElement + k];
+
+            if (element.Semantic >= _countof(BMDL::SEMANTIC_NAMES))
+                throw std::exception("Invalid vertex declaration found");
+
+            auto& desc = (*vbDecl)[k];
+            desc.SemanticName = BMDL::SEMANTIC_NAMES[element.Semantic];
+            desc.SemanticIndex = element.SemanticIndex;
+            desc.Format = static_cast<DXGI_FORMAT>(element.Format);
+            desc.InputSlot = element.InputSlot;
+            desc.AlignedByteOffset = element.AlignedByteOffset;
+            desc.InputSlotClass = static_cast<D3D11_INPUT_CLASSIFICATION>(element.InputSlotClass);
+            desc.InstanceDataStepRate = element.InstanceDataStepRate;
+        }
+
+        vbDecls.emplace_back(vbDecl);
+    }
+
+    // Buffers
+    std::vector<ComPtr<ID3D11Buffer>> buffers(header->Buffers.Count);
+
+    for (UINT j = 0; j < header->Buffers.Count; ++j)
+    {
+        auto& bh = bufferArray[j];
+
+        if (!bh.Size
+            || (bh.BindFlags != D3D11_BIND_VERTEX_BUFFER && bh.BindFlags != D3D11_BIND_INDEX_BUFFER))
+            throw std::exception("Invalid buffer found");
+
+        if (bh.Size > uint64_t(D3D11_REQ_RESOURCE_SIZE_IN_MEGABYTES_EXPRESSION_A_TERM * 1024u * 1024u))
+            throw std::exception("Buffer too large for DirectX 11");
+
+        if (dataSize < bh.Offset
+            || (dataSize < bh.Offset + uint64_t(bh.Size)))
+            throw std::exception("End of file");
+
+        D3D11_BUFFER_DESC desc = {};
+        desc.Usage = D3D11_USAGE_DEFAULT;
+        desc.ByteWidth = bh.Size;
+        desc.BindFlags = bh.BindFlags;
+
+        D3D11_SUBRESOURCE_DATA initData = {};
+        initData.pSysMem = meshData + bh.Offset;
+
+        ThrowIfFailed(
+            d3dDevice->CreateBuffer(&desc, &initData, buffers[j].GetAddressOf())
+        );
+
+        SetDebugObjectName(buffers[j].Get(), "ModelBMDL");
+    }
+
+    // Materials
+    std::vector<std::shared_ptr<IEffect>> effects(header->Materials.Count);
+
+    for (UINT j = 0; j < header->Materials.Count; ++j)
+    {
+        auto& mh = materialArray[j];
+
+        EffectFactory::EffectInfo info;
+        info.name = GetString(meshData, dataSize, mh.Name);
+        info.perVertexColor = (mh.Flags & BMDL::MATERIAL_PER_VERTEX_COLOR) != 0;
+        info.enableSkinning = (mh.Flags & BMDL::MATERIAL_SKINNING) != 0;
+        info.enableDualTexture = (mh.Flags & BMDL::MATERIAL_DUAL_TEXTURE) != 0;
+        info.enableNormalMaps = (mh.Flags & BMDL::MATERIAL_NORMAL_MAPS) != 0;
+        info.biasedVertexNormals = (mh.Flags & BMDL::MATERIAL_BIASED_VERTEX_NORMALS) != 0;
+        info.specularPower = mh.SpecularPower;
+        info.alpha = mh.Alpha;
+        info.ambientColor = mh.AmbientColor;
+        info.diffuseColor = mh.DiffuseColor;
+        info.specularColor = mh.SpecularColor;
+        info.emissiveColor = mh.EmissiveColor;
+        info.diffuseTexture = GetString(meshData, dataSize, mh.Textures[0]);
+        info.specularTexture = GetString(meshData, dataSize, mh.Textures[1]);
+        info.normalTexture = GetString(meshData, dataSize, mh.Textures[2]);
+
+        effects[j] = fxFactory.CreateEffect(info, nullptr);
+    }
+
+    // Meshes
+    std::unique_ptr<Model> model(new Model());
+
+    model->meshes.reserve(header->Meshes.Count);
+
+    for (UINT meshIndex = 0; meshIndex < header->Meshes.Count; ++meshIndex)
+    {
+        auto& mh = meshArray[meshIndex];
+
+        if (uint64_t(mh.FirstPart) + mh.PartCount > header->Parts.Count)
+            throw std::exception("Invalid mesh found");
+
+        auto mesh = std::make_shared<ModelMesh>();
+
+        auto name = GetString(meshData, dataSize, mh.Name);
+        if (name)
+            mesh->name = name;
+
+        mesh->ccw = (mh.Flags & BMDL::MESH_CCW) != 0;
+        mesh->pmalpha = (mh.Flags & BMDL::MESH_PMALPHA) != 0;
+
+        // Extents
+        mesh->boundingSphere.Center = mh.SphereCenter;
+        mesh->boundingSphere.Radius = mh.SphereRadius;
+        mesh->boundingBox.Center = mh.BoxCenter;
+        mesh->boundingBox.Extents = mh.BoxExtents;
+
+        mesh->meshParts.reserve(mh.PartCount);
+
+        for (UINT j = 0; j < mh.PartCount; ++j)
+        {
+            auto& ph = partArray[mh.FirstPart + j];
+
+            if (ph.Material >= header->Materials.Count
+                || ph.VertexDecl >= header->VertexDecls.Count
+                || ph.VertexBuffer >= header->Buffers.Count
+                || ph.IndexBuffer >= header->Buffers.Count
+                || bufferArray[ph.VertexBuffer].BindFlags != D3D11_BIND_VERTEX_BUFFER
+                || bufferArray[ph.IndexBuffer].BindFlags != D3D11_BIND_INDEX_BUFFER
+                || (ph.IndexFormat != DXGI_FORMAT_R16_UINT && ph.IndexFormat != DXGI_FORMAT_R32_UINT))
+                throw std::exception("Invalid mesh part found");
+
+            auto part = new ModelMeshPart();
+            mesh->meshParts.emplace_back(part);
+
+            part->isAlpha = (ph.Flags & BMDL::PART_ALPHA) != 0;
+
+            part->indexCount = ph.IndexCount;
+            part->startIndex = ph.StartIndex;
+            part->vertexOffset = ph.VertexOffset;
+            part->vertexStride = ph.VertexStride;
+            part->indexFormat = static_cast<DXGI_FORMAT>(ph.IndexFormat);
+            part->primitiveType = static_cast<D3D_PRIMITIVE_TOPOLOGY>(ph.PrimitiveType);
+            part->indexBuffer = buffers[ph.IndexBuffer];
+            part->vertexBuffer = buffers[ph.VertexBuffer];
+            part->effect = effects[ph.Material];
+            part->vbDecl = vbDecls[ph.VertexDecl];
+
+            part->CreateInputLayout(d3dDevice, part->effect.get(), part->inputLayout.GetAddressOf());
+        }
+
+        model->meshes.emplace_back(mesh);
+    }
+
+    return model;
+}
+
+
+//--------------------------------------------------------------------------------------
+_Use_decl_annotations_
+std::unique_ptr<Model> DirectX::Model::CreateFromBMDL(ID3D11Device* d3dDevice, const wchar_t* szFileName, IEffectFactory& fxFactory)
+{
+    size_t dataSize = 0;
+    ScopedMappedView data;
+    HRESULT hr = BinaryReader::MapEntireFile(szFileName, data, &dataSize);
+    if (FAILED(hr))
+    {
+        DebugTrace("ERROR: CreateFromBMDL failed (%08X) loading '%ls'\n", hr, szFileName);
+        throw std::exception("CreateFromBMDL");
+    }
+
+    auto model = CreateFromBMDL(d3dDevice, data.get(), dataSize, fxFactory);
+
+    model->name = szFileName;
+
+    return model;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Converter
+//--------------------------------------------------------------------------------------
+
+_Use_decl_annotations_
+void DirectX::Model::ConvertToBMDL(ID3D11DeviceContext* deviceContext, const wchar_t* szSourceFile, std::vector<uint8_t>& bmdlData)
+{
+    if (!deviceContext || !szSourceFile)
+        throw std::exception("Device context and file name cannot be null");
+
+    ComPtr<ID3D11Device> device;
+    deviceContext->GetDevice(&device);
+
+    MaterialRecorder recorder(device.Get());
+
+    wchar_t ext[_MAX_EXT];
+    _wsplitpath_s(szSourceFile, nullptr, 0, nullptr, 0, nullptr, 0, ext, _MAX_EXT);
+
+    std::unique_ptr<Model> model;
+
+    if (_wcsicmp(ext, L".cmo") == 0)
+    {
+        model = CreateFromCMO(device.Get(), szSourceFile, recorder);
+    }
+    else if (_wcsicmp(ext, L".sdkmesh") == 0)
+    {
+        model = CreateFromSDKMESH(device.Get(), szSourceFile, recorder);
+    }
+    else if (_wcsicmp(ext, L".vbo") == 0)
+    {
+        model = CreateFromVBO(device.Get(), szSourceFile);
+    }
+    else
+    {
+        DebugTrace("ERROR: ConvertToBMDL does not support the file type of '%ls'\n", szSourceFile);
+        throw std::exception("ConvertToBMDL");
+    }
+
+    StringTable strings;
+
+    std::vector<BMDL::InputElement> elements;
+    std::vector<BMDL::VertexDecl> decls;
+    std::vector<BMDL::Material> materials;
+    std::vector<BMDL::Mesh> meshes;
+    std::vector<BMDL::Part> parts;
+    std::vector<BMDL::Buffer> buffers;
+    std::vector<std::vector<uint8_t>> bufferContents;
+
+    std::map<std::vector<D3D11_INPUT_ELEMENT_DESC>*, uint32_t> declIndices;
+    std::map<IEffect*, uint32_t> materialIndices;
+    std::map<ID3D11Buffer*, uint32_t> bufferIndices;
+
+    auto addBuffer = [&](ID3D11Buffer* buffer, UINT bindFlags) -> uint32_t
+    {
+        auto it = bufferIndices.find(buffer);
+        if (it != bufferIndices.end())
+            return it->second;
+
+        bufferContents.emplace_back();
+        ModelHelpers::ReadBackBuffer(deviceContext, buffer, bufferContents.back());
+
+        BMDL::Buffer bh = {};
+        bh.BindFlags = bindFlags;
+        buffers.push_back(bh);
+
+        auto index = static_cast<uint32_t>(buffers.size() - 1);
+        bufferIndices.insert(std::make_pair(buffer, index));
+
+        return index;
+    };
+
+    auto addMaterial = [&](IEffect* effect) -> uint32_t
+    {
+        auto it = materialIndices.find(effect);
+        if (it != materialIndices.end())
+            return it->second;
+
+        BMDL::Material mh = {};
+
+        auto material = recorder.Find(effect);
+        if (material)
+        {
+            auto& info = material->info;
+
+            mh.Name = strings.Add(material->name);
+            mh.Flags = (info.perVertexColor ? BMDL::MATERIAL_PER_VERTEX_COLOR : 0)
+                | (info.enableSkinning ? BMDL::MATERIAL_SKINNING : 0)
+                | (info.enableDualTexture ? BMDL::MATERIAL_DUAL_TEXTURE : 0)
+                | (info.enableNormalMaps ? BMDL::MATERIAL_NORMAL_MAPS : 0)
+                | (info.biasedVertexNormals ? BMDL::MATERIAL_BIASED_VERTEX_NORMALS : 0);
+            mh.SpecularPower = info.specularPower;
+            mh.Alpha = info.alpha;
+            mh.AmbientColor = info.ambientColor;
+            mh.DiffuseColor = info.diffuseColor;
+            mh.SpecularColor = info.specularColor;
+            mh.EmissiveColor = info.emissiveColor;
+
+            for (size_t k = 0; k < 3; ++k)
+            {
+                mh.Textures[k] = strings.Add(material->textures[k]);
+                mh.TextureHashes[k] = material->textures[k].empty() ? 0 : BMDL::HashTextureName(material->textures[k].c_str());
+            }
+        }
+        else
+        {
+            // Effects the loader made itself (.VBO) use BasicEffect defaults.
+            mh.SpecularPower = 16.f;
+            mh.Alpha = 1.f;
+            mh.DiffuseColor = XMFLOAT3(1.f, 1.f, 1.f);
+            mh.SpecularColor = XMFLOAT3(1.f, 1.f, 1.f);
+        }
+
+        materials.push_back(mh);
+
+        auto index = static_cast<uint32_t>(materials.size() - 1);
+        materialIndices.insert(std::make_pair(effect, index));
+
+        return index;
+    };
+
+    auto addDecl = [&](std::shared_ptr<std::vector<D3D11_INPUT_ELEMENT_DESC>> const& vbDecl) -> uint32_t
+    {
+        auto it = declIndices.find(vbDecl.get());
+        if (it != declIndices.end())
+            return it->second;
+
+        BMDL::VertexDecl decl = {};
+        decl.FirstElement = static_cast<uint32_t>(elements.size());
+        decl.ElementCount = static_cast<uint32_t>(vbDecl->size());
+
+        for (auto eit = vbDecl->cbegin(); eit != vbDecl->cend(); ++eit)
+        {
+            BMDL::InputElement element = {};
+            element.Semantic = FindSemantic(eit->SemanticName);
+            element.SemanticIndex = eit->SemanticIndex;
+            element.Format = static_cast<uint32_t>(eit->Format);
+            element.InputSlot = eit->InputSlot;
+            element.AlignedByteOffset = eit->AlignedByteOffset;
+            element.InputSlotClass = static_cast<uint32_t>(eit->InputSlotClass);
+            element.InstanceDataStepRate = eit->InstanceDataStepRate;
+            elements.push_back(element);
+        }
+
+        decls.push_back(decl);
+
+        auto index = static_cast<uint32_t>(decls.size() - 1);
+        declIndices.insert(std::make_pair(vbDecl.get(), index));
+
+        return index;
+    };
+
+    for (auto mit = model->meshes.cbegin(); mit != model->meshes.cend(); ++mit)
+    {
+        auto mesh = mit->get();
+        assert(mesh != nullptr);
+
+        BMDL::Mesh mh = {};
+        mh.Name = strings.Add(mesh->name);
+        mh.Flags = (mesh->ccw ? BMDL::MESH_CCW : 0) | (mesh->pmalpha ? BMDL::MESH_PMALPHA : 0);
+        mh.FirstPart = static_cast<uint32_t>(parts.size());
+        mh.SphereCenter = mesh->boundingSphere.Center;
+        mh.SphereRadius = mesh->boundingSphere.Radius;
+        mh.BoxCenter = mesh->boundingBox.Center;
+        mh.BoxExtents = mesh->boundingBox.Extents;
+
+        for (auto it = mesh->meshParts.cbegin(); it != mesh->meshParts.cend(); ++it)
+        {
+            auto part = it->get();
+            assert(part != nullptr);
+
+            if (!part->vbDecl || !part->vertexBuffer || !part->indexBuffer || !part->effect)
+                throw std::exception("Model mesh part cannot be converted");
+
+            BMDL::Part ph = {};
+            ph.Material = addMaterial(part->effect.get());
+            ph.VertexDecl = addDecl(part->vbDecl);
+            ph.VertexBuffer = addBuffer(part->vertexBuffer.Get(), D3D11_BIND_VERTEX_BUFFER);
+            ph.IndexBuffer = addBuffer(part->indexBuffer.Get(), D3D11_BIND_INDEX_BUFFER);
+            ph.IndexCount = part->indexCount;
+            ph.StartIndex = part->startIndex;
+            ph.VertexOffset = part->vertexOffset;
+            ph.VertexStride = part->vertexStride;
+            ph.PrimitiveType = static_cast<uint32_t>(part->primitiveType);
+            ph.IndexFormat = static_cast<uint32_t>(part->indexFormat);
+            ph.Flags = part->isAlpha ? BMDL::PART_ALPHA : 0;
+            parts.push_back(ph);
+        }
+
+        mh.PartCount = static_cast<uint32_t>(parts.size()) - mh.FirstPart;
+        meshes.push_back(mh);
+    }
+
+    // Header, strings, tables, then the buffer contents.
+    Writer writer;
+
+    BMDL::Header header = {};
+    writer.Append(&header, sizeof(header));
+    writer.data.insert(writer.data.end(),
+                       reinterpret_cast<const uint8_t*>(strings.chars.data()),
+                       reinterpret_cast<const uint8_t*>(strings.chars.data() + strings.chars.size()));
+
+    memcpy(header.Magic, c_Magic, sizeof(c_Magic));
+    header.Version = BMDL::FILE_VERSION;
+    header.InputElements = writer.AppendTable(elements);
+    header.VertexDecls = writer.AppendTable(decls);
+    header.Materials = writer.AppendTable(materials);
+    header.Meshes = writer.AppendTable(meshes);
+    header.Parts = writer.AppendTable(parts);
+
+    for (size_t j = 0; j < buffers.size(); ++j)
+    {
+        buffers[j].Offset = writer.Append(bufferContents[j].data(), bufferContents[j].size());
+        buffers[j].Size = static_cast<uint32_t>(bufferContents[j].size());
+    }
+
+    header.Buffers = writer.AppendTable(buffers);
+    header.FileSize = static_cast<uint32_t>(writer.data.size());
+
+    memcpy(writer.data.data(), &header, sizeof(header));
+
+    bmdlData.swap(writer.data);
+}
+
+
+_Use_decl_annotations_
+void DirectX::Model::ConvertToBMDL(ID3D11DeviceContext* deviceContext, const wchar_t* szSourceFile, const wchar_t* szBMDLFile)
+{
+    if (!szBMDLFile)
+        throw std::exception("File name cannot be null");
+
+    std::vector<uint8_t> data;
+    ConvertToBMDL(deviceContext, szSourceFile, data);
+
+#if (_WIN32_WINNT >= _WIN32_WINNT_WIN8)
+    ScopedHandle hFile(safe_handle(CreateFile2(szBMDLFile, GENERIC_WRITE, 0, CREATE_ALWAYS, nullptr)));
+#else
+    ScopedHandle hFile(safe_handle(CreateFileW(szBMDLFile, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, 0, nullptr)));
+#endif
+
+    DWORD bytesWritten = 0;
+
+    if (!hFile
+        || !WriteFile(hFile.get(), data.data(), static_cast<DWORD>(data.size()), &bytesWritten, nullptr)
+        || bytesWritten != data.size())
+    {
+        DebugTrace("ERROR: ConvertToBMDL failed (%08X) writing '%ls'\n", HRESULT_FROM_WIN32(GetLastError()), szBMDLFile);
+        throw std::exception("ConvertToBMDL");
+    }
+}
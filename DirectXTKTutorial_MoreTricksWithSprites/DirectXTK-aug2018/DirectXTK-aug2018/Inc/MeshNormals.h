@@ -0,0 +1,42 @@
+//--------------------------------------------------------------------------------------
+// File: MeshNormals.h
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <DirectXMath.h>
+
+#include <stdint.h>
+
+
+namespace DirectX
+{
+    // Computes vertex normals as the average of the adjacent face normals, weighted by the angle of each face at
+    // the vertex. Face normals come from the cross product of the first two edges, negated if cw is set.
+    void __cdecl ComputeNormals(_In_reads_(nFaces * 3) const uint16_t* indices, size_t nFaces,
+                                _In_reads_(nVerts) const XMFLOAT3* positions, size_t nVerts,
+                                bool cw, _Out_writes_(nVerts) XMFLOAT3* normals);
+    void __cdecl ComputeNormals(_In_reads_(nFaces * 3) const uint32_t* indices, size_t nFaces,
+                                _In_reads_(nVerts) const XMFLOAT3* positions, size_t nVerts,
+                                bool cw, _Out_writes_(nVerts) XMFLOAT3* normals);
+
+    // Computes a tangent frame per vertex following the MikkTSpace conventions: face tangents are projected onto each
+    // vertex normal and angle-weighted, and w holds the sign of the bitangent (bitangent = cross(normal, tangent) * w).
+    void __cdecl ComputeTangentFrame(_In_reads_(nFaces * 3) const uint16_t* indices, size_t nFaces,
+                                     _In_reads_(nVerts) const XMFLOAT3* positions,
+                                     _In_reads_(nVerts) const XMFLOAT3* normals,
+                                     _In_reads_(nVerts) const XMFLOAT2* textureCoordinates, size_t nVerts,
+                                     _Out_writes_(nVerts) XMFLOAT4* tangents,
+                                     _Out_writes_opt_(nVerts) XMFLOAT3* bitangents = nullptr);
+    void __cdecl ComputeTangentFrame(_In_reads_(nFaces * 3) const uint32_t* indices, size_t nFaces,
+                                     _In_reads_(nVerts) const XMFLOAT3* positions,
+                                     _In_reads_(nVerts) const XMFLOAT3* normals,
+                                     _In_reads_(nVerts) const XMFLOAT2* textureCoordinates, size_t nVerts,
+                                     _Out_writes_(nVerts) XMFLOAT4* tangents,
+                                     _Out_writes_opt_(nVerts) XMFLOAT3* bitangents = nullptr);
+}
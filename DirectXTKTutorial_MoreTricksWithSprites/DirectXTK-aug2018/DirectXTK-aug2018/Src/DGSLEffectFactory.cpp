@@ -11,6 +11,7 @@
 #include "Effects.h"
 #include "DemandCreate.h"
 #include "SharedResourcePool.h"
+#include "FactoryCache.h"
 
 #include "DDSTextureLoader.h"
 #include "WICTextureLoader.h"
@@ -52,9 +53,14 @@ public:
     ComPtr<ID3D11Device> mDevice;
 
 private:
-    typedef std::map< std::wstring, std::shared_ptr<IEffect> > EffectCache;
-    typedef std::map< std::wstring, ComPtr<ID3D11ShaderResourceView> > TextureCache;
-    typedef std::map< std::wstring, ComPtr<ID3D11PixelShader> > ShaderCache;
+    std::shared_ptr<IEffect> CreateNewEffect(_In_ DGSLEffectFactory* factory, _In_ const IEffectFactory::EffectInfo& info, _In_opt_ ID3D11DeviceContext* deviceContext);
+    std::shared_ptr<IEffect> CreateNewDGSLEffect(_In_ DGSLEffectFactory* factory, _In_ const DGSLEffectInfo& info, _In_opt_ ID3D11DeviceContext* deviceContext);
+    void LoadTexture(_In_z_ const wchar_t* texture, _In_opt_ ID3D11DeviceContext* deviceContext, _Outptr_ ID3D11ShaderResourceView** textureView);
+    void LoadPixelShader(_In_z_ const wchar_t* shader, _Outptr_ ID3D11PixelShader** pixelShader);
+
+    typedef FactoryCache< std::shared_ptr<IEffect> > EffectCache;
+    typedef FactoryCache< ComPtr<ID3D11ShaderResourceView> > TextureCache;
+    typedef FactoryCache< ComPtr<ID3D11PixelShader> > ShaderCache;
 
     EffectCache  mEffectCache;
     EffectCache  mEffectCacheSkinning;
@@ -64,6 +70,7 @@ private:
     bool mSharing;
     bool mForceSRGB;
 
+    // Serializes WIC loads that use the device context, which is not thread-safe.
     std::mutex mutex;
 };
 
@@ -80,26 +87,23 @@ std::shared_ptr<IEffect> DGSLEffectFactory::Impl::CreateEffect(DGSLEffectFactory
         throw std::exception("DGSLEffect does not support multiple texcoords");
     }
 
-    if (mSharing && info.name && *info.name)
+    if (!mSharing || !info.name || !*info.name)
     {
-        if (info.enableSkinning)
-        {
-            auto it = mEffectCacheSkinning.find(info.name);
-            if (it != mEffectCacheSkinning.end())
-            {
-                return it->second;
-            }
-        }
-        else
-        {
-            auto it = mEffectCache.find(info.name);
-            if (it != mEffectCache.end())
-            {
-                return it->second;
-            }
-        }
+        return CreateNewEffect(factory, info, deviceContext);
     }
 
+    auto& cache = info.enableSkinning ? mEffectCacheSkinning : mEffectCache;
+
+    return cache.GetOrCreate(info.name, [&]()
+    {
+        return CreateNewEffect(factory, info, deviceContext);
+    });
+}
+
+
+_Use_decl_annotations_
+std::shared_ptr<IEffect> DGSLEffectFactory::Impl::CreateNewEffect(DGSLEffectFactory* factory, const DGSLEffectFactory::EffectInfo& info, ID3D11DeviceContext* deviceContext)
+{
     auto effect = std::make_shared<DGSLEffect>(mDevice.Get(), nullptr, info.enableSkinning);
 
     effect->EnableDefaultLighting();
@@ -141,20 +145,6 @@ std::shared_ptr<IEffect> DGSLEffectFactory::Impl::CreateEffect(DGSLEffectFactory
         effect->SetTextureEnabled(true);
     }
 
-    if (mSharing && info.name && *info.name)
-    {
-        std::lock_guard<std::mutex> lock(mutex);
-        EffectCache::value_type v(info.name, effect);
-        if (info.enableSkinning)
-        {
-            mEffectCacheSkinning.insert(v);
-        }
-        else
-        {
-            mEffectCache.insert(v);
-        }
-    }
-
     return effect;
 }
 
@@ -162,26 +152,23 @@ std::shared_ptr<IEffect> DGSLEffectFactory::Impl::CreateEffect(DGSLEffectFactory
 _Use_decl_annotations_
 std::shared_ptr<IEffect> DGSLEffectFactory::Impl::CreateDGSLEffect(DGSLEffectFactory* factory, const DGSLEffectFactory::DGSLEffectInfo& info, ID3D11DeviceContext* deviceContext)
 {
-    if (mSharing && info.name && *info.name)
+    if (!mSharing || !info.name || !*info.name)
     {
-        if (info.enableSkinning)
-        {
-            auto it = mEffectCacheSkinning.find(info.name);
-            if (it != mEffectCacheSkinning.end())
-            {
-                return it->second;
-            }
-        }
-        else
-        {
-            auto it = mEffectCache.find(info.name);
-            if (it != mEffectCache.end())
-            {
-                return it->second;
-            }
-        }
+        return CreateNewDGSLEffect(factory, info, deviceContext);
     }
 
+    auto& cache = info.enableSkinning ? mEffectCacheSkinning : mEffectCache;
+
+    return cache.GetOrCreate(info.name, [&]()
+    {
+        return CreateNewDGSLEffect(factory, info, deviceContext);
+    });
+}
+
+
+_Use_decl_annotations_
+std::shared_ptr<IEffect> DGSLEffectFactory::Impl::CreateNewDGSLEffect(DGSLEffectFactory* factory, const DGSLEffectFactory::DGSLEffectInfo& info, ID3D11DeviceContext* deviceContext)
+{
     std::shared_ptr<DGSLEffect> effect;
 
     bool lighting = true;
@@ -323,20 +310,6 @@ std::shared_ptr<IEffect> DGSLEffectFactory::Impl::CreateDGSLEffect(DGSLEffectFac
         }
     }
 
-    if (mSharing && info.name && *info.name)
-    {
-        std::lock_guard<std::mutex> lock(mutex);
-        EffectCache::value_type v(info.name, effect);
-        if (info.enableSkinning)
-        {
-            mEffectCacheSkinning.insert(v);
-        }
-        else
-        {
-            mEffectCache.insert(v);
-        }
-    }
-
     return effect;
 }
 
@@ -347,84 +320,86 @@ void DGSLEffectFactory::Impl::CreateTexture(const wchar_t* name, ID3D11DeviceCon
     if (!name || !textureView)
         throw std::exception("invalid arguments");
 
+    if (!mSharing || !*name)
+    {
+        LoadTexture(name, deviceContext, textureView);
+        return;
+    }
+
+    auto result = mTextureCache.GetOrCreate(name, [&]()
+    {
+        ComPtr<ID3D11ShaderResourceView> value;
+        LoadTexture(name, deviceContext, value.GetAddressOf());
+        return value;
+    });
+
+    *textureView = result.Detach();
+}
+
+
+_Use_decl_annotations_
+void DGSLEffectFactory::Impl::LoadTexture(const wchar_t* name, ID3D11DeviceContext* deviceContext, ID3D11ShaderResourceView** textureView)
+{
 #if defined(_XBOX_ONE) && defined(_TITLE)
     UNREFERENCED_PARAMETER(deviceContext);
 #endif
 
-    auto it = mTextureCache.find(name);
+    wchar_t fullName[MAX_PATH] = {};
+    wcscpy_s(fullName, mPath);
+    wcscat_s(fullName, name);
 
-    if (mSharing && it != mTextureCache.end())
-    {
-        ID3D11ShaderResourceView* srv = it->second.Get();
-        srv->AddRef();
-        *textureView = srv;
-    }
-    else
+    WIN32_FILE_ATTRIBUTE_DATA fileAttr = {};
+    if (!GetFileAttributesExW(fullName, GetFileExInfoStandard, &fileAttr))
     {
-        wchar_t fullName[MAX_PATH] = {};
-        wcscpy_s(fullName, mPath);
-        wcscat_s(fullName, name);
-
-        WIN32_FILE_ATTRIBUTE_DATA fileAttr = {};
+        // Try Current Working Directory (CWD)
+        wcscpy_s(fullName, name);
         if (!GetFileAttributesExW(fullName, GetFileExInfoStandard, &fileAttr))
         {
-            // Try Current Working Directory (CWD)
-            wcscpy_s(fullName, name);
-            if (!GetFileAttributesExW(fullName, GetFileExInfoStandard, &fileAttr))
-            {
-                DebugTrace("ERROR: DGSLEffectFactory could not find texture file '%ls'\n", name);
-                throw std::exception("CreateTexture");
-            }
+            DebugTrace("ERROR: DGSLEffectFactory could not find texture file '%ls'\n", name);
+            throw std::exception("CreateTexture");
         }
+    }
 
-        wchar_t ext[_MAX_EXT];
-        _wsplitpath_s(name, nullptr, 0, nullptr, 0, nullptr, 0, ext, _MAX_EXT);
+    wchar_t ext[_MAX_EXT];
+    _wsplitpath_s(name, nullptr, 0, nullptr, 0, nullptr, 0, ext, _MAX_EXT);
 
-        if (_wcsicmp(ext, L".dds") == 0)
-        {
-            HRESULT hr = CreateDDSTextureFromFileEx(
-                mDevice.Get(), fullName, 0,
-                D3D11_USAGE_DEFAULT, D3D11_BIND_SHADER_RESOURCE, 0, 0,
-                mForceSRGB, nullptr, textureView);
-            if (FAILED(hr))
-            {
-                DebugTrace("ERROR: CreateDDSTextureFromFile failed (%08X) for '%ls'\n", hr, fullName);
-                throw std::exception("CreateDDSTextureFromFile");
-            }
-        }
-    #if !defined(_XBOX_ONE) || !defined(_TITLE)
-        else if (deviceContext)
+    if (_wcsicmp(ext, L".dds") == 0)
+    {
+        HRESULT hr = CreateDDSTextureFromFileEx(
+            mDevice.Get(), fullName, 0,
+            D3D11_USAGE_DEFAULT, D3D11_BIND_SHADER_RESOURCE, 0, 0,
+            mForceSRGB, nullptr, textureView);
+        if (FAILED(hr))
         {
-            std::lock_guard<std::mutex> lock(mutex);
-            HRESULT hr = CreateWICTextureFromFileEx(
-                mDevice.Get(), deviceContext, fullName, 0,
-                D3D11_USAGE_DEFAULT, D3D11_BIND_SHADER_RESOURCE, 0, 0,
-                mForceSRGB ? WIC_LOADER_FORCE_SRGB : WIC_LOADER_DEFAULT, nullptr, textureView);
-            if (FAILED(hr))
-            {
-                DebugTrace("ERROR: CreateWICTextureFromFile failed (%08X) for '%ls'\n", hr, fullName);
-                throw std::exception("CreateWICTextureFromFile");
-            }
+            DebugTrace("ERROR: CreateDDSTextureFromFile failed (%08X) for '%ls'\n", hr, fullName);
+            throw std::exception("CreateDDSTextureFromFile");
         }
-    #endif
-        else
+    }
+#if !defined(_XBOX_ONE) || !defined(_TITLE)
+    else if (deviceContext)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        HRESULT hr = CreateWICTextureFromFileEx(
+            mDevice.Get(), deviceContext, fullName, 0,
+            D3D11_USAGE_DEFAULT, D3D11_BIND_SHADER_RESOURCE, 0, 0,
+            mForceSRGB ? WIC_LOADER_FORCE_SRGB : WIC_LOADER_DEFAULT, nullptr, textureView);
+        if (FAILED(hr))
         {
-            HRESULT hr = CreateWICTextureFromFileEx(
-                mDevice.Get(), fullName, 0,
-                D3D11_USAGE_DEFAULT, D3D11_BIND_SHADER_RESOURCE, 0, 0,
-                mForceSRGB ? WIC_LOADER_FORCE_SRGB : WIC_LOADER_DEFAULT, nullptr, textureView);
-            if (FAILED(hr))
-            {
-                DebugTrace("ERROR: CreateWICTextureFromFile failed (%08X) for '%ls'\n", hr, fullName);
-                throw std::exception("CreateWICTextureFromFile");
-            }
+            DebugTrace("ERROR: CreateWICTextureFromFile failed (%08X) for '%ls'\n", hr, fullName);
+            throw std::exception("CreateWICTextureFromFile");
         }
-
-        if (mSharing && *name && it == mTextureCache.end())
+    }
+#endif
+    else
+    {
+        HRESULT hr = CreateWICTextureFromFileEx(
+            mDevice.Get(), fullName, 0,
+            D3D11_USAGE_DEFAULT, D3D11_BIND_SHADER_RESOURCE, 0, 0,
+            mForceSRGB ? WIC_LOADER_FORCE_SRGB : WIC_LOADER_DEFAULT, nullptr, textureView);
+        if (FAILED(hr))
         {
-            std::lock_guard<std::mutex> lock(mutex);
-            TextureCache::value_type v(name, *textureView);
-            mTextureCache.insert(v);
+            DebugTrace("ERROR: CreateWICTextureFromFile failed (%08X) for '%ls'\n", hr, fullName);
+            throw std::exception("CreateWICTextureFromFile");
         }
     }
 }
@@ -436,63 +411,64 @@ void DGSLEffectFactory::Impl::CreatePixelShader(const wchar_t* name, ID3D11Pixel
     if (!name || !pixelShader)
         throw std::exception("invalid arguments");
 
-    auto it = mShaderCache.find(name);
-
-    if (mSharing && it != mShaderCache.end())
+    if (!mSharing || !*name)
     {
-        ID3D11PixelShader* ps = it->second.Get();
-        ps->AddRef();
-        *pixelShader = ps;
+        LoadPixelShader(name, pixelShader);
+        return;
     }
-    else
+
+    auto result = mShaderCache.GetOrCreate(name, [&]()
     {
-        wchar_t fullName[MAX_PATH] = {};
-        wcscpy_s(fullName, mPath);
-        wcscat_s(fullName, name);
+        ComPtr<ID3D11PixelShader> value;
+        LoadPixelShader(name, value.GetAddressOf());
+        return value;
+    });
 
-        WIN32_FILE_ATTRIBUTE_DATA fileAttr = {};
-        if (!GetFileAttributesExW(fullName, GetFileExInfoStandard, &fileAttr))
-        {
-            // Try Current Working Directory (CWD)
-            wcscpy_s(fullName, name);
-            if (!GetFileAttributesExW(fullName, GetFileExInfoStandard, &fileAttr))
-            {
-                DebugTrace("ERROR: DGSLEffectFactory could not find shader file '%ls'\n", name);
-                throw std::exception("CreatePixelShader");
-            }
-        }
+    *pixelShader = result.Detach();
+}
 
-        size_t dataSize = 0;
-        std::unique_ptr<uint8_t[]> data;
-        HRESULT hr = BinaryReader::ReadEntireFile(fullName, data, &dataSize);
-        if (FAILED(hr))
+
+_Use_decl_annotations_
+void DGSLEffectFactory::Impl::LoadPixelShader(const wchar_t* name, ID3D11PixelShader** pixelShader)
+{
+    wchar_t fullName[MAX_PATH] = {};
+    wcscpy_s(fullName, mPath);
+    wcscat_s(fullName, name);
+
+    WIN32_FILE_ATTRIBUTE_DATA fileAttr = {};
+    if (!GetFileAttributesExW(fullName, GetFileExInfoStandard, &fileAttr))
+    {
+        // Try Current Working Directory (CWD)
+        wcscpy_s(fullName, name);
+        if (!GetFileAttributesExW(fullName, GetFileExInfoStandard, &fileAttr))
         {
-            DebugTrace("ERROR: CreatePixelShader failed (%08X) to load shader file '%ls'\n", hr, fullName);
+            DebugTrace("ERROR: DGSLEffectFactory could not find shader file '%ls'\n", name);
             throw std::exception("CreatePixelShader");
         }
+    }
 
-        ThrowIfFailed(
-            mDevice->CreatePixelShader(data.get(), dataSize, nullptr, pixelShader));
+    size_t dataSize = 0;
+    std::unique_ptr<uint8_t[]> data;
+    HRESULT hr = BinaryReader::ReadEntireFile(fullName, data, &dataSize);
+    if (FAILED(hr))
+    {
+        DebugTrace("ERROR: CreatePixelShader failed (%08X) to load shader file '%ls'\n", hr, fullName);
+        throw std::exception("CreatePixelShader");
+    }
 
-        _Analysis_assume_(*pixelShader != 0);
+    ThrowIfFailed(
+        mDevice->CreatePixelShader(data.get(), dataSize, nullptr, pixelShader));
 
-        if (mSharing && *name && it == mShaderCache.end())
-        {
-            std::lock_guard<std::mutex> lock(mutex);
-            ShaderCache::value_type v(name, *pixelShader);
-            mShaderCache.insert(v);
-        }
-    }
+    _Analysis_assume_(*pixelShader != 0);
 }
 
 
 void DGSLEffectFactory::Impl::ReleaseCache()
 {
-    std::lock_guard<std::mutex> lock(mutex);
-    mEffectCache.clear();
-    mEffectCacheSkinning.clear();
-    mTextureCache.clear();
-    mShaderCache.clear();
+    mEffectCache.Clear();
+    mEffectCacheSkinning.Clear();
+    mTextureCache.Clear();
+    mShaderCache.Clear();
 }
 
 
@@ -9,6 +9,7 @@
 
 #pragma once
 
+#include <atomic>
 #include <memory>
 
 #include "Effects.h"
@@ -16,6 +17,7 @@
 #include "ConstantBuffer.h"
 #include "SharedResourcePool.h"
 #include "AlignedNew.h"
+#include "StateFilter.h"
 
 
 // BasicEffect, SkinnedEffect, et al, have many things in common, but also significant
@@ -40,6 +42,19 @@ namespace DirectX
     }
 
 
+    // Counters behind GetEffectConstantBufferStatistics, shared by all the effects.
+    struct EffectConstantBufferCounters
+    {
+        static std::atomic<size_t> uploads;
+        static std::atomic<size_t> uploadsSkipped;
+
+        static void Count(bool uploaded)
+        {
+            (uploaded ? uploads : uploadsSkipped).fetch_add(1, std::memory_order_relaxed);
+        }
+    };
+
+
     // Helper stores matrix parameter values, and computes derived matrices.
     struct EffectMatrices
     {
@@ -51,6 +66,12 @@ namespace DirectX
         XMMATRIX worldView;
 
         void SetConstants(_Inout_ int& dirtyFlags, _Inout_ XMMATRIX& worldViewProjConstant);
+
+        // Take a world matrix along with matrices computed from it by ComputeEffectMatrices, in place of SetConstants
+        // and the world inverse transpose computation deriving them.
+        void SetDerived(_Inout_ int& dirtyFlags, EffectDerivedMatrices const& derived, _Inout_ XMMATRIX& worldViewProjConstant);
+
+        static void SetDerivedWorldConstants(_Inout_ int& dirtyFlags, EffectDerivedMatrices const& derived, _Inout_ XMMATRIX& worldConstant, _Inout_updates_(3) XMVECTOR worldInverseTransposeConstant[3]);
     };
 
 
@@ -117,6 +138,43 @@ namespace DirectX
     };
 
 
+    // Shader objects created from precompiled bytecode, shared by all the effects on a device, so that effect types
+    // which compiled in the same shader program get the same object.
+    class EffectShaderCache
+    {
+    public:
+        explicit EffectShaderCache(_In_ ID3D11Device* device) noexcept
+          : mDevice(device)
+        { }
+
+        HRESULT GetVertexShader(ShaderBytecode const& bytecode, _Outptr_ ID3D11VertexShader** pResult);
+        HRESULT GetPixelShader(ShaderBytecode const& bytecode, _Outptr_ ID3D11PixelShader** pResult);
+
+    private:
+        // Bytecode is identified by the checksum in its DXBC container header, since each effect source file holds
+        // its own copy of the bytecode it uses, or by its address if it has no such header.
+        struct BytecodeKey
+        {
+            explicit BytecodeKey(ShaderBytecode const& bytecode) noexcept;
+
+            bool operator< (BytecodeKey const& other) const noexcept { return memcmp(this, &other, sizeof(BytecodeKey)) < 0; }
+
+            uint32_t checksum[4];
+            uint64_t address;
+            uint64_t length;
+        };
+
+        template<typename T, typename TCreateFunc>
+        HRESULT GetShader(std::map<BytecodeKey, Microsoft::WRL::ComPtr<T>>& shaders, ShaderBytecode const& bytecode, _Outptr_ T** pResult, TCreateFunc createFunc);
+
+        Microsoft::WRL::ComPtr<ID3D11Device> mDevice;
+
+        std::mutex mMutex;
+        std::map<BytecodeKey, Microsoft::WRL::ComPtr<ID3D11VertexShader>> mVertexShaders;
+        std::map<BytecodeKey, Microsoft::WRL::ComPtr<ID3D11PixelShader>> mPixelShaders;
+    };
+
+
     // Factory for lazily instantiating shaders. BasicEffect supports many different
     // shader permutations, so we only bother creating the ones that are actually used.
     class EffectDeviceResources
@@ -135,6 +193,12 @@ namespace DirectX
         Microsoft::WRL::ComPtr<ID3D11ShaderResourceView> mDefaultTexture;
 
         std::mutex mMutex;
+
+    private:
+        // Looks up the device's shared shader cache on first use. Called with mMutex held.
+        EffectShaderCache* GetShaderCache();
+
+        std::shared_ptr<EffectShaderCache> mShaderCache;
     };
 
 
@@ -188,8 +252,8 @@ namespace DirectX
             auto vertexShader = mDeviceResources->GetVertexShader(permutation);
             auto pixelShader = mDeviceResources->GetPixelShader(permutation);
 
-            deviceContext->VSSetShader(vertexShader, nullptr, 0);
-            deviceContext->PSSetShader(pixelShader, nullptr, 0);
+            StateFilter::VSSetShader(deviceContext, vertexShader, nullptr, 0);
+            StateFilter::PSSetShader(deviceContext, pixelShader, nullptr, 0);
 
 #if defined(_XBOX_ONE) && defined(_TITLE)
             void *grfxMemory;
@@ -203,10 +267,11 @@ namespace DirectX
             deviceContextX->VSSetPlacementConstantBuffer(0, buffer, grfxMemory);
             deviceContextX->PSSetPlacementConstantBuffer(0, buffer, grfxMemory);
 #else
-            // Make sure the constant buffer is up to date.
+            // Make sure the constant buffer is up to date. Setters flag it even when they store an unchanged
+            // value, so the upload is skipped if the constants match the last ones written.
             if (dirtyFlags & EffectDirtyFlags::ConstantBuffer)
             {
-                mConstantBuffer.SetData(deviceContext, constants);
+                EffectConstantBufferCounters::Count(mConstantBuffer.SetDataIfChanged(deviceContext, constants));
      
                 dirtyFlags &= ~EffectDirtyFlags::ConstantBuffer;
             }
@@ -214,8 +279,8 @@ namespace DirectX
             // Set the constant buffer.
             ID3D11Buffer* buffer = mConstantBuffer.GetBuffer();
 
-            deviceContext->VSSetConstantBuffers(0, 1, &buffer);
-            deviceContext->PSSetConstantBuffers(0, 1, &buffer);
+            StateFilter::VSSetConstantBuffers(deviceContext, 0, 1, &buffer);
+            StateFilter::PSSetConstantBuffers(deviceContext, 0, 1, &buffer);
 #endif
         }
 
@@ -224,6 +289,20 @@ namespace DirectX
         ID3D11ShaderResourceView* GetDefaultTexture() { return mDeviceResources->GetDefaultTexture(); }
 
 
+        // Helper creates the shaders of one permutation, or of all of them if permutation is negative, ahead of first use.
+        void CreateShaders(int permutation)
+        {
+            int first = (permutation < 0) ? 0 : permutation;
+            int last = (permutation < 0) ? Traits::ShaderPermutationCount : permutation + 1;
+
+            for (int i = first; i < last; ++i)
+            {
+                mDeviceResources->GetVertexShader(i);
+                mDeviceResources->GetPixelShader(i);
+            }
+        }
+
+
     protected:
         // Static arrays hold all the precompiled shader permutations.
         static const ShaderBytecode VertexShaderBytecode[Traits::VertexShaderCount];
@@ -13,7 +13,9 @@
 #include "CommonStates.h"
 #include "DirectXHelpers.h"
 #include "SharedResourcePool.h"
+#include "StateFilter.h"
 #include "Geometry.h"
+#include "ModelHelpers.h"
 
 using namespace DirectX;
 using Microsoft::WRL::ComPtr;
@@ -74,6 +76,59 @@ namespace
 
         SetDebugObjectName(*pInputLayout, "DirectXTK:GeometricPrimitive");
     }
+
+
+    // Range of the vertex and index buffers used by a single level of detail.
+    struct LevelOfDetail
+    {
+        UINT indexCount;
+        UINT startIndex;
+        INT baseVertex;
+    };
+
+
+    // Helper for building a chain of levels of detail, halving the tessellation for each successive level.
+    // Indices stay relative to the start of their own level, so each level is limited to 16-bit indices
+    // but the chain as a whole is not.
+    template<typename TCompute>
+    void ComputeLODChain(VertexCollection& vertices, IndexCollection& indices, std::vector<LevelOfDetail>& levels,
+                         size_t tessellation, size_t levelCount, size_t minTessellation, TCompute compute)
+    {
+        if (!levelCount)
+            throw std::out_of_range("levels parameter out of range");
+
+        vertices.clear();
+        indices.clear();
+        levels.clear();
+
+        VertexCollection levelVertices;
+        IndexCollection levelIndices;
+
+        for (size_t level = 0; level < levelCount; level++)
+        {
+            if (level > 0)
+            {
+                tessellation /= 2;
+
+                if (tessellation < minTessellation)
+                    break;
+            }
+
+            compute(levelVertices, levelIndices, tessellation);
+
+            if (indices.size() + levelIndices.size() > UINT32_MAX)
+                throw std::exception("Too many indices");
+
+            LevelOfDetail lod;
+            lod.indexCount = static_cast<UINT>(levelIndices.size());
+            lod.startIndex = static_cast<UINT>(indices.size());
+            lod.baseVertex = static_cast<INT>(vertices.size());
+            levels.push_back(lod);
+
+            vertices.insert(vertices.end(), levelVertices.cbegin(), levelVertices.cend());
+            indices.insert(indices.end(), levelIndices.cbegin(), levelIndices.cend());
+        }
+    }
 }
 
 
@@ -81,21 +136,31 @@ namespace
 class GeometricPrimitive::Impl
 {
 public:
-    Impl() noexcept : mIndexCount(0) {}
+    Impl() noexcept : mLODScreenCoverage(0.5f) {}
 
     void Initialize(_In_ ID3D11DeviceContext* deviceContext, const VertexCollection& vertices, const IndexCollection& indices);
 
+    void Initialize(_In_ ID3D11DeviceContext* deviceContext, const VertexCollection& vertices, const IndexCollection& indices, const std::vector<LevelOfDetail>& levels);
+
     void XM_CALLCONV Draw(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection, FXMVECTOR color, _In_opt_ ID3D11ShaderResourceView* texture, bool wireframe, std::function<void()>& setCustomState) const;
 
-    void Draw(_In_ IEffect* effect, _In_ ID3D11InputLayout* inputLayout, bool alpha, bool wireframe, std::function<void()>& setCustomState) const;
+    void Draw(_In_ IEffect* effect, _In_ ID3D11InputLayout* inputLayout, bool alpha, bool wireframe, std::function<void()>& setCustomState, size_t lod) const;
 
     void CreateInputLayout(_In_ IEffect* effect, _Outptr_ ID3D11InputLayout** inputLayout) const;
 
+    size_t XM_CALLCONV SelectLOD(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection) const;
+
+    size_t GetLODCount() const { return mLevels.size(); }
+
+    void SetLODScreenCoverage(float coverage) { mLODScreenCoverage = coverage; }
+
 private:
     ComPtr<ID3D11Buffer> mVertexBuffer;
     ComPtr<ID3D11Buffer> mIndexBuffer;
 
-    UINT mIndexCount;
+    std::vector<LevelOfDetail> mLevels;
+    BoundingSphere mBounds;
+    float mLODScreenCoverage;
 
     // Only one of these helpers is allocated per D3D device context, even if there are multiple GeometricPrimitive instances.
     class SharedResources
@@ -170,18 +235,18 @@ void GeometricPrimitive::Impl::SharedResources::PrepareForRendering(bool alpha,
         depthStencilState = stateObjects->DepthDefault();
     }
 
-    deviceContext->OMSetBlendState(blendState, nullptr, 0xFFFFFFFF);
-    deviceContext->OMSetDepthStencilState(depthStencilState, 0);
+    StateFilter::OMSetBlendState(deviceContext, blendState, nullptr, 0xFFFFFFFF);
+    StateFilter::OMSetDepthStencilState(deviceContext, depthStencilState, 0);
 
     // Set the rasterizer state.
     if (wireframe)
-        deviceContext->RSSetState(stateObjects->Wireframe());
+        StateFilter::RSSetState(deviceContext, stateObjects->Wireframe());
     else
-        deviceContext->RSSetState(stateObjects->CullCounterClockwise());
+        StateFilter::RSSetState(deviceContext, stateObjects->CullCounterClockwise());
 
     ID3D11SamplerState* samplerState = stateObjects->LinearWrap();
 
-    deviceContext->PSSetSamplers(0, 1, &samplerState);
+    StateFilter::PSSetSamplers(deviceContext, 0, 1, &samplerState);
 }
 
 
@@ -195,6 +260,19 @@ void GeometricPrimitive::Impl::Initialize(ID3D11DeviceContext* deviceContext, co
     if (indices.size() > UINT32_MAX)
         throw std::exception("Too many indices");
 
+    LevelOfDetail lod = { static_cast<UINT>(indices.size()), 0, 0 };
+
+    Initialize(deviceContext, vertices, indices, std::vector<LevelOfDetail>(1, lod));
+}
+
+
+// Initializes a geometric primitive instance that will draw one of several levels of detail packed into the vertex and index data.
+_Use_decl_annotations_
+void GeometricPrimitive::Impl::Initialize(ID3D11DeviceContext* deviceContext, const VertexCollection& vertices, const IndexCollection& indices, const std::vector<LevelOfDetail>& levels)
+{
+    if (vertices.empty() || levels.empty())
+        throw std::exception("Requires at least one level of detail");
+
     mResources = sharedResourcesPool.DemandCreate(deviceContext);
 
     ComPtr<ID3D11Device> device;
@@ -203,7 +281,10 @@ void GeometricPrimitive::Impl::Initialize(ID3D11DeviceContext* deviceContext, co
     CreateBuffer(device.Get(), vertices, D3D11_BIND_VERTEX_BUFFER, &mVertexBuffer);
     CreateBuffer(device.Get(), indices, D3D11_BIND_INDEX_BUFFER, &mIndexBuffer);
 
-    mIndexCount = static_cast<UINT>(indices.size());
+    mLevels = levels;
+
+    // Every level approximates the same shape, so the bounds of all the vertices are used for level selection.
+    BoundingSphere::CreateFromPoints(mBounds, vertices.size(), &vertices.front().position, sizeof(VertexType));
 }
 
 
@@ -243,7 +324,7 @@ void XM_CALLCONV GeometricPrimitive::Impl::Draw(
     effect->SetColorAndAlpha(color);
 
     float alpha = XMVectorGetW(color);
-    Draw(effect, inputLayout, (alpha < 1.f), wireframe, setCustomState);
+    Draw(effect, inputLayout, (alpha < 1.f), wireframe, setCustomState, SelectLOD(world, view, projection));
 }
 
 
@@ -254,18 +335,22 @@ void GeometricPrimitive::Impl::Draw(
     ID3D11InputLayout* inputLayout,
     bool alpha,
     bool wireframe,
-    std::function<void()>& setCustomState) const
+    std::function<void()>& setCustomState,
+    size_t lod) const
 {
     assert(mResources);
     auto deviceContext = mResources->deviceContext.Get();
     assert(deviceContext != nullptr);
 
+    assert(!mLevels.empty());
+    auto& level = mLevels[std::min(lod, mLevels.size() - 1)];
+
     // Set state objects.
     mResources->PrepareForRendering(alpha, wireframe);
 
     // Set input layout.
     assert(inputLayout != nullptr);
-    deviceContext->IASetInputLayout(inputLayout);
+    StateFilter::IASetInputLayout(deviceContext, inputLayout);
 
     // Activate our shaders, constant buffers, texture, etc.
     assert(effect != nullptr);
@@ -276,20 +361,21 @@ void GeometricPrimitive::Impl::Draw(
     UINT vertexStride = sizeof(VertexType);
     UINT vertexOffset = 0;
 
-    deviceContext->IASetVertexBuffers(0, 1, &vertexBuffer, &vertexStride, &vertexOffset);
+    StateFilter::IASetVertexBuffers(deviceContext, 0, 1, &vertexBuffer, &vertexStride, &vertexOffset);
 
-    deviceContext->IASetIndexBuffer(mIndexBuffer.Get(), DXGI_FORMAT_R16_UINT, 0);
+    StateFilter::IASetIndexBuffer(deviceContext, mIndexBuffer.Get(), DXGI_FORMAT_R16_UINT, 0);
 
     // Hook lets the caller replace our shaders or state settings with whatever else they see fit.
     if (setCustomState)
     {
         setCustomState();
+        StateFilter::Invalidate(deviceContext);
     }
 
     // Draw the primitive.
-    deviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    StateFilter::IASetPrimitiveTopology(deviceContext, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
-    deviceContext->DrawIndexed(mIndexCount, 0, 0);
+    deviceContext->DrawIndexed(level.indexCount, level.startIndex, level.baseVertex);
 }
 
 
@@ -311,6 +397,14 @@ void GeometricPrimitive::Impl::CreateInputLayout(IEffect* effect, ID3D11InputLay
 }
 
 
+// Picks the level of detail from the projected size of the bounding sphere.
+_Use_decl_annotations_
+size_t XM_CALLCONV GeometricPrimitive::Impl::SelectLOD(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection) const
+{
+    return ModelHelpers::SelectLevelOfDetail(mBounds, world, view, projection, mLevels.size(), mLODScreenCoverage);
+}
+
+
 //--------------------------------------------------------------------------------------
 // GeometricPrimitive
 //--------------------------------------------------------------------------------------
@@ -349,9 +443,10 @@ void GeometricPrimitive::Draw(
     ID3D11InputLayout* inputLayout,
     bool alpha,
     bool wireframe,
-    std::function<void()> setCustomState) const
+    std::function<void()> setCustomState,
+    size_t lod) const
 {
-    pImpl->Draw(effect, inputLayout, alpha, wireframe, setCustomState);
+    pImpl->Draw(effect, inputLayout, alpha, wireframe, setCustomState, lod);
 }
 
 
@@ -362,6 +457,25 @@ void GeometricPrimitive::CreateInputLayout(IEffect* effect, ID3D11InputLayout**
 }
 
 
+size_t GeometricPrimitive::GetLODCount() const
+{
+    return pImpl->GetLODCount();
+}
+
+
+_Use_decl_annotations_
+size_t XM_CALLCONV GeometricPrimitive::SelectLOD(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection) const
+{
+    return pImpl->SelectLOD(world, view, projection);
+}
+
+
+void GeometricPrimitive::SetLODScreenCoverage(float coverage)
+{
+    pImpl->SetLODScreenCoverage(coverage);
+}
+
+
 //--------------------------------------------------------------------------------------
 // Cube (aka a Hexahedron) or Box
 //--------------------------------------------------------------------------------------
@@ -461,6 +575,33 @@ void GeometricPrimitive::CreateSphere(
 }
 
 
+// Creates a chain of spheres at decreasing tessellation.
+_Use_decl_annotations_
+std::unique_ptr<GeometricPrimitive> GeometricPrimitive::CreateSphereLOD(
+    ID3D11DeviceContext* deviceContext,
+    float diameter,
+    size_t tessellation,
+    size_t levels,
+    bool rhcoords,
+    bool invertn)
+{
+    VertexCollection vertices;
+    IndexCollection indices;
+    std::vector<LevelOfDetail> lods;
+    ComputeLODChain(vertices, indices, lods, tessellation, levels, 3, [=](VertexCollection& v, IndexCollection& i, size_t t)
+    {
+        ComputeSphere(v, i, diameter, t, rhcoords, invertn);
+    });
+
+    // Create the primitive object.
+    std::unique_ptr<GeometricPrimitive> primitive(new GeometricPrimitive());
+
+    primitive->pImpl->Initialize(deviceContext, vertices, indices, lods);
+
+    return primitive;
+}
+
+
 //--------------------------------------------------------------------------------------
 // Geodesic sphere
 //--------------------------------------------------------------------------------------
@@ -531,6 +672,33 @@ void GeometricPrimitive::CreateCylinder(
 }
 
 
+// Creates a chain of cylinders at decreasing tessellation.
+_Use_decl_annotations_
+std::unique_ptr<GeometricPrimitive> GeometricPrimitive::CreateCylinderLOD(
+    ID3D11DeviceContext* deviceContext,
+    float height,
+    float diameter,
+    size_t tessellation,
+    size_t levels,
+    bool rhcoords)
+{
+    VertexCollection vertices;
+    IndexCollection indices;
+    std::vector<LevelOfDetail> lods;
+    ComputeLODChain(vertices, indices, lods, tessellation, levels, 3, [=](VertexCollection& v, IndexCollection& i, size_t t)
+    {
+        ComputeCylinder(v, i, height, diameter, t, rhcoords);
+    });
+
+    // Create the primitive object.
+    std::unique_ptr<GeometricPrimitive> primitive(new GeometricPrimitive());
+
+    primitive->pImpl->Initialize(deviceContext, vertices, indices, lods);
+
+    return primitive;
+}
+
+
 // Creates a cone primitive.
 _Use_decl_annotations_
 std::unique_ptr<GeometricPrimitive> GeometricPrimitive::CreateCone(
@@ -564,6 +732,33 @@ void GeometricPrimitive::CreateCone(
 }
 
 
+// Creates a chain of cones at decreasing tessellation.
+_Use_decl_annotations_
+std::unique_ptr<GeometricPrimitive> GeometricPrimitive::CreateConeLOD(
+    ID3D11DeviceContext* deviceContext,
+    float diameter,
+    float height,
+    size_t tessellation,
+    size_t levels,
+    bool rhcoords)
+{
+    VertexCollection vertices;
+    IndexCollection indices;
+    std::vector<LevelOfDetail> lods;
+    ComputeLODChain(vertices, indices, lods, tessellation, levels, 3, [=](VertexCollection& v, IndexCollection& i, size_t t)
+    {
+        ComputeCone(v, i, diameter, height, t, rhcoords);
+    });
+
+    // Create the primitive object.
+    std::unique_ptr<GeometricPrimitive> primitive(new GeometricPrimitive());
+
+    primitive->pImpl->Initialize(deviceContext, vertices, indices, lods);
+
+    return primitive;
+}
+
+
 //--------------------------------------------------------------------------------------
 // Torus
 //--------------------------------------------------------------------------------------
@@ -600,6 +795,33 @@ void GeometricPrimitive::CreateTorus(
 }
 
 
+// Creates a chain of tori at decreasing tessellation.
+_Use_decl_annotations_
+std::unique_ptr<GeometricPrimitive> GeometricPrimitive::CreateTorusLOD(
+    ID3D11DeviceContext* deviceContext,
+    float diameter,
+    float thickness,
+    size_t tessellation,
+    size_t levels,
+    bool rhcoords)
+{
+    VertexCollection vertices;
+    IndexCollection indices;
+    std::vector<LevelOfDetail> lods;
+    ComputeLODChain(vertices, indices, lods, tessellation, levels, 3, [=](VertexCollection& v, IndexCollection& i, size_t t)
+    {
+        ComputeTorus(v, i, diameter, thickness, t, rhcoords);
+    });
+
+    // Create the primitive object.
+    std::unique_ptr<GeometricPrimitive> primitive(new GeometricPrimitive());
+
+    primitive->pImpl->Initialize(deviceContext, vertices, indices, lods);
+
+    return primitive;
+}
+
+
 //--------------------------------------------------------------------------------------
 // Tetrahedron
 //--------------------------------------------------------------------------------------
@@ -762,6 +984,108 @@ void GeometricPrimitive::CreateTeapot(
 }
 
 
+// Creates a chain of teapots at decreasing tessellation.
+_Use_decl_annotations_
+std::unique_ptr<GeometricPrimitive> GeometricPrimitive::CreateTeapotLOD(
+    ID3D11DeviceContext* deviceContext,
+    float size,
+    size_t tessellation,
+    size_t levels,
+    bool rhcoords)
+{
+    VertexCollection vertices;
+    IndexCollection indices;
+    std::vector<LevelOfDetail> lods;
+    ComputeLODChain(vertices, indices, lods, tessellation, levels, 1, [=](VertexCollection& v, IndexCollection& i, size_t t)
+    {
+        ComputeTeapot(v, i, size, t, rhcoords);
+    });
+
+    // Create the primitive object.
+    std::unique_ptr<GeometricPrimitive> primitive(new GeometricPrimitive());
+
+    primitive->pImpl->Initialize(deviceContext, vertices, indices, lods);
+
+    return primitive;
+}
+
+
+// Creates a teapot tessellated per patch from its curvature.
+_Use_decl_annotations_
+std::unique_ptr<GeometricPrimitive> GeometricPrimitive::CreateTeapotAdaptive(
+    ID3D11DeviceContext* deviceContext,
+    float size,
+    float tolerance,
+    size_t maxTessellation,
+    bool rhcoords)
+{
+    VertexCollection vertices;
+    IndexCollection indices;
+    ComputeTeapotAdaptive(vertices, indices, size, tolerance, maxTessellation, rhcoords);
+
+    // Create the primitive object.
+    std::unique_ptr<GeometricPrimitive> primitive(new GeometricPrimitive());
+
+    primitive->pImpl->Initialize(deviceContext, vertices, indices);
+
+    return primitive;
+}
+
+void GeometricPrimitive::CreateTeapotAdaptive(
+    std::vector<VertexType>& vertices,
+    std::vector<uint16_t>& indices,
+    float size,
+    float tolerance,
+    size_t maxTessellation,
+    bool rhcoords)
+{
+    ComputeTeapotAdaptive(vertices, indices, size, tolerance, maxTessellation, rhcoords);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Bezier patches
+//--------------------------------------------------------------------------------------
+
+static_assert(sizeof(GeometricPrimitive::BezierPatch) == 16 * sizeof(uint32_t), "Patch indices must be tightly packed");
+
+_Use_decl_annotations_
+std::unique_ptr<GeometricPrimitive> GeometricPrimitive::CreateBezierPatches(
+    ID3D11DeviceContext* deviceContext,
+    const std::vector<XMFLOAT3>& controlPoints,
+    const std::vector<BezierPatch>& patches,
+    float tolerance,
+    size_t maxTessellation,
+    bool rhcoords)
+{
+    VertexCollection vertices;
+    IndexCollection indices;
+    CreateBezierPatches(vertices, indices, controlPoints, patches, tolerance, maxTessellation, rhcoords);
+
+    // Create the primitive object.
+    std::unique_ptr<GeometricPrimitive> primitive(new GeometricPrimitive());
+
+    primitive->pImpl->Initialize(deviceContext, vertices, indices);
+
+    return primitive;
+}
+
+void GeometricPrimitive::CreateBezierPatches(
+    std::vector<VertexType>& vertices,
+    std::vector<uint16_t>& indices,
+    const std::vector<XMFLOAT3>& controlPoints,
+    const std::vector<BezierPatch>& patches,
+    float tolerance,
+    size_t maxTessellation,
+    bool rhcoords)
+{
+    ComputeBezierPatches(vertices, indices,
+        controlPoints.data(), controlPoints.size(),
+        patches.empty() ? nullptr : patches.front().indices, patches.size(),
+        tolerance, maxTessellation, rhcoords);
+}
+
+
 //--------------------------------------------------------------------------------------
 // Custom
 //--------------------------------------------------------------------------------------
@@ -26,4 +26,6 @@ namespace DirectX
     void ComputeDodecahedron(VertexCollection& vertices, IndexCollection& indices, float size, bool rhcoords);
     void ComputeIcosahedron(VertexCollection& vertices, IndexCollection& indices, float size, bool rhcoords);
     void ComputeTeapot(VertexCollection& vertices, IndexCollection& indices, float size, size_t tessellation, bool rhcoords);
+    void ComputeTeapotAdaptive(VertexCollection& vertices, IndexCollection& indices, float size, float tolerance, size_t maxTessellation, bool rhcoords);
+    void ComputeBezierPatches(VertexCollection& vertices, IndexCollection& indices, const XMFLOAT3* controlPoints, size_t controlPointCount, const uint32_t* patchIndices, size_t patchCount, float tolerance, size_t maxTessellation, bool rhcoords);
 }
@@ -12,6 +12,7 @@
 #include "DirectXHelpers.h"
 #include "GraphicsMemory.h"
 #include "PlatformHelpers.h"
+#include "StateFilter.h"
 
 using namespace DirectX;
 using namespace DirectX::Internal;
@@ -178,12 +179,12 @@ void PrimitiveBatchBase::Impl::Begin()
         throw std::exception("Cannot nest Begin calls");
 
 #if defined(_XBOX_ONE) && defined(_TITLE)
-    mDeviceContext->IASetIndexBuffer(nullptr, DXGI_FORMAT_UNKNOWN, 0);
+    StateFilter::IASetIndexBuffer(mDeviceContext.Get(), nullptr, DXGI_FORMAT_UNKNOWN, 0);
 #else
     // Bind the index buffer.
     if (mMaxIndices > 0)
     {
-        mDeviceContext->IASetIndexBuffer(mIndexBuffer.Get(), DXGI_FORMAT_R16_UINT, 0);
+        StateFilter::IASetIndexBuffer(mDeviceContext.Get(), mIndexBuffer.Get(), DXGI_FORMAT_R16_UINT, 0);
     }
 
     // Bind the vertex buffer.
@@ -191,7 +192,7 @@ void PrimitiveBatchBase::Impl::Begin()
     UINT vertexStride = static_cast<UINT>(mVertexSize);
     UINT vertexOffset = 0;
 
-    mDeviceContext->IASetVertexBuffers(0, 1, &vertexBuffer, &vertexStride, &vertexOffset);
+    StateFilter::IASetVertexBuffers(mDeviceContext.Get(), 0, 1, &vertexBuffer, &vertexStride, &vertexOffset);
 #endif
      
     // If this is a deferred D3D context, reset position so the first Map calls will use D3D11_MAP_WRITE_DISCARD.
@@ -369,7 +370,7 @@ void PrimitiveBatchBase::Impl::FlushBatch()
     if (mCurrentTopology == D3D11_PRIMITIVE_TOPOLOGY_UNDEFINED)
         return;
 
-    mDeviceContext->IASetPrimitiveTopology(mCurrentTopology);
+    StateFilter::IASetPrimitiveTopology(mDeviceContext.Get(), mCurrentTopology);
 
 #if defined(_XBOX_ONE) && defined(_TITLE)
     if (mCurrentlyIndexed)
@@ -377,6 +378,8 @@ void PrimitiveBatchBase::Impl::FlushBatch()
         // Draw indexed geometry.
         mDeviceContext->IASetPlacementIndexBuffer(mIndexBuffer.Get(), grfxMemoryIB, DXGI_FORMAT_R16_UINT);
         mDeviceContext->IASetPlacementVertexBuffer(0, mVertexBuffer.Get(), grfxMemoryVB, (UINT)mVertexSize);
+        StateFilter::InvalidateIndexBuffer(mDeviceContext.Get());
+        StateFilter::InvalidateVertexBuffer(mDeviceContext.Get(), 0);
 
         mDeviceContext->DrawIndexed((UINT)mCurrentIndex, 0, 0);
     }
@@ -384,6 +387,7 @@ void PrimitiveBatchBase::Impl::FlushBatch()
     {
         // Draw non-indexed geometry.
         mDeviceContext->IASetPlacementVertexBuffer(0, mVertexBuffer.Get(), grfxMemoryVB, (UINT)mVertexSize);
+        StateFilter::InvalidateVertexBuffer(mDeviceContext.Get(), 0);
 
         mDeviceContext->Draw((UINT)mCurrentVertex, 0);
     }
@@ -270,7 +270,7 @@ void PBREffect::Impl::Apply(_In_ ID3D11DeviceContext* deviceContext)
             albedoTexture.Get(), normalTexture.Get(), rmaTexture.Get(),
             emissiveTexture.Get(),
             radianceTexture.Get(), irradianceTexture.Get() };
-        deviceContext->PSSetShaderResources(0, _countof(textures), textures);
+        StateFilter::PSSetShaderResources(deviceContext, 0, _countof(textures), textures);
     }
     else
     {
@@ -278,7 +278,7 @@ void PBREffect::Impl::Apply(_In_ ID3D11DeviceContext* deviceContext)
             nullptr, nullptr, nullptr,
             nullptr,
             radianceTexture.Get(), irradianceTexture.Get() };
-        deviceContext->PSSetShaderResources(0, _countof(textures), textures);
+        StateFilter::PSSetShaderResources(deviceContext, 0, _countof(textures), textures);
     }
 
     // Set shaders and constant buffers.
@@ -326,6 +326,12 @@ void PBREffect::GetVertexShaderBytecode(_Out_ void const** pShaderByteCode, _Out
 }
 
 
+void PBREffect::CreateShaders(bool allPermutations)
+{
+    pImpl->CreateShaders(allPermutations ? -1 : pImpl->GetCurrentShaderPermutation());
+}
+
+
 // Camera settings.
 void XM_CALLCONV PBREffect::SetWorld(FXMMATRIX value)
 {
@@ -361,6 +367,17 @@ void XM_CALLCONV PBREffect::SetMatrices(FXMMATRIX world, CXMMATRIX view, CXMMATR
 }
 
 
+void PBREffect::SetDerivedMatrices(const EffectDerivedMatrices& value)
+{
+    // The combined matrix is still computed on Apply, which keeps the previous one for the velocity buffer.
+    pImpl->matrices.world = value.world;
+
+    pImpl->dirtyFlags |= EffectDirtyFlags::WorldViewProj;
+
+    EffectMatrices::SetDerivedWorldConstants(pImpl->dirtyFlags, value, pImpl->constants.world, pImpl->constants.worldInverseTranspose);
+}
+
+
 // Light settings
 void PBREffect::SetLightingEnabled(bool value)
 {
@@ -0,0 +1,1255 @@
+//--------------------------------------------------------------------------------------
+// File: MeshBVH.cpp
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#include "pch.h"
+#include "MeshBVH.h"
+#include "Model.h"
+#include "DirectXHelpers.h"
+#include "ModelHelpers.h"
+#include "PlatformHelpers.h"
+
+using namespace DirectX;
+
+
+namespace
+{
+    // Centroids are sorted into this many bins along each axis when choosing a split.
+    const uint32_t BinCount = 16;
+
+    // Leaves are split whenever they hold more than this many triangles, even where the surface area heuristic
+    // prefers a leaf.
+    const uint32_t MaxLeafTriangles = 8;
+
+    // Below this depth, nodes are split at the median centroid rather than by the heuristic, which bounds the
+    // depth of the tree (and so the traversal stack) for any input.
+    const uint32_t MaxHeuristicDepth = 64;
+    const size_t StackSize = 128;
+
+    // Node offsets and counts must stay below the bit patterns of infinity and NaN, since they are loaded as the w
+    // lane of the bounds.
+    const size_t MaxTriangles = 1u << 29;
+
+    // Determinants closer to zero than this are treated as rays parallel to the triangle.
+    const float RayEpsilon = 1e-20f;
+
+    // Interior nodes have a count of zero, and their two children are at offset and offset + 1. Leaves hold the
+    // triangles [offset, offset + count). The offset and count share the w lane of the bounds, so a node is
+    // loaded as two vectors.
+    struct Node
+    {
+        float       boundsMin[3];
+        uint32_t    offset;
+        float       boundsMax[3];
+        uint32_t    count;
+    };
+
+    static_assert(sizeof(Node) == 32, "MeshBVH node size mismatch");
+
+    // Triangles are stored as a vertex and the edges from it to the other two, as used by the ray test.
+    struct Triangle
+    {
+        XMFLOAT3    v0;
+        XMFLOAT3    edge1;
+        XMFLOAT3    edge2;
+    };
+
+    struct BuildTriangle
+    {
+        XMFLOAT3    boundsMin;
+        XMFLOAT3    boundsMax;
+        XMFLOAT3    centroid;
+    };
+
+    struct StackEntry
+    {
+        uint32_t    node;
+        float       entry;
+    };
+
+    inline XMVECTOR LoadBoundsMin(const Node& node)
+    {
+        return XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(node.boundsMin));
+    }
+
+    inline XMVECTOR LoadBoundsMax(const Node& node)
+    {
+        return XMLoadFloat4(reinterpret_cast<const XMFLOAT4*>(node.boundsMax));
+    }
+
+    // Half the surface area of a box.
+    inline float XM_CALLCONV HalfArea(FXMVECTOR boundsMin, FXMVECTOR boundsMax)
+    {
+        XMFLOAT3 extents;
+        XMStoreFloat3(&extents, XMVectorMax(XMVectorSubtract(boundsMax, boundsMin), XMVectorZero()));
+
+        return extents.x * extents.y + extents.y * extents.z + extents.z * extents.x;
+    }
+
+    inline XMVECTOR XM_CALLCONV HorizontalMin(FXMVECTOR v)
+    {
+        XMVECTOR m = XMVectorMin(v, XMVectorSwizzle<1, 0, 3, 2>(v));
+        return XMVectorMin(m, XMVectorSwizzle<2, 3, 0, 1>(m));
+    }
+
+    inline XMVECTOR XM_CALLCONV HorizontalMax(FXMVECTOR v)
+    {
+        XMVECTOR m = XMVectorMax(v, XMVectorSwizzle<1, 0, 3, 2>(v));
+        return XMVectorMax(m, XMVectorSwizzle<2, 3, 0, 1>(m));
+    }
+
+
+    //----------------------------------------------------------------------------------
+    // Slab test of one ray against a node. The w lanes of origin and invDirection are zero, so the w lane of the
+    // near distances clamps the entry to the ray origin, and the far w lane is replaced by the closest hit so far.
+    inline bool XM_CALLCONV RayNode(FXMVECTOR origin, FXMVECTOR invDirection, FXMVECTOR tBest, const Node& node, _Out_ float* entry)
+    {
+        XMVECTOR t1 = XMVectorMultiply(XMVectorSubtract(LoadBoundsMin(node), origin), invDirection);
+        XMVECTOR t2 = XMVectorMultiply(XMVectorSubtract(LoadBoundsMax(node), origin), invDirection);
+
+        XMVECTOR tNear = HorizontalMax(XMVectorMin(t1, t2));
+        XMVECTOR tFar = HorizontalMin(XMVectorSelect(tBest, XMVectorMax(t1, t2), g_XMSelect1110));
+
+        *entry = XMVectorGetX(tNear);
+
+        return XMVector4LessOrEqual(tNear, tFar);
+    }
+
+
+    // Moller-Trumbore test of one ray against a triangle, accepting hits closer than tMax.
+    inline bool XM_CALLCONV RayTriangle(FXMVECTOR origin, FXMVECTOR direction, const Triangle& tri, float tMax,
+                                        _Out_ float* t, _Out_ float* u, _Out_ float* v)
+    {
+        XMVECTOR edge1 = XMLoadFloat3(&tri.edge1);
+        XMVECTOR edge2 = XMLoadFloat3(&tri.edge2);
+
+        XMVECTOR p = XMVector3Cross(direction, edge2);
+
+        float det = XMVectorGetX(XMVector3Dot(edge1, p));
+        if (fabsf(det) < RayEpsilon)
+            return false;
+
+        float invDet = 1.f / det;
+
+        XMVECTOR s = XMVectorSubtract(origin, XMLoadFloat3(&tri.v0));
+
+        float uu = XMVectorGetX(XMVector3Dot(s, p)) * invDet;
+        if (uu < 0.f || uu > 1.f)
+            return false;
+
+        XMVECTOR q = XMVector3Cross(s, edge1);
+
+        float vv = XMVectorGetX(XMVector3Dot(direction, q)) * invDet;
+        if (vv < 0.f || uu + vv > 1.f)
+            return false;
+
+        float tt = XMVectorGetX(XMVector3Dot(edge2, q)) * invDet;
+        if (tt < 0.f || tt >= tMax)
+            return false;
+
+        *t = tt;
+        *u = uu;
+        *v = vv;
+        return true;
+    }
+
+
+    //----------------------------------------------------------------------------------
+    // Four rays in structure-of-arrays form, for packet traversal. Unused lanes have a negative tBest, so
+    // they never hit anything.
+    struct RayPacket
+    {
+        XMVECTOR originX, originY, originZ;
+        XMVECTOR dirX, dirY, dirZ;
+        XMVECTOR invDirX, invDirY, invDirZ;
+        XMVECTOR tBest;
+        XMVECTOR u, v;
+        XMVECTOR triangle;
+    };
+
+    // Slab test of four rays against a node, returning the mask of rays that hit it, and the nearest entry
+    // distance of those rays.
+    inline XMVECTOR RayNodePacket(const RayPacket& rays, const Node& node, _Out_ float* entry)
+    {
+        XMVECTOR t1 = XMVectorMultiply(XMVectorSubtract(XMVectorReplicatePtr(&node.boundsMin[0]), rays.originX), rays.invDirX);
+        XMVECTOR t2 = XMVectorMultiply(XMVectorSubtract(XMVectorReplicatePtr(&node.boundsMax[0]), rays.originX), rays.invDirX);
+        XMVECTOR tNear = XMVectorMax(XMVectorMin(t1, t2), XMVectorZero());
+        XMVECTOR tFar = XMVectorMin(XMVectorMax(t1, t2), rays.tBest);
+
+        t1 = XMVectorMultiply(XMVectorSubtract(XMVectorReplicatePtr(&node.boundsMin[1]), rays.originY), rays.invDirY);
+        t2 = XMVectorMultiply(XMVectorSubtract(XMVectorReplicatePtr(&node.boundsMax[1]), rays.originY), rays.invDirY);
+        tNear = XMVectorMax(tNear, XMVectorMin(t1, t2));
+        tFar = XMVectorMin(tFar, XMVectorMax(t1, t2));
+
+        t1 = XMVectorMultiply(XMVectorSubtract(XMVectorReplicatePtr(&node.boundsMin[2]), rays.originZ), rays.invDirZ);
+        t2 = XMVectorMultiply(XMVectorSubtract(XMVectorReplicatePtr(&node.boundsMax[2]), rays.originZ), rays.invDirZ);
+        tNear = XMVectorMax(tNear, XMVectorMin(t1, t2));
+        tFar = XMVectorMin(tFar, XMVectorMax(t1, t2));
+
+        XMVECTOR mask = XMVectorLessOrEqual(tNear, tFar);
+
+        *entry = XMVectorGetX(HorizontalMin(XMVectorSelect(g_XMInfinity, tNear, mask)));
+
+        return mask;
+    }
+
+
+    // Moller-Trumbore test of four rays against a triangle, updating the closest hits.
+    inline void RayTrianglePacket(RayPacket& rays, const Triangle& tri, uint32_t index)
+    {
+        XMVECTOR e1x = XMVectorReplicatePtr(&tri.edge1.x);
+        XMVECTOR e1y = XMVectorReplicatePtr(&tri.edge1.y);
+        XMVECTOR e1z = XMVectorReplicatePtr(&tri.edge1.z);
+        XMVECTOR e2x = XMVectorReplicatePtr(&tri.edge2.x);
+        XMVECTOR e2y = XMVectorReplicatePtr(&tri.edge2.y);
+        XMVECTOR e2z = XMVectorReplicatePtr(&tri.edge2.z);
+
+        // p = direction x edge2
+        XMVECTOR px = XMVectorNegativeMultiplySubtract(rays.dirZ, e2y, XMVectorMultiply(rays.dirY, e2z));
+        XMVECTOR py = XMVectorNegativeMultiplySubtract(rays.dirX, e2z, XMVectorMultiply(rays.dirZ, e2x));
+        XMVECTOR pz = XMVectorNegativeMultiplySubtract(rays.dirY, e2x, XMVectorMultiply(rays.dirX, e2y));
+
+        XMVECTOR det = XMVectorMultiplyAdd(e1z, pz, XMVectorMultiplyAdd(e1y, py, XMVectorMultiply(e1x, px)));
+        XMVECTOR invDet = XMVectorReciprocal(det);
+
+        XMVECTOR sx = XMVectorSubtract(rays.originX, XMVectorReplicatePtr(&tri.v0.x));
+        XMVECTOR sy = XMVectorSubtract(rays.originY, XMVectorReplicatePtr(&tri.v0.y));
+        XMVECTOR sz = XMVectorSubtract(rays.originZ, XMVectorReplicatePtr(&tri.v0.z));
+
+        XMVECTOR u = XMVectorMultiply(XMVectorMultiplyAdd(sz, pz, XMVectorMultiplyAdd(sy, py, XMVectorMultiply(sx, px))), invDet);
+
+        // q = s x edge1
+        XMVECTOR qx = XMVectorNegativeMultiplySubtract(sz, e1y, XMVectorMultiply(sy, e1z));
+        XMVECTOR qy = XMVectorNegativeMultiplySubtract(sx, e1z, XMVectorMultiply(sz, e1x));
+        XMVECTOR qz = XMVectorNegativeMultiplySubtract(sy, e1x, XMVectorMultiply(sx, e1y));
+
+        XMVECTOR v = XMVectorMultiply(XMVectorMultiplyAdd(rays.dirZ, qz, XMVectorMultiplyAdd(rays.dirY, qy, XMVectorMultiply(rays.dirX, qx))), invDet);
+        XMVECTOR t = XMVectorMultiply(XMVectorMultiplyAdd(e2z, qz, XMVectorMultiplyAdd(e2y, qy, XMVectorMultiply(e2x, qx))), invDet);
+
+        XMVECTOR zero = XMVectorZero();
+
+        XMVECTOR mask = XMVectorGreaterOrEqual(XMVectorAbs(det), XMVectorReplicate(RayEpsilon));
+        mask = XMVectorAndInt(mask, XMVectorGreaterOrEqual(u, zero));
+        mask = XMVectorAndInt(mask, XMVectorGreaterOrEqual(v, zero));
+        mask = XMVectorAndInt(mask, XMVectorLessOrEqual(XMVectorAdd(u, v), g_XMOne));
+        mask = XMVectorAndInt(mask, XMVectorGreaterOrEqual(t, zero));
+        mask = XMVectorAndInt(mask, XMVectorLess(t, rays.tBest));
+
+        rays.tBest = XMVectorSelect(rays.tBest, t, mask);
+        rays.u = XMVectorSelect(rays.u, u, mask);
+        rays.v = XMVectorSelect(rays.v, v, mask);
+        rays.triangle = XMVectorSelect(rays.triangle, XMVectorReplicateInt(index), mask);
+    }
+
+
+    //----------------------------------------------------------------------------------
+    // Appends the triangles of an index range, reading positions in any format LoadVertexElement supports.
+    template<typename TIndex>
+    void AddTriangles(const uint8_t* positions, size_t positionStride, DXGI_FORMAT positionFormat, size_t vertexCount,
+                      const TIndex* indices, size_t indexCount, uint32_t part,
+                      std::vector<Triangle>& triangles, std::vector<MeshBVHTriangle>& sources)
+    {
+        if (indexCount % 3)
+            throw std::exception("MeshBVH requires a triangle list");
+
+        for (size_t j = 0; j < indexCount; j += 3)
+        {
+            XMVECTOR v[3];
+
+            for (size_t k = 0; k < 3; ++k)
+            {
+                size_t index = indices[j + k];
+                if (index >= vertexCount)
+                    throw std::out_of_range("Index out of range of the vertex data");
+
+                ModelHelpers::LoadVertexElement(positions + index * positionStride, positionFormat, &v[k]);
+            }
+
+            Triangle tri;
+            XMStoreFloat3(&tri.v0, v[0]);
+            XMStoreFloat3(&tri.edge1, XMVectorSubtract(v[1], v[0]));
+            XMStoreFloat3(&tri.edge2, XMVectorSubtract(v[2], v[0]));
+            triangles.push_back(tri);
+
+            MeshBVHTriangle source = { part, static_cast<uint32_t>(j / 3) };
+            sources.push_back(source);
+        }
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// MeshBVH::Impl
+//--------------------------------------------------------------------------------------
+
+class MeshBVH::Impl
+{
+public:
+    void Build(std::vector<Triangle>& triangles, std::vector<MeshBVHTriangle>& sources);
+
+    template<bool AnyHit>
+    bool XM_CALLCONV IntersectRay(FXMVECTOR origin, FXMVECTOR direction, float maxDistance, _Out_opt_ MeshBVHHit* hit) const;
+
+    void IntersectPacket(const XMFLOAT3* origins, const XMFLOAT3* directions, size_t count, MeshBVHHit* hits, float maxDistance) const;
+
+    template<typename TNodeTest, typename TTriangleTest>
+    size_t Overlap(TNodeTest nodeTest, TTriangleTest triangleTest, _Inout_opt_ std::vector<MeshBVHTriangle>* result) const;
+
+    std::vector<Node> mNodes;
+    std::vector<Triangle> mTriangles;
+    std::vector<MeshBVHTriangle> mSources;
+};
+
+
+// Builds the hierarchy top-down, splitting each node where the surface area heuristic estimates the cheapest
+// traversal, with the candidate planes taken from a binning of the triangle centroids.
+void MeshBVH::Impl::Build(std::vector<Triangle>& triangles, std::vector<MeshBVHTriangle>& sources)
+{
+    mNodes.clear();
+
+    size_t triangleCount = triangles.size();
+
+    if (triangleCount > MaxTriangles)
+        throw std::exception("Too many triangles for MeshBVH");
+
+    if (!triangleCount)
+    {
+        mTriangles.clear();
+        mSources.clear();
+        return;
+    }
+
+    std::vector<BuildTriangle> buildTriangles(triangleCount);
+
+    for (size_t j = 0; j < triangleCount; ++j)
+    {
+        XMVECTOR v0 = XMLoadFloat3(&triangles[j].v0);
+        XMVECTOR v1 = XMVectorAdd(v0, XMLoadFloat3(&triangles[j].edge1));
+        XMVECTOR v2 = XMVectorAdd(v0, XMLoadFloat3(&triangles[j].edge2));
+
+        XMVECTOR boundsMin = XMVectorMin(v0, XMVectorMin(v1, v2));
+        XMVECTOR boundsMax = XMVectorMax(v0, XMVectorMax(v1, v2));
+
+        XMStoreFloat3(&buildTriangles[j].boundsMin, boundsMin);
+        XMStoreFloat3(&buildTriangles[j].boundsMax, boundsMax);
+        XMStoreFloat3(&buildTriangles[j].centroid, XMVectorScale(XMVectorAdd(boundsMin, boundsMax), 0.5f));
+    }
+
+    std::vector<uint32_t> order(triangleCount);
+    for (size_t j = 0; j < triangleCount; ++j)
+    {
+        order[j] = static_cast<uint32_t>(j);
+    }
+
+    mNodes.reserve(2 * triangleCount);
+
+    Node root = {};
+    root.count = static_cast<uint32_t>(triangleCount);
+    mNodes.push_back(root);
+
+    struct BuildEntry
+    {
+        uint32_t node;
+        uint32_t depth;
+    };
+
+    std::vector<BuildEntry> stack;
+    stack.push_back({ 0, 0 });
+
+    while (!stack.empty())
+    {
+        auto entry = stack.back();
+        stack.pop_back();
+
+        uint32_t first = mNodes[entry.node].offset;
+        uint32_t count = mNodes[entry.node].count;
+
+        XMVECTOR boundsMin = g_XMFltMax;
+        XMVECTOR boundsMax = XMVectorNegate(g_XMFltMax);
+        XMVECTOR centroidMin = g_XMFltMax;
+        XMVECTOR centroidMax = XMVectorNegate(g_XMFltMax);
+
+        for (uint32_t j = first; j < first + count; ++j)
+        {
+            auto& tri = buildTriangles[order[j]];
+
+            boundsMin = XMVectorMin(boundsMin, XMLoadFloat3(&tri.boundsMin));
+            boundsMax = XMVectorMax(boundsMax, XMLoadFloat3(&tri.boundsMax));
+
+            XMVECTOR centroid = XMLoadFloat3(&tri.centroid);
+            centroidMin = XMVectorMin(centroidMin, centroid);
+            centroidMax = XMVectorMax(centroidMax, centroid);
+        }
+
+        XMStoreFloat3(reinterpret_cast<XMFLOAT3*>(mNodes[entry.node].boundsMin), boundsMin);
+        XMStoreFloat3(reinterpret_cast<XMFLOAT3*>(mNodes[entry.node].boundsMax), boundsMax);
+
+        if (count <= 2)
+            continue;
+
+        XMFLOAT3 cmin, cmax;
+        XMStoreFloat3(&cmin, centroidMin);
+        XMStoreFloat3(&cmax, centroidMax);
+
+        const float* centroidLow = &cmin.x;
+        const float* centroidHigh = &cmax.x;
+
+        int splitAxis = -1;
+        uint32_t splitBin = 0;
+        float splitCost = FLT_MAX;
+
+        if (entry.depth < MaxHeuristicDepth)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                float extent = centroidHigh[axis] - centroidLow[axis];
+                if (extent <= 0.f)
+                    continue;
+
+                XMVECTOR binMin[BinCount];
+                XMVECTOR binMax[BinCount];
+                uint32_t binCounts[BinCount] = {};
+
+                for (uint32_t b = 0; b < BinCount; ++b)
+                {
+                    binMin[b] = g_XMFltMax;
+                    binMax[b] = XMVectorNegate(g_XMFltMax);
+                }
+
+                float scale = float(BinCount) / extent;
+
+                for (uint32_t j = first; j < first + count; ++j)
+                {
+                    auto& tri = buildTriangles[order[j]];
+
+                    auto b = std::min(static_cast<uint32_t>(((&tri.centroid.x)[axis] - centroidLow[axis]) * scale), BinCount - 1);
+
+                    binMin[b] = XMVectorMin(binMin[b], XMLoadFloat3(&tri.boundsMin));
+                    binMax[b] = XMVectorMax(binMax[b], XMLoadFloat3(&tri.boundsMax));
+                    ++binCounts[b];
+                }
+
+                // Sweep from the right to find the cost of everything past each plane, then from the left.
+                float rightCosts[BinCount];
+                XMVECTOR sweepMin = g_XMFltMax;
+                XMVECTOR sweepMax = XMVectorNegate(g_XMFltMax);
+                uint32_t sweepCount = 0;
+
+                for (uint32_t b = BinCount - 1; b > 0; --b)
+                {
+                    sweepMin = XMVectorMin(sweepMin, binMin[b]);
+                    sweepMax = XMVectorMax(sweepMax, binMax[b]);
+                    sweepCount += binCounts[b];
+                    rightCosts[b] = sweepCount ? HalfArea(sweepMin, sweepMax) * float(sweepCount) : 0.f;
+                }
+
+                sweepMin = g_XMFltMax;
+                sweepMax = XMVectorNegate(g_XMFltMax);
+                sweepCount = 0;
+
+                for (uint32_t b = 1; b < BinCount; ++b)
+                {
+                    sweepMin = XMVectorMin(sweepMin, binMin[b - 1]);
+                    sweepMax = XMVectorMax(sweepMax, binMax[b - 1]);
+                    sweepCount += binCounts[b - 1];
+
+                    if (!sweepCount || sweepCount == count)
+                        continue;
+
+                    float cost = HalfArea(sweepMin, sweepMax) * float(sweepCount) + rightCosts[b];
+                    if (cost < splitCost)
+                    {
+                        splitAxis = axis;
+                        splitBin = b;
+                        splitCost = cost;
+                    }
+                }
+            }
+        }
+
+        uint32_t middle = first;
+
+        // A split costs one extra box test on top of its triangle tests, in the same area-weighted units.
+        float area = HalfArea(boundsMin, boundsMax);
+        bool split = (splitAxis >= 0 && splitCost + area < area * float(count));
+
+        if (split || count > MaxLeafTriangles)
+        {
+            if (splitAxis >= 0)
+            {
+                float low = centroidLow[splitAxis];
+                float scale = float(BinCount) / (centroidHigh[splitAxis] - low);
+
+                auto it = std::partition(order.begin() + first, order.begin() + first + count, [&](uint32_t index)
+                {
+                    float c = (&buildTriangles[index].centroid.x)[splitAxis];
+                    return std::min(static_cast<uint32_t>((c - low) * scale), BinCount - 1) < splitBin;
+                });
+
+                middle = static_cast<uint32_t>(it - order.begin());
+            }
+
+            if (middle == first || middle == first + count)
+            {
+                // No useful plane, from coincident centroids or the depth limit, so split at the median.
+                int axis = 0;
+                float extent = centroidHigh[0] - centroidLow[0];
+
+                for (int a = 1; a < 3; ++a)
+                {
+                    if (centroidHigh[a] - centroidLow[a] > extent)
+                    {
+                        axis = a;
+                        extent = centroidHigh[a] - centroidLow[a];
+                    }
+                }
+
+                middle = first + count / 2;
+
+                std::nth_element(order.begin() + first, order.begin() + middle, order.begin() + first + count, [&](uint32_t a, uint32_t b)
+                {
+                    return (&buildTriangles[a].centroid.x)[axis] < (&buildTriangles[b].centroid.x)[axis];
+                });
+            }
+
+            auto left = static_cast<uint32_t>(mNodes.size());
+
+            Node child = {};
+            child.offset = first;
+            child.count = middle - first;
+            mNodes.push_back(child);
+
+            child.offset = middle;
+            child.count = first + count - middle;
+            mNodes.push_back(child);
+
+            mNodes[entry.node].offset = left;
+            mNodes[entry.node].count = 0;
+
+            stack.push_back({ left, entry.depth + 1 });
+            stack.push_back({ left + 1, entry.depth + 1 });
+        }
+    }
+
+    mNodes.shrink_to_fit();
+
+    // Store the triangles in leaf order.
+    mTriangles.resize(triangleCount);
+    mSources.resize(triangleCount);
+
+    for (size_t j = 0; j < triangleCount; ++j)
+    {
+        mTriangles[j] = triangles[order[j]];
+        mSources[j] = sources[order[j]];
+    }
+}
+
+
+// Depth-first walk visiting the nearer child first, and skipping nodes that start beyond the closest hit.
+template<bool AnyHit>
+bool XM_CALLCONV MeshBVH::Impl::IntersectRay(FXMVECTOR origin, FXMVECTOR direction, float maxDistance, MeshBVHHit* hit) const
+{
+    if (hit)
+    {
+        hit->part = hit->triangle = c_Miss;
+        hit->distance = maxDistance;
+        hit->u = hit->v = 0.f;
+    }
+
+    if (mNodes.empty())
+        return false;
+
+    XMVECTOR rayOrigin = XMVectorAndInt(origin, g_XMMask3);
+    XMVECTOR rayDirection = XMVectorAndInt(direction, g_XMMask3);
+    XMVECTOR invDirection = XMVectorAndInt(XMVectorReciprocal(rayDirection), g_XMMask3);
+
+    float tBest = maxDistance;
+    XMVECTOR tBestV = XMVectorReplicate(tBest);
+    uint32_t best = c_Miss;
+    float bestU = 0.f;
+    float bestV = 0.f;
+
+    StackEntry stack[StackSize];
+    size_t stackSize = 0;
+
+    float entry;
+    const Node* node = mNodes.data();
+    if (!RayNode(rayOrigin, invDirection, tBestV, *node, &entry))
+        return false;
+
+    for (;;)
+    {
+        if (node->count)
+        {
+            for (uint32_t j = node->offset; j < node->offset + node->count; ++j)
+            {
+                float t, u, v;
+                if (RayTriangle(rayOrigin, rayDirection, mTriangles[j], tBest, &t, &u, &v))
+                {
+                    tBest = t;
+                    tBestV = XMVectorReplicate(t);
+                    best = j;
+                    bestU = u;
+                    bestV = v;
+
+                    if (AnyHit)
+                        break;
+                }
+            }
+
+            if (AnyHit && best != c_Miss)
+                break;
+        }
+        else
+        {
+            const Node* child0 = &mNodes[node->offset];
+            const Node* child1 = child0 + 1;
+
+            float entry0, entry1;
+            bool hit0 = RayNode(rayOrigin, invDirection, tBestV, *child0, &entry0);
+            bool hit1 = RayNode(rayOrigin, invDirection, tBestV, *child1, &entry1);
+
+            if (hit0 && hit1)
+            {
+                if (entry1 < entry0)
+                {
+                    std::swap(child0, child1);
+                    std::swap(entry0, entry1);
+                }
+
+                assert(stackSize < StackSize);
+                stack[stackSize].node = static_cast<uint32_t>(child1 - mNodes.data());
+                stack[stackSize].entry = entry1;
+                ++stackSize;
+
+                node = child0;
+                continue;
+            }
+            else if (hit0)
+            {
+                node = child0;
+                continue;
+            }
+            else if (hit1)
+            {
+                node = child1;
+                continue;
+            }
+        }
+
+        // Pop the next node that may still hold a closer hit.
+        node = nullptr;
+
+        while (stackSize)
+        {
+            --stackSize;
+            if (stack[stackSize].entry <= tBest)
+            {
+                node = &mNodes[stack[stackSize].node];
+                break;
+            }
+        }
+
+        if (!node)
+            break;
+    }
+
+    if (best == c_Miss)
+        return false;
+
+    if (hit)
+    {
+        hit->part = mSources[best].part;
+        hit->triangle = mSources[best].triangle;
+        hit->distance = tBest;
+        hit->u = bestU;
+        hit->v = bestV;
+    }
+
+    return true;
+}
+
+
+// Walks the hierarchy once for each group of four rays, descending wherever any of them hits the node.
+void MeshBVH::Impl::IntersectPacket(const XMFLOAT3* origins, const XMFLOAT3* directions, size_t count, MeshBVHHit* hits, float maxDistance) const
+{
+    for (size_t first = 0; first < count; first += 4)
+    {
+        size_t rayCount = std::min<size_t>(count - first, 4);
+
+        XMFLOAT4A lanes[7] = {};
+
+        for (size_t j = 0; j < 4; ++j)
+        {
+            if (j < rayCount)
+            {
+                auto& origin = origins[first + j];
+                auto& direction = directions[first + j];
+
+                (&lanes[0].x)[j] = origin.x;
+                (&lanes[1].x)[j] = origin.y;
+                (&lanes[2].x)[j] = origin.z;
+                (&lanes[3].x)[j] = direction.x;
+                (&lanes[4].x)[j] = direction.y;
+                (&lanes[5].x)[j] = direction.z;
+                (&lanes[6].x)[j] = maxDistance;
+            }
+            else
+            {
+                (&lanes[3].x)[j] = 1.f;
+                (&lanes[4].x)[j] = 1.f;
+                (&lanes[5].x)[j] = 1.f;
+                (&lanes[6].x)[j] = -1.f;
+            }
+        }
+
+        RayPacket rays;
+        rays.originX = XMLoadFloat4A(&lanes[0]);
+        rays.originY = XMLoadFloat4A(&lanes[1]);
+        rays.originZ = XMLoadFloat4A(&lanes[2]);
+        rays.dirX = XMLoadFloat4A(&lanes[3]);
+        rays.dirY = XMLoadFloat4A(&lanes[4]);
+        rays.dirZ = XMLoadFloat4A(&lanes[5]);
+        rays.invDirX = XMVectorReciprocal(rays.dirX);
+        rays.invDirY = XMVectorReciprocal(rays.dirY);
+        rays.invDirZ = XMVectorReciprocal(rays.dirZ);
+        rays.tBest = XMLoadFloat4A(&lanes[6]);
+        rays.u = rays.v = XMVectorZero();
+        rays.triangle = XMVectorReplicateInt(c_Miss);
+
+        StackEntry stack[StackSize];
+        size_t stackSize = 0;
+
+        float entry;
+        const Node* node = mNodes.empty() ? nullptr : mNodes.data();
+        if (node && XMVector4EqualInt(RayNodePacket(rays, *node, &entry), XMVectorZero()))
+            node = nullptr;
+
+        while (node)
+        {
+            if (node->count)
+            {
+                for (uint32_t j = node->offset; j < node->offset + node->count; ++j)
+                {
+                    RayTrianglePacket(rays, mTriangles[j], j);
+                }
+            }
+            else
+            {
+                const Node* child0 = &mNodes[node->offset];
+                const Node* child1 = child0 + 1;
+
+                float entry0, entry1;
+                bool hit0 = !XMVector4EqualInt(RayNodePacket(rays, *child0, &entry0), XMVectorZero());
+                bool hit1 = !XMVector4EqualInt(RayNodePacket(rays, *child1, &entry1), XMVectorZero());
+
+                if (hit0 && hit1)
+                {
+                    if (entry1 < entry0)
+                    {
+                        std::swap(child0, child1);
+                        std::swap(entry0, entry1);
+                    }
+
+                    assert(stackSize < StackSize);
+                    stack[stackSize].node = static_cast<uint32_t>(child1 - mNodes.data());
+                    stack[stackSize].entry = entry1;
+                    ++stackSize;
+
+                    node = child0;
+                    continue;
+                }
+                else if (hit0)
+                {
+                    node = child0;
+                    continue;
+                }
+                else if (hit1)
+                {
+                    node = child1;
+                    continue;
+                }
+            }
+
+            // Pop the next node that may still hold a closer hit for at least one ray.
+            float tFarthest = XMVectorGetX(HorizontalMax(rays.tBest));
+
+            node = nullptr;
+
+            while (stackSize)
+            {
+                --stackSize;
+                if (stack[stackSize].entry <= tFarthest)
+                {
+                    node = &mNodes[stack[stackSize].node];
+                    break;
+                }
+            }
+        }
+
+        XMFLOAT4A tBest, u, v;
+        XMStoreFloat4A(&tBest, rays.tBest);
+        XMStoreFloat4A(&u, rays.u);
+        XMStoreFloat4A(&v, rays.v);
+
+        uint32_t best[4];
+        XMStoreInt4(best, rays.triangle);
+
+        for (size_t j = 0; j < rayCount; ++j)
+        {
+            auto& hit = hits[first + j];
+
+            if (best[j] == c_Miss)
+            {
+                hit.part = hit.triangle = c_Miss;
+                hit.distance = maxDistance;
+                hit.u = hit.v = 0.f;
+            }
+            else
+            {
+                hit.part = mSources[best[j]].part;
+                hit.triangle = mSources[best[j]].triangle;
+                hit.distance = (&tBest.x)[j];
+                hit.u = (&u.x)[j];
+                hit.v = (&v.x)[j];
+            }
+        }
+    }
+}
+
+
+// Collects triangles passing triangleTest in nodes passing nodeTest, or stops at the first one when result is null.
+template<typename TNodeTest, typename TTriangleTest>
+size_t MeshBVH::Impl::Overlap(TNodeTest nodeTest, TTriangleTest triangleTest, std::vector<MeshBVHTriangle>* result) const
+{
+    if (result)
+        result->clear();
+
+    if (mNodes.empty() || !nodeTest(mNodes[0]))
+        return 0;
+
+    size_t found = 0;
+
+    uint32_t stack[StackSize];
+    size_t stackSize = 0;
+
+    stack[stackSize++] = 0;
+
+    while (stackSize)
+    {
+        auto& node = mNodes[stack[--stackSize]];
+
+        if (node.count)
+        {
+            for (uint32_t j = node.offset; j < node.offset + node.count; ++j)
+            {
+                auto& tri = mTriangles[j];
+
+                XMVECTOR v0 = XMLoadFloat3(&tri.v0);
+                XMVECTOR v1 = XMVectorAdd(v0, XMLoadFloat3(&tri.edge1));
+                XMVECTOR v2 = XMVectorAdd(v0, XMLoadFloat3(&tri.edge2));
+
+                if (triangleTest(v0, v1, v2))
+                {
+                    ++found;
+
+                    if (!result)
+                        return found;
+
+                    result->push_back(mSources[j]);
+                }
+            }
+        }
+        else
+        {
+            for (uint32_t child = node.offset; child < node.offset + 2; ++child)
+            {
+                if (nodeTest(mNodes[child]))
+                {
+                    assert(stackSize < StackSize);
+                    stack[stackSize++] = child;
+                }
+            }
+        }
+    }
+
+    return found;
+}
+
+
+//--------------------------------------------------------------------------------------
+// MeshBVH
+//--------------------------------------------------------------------------------------
+
+namespace
+{
+    // Overlap tests of the query volumes against the nodes. The w lanes of the bounds hold the node offset and
+    // count, so only the first three lanes are compared.
+    struct SphereNodeTest
+    {
+        explicit SphereNodeTest(const BoundingSphere& sphere) :
+            center(XMLoadFloat3(&sphere.Center)),
+            radiusSq(XMVectorReplicate(sphere.Radius * sphere.Radius))
+        {
+        }
+
+        bool operator()(const Node& node) const
+        {
+            XMVECTOR d = XMVectorAdd(XMVectorMax(XMVectorSubtract(LoadBoundsMin(node), center), XMVectorZero()),
+                                     XMVectorMax(XMVectorSubtract(center, LoadBoundsMax(node)), XMVectorZero()));
+
+            return XMVector3LessOrEqual(XMVector3LengthSq(d), radiusSq);
+        }
+
+        XMVECTOR center;
+        XMVECTOR radiusSq;
+    };
+
+    struct BoxNodeTest
+    {
+        explicit BoxNodeTest(const BoundingBox& box)
+        {
+            XMVECTOR center = XMLoadFloat3(&box.Center);
+            XMVECTOR extents = XMLoadFloat3(&box.Extents);
+
+            boxMin = XMVectorSubtract(center, extents);
+            boxMax = XMVectorAdd(center, extents);
+        }
+
+        bool operator()(const Node& node) const
+        {
+            return XMVector3LessOrEqual(LoadBoundsMin(node), boxMax) && XMVector3GreaterOrEqual(LoadBoundsMax(node), boxMin);
+        }
+
+        XMVECTOR boxMin;
+        XMVECTOR boxMax;
+    };
+}
+
+
+// Public constructor.
+MeshBVH::MeshBVH() noexcept(false)
+    : pImpl(std::make_unique<Impl>())
+{
+}
+
+
+// Move constructor.
+MeshBVH::MeshBVH(MeshBVH&& moveFrom) noexcept
+    : pImpl(std::move(moveFrom.pImpl))
+{
+}
+
+
+// Move assignment.
+MeshBVH& MeshBVH::operator= (MeshBVH&& moveFrom) noexcept
+{
+    pImpl = std::move(moveFrom.pImpl);
+    return *this;
+}
+
+
+// Public destructor.
+MeshBVH::~MeshBVH()
+{
+}
+
+
+_Use_decl_annotations_
+std::unique_ptr<MeshBVH> MeshBVH::Create(
+    const XMFLOAT3* positions,
+    size_t positionStride,
+    size_t vertexCount,
+    const uint16_t* indices,
+    size_t indexCount)
+{
+    std::vector<Triangle> triangles;
+    std::vector<MeshBVHTriangle> sources;
+    triangles.reserve(indexCount / 3);
+    sources.reserve(indexCount / 3);
+
+    AddTriangles(reinterpret_cast<const uint8_t*>(positions), positionStride, DXGI_FORMAT_R32G32B32_FLOAT, vertexCount,
+                 indices, indexCount, 0, triangles, sources);
+
+    std::unique_ptr<MeshBVH> bvh(new MeshBVH());
+
+    bvh->pImpl->Build(triangles, sources);
+
+    return bvh;
+}
+
+
+_Use_decl_annotations_
+std::unique_ptr<MeshBVH> MeshBVH::Create(
+    const XMFLOAT3* positions,
+    size_t positionStride,
+    size_t vertexCount,
+    const uint32_t* indices,
+    size_t indexCount)
+{
+    std::vector<Triangle> triangles;
+    std::vector<MeshBVHTriangle> sources;
+    triangles.reserve(indexCount / 3);
+    sources.reserve(indexCount / 3);
+
+    AddTriangles(reinterpret_cast<const uint8_t*>(positions), positionStride, DXGI_FORMAT_R32G32B32_FLOAT, vertexCount,
+                 indices, indexCount, 0, triangles, sources);
+
+    std::unique_ptr<MeshBVH> bvh(new MeshBVH());
+
+    bvh->pImpl->Build(triangles, sources);
+
+    return bvh;
+}
+
+
+_Use_decl_annotations_
+std::unique_ptr<MeshBVH> MeshBVH::CreateFromMesh(const ModelMesh& mesh, const MeshBVHPartData* parts, size_t partCount)
+{
+    if (partCount != mesh.meshParts.size() || (partCount && !parts))
+        throw std::exception("Part data must be given for each mesh part");
+
+    std::vector<Triangle> triangles;
+    std::vector<MeshBVHTriangle> sources;
+
+    for (size_t partIndex = 0; partIndex < mesh.meshParts.size(); ++partIndex)
+    {
+        auto& part = *mesh.meshParts[partIndex];
+        auto& partData = parts[partIndex];
+
+        if (part.primitiveType != D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST)
+            continue;
+
+        if (!part.vbDecl || !partData.vertices || !partData.indices || !part.vertexStride)
+            throw std::exception("Model mesh part is missing buffers or vertex buffer input elements data");
+
+        uint32_t positionOffset;
+        auto positionElement = ModelHelpers::FindVertexElement(*part.vbDecl, "SV_Position", 0, &positionOffset);
+
+        if (!positionElement)
+            throw std::exception("Model mesh part has no position element");
+
+        size_t vertexCount = partData.vertexBytes / part.vertexStride;
+
+        if (part.vertexOffset >= vertexCount || positionOffset + LoaderHelpers::BitsPerPixel(positionElement->Format) / 8 > part.vertexStride)
+            throw std::exception("Model mesh part vertex data is invalid");
+
+        auto positions = partData.vertices + size_t(part.vertexOffset) * part.vertexStride + positionOffset;
+
+        vertexCount -= part.vertexOffset;
+
+        auto partId = static_cast<uint32_t>(partIndex);
+
+        if (part.indexFormat == DXGI_FORMAT_R16_UINT)
+        {
+            if ((uint64_t(part.startIndex) + part.indexCount) * sizeof(uint16_t) > partData.indexBytes)
+                throw std::exception("Model mesh part index data is invalid");
+
+            auto indices = reinterpret_cast<const uint16_t*>(partData.indices) + part.startIndex;
+
+            AddTriangles(positions, part.vertexStride, positionElement->Format, vertexCount, indices, part.indexCount, partId, triangles, sources);
+        }
+        else
+        {
+            if ((uint64_t(part.startIndex) + part.indexCount) * sizeof(uint32_t) > partData.indexBytes)
+                throw std::exception("Model mesh part index data is invalid");
+
+            auto indices = reinterpret_cast<const uint32_t*>(partData.indices) + part.startIndex;
+
+            AddTriangles(positions, part.vertexStride, positionElement->Format, vertexCount, indices, part.indexCount, partId, triangles, sources);
+        }
+    }
+
+    std::unique_ptr<MeshBVH> bvh(new MeshBVH());
+
+    bvh->pImpl->Build(triangles, sources);
+
+    return bvh;
+}
+
+
+_Use_decl_annotations_
+std::unique_ptr<MeshBVH> MeshBVH::CreateFromMesh(ID3D11DeviceContext* deviceContext, const ModelMesh& mesh)
+{
+    assert(deviceContext != nullptr);
+
+    // Parts often share buffers, so each is read back only once.
+    std::map<ID3D11Buffer*, std::vector<uint8_t>> bufferCache;
+
+    auto readBuffer = [&](ID3D11Buffer* buffer) -> const std::vector<uint8_t>&
+    {
+        auto it = bufferCache.find(buffer);
+        if (it == bufferCache.end())
+        {
+            it = bufferCache.insert(std::make_pair(buffer, std::vector<uint8_t>())).first;
+            ModelHelpers::ReadBackBuffer(deviceContext, buffer, it->second);
+        }
+        return it->second;
+    };
+
+    std::vector<MeshBVHPartData> parts(mesh.meshParts.size());
+
+    for (size_t partIndex = 0; partIndex < mesh.meshParts.size(); ++partIndex)
+    {
+        auto& part = *mesh.meshParts[partIndex];
+
+        if (part.primitiveType != D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST || !part.vertexBuffer || !part.indexBuffer)
+            continue;
+
+        auto& vertexData = readBuffer(part.vertexBuffer.Get());
+        auto& indexData = readBuffer(part.indexBuffer.Get());
+
+        parts[partIndex].vertices = vertexData.data();
+        parts[partIndex].vertexBytes = vertexData.size();
+        parts[partIndex].indices = indexData.data();
+        parts[partIndex].indexBytes = indexData.size();
+    }
+
+    return CreateFromMesh(mesh, parts.data(), parts.size());
+}
+
+
+size_t MeshBVH::GetTriangleCount() const
+{
+    return pImpl->mTriangles.size();
+}
+
+
+size_t MeshBVH::GetNodeCount() const
+{
+    return pImpl->mNodes.size();
+}
+
+
+BoundingBox MeshBVH::GetBounds() const
+{
+    BoundingBox box;
+
+    if (!pImpl->mNodes.empty())
+    {
+        auto& root = pImpl->mNodes[0];
+        BoundingBox::CreateFromPoints(box, LoadBoundsMin(root), LoadBoundsMax(root));
+    }
+
+    return box;
+}
+
+
+_Use_decl_annotations_
+bool XM_CALLCONV MeshBVH::Intersects(FXMVECTOR origin, FXMVECTOR direction, MeshBVHHit* hit, float maxDistance) const
+{
+    assert(hit != nullptr);
+
+    return pImpl->IntersectRay<false>(origin, direction, maxDistance, hit);
+}
+
+
+bool XM_CALLCONV MeshBVH::IntersectsAny(FXMVECTOR origin, FXMVECTOR direction, float maxDistance) const
+{
+    return pImpl->IntersectRay<true>(origin, direction, maxDistance, nullptr);
+}
+
+
+_Use_decl_annotations_
+void MeshBVH::IntersectsPacket(const XMFLOAT3* origins, const XMFLOAT3* directions, size_t count, MeshBVHHit* hits, float maxDistance) const
+{
+    assert(origins != nullptr && directions != nullptr && hits != nullptr);
+
+    pImpl->IntersectPacket(origins, directions, count, hits, maxDistance);
+}
+
+
+bool MeshBVH::Intersects(const BoundingSphere& sphere) const
+{
+    return pImpl->Overlap(SphereNodeTest(sphere), [&](FXMVECTOR v0, FXMVECTOR v1, FXMVECTOR v2)
+    {
+        return sphere.Intersects(v0, v1, v2);
+    }, nullptr) != 0;
+}
+
+
+bool MeshBVH::Intersects(const BoundingBox& box) const
+{
+    return pImpl->Overlap(BoxNodeTest(box), [&](FXMVECTOR v0, FXMVECTOR v1, FXMVECTOR v2)
+    {
+        return box.Intersects(v0, v1, v2);
+    }, nullptr) != 0;
+}
+
+
+size_t MeshBVH::Intersects(const BoundingSphere& sphere, std::vector<MeshBVHTriangle>& triangles) const
+{
+    return pImpl->Overlap(SphereNodeTest(sphere), [&](FXMVECTOR v0, FXMVECTOR v1, FXMVECTOR v2)
+    {
+        return sphere.Intersects(v0, v1, v2);
+    }, &triangles);
+}
+
+
+size_t MeshBVH::Intersects(const BoundingBox& box, std::vector<MeshBVHTriangle>& triangles) const
+{
+    return pImpl->Overlap(BoxNodeTest(box), [&](FXMVECTOR v0, FXMVECTOR v1, FXMVECTOR v2)
+    {
+        return box.Intersects(v0, v1, v2);
+    }, &triangles);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Model
+//--------------------------------------------------------------------------------------
+
+void ModelHelpers::CreateBVHs(Model& model, const ModelData& data)
+{
+    std::vector<MeshBVHPartData> parts;
+
+    for (auto it = model.meshes.cbegin(); it != model.meshes.cend(); ++it)
+    {
+        auto mesh = it->get();
+        assert(mesh != nullptr);
+
+        parts.clear();
+        parts.resize(mesh->meshParts.size());
+
+        for (size_t partIndex = 0; partIndex < mesh->meshParts.size(); ++partIndex)
+        {
+            auto pit = data.find(mesh->meshParts[partIndex].get());
+            if (pit == data.end())
+                continue;
+
+            auto const& vertices = pit->second.vertices;
+            auto const& indices = pit->second.indices;
+
+            if (vertices)
+            {
+                parts[partIndex].vertices = vertices->data;
+                parts[partIndex].vertexBytes = vertices->size;
+            }
+
+            if (indices)
+            {
+                parts[partIndex].indices = indices->data;
+                parts[partIndex].indexBytes = indices->size;
+            }
+        }
+
+        mesh->bvh = MeshBVH::CreateFromMesh(*mesh, parts.data(), parts.size());
+    }
+}
+
+
+_Use_decl_annotations_
+void Model::CreateBVHs(ID3D11DeviceContext* deviceContext)
+{
+    assert(deviceContext != nullptr);
+
+    ModelHelpers::ModelData data;
+    ModelHelpers::ReadBackModelData(deviceContext, *this, data);
+
+    ModelHelpers::CreateBVHs(*this, data);
+}
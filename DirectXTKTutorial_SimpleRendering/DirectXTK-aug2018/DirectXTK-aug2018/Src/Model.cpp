@@ -13,14 +13,173 @@
 #include "CommonStates.h"
 #include "DirectXHelpers.h"
 #include "Effects.h"
+#include "MeshNormals.h"
+#include "MeshSimplify.h"
+#include "ModelHelpers.h"
 #include "PlatformHelpers.h"
+#include "StateFilter.h"
+#include "TransparentQueue.h"
 
 using namespace DirectX;
+using Microsoft::WRL::ComPtr;
 
 #ifndef _CPPRTTI 
 #error Model requires RTTI
 #endif
 
+namespace
+{
+    // Extracts the view frustum planes in the space that worldViewProjection transforms from, with the normals
+    // pointing out of the frustum as DirectXCollision expects. Works for both left and right-handed projections.
+    void XM_CALLCONV ComputeFrustumPlanes(FXMMATRIX worldViewProjection, _Out_writes_(6) XMVECTOR* planes)
+    {
+        XMMATRIX clip = XMMatrixTranspose(worldViewProjection);
+
+        planes[0] = XMVectorNegate(XMPlaneNormalize(XMVectorAdd(clip.r[3], clip.r[0])));
+        planes[1] = XMVectorNegate(XMPlaneNormalize(XMVectorSubtract(clip.r[3], clip.r[0])));
+        planes[2] = XMVectorNegate(XMPlaneNormalize(XMVectorAdd(clip.r[3], clip.r[1])));
+        planes[3] = XMVectorNegate(XMPlaneNormalize(XMVectorSubtract(clip.r[3], clip.r[1])));
+        planes[4] = XMVectorNegate(XMPlaneNormalize(clip.r[2]));
+        planes[5] = XMVectorNegate(XMPlaneNormalize(XMVectorSubtract(clip.r[3], clip.r[2])));
+    }
+
+
+    // Tests the mesh bounds against planes in object space, trying the sphere first as the cheaper test.
+    bool IsMeshVisible(ModelMesh const& mesh, _In_reads_(6) const XMVECTOR* planes)
+    {
+        switch (mesh.boundingSphere.ContainedBy(planes[0], planes[1], planes[2], planes[3], planes[4], planes[5]))
+        {
+            case DISJOINT:
+                return false;
+
+            case CONTAINS:
+                return true;
+
+            default:
+                return mesh.boundingBox.ContainedBy(planes[0], planes[1], planes[2], planes[3], planes[4], planes[5]) != DISJOINT;
+        }
+    }
+
+
+    // Packs the contents of many buffers into as few as possible, placing each source buffer once.
+    class BufferPacker
+    {
+    public:
+        struct Placement
+        {
+            size_t bufferIndex;
+            uint32_t firstElement;
+        };
+
+        BufferPacker(uint32_t elementSize, size_t maxBufferSize) :
+            mElementSize(elementSize),
+            mMaxBufferSize(std::max<size_t>(maxBufferSize, elementSize))
+        {
+        }
+
+        // Appends data, starting a new buffer whenever it would take the current one past the size limit.
+        Placement Place(_In_reads_bytes_(size) const uint8_t* data, size_t size)
+        {
+            size -= size % mElementSize;
+
+            if (mContents.empty() || mContents.back().size() + size > mMaxBufferSize)
+            {
+                mContents.emplace_back();
+            }
+
+            auto& contents = mContents.back();
+
+            Placement placement = { mContents.size() - 1, static_cast<uint32_t>(contents.size() / mElementSize) };
+
+            contents.insert(contents.end(), data, data + size);
+
+            return placement;
+        }
+
+        // Reads back and places a buffer, once. Returns false for buffers that cannot be moved: dynamic, CPU
+        // accessible, or bound to anything else.
+        bool Add(_In_ ID3D11DeviceContext* deviceContext, _In_ ID3D11Buffer* buffer, UINT bindFlags)
+        {
+            if (mPlacements.find(buffer) != mPlacements.end())
+                return true;
+
+            D3D11_BUFFER_DESC desc = {};
+            buffer->GetDesc(&desc);
+
+            if ((desc.Usage != D3D11_USAGE_DEFAULT && desc.Usage != D3D11_USAGE_IMMUTABLE)
+                || desc.BindFlags != bindFlags || desc.CPUAccessFlags || desc.MiscFlags)
+                return false;
+
+            std::vector<uint8_t> data;
+            ModelHelpers::ReadBackBuffer(deviceContext, buffer, data);
+
+            mPlacements.insert(std::make_pair(buffer, Place(data.data(), data.size())));
+
+            return true;
+        }
+
+        Placement const* Find(_In_ ID3D11Buffer* buffer) const
+        {
+            auto it = mPlacements.find(buffer);
+            return (it != mPlacements.end()) ? &it->second : nullptr;
+        }
+
+        void CreateBuffers(_In_ ID3D11Device* device, UINT bindFlags, std::vector<ComPtr<ID3D11Buffer>>& buffers) const
+        {
+            buffers.resize(mContents.size());
+
+            for (size_t i = 0; i < mContents.size(); i++)
+            {
+                if (mContents[i].empty())
+                    continue;
+
+                D3D11_BUFFER_DESC desc = {};
+                desc.Usage = D3D11_USAGE_DEFAULT;
+                desc.ByteWidth = static_cast<UINT>(mContents[i].size());
+                desc.BindFlags = bindFlags;
+
+                D3D11_SUBRESOURCE_DATA initData = {};
+                initData.pSysMem = mContents[i].data();
+
+                ThrowIfFailed(
+                    device->CreateBuffer(&desc, &initData, buffers[i].ReleaseAndGetAddressOf())
+                );
+
+                SetDebugObjectName(buffers[i].Get(), "ModelShared");
+            }
+        }
+
+    private:
+        uint32_t mElementSize;
+        size_t mMaxBufferSize;
+        std::map<ID3D11Buffer*, Placement> mPlacements;
+        std::vector<std::vector<uint8_t>> mContents;
+    };
+
+
+    // Vertex buffers are packed by stride alone, as each part still binds its own input layout.
+    typedef std::map<uint32_t, BufferPacker> VertexPackers;
+    typedef std::map<DXGI_FORMAT, BufferPacker> IndexPackers;
+
+    template<typename TKey>
+    BufferPacker& GetPacker(std::map<TKey, BufferPacker>& packers, TKey key, uint32_t elementSize, size_t maxBufferSize)
+    {
+        auto it = packers.find(key);
+        if (it == packers.end())
+        {
+            it = packers.insert(std::make_pair(key, BufferPacker(elementSize, maxBufferSize))).first;
+        }
+
+        return it->second;
+    }
+
+
+    uint32_t GetIndexSize(DXGI_FORMAT format)
+    {
+        return (format == DXGI_FORMAT_R32_UINT) ? sizeof(uint32_t) : sizeof(uint16_t);
+    }
+}
+
 //--------------------------------------------------------------------------------------
 // ModelMeshPart
 //--------------------------------------------------------------------------------------
@@ -47,17 +206,32 @@ void ModelMeshPart::Draw(
     ID3D11DeviceContext* deviceContext,
     IEffect* ieffect,
     ID3D11InputLayout* iinputLayout,
-    std::function<void()> setCustomState) const
+    std::function<void()> setCustomState,
+    size_t lod) const
 {
-    deviceContext->IASetInputLayout(iinputLayout);
+    StateFilter::IASetInputLayout(deviceContext, iinputLayout);
 
     auto vb = vertexBuffer.Get();
     UINT vbStride = vertexStride;
     UINT vbOffset = 0;
-    deviceContext->IASetVertexBuffers(0, 1, &vb, &vbStride, &vbOffset);
+    StateFilter::IASetVertexBuffers(deviceContext, 0, 1, &vb, &vbStride, &vbOffset);
+
+    // Levels past the last one generated use the coarsest available.
+    auto ib = indexBuffer.Get();
+    UINT drawIndexCount = indexCount;
+    UINT drawStartIndex = startIndex;
+
+    if (lod > 0 && !lods.empty())
+    {
+        auto& level = lods[std::min(lod, lods.size()) - 1];
+
+        ib = level.indexBuffer.Get();
+        drawIndexCount = level.indexCount;
+        drawStartIndex = level.startIndex;
+    }
 
     // Note that if indexFormat is DXGI_FORMAT_R32_UINT, this model mesh part requires a Feature Level 9.2 or greater device
-    deviceContext->IASetIndexBuffer(indexBuffer.Get(), indexFormat, 0);
+    StateFilter::IASetIndexBuffer(deviceContext, ib, indexFormat, 0);
 
     assert(ieffect != nullptr);
     ieffect->Apply(deviceContext);
@@ -66,12 +240,13 @@ void ModelMeshPart::Draw(
     if (setCustomState)
     {
         setCustomState();
+        StateFilter::Invalidate(deviceContext);
     }
 
     // Draw the primitive.
-    deviceContext->IASetPrimitiveTopology(primitiveType);
+    StateFilter::IASetPrimitiveTopology(deviceContext, primitiveType);
 
-    deviceContext->DrawIndexed(indexCount, startIndex, vertexOffset);
+    deviceContext->DrawIndexed(drawIndexCount, drawStartIndex, vertexOffset);
 }
 
 
@@ -83,15 +258,15 @@ void ModelMeshPart::DrawInstanced(
     uint32_t instanceCount, uint32_t startInstanceLocation,
     std::function<void()> setCustomState) const
 {
-    deviceContext->IASetInputLayout(iinputLayout);
+    StateFilter::IASetInputLayout(deviceContext, iinputLayout);
 
     auto vb = vertexBuffer.Get();
     UINT vbStride = vertexStride;
     UINT vbOffset = 0;
-    deviceContext->IASetVertexBuffers(0, 1, &vb, &vbStride, &vbOffset);
+    StateFilter::IASetVertexBuffers(deviceContext, 0, 1, &vb, &vbStride, &vbOffset);
 
     // Note that if indexFormat is DXGI_FORMAT_R32_UINT, this model mesh part requires a Feature Level 9.2 or greater device
-    deviceContext->IASetIndexBuffer(indexBuffer.Get(), indexFormat, 0);
+    StateFilter::IASetIndexBuffer(deviceContext, indexBuffer.Get(), indexFormat, 0);
 
     assert(ieffect != nullptr);
     ieffect->Apply(deviceContext);
@@ -100,10 +275,11 @@ void ModelMeshPart::DrawInstanced(
     if (setCustomState)
     {
         setCustomState();
+        StateFilter::Invalidate(deviceContext);
     }
 
     // Draw the primitive.
-    deviceContext->IASetPrimitiveTopology(primitiveType);
+    StateFilter::IASetPrimitiveTopology(deviceContext, primitiveType);
 
     deviceContext->DrawIndexedInstanced(indexCount, instanceCount, startIndex, vertexOffset, startInstanceLocation);
 }
@@ -172,7 +348,9 @@ void ModelMeshPart::ModifyEffect(ID3D11Device* d3dDevice, std::shared_ptr<IEffec
 
 ModelMesh::ModelMesh() noexcept :
     ccw(true),
-    pmalpha(true)
+    pmalpha(true),
+    lodScreenCoverage(0.5f),
+    boneIndex(ModelSkeleton::c_Invalid)
 {
 }
 
@@ -214,14 +392,14 @@ void ModelMesh::PrepareForRendering(
         depthStencilState = states.DepthDefault();
     }
 
-    deviceContext->OMSetBlendState(blendState, nullptr, 0xFFFFFFFF);
-    deviceContext->OMSetDepthStencilState(depthStencilState, 0);
+    StateFilter::OMSetBlendState(deviceContext, blendState, nullptr, 0xFFFFFFFF);
+    StateFilter::OMSetDepthStencilState(deviceContext, depthStencilState, 0);
 
     // Set the rasterizer state.
     if (wireframe)
-        deviceContext->RSSetState(states.Wireframe());
+        StateFilter::RSSetState(deviceContext, states.Wireframe());
     else
-        deviceContext->RSSetState(ccw ? states.CullCounterClockwise() : states.CullClockwise());
+        StateFilter::RSSetState(deviceContext, ccw ? states.CullCounterClockwise() : states.CullClockwise());
 
     // Set sampler state.
     ID3D11SamplerState* samplers[] =
@@ -230,7 +408,35 @@ void ModelMesh::PrepareForRendering(
         states.LinearWrap(),
     };
 
-    deviceContext->PSSetSamplers(0, 2, samplers);
+    StateFilter::PSSetSamplers(deviceContext, 0, 2, samplers);
+}
+
+
+size_t ModelMesh::GetLODCount() const
+{
+    size_t count = 1;
+
+    for (auto it = meshParts.cbegin(); it != meshParts.cend(); ++it)
+    {
+        count = std::max(count, (*it)->lods.size() + 1);
+    }
+
+    return count;
+}
+
+
+size_t XM_CALLCONV ModelMesh::SelectLOD(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection) const
+{
+    return ModelHelpers::SelectLevelOfDetail(boundingSphere, world, view, projection, GetLODCount(), lodScreenCoverage);
+}
+
+
+bool XM_CALLCONV ModelMesh::IsVisible(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection) const
+{
+    XMVECTOR planes[6];
+    ComputeFrustumPlanes(XMMatrixMultiply(XMMatrixMultiply(world, view), projection), planes);
+
+    return IsMeshVisible(*this, planes);
 }
 
 
@@ -245,6 +451,8 @@ void XM_CALLCONV ModelMesh::Draw(
 {
     assert(deviceContext != nullptr);
 
+    size_t lod = SelectLOD(world, view, projection);
+
     for (auto it = meshParts.cbegin(); it != meshParts.cend(); ++it)
     {
         auto part = (*it).get();
@@ -262,7 +470,7 @@ void XM_CALLCONV ModelMesh::Draw(
             imatrices->SetMatrices(world, view, projection);
         }
 
-        part->Draw(deviceContext, part->effect.get(), part->inputLayout.Get(), setCustomState);
+        part->Draw(deviceContext, part->effect.get(), part->inputLayout.Get(), setCustomState, lod);
     }
 }
 
@@ -271,6 +479,21 @@ void XM_CALLCONV ModelMesh::Draw(
 // Model
 //--------------------------------------------------------------------------------------
 
+const D3D11_INPUT_ELEMENT_DESC Model::InstanceInputElements[3] =
+{
+    { "InstMatrix", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 0,  D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    { "InstMatrix", 1, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 16, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+    { "InstMatrix", 2, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 32, D3D11_INPUT_PER_INSTANCE_DATA, 1 },
+};
+
+
+Model::Model() noexcept :
+    frustumCulling(false),
+    mInstanceCapacity(0)
+{
+}
+
+
 Model::~Model()
 {
 }
@@ -287,10 +510,22 @@ void XM_CALLCONV Model::Draw(
 {
     assert(deviceContext != nullptr);
 
+    std::vector<uint8_t> visibility;
+    ComputeVisibility(world, view, projection, visibility);
+
+    if (!mDrawPackets.empty())
+    {
+        DrawPackets(deviceContext, states, world, view, projection, visibility, true, wireframe, setCustomState);
+        return;
+    }
+
     // Draw opaque parts
-    for (auto it = meshes.cbegin(); it != meshes.cend(); ++it)
+    for (size_t i = 0; i < meshes.size(); i++)
     {
-        auto mesh = it->get();
+        if (frustumCulling && !visibility[i])
+            continue;
+
+        auto mesh = meshes[i].get();
         assert(mesh != nullptr);
 
         mesh->PrepareForRendering(deviceContext, states, false, wireframe);
@@ -299,9 +534,12 @@ void XM_CALLCONV Model::Draw(
     }
 
     // Draw alpha parts
-    for (auto it = meshes.cbegin(); it != meshes.cend(); ++it)
+    for (size_t i = 0; i < meshes.size(); i++)
     {
-        auto mesh = it->get();
+        if (frustumCulling && !visibility[i])
+            continue;
+
+        auto mesh = meshes[i].get();
         assert(mesh != nullptr);
 
         mesh->PrepareForRendering(deviceContext, states, true, wireframe);
@@ -311,28 +549,1481 @@ void XM_CALLCONV Model::Draw(
 }
 
 
-void Model::UpdateEffects(_In_ std::function<void(IEffect*)> setEffect)
+_Use_decl_annotations_
+void XM_CALLCONV Model::Draw(
+    ID3D11DeviceContext* deviceContext,
+    const CommonStates& states,
+    FXMMATRIX world,
+    CXMMATRIX view,
+    CXMMATRIX projection,
+    TransparentQueue& transparentQueue,
+    bool wireframe, std::function<void()> setCustomState) const
 {
-    if (mEffectCache.empty())
+    assert(deviceContext != nullptr);
+
+    std::vector<uint8_t> visibility;
+    ComputeVisibility(world, view, projection, visibility);
+
+    if (!mDrawPackets.empty())
     {
-        // This cache ensures we only set each effect once (could be shared)
+        DrawPackets(deviceContext, states, world, view, projection, visibility, false, wireframe, setCustomState);
+    }
+    else
+    {
+        for (size_t i = 0; i < meshes.size(); i++)
+        {
+            if (frustumCulling && !visibility[i])
+                continue;
+
+            auto mesh = meshes[i].get();
+            assert(mesh != nullptr);
+
+            mesh->PrepareForRendering(deviceContext, states, false, wireframe);
+
+            mesh->Draw(deviceContext, world, view, projection, false, setCustomState);
+        }
+    }
+
+    // Queue alpha parts
+    for (size_t i = 0; i < meshes.size(); i++)
+    {
+        if (frustumCulling && !visibility[i])
+            continue;
+
+        transparentQueue.Submit(*meshes[i], world);
+    }
+}
+
+
+// The bounds are tested once in object space, and the result is used for both passes.
+void XM_CALLCONV Model::ComputeVisibility(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection, std::vector<uint8_t>& visibility) const
+{
+    if (!frustumCulling)
+        return;
+
+    XMVECTOR planes[6];
+    ComputeFrustumPlanes(XMMatrixMultiply(XMMatrixMultiply(world, view), projection), planes);
+
+    visibility.resize(meshes.size());
+
+    size_t visibleCount = 0;
+
+    for (size_t i = 0; i < meshes.size(); i++)
+    {
+        assert(meshes[i] != nullptr);
+        visibility[i] = static_cast<uint8_t>(IsMeshVisible(*meshes[i], planes));
+
+        visibleCount += visibility[i];
+    }
+
+    mMeshesTested.value += meshes.size();
+    mMeshesVisible.value += visibleCount;
+}
+
+
+_Use_decl_annotations_
+void XM_CALLCONV Model::DrawInstanced(
+    ID3D11DeviceContext* deviceContext,
+    const CommonStates& states,
+    const XMFLOAT4X4* instanceWorlds,
+    size_t instanceCount,
+    FXMMATRIX view,
+    CXMMATRIX projection,
+    IEffect* instancingEffect,
+    bool wireframe,
+    std::function<void()> setCustomState)
+{
+    assert(instancingEffect != nullptr);
+
+    DrawInstanced(deviceContext, states, instanceWorlds, instanceCount, view, projection,
+                  [=](const ModelMeshPart&) { return instancingEffect; },
+                  wireframe, setCustomState);
+}
+
+
+_Use_decl_annotations_
+void XM_CALLCONV Model::DrawInstanced(
+    ID3D11DeviceContext* deviceContext,
+    const CommonStates& states,
+    const XMFLOAT4X4* instanceWorlds,
+    size_t instanceCount,
+    FXMMATRIX view,
+    CXMMATRIX projection,
+    std::function<IEffect*(const ModelMeshPart& part)> getInstancingEffect,
+    bool wireframe,
+    std::function<void()> setCustomState)
+{
+    assert(deviceContext != nullptr);
+    assert(getInstancingEffect);
+
+    if (!instanceCount)
+        return;
+
+    assert(instanceWorlds != nullptr);
+
+    if (instanceCount > UINT32_MAX)
+        throw std::out_of_range("Too many instances");
+
+    ComPtr<ID3D11Device> device;
+    deviceContext->GetDevice(&device);
+
+    // Upload the instance transforms, growing the buffer to the next power of two when it is too small.
+    const UINT instanceStride = sizeof(XMFLOAT4) * 3;
+
+    if (!mInstanceBuffer || mInstanceCapacity < instanceCount)
+    {
+        size_t capacity = 64;
+        while (capacity < instanceCount)
+            capacity <<= 1;
+
+        D3D11_BUFFER_DESC desc = {};
+        desc.Usage = D3D11_USAGE_DYNAMIC;
+        desc.ByteWidth = static_cast<UINT>(capacity * instanceStride);
+        desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+        desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+
+        mInstanceBuffer.Reset();
+        ThrowIfFailed(
+            device->CreateBuffer(&desc, nullptr, mInstanceBuffer.GetAddressOf())
+        );
+
+        SetDebugObjectName(mInstanceBuffer.Get(), "ModelInstances");
+
+        mInstanceCapacity = capacity;
+    }
+
+    D3D11_MAPPED_SUBRESOURCE mapped;
+    ThrowIfFailed(
+        deviceContext->Map(mInstanceBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)
+    );
+
+    auto dest = static_cast<XMFLOAT4*>(mapped.pData);
+
+    // Instances with no mesh in view are left out of the instance buffer.
+    XMMATRIX viewProjection = XMMatrixMultiply(view, projection);
+
+    size_t visibleCount = 0;
+    size_t meshesTested = 0;
+    size_t meshesVisible = 0;
+
+    for (size_t i = 0; i < instanceCount; i++)
+    {
+        XMMATRIX world = XMLoadFloat4x4(&instanceWorlds[i]);
+
+        if (frustumCulling)
+        {
+            XMVECTOR planes[6];
+            ComputeFrustumPlanes(XMMatrixMultiply(world, viewProjection), planes);
+
+            bool visible = false;
+
+            for (auto it = meshes.cbegin(); it != meshes.cend() && !visible; ++it)
+            {
+                ++meshesTested;
+
+                if (IsMeshVisible(**it, planes))
+                {
+                    ++meshesVisible;
+                    visible = true;
+                }
+            }
+
+            if (!visible)
+                continue;
+        }
+
+        XMMATRIX transform = XMMatrixTranspose(world);
+
+        XMStoreFloat4(dest++, transform.r[0]);
+        XMStoreFloat4(dest++, transform.r[1]);
+        XMStoreFloat4(dest++, transform.r[2]);
+
+        ++visibleCount;
+    }
+
+    deviceContext->Unmap(mInstanceBuffer.Get(), 0);
+
+    mMeshesTested.value += meshesTested;
+    mMeshesVisible.value += meshesVisible;
+
+    if (!visibleCount)
+        return;
+
+    // The parts only rebind the first input slot, so the instance data stays bound for all of them.
+    auto instanceBuffer = mInstanceBuffer.Get();
+    UINT instanceOffset = 0;
+    StateFilter::IASetVertexBuffers(deviceContext, 1, 1, &instanceBuffer, &instanceStride, &instanceOffset);
+
+    IEffect* currentEffect = nullptr;
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+        bool alpha = (pass > 0);
+
         for (auto mit = meshes.cbegin(); mit != meshes.cend(); ++mit)
         {
             auto mesh = mit->get();
             assert(mesh != nullptr);
 
+            mesh->PrepareForRendering(deviceContext, states, alpha, wireframe);
+
             for (auto it = mesh->meshParts.cbegin(); it != mesh->meshParts.cend(); ++it)
             {
-                if ((*it)->effect)
-                    mEffectCache.insert((*it)->effect.get());
+                auto part = it->get();
+                assert(part != nullptr);
+
+                if (part->isAlpha != alpha)
+                    continue;
+
+                if (!part->vbDecl || part->vbDecl->empty())
+                    throw std::exception("Model mesh part missing vertex buffer input elements data");
+
+                auto instancingEffect = getInstancingEffect(*part);
+                if (!instancingEffect)
+                    continue;
+
+                // Consecutive parts usually share an effect, so its matrices are only set when it changes.
+                if (instancingEffect != currentEffect)
+                {
+                    auto imatrices = dynamic_cast<IEffectMatrices*>(instancingEffect);
+                    if (imatrices)
+                    {
+                        imatrices->SetMatrices(XMMatrixIdentity(), view, projection);
+                    }
+
+                    currentEffect = instancingEffect;
+                }
+
+                void const* shaderByteCode;
+                size_t byteCodeLength;
+                instancingEffect->GetVertexShaderBytecode(&shaderByteCode, &byteCodeLength);
+
+                // Input layouts depend only on the vertex declaration and the vertex shader.
+                auto& inputLayout = mInstancedInputLayouts[std::make_pair(part->vbDecl, shaderByteCode)];
+
+                if (!inputLayout)
+                {
+                    std::vector<D3D11_INPUT_ELEMENT_DESC> decl(*part->vbDecl);
+                    decl.insert(decl.end(), std::begin(InstanceInputElements), std::end(InstanceInputElements));
+
+                    if (decl.size() > D3D11_IA_VERTEX_INPUT_STRUCTURE_ELEMENT_COUNT)
+                        throw std::exception("Model mesh part input layout size is too large for DirectX 11");
+
+                    ThrowIfFailed(
+                        device->CreateInputLayout(decl.data(),
+                        static_cast<UINT>(decl.size()),
+                        shaderByteCode, byteCodeLength,
+                        inputLayout.GetAddressOf())
+                    );
+
+                    SetDebugObjectName(inputLayout.Get(), "ModelInstanced");
+                }
+
+                part->DrawInstanced(deviceContext, instancingEffect, inputLayout.Get(), static_cast<uint32_t>(visibleCount), 0, setCustomState);
             }
         }
     }
+}
 
-    assert(setEffect != nullptr);
 
-    for (auto it = mEffectCache.begin(); it != mEffectCache.end(); ++it)
+void Model::Compile()
+{
+    mDrawPackets.clear();
+
+    std::vector<DrawPacket> alphaPackets;
+
+    for (size_t i = 0; i < meshes.size(); i++)
     {
-        setEffect(*it);
+        auto mesh = meshes[i].get();
+        assert(mesh != nullptr);
+
+        for (auto it = mesh->meshParts.cbegin(); it != mesh->meshParts.cend(); ++it)
+        {
+            auto part = it->get();
+            assert(part != nullptr);
+
+            if (!part->effect)
+                continue;
+
+            DrawPacket packet = {};
+            packet.mesh = meshes[i];
+            packet.part = part;
+            packet.effect = part->effect;
+            packet.matrices = dynamic_cast<IEffectMatrices*>(packet.effect.get());
+            packet.inputLayout = part->inputLayout;
+            packet.meshIndex = i;
+
+            if (part->isAlpha)
+                alphaPackets.push_back(packet);
+            else
+                mDrawPackets.push_back(packet);
+        }
+    }
+
+    // Opaque parts can be drawn in any order, so they are grouped to minimize state changes. Alpha parts keep the
+    // order of the meshes, as with the uncompiled alpha pass.
+    // Pointers to unrelated objects are ordered with std::less, as the built-in comparison leaves them unspecified.
+    std::less<> less;
+
+    std::stable_sort(mDrawPackets.begin(), mDrawPackets.end(), [&](DrawPacket const& a, DrawPacket const& b) -> bool
+    {
+        bool accw = a.mesh->ccw;
+        bool bccw = b.mesh->ccw;
+        if (accw != bccw)
+            return accw < bccw;
+
+        if (a.effect != b.effect)
+            return less(a.effect.get(), b.effect.get());
+
+        if (a.inputLayout != b.inputLayout)
+            return less(a.inputLayout.Get(), b.inputLayout.Get());
+
+        if (a.part->vertexBuffer.Get() != b.part->vertexBuffer.Get())
+            return less(a.part->vertexBuffer.Get(), b.part->vertexBuffer.Get());
+
+        return less(a.part->indexBuffer.Get(), b.part->indexBuffer.Get());
+    });
+
+    mDrawPackets.insert(mDrawPackets.end(), alphaPackets.cbegin(), alphaPackets.cend());
+}
+
+
+_Use_decl_annotations_
+void XM_CALLCONV Model::DrawPackets(
+    ID3D11DeviceContext* deviceContext,
+    const CommonStates& states,
+    FXMMATRIX world,
+    CXMMATRIX view,
+    CXMMATRIX projection,
+    std::vector<uint8_t> const& visibility,
+    bool alpha,
+    bool wireframe,
+    std::function<void()> const& setCustomState) const
+{
+    ID3D11SamplerState* samplers[] =
+    {
+        states.LinearWrap(),
+        states.LinearWrap(),
+    };
+
+    StateFilter::PSSetSamplers(deviceContext, 0, 2, samplers);
+
+    // State last set by this function. Everything is reset after a custom state callback, which may change anything.
+    ID3D11BlendState* currentBlendState = nullptr;
+    ID3D11DepthStencilState* currentDepthStencilState = nullptr;
+    ID3D11RasterizerState* currentRasterizerState = nullptr;
+    IEffect* currentEffect = nullptr;
+    ID3D11InputLayout* currentInputLayout = nullptr;
+    ID3D11Buffer* currentVertexBuffer = nullptr;
+    UINT currentVertexStride = 0;
+    ID3D11Buffer* currentIndexBuffer = nullptr;
+    DXGI_FORMAT currentIndexFormat = DXGI_FORMAT_UNKNOWN;
+    D3D_PRIMITIVE_TOPOLOGY currentTopology = D3D_PRIMITIVE_TOPOLOGY_UNDEFINED;
+
+    for (auto it = mDrawPackets.cbegin(); it != mDrawPackets.cend(); ++it)
+    {
+        if (it->meshIndex >= meshes.size() || meshes[it->meshIndex] != it->mesh)
+            throw std::exception("Model meshes changed since Compile; call Modified and Compile again");
+
+        // Alpha packets are all at the end.
+        if (!alpha && it->part->isAlpha)
+            break;
+
+        if (frustumCulling && !visibility[it->meshIndex])
+            continue;
+
+        auto mesh = it->mesh.get();
+        auto part = it->part;
+
+        // Set the blend, depth stencil, and rasterizer state as PrepareForRendering would.
+        ID3D11BlendState* blendState = states.Opaque();
+        ID3D11DepthStencilState* depthStencilState = states.DepthDefault();
+
+        if (part->isAlpha)
+        {
+            blendState = mesh->pmalpha ? states.AlphaBlend() : states.NonPremultiplied();
+            depthStencilState = states.DepthRead();
+        }
+
+        ID3D11RasterizerState* rasterizerState = wireframe
+            ? states.Wireframe()
+            : (mesh->ccw ? states.CullCounterClockwise() : states.CullClockwise());
+
+        if (blendState != currentBlendState)
+        {
+            StateFilter::OMSetBlendState(deviceContext, blendState, nullptr, 0xFFFFFFFF);
+            currentBlendState = blendState;
+        }
+
+        if (depthStencilState != currentDepthStencilState)
+        {
+            StateFilter::OMSetDepthStencilState(deviceContext, depthStencilState, 0);
+            currentDepthStencilState = depthStencilState;
+        }
+
+        if (rasterizerState != currentRasterizerState)
+        {
+            StateFilter::RSSetState(deviceContext, rasterizerState);
+            currentRasterizerState = rasterizerState;
+        }
+
+        // Set the input assembler state, using the index data for the level of detail of the mesh.
+        if (it->inputLayout.Get() != currentInputLayout)
+        {
+            StateFilter::IASetInputLayout(deviceContext, it->inputLayout.Get());
+            currentInputLayout = it->inputLayout.Get();
+        }
+
+        auto vb = part->vertexBuffer.Get();
+        UINT vbStride = part->vertexStride;
+
+        if (vb != currentVertexBuffer || vbStride != currentVertexStride)
+        {
+            UINT vbOffset = 0;
+            StateFilter::IASetVertexBuffers(deviceContext, 0, 1, &vb, &vbStride, &vbOffset);
+            currentVertexBuffer = vb;
+            currentVertexStride = vbStride;
+        }
+
+        auto ib = part->indexBuffer.Get();
+        UINT drawIndexCount = part->indexCount;
+        UINT drawStartIndex = part->startIndex;
+
+        if (!part->lods.empty())
+        {
+            size_t lod = mesh->SelectLOD(world, view, projection);
+
+            if (lod > 0)
+            {
+                auto& level = part->lods[std::min(lod, part->lods.size()) - 1];
+
+                ib = level.indexBuffer.Get();
+                drawIndexCount = level.indexCount;
+                drawStartIndex = level.startIndex;
+            }
+        }
+
+        if (ib != currentIndexBuffer || part->indexFormat != currentIndexFormat)
+        {
+            StateFilter::IASetIndexBuffer(deviceContext, ib, part->indexFormat, 0);
+            currentIndexBuffer = ib;
+            currentIndexFormat = part->indexFormat;
+        }
+
+        // Consecutive parts with the same effect share its matrices, so it only needs applying once.
+        if (it->effect.get() != currentEffect)
+        {
+            if (it->matrices)
+            {
+                it->matrices->SetMatrices(world, view, projection);
+            }
+
+            it->effect->Apply(deviceContext);
+            currentEffect = it->effect.get();
+        }
+
+        if (setCustomState)
+        {
+            setCustomState();
+            StateFilter::Invalidate(deviceContext);
+
+            currentBlendState = nullptr;
+            currentDepthStencilState = nullptr;
+            currentRasterizerState = nullptr;
+            currentEffect = nullptr;
+            currentInputLayout = nullptr;
+            currentVertexBuffer = nullptr;
+            currentIndexBuffer = nullptr;
+            currentTopology = D3D_PRIMITIVE_TOPOLOGY_UNDEFINED;
+        }
+
+        if (part->primitiveType != currentTopology)
+        {
+            StateFilter::IASetPrimitiveTopology(deviceContext, part->primitiveType);
+            currentTopology = part->primitiveType;
+        }
+
+        deviceContext->DrawIndexed(drawIndexCount, drawStartIndex, part->vertexOffset);
+    }
+}
+
+
+void Model::UpdateEffects(_In_ std::function<void(IEffect*)> setEffect)
+{
+    if (mEffectCache.empty())
+    {
+        // This cache ensures we only set each effect once (could be shared)
+        for (auto mit = meshes.cbegin(); mit != meshes.cend(); ++mit)
+        {
+            auto mesh = mit->get();
+            assert(mesh != nullptr);
+
+            for (auto it = mesh->meshParts.cbegin(); it != mesh->meshParts.cend(); ++it)
+            {
+                if ((*it)->effect)
+                    mEffectCache.insert((*it)->effect.get());
+            }
+        }
+    }
+
+    assert(setEffect != nullptr);
+
+    for (auto it = mEffectCache.begin(); it != mEffectCache.end(); ++it)
+    {
+        setEffect(*it);
+    }
+}
+
+
+_Use_decl_annotations_
+size_t XM_CALLCONV Model::CullInstances(
+    FXMMATRIX view,
+    CXMMATRIX projection,
+    const Model* const* models,
+    const XMFLOAT4X4* worlds,
+    size_t count,
+    bool* visible)
+{
+    assert(models != nullptr && worlds != nullptr && visible != nullptr);
+
+    XMMATRIX viewProjection = XMMatrixMultiply(view, projection);
+
+    size_t visibleCount = 0;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        visible[i] = false;
+
+        auto model = models[i];
+        if (!model)
+            continue;
+
+        XMVECTOR planes[6];
+        ComputeFrustumPlanes(XMMatrixMultiply(XMLoadFloat4x4(&worlds[i]), viewProjection), planes);
+
+        // One visible mesh is enough to draw the instance.
+        for (auto it = model->meshes.cbegin(); it != model->meshes.cend(); ++it)
+        {
+            assert(*it != nullptr);
+
+            ++model->mMeshesTested.value;
+
+            if (IsMeshVisible(**it, planes))
+            {
+                ++model->mMeshesVisible.value;
+                visible[i] = true;
+                ++visibleCount;
+                break;
+            }
+        }
+    }
+
+    return visibleCount;
+}
+
+
+void ModelHelpers::GenerateLODs(Model& model, ModelData& data, size_t levels, float ratio)
+{
+    if (ratio <= 0.f || ratio >= 1.f)
+        throw std::out_of_range("ratio parameter out of range");
+
+    for (auto mit = model.meshes.cbegin(); mit != model.meshes.cend(); ++mit)
+    {
+        auto mesh = mit->get();
+        assert(mesh != nullptr);
+
+        for (auto it = mesh->meshParts.cbegin(); it != mesh->meshParts.cend(); ++it)
+        {
+            auto part = it->get();
+            assert(part != nullptr);
+
+            auto pit = data.find(part);
+            if (pit == data.end())
+                continue;
+
+            auto& partData = pit->second;
+
+            part->lods.clear();
+            partData.lodIndices.reset();
+
+            if (!levels
+                || part->primitiveType != D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST
+                || !part->vbDecl || !partData.vertices || !partData.indices || !part->vertexStride)
+                continue;
+
+            // Locate the vertex elements used to weigh the collapses.
+            auto elementFits = [&](const D3D11_INPUT_ELEMENT_DESC* element, uint32_t offset)
+            {
+                return element && (offset + LoaderHelpers::BitsPerPixel(element->Format) / 8 <= part->vertexStride);
+            };
+
+            uint32_t positionOffset, normalOffset, textureOffset;
+            auto positionElement = FindVertexElement(*part->vbDecl, "SV_Position", 0, &positionOffset);
+            auto normalElement = FindVertexElement(*part->vbDecl, "NORMAL", 0, &normalOffset);
+            auto textureElement = FindVertexElement(*part->vbDecl, "TEXCOORD", 0, &textureOffset);
+
+            if (!elementFits(positionElement, positionOffset))
+                continue;
+
+            bool hasNormals = elementFits(normalElement, normalOffset);
+            bool hasTextureCoordinates = elementFits(textureElement, textureOffset);
+
+            auto const& vertexData = *partData.vertices;
+            auto const& indexData = *partData.indices;
+
+            size_t vertexCount = vertexData.size / part->vertexStride;
+
+            if (part->vertexOffset >= vertexCount)
+                throw std::exception("Model mesh part vertex data is invalid");
+
+            vertexCount -= part->vertexOffset;
+
+            std::vector<XMFLOAT3> positions(vertexCount);
+            std::vector<XMFLOAT3> normals(hasNormals ? vertexCount : 0);
+            std::vector<XMFLOAT2> textureCoordinates(hasTextureCoordinates ? vertexCount : 0);
+
+            bool supported = true;
+
+            for (size_t i = 0; i < vertexCount && supported; i++)
+            {
+                auto vertex = vertexData.data + (part->vertexOffset + i) * part->vertexStride;
+
+                XMVECTOR value;
+                supported = LoadVertexElement(vertex + positionOffset, positionElement->Format, &value);
+                XMStoreFloat3(&positions[i], value);
+
+                if (hasNormals)
+                {
+                    hasNormals = LoadVertexDirection(vertex + normalOffset, normalElement->Format, &value);
+                    XMStoreFloat3(&normals[i], value);
+                }
+
+                if (hasTextureCoordinates)
+                {
+                    hasTextureCoordinates = LoadVertexElement(vertex + textureOffset, textureElement->Format, &value);
+                    XMStoreFloat2(&textureCoordinates[i], value);
+                }
+            }
+
+            if (!supported)
+                continue;
+
+            bool is32bit = (part->indexFormat == DXGI_FORMAT_R32_UINT);
+            size_t indexSize = is32bit ? sizeof(uint32_t) : sizeof(uint16_t);
+
+            if ((uint64_t(part->startIndex) + part->indexCount) * indexSize > indexData.size)
+                throw std::exception("Model mesh part index data is invalid");
+
+            std::vector<uint32_t> source(part->indexCount);
+
+            for (size_t i = 0; i < part->indexCount; i++)
+            {
+                source[i] = is32bit
+                    ? reinterpret_cast<const uint32_t*>(indexData.data)[part->startIndex + i]
+                    : reinterpret_cast<const uint16_t*>(indexData.data)[part->startIndex + i];
+            }
+
+            // Simplify each level from the previous one, stopping once the mesh can't be reduced further.
+            std::vector<uint32_t> lodIndices;
+            std::vector<uint32_t> simplified;
+
+            for (size_t level = 0; level < levels; level++)
+            {
+                size_t target = static_cast<size_t>(float(source.size() / 3) * ratio) * 3;
+
+                SimplifyMesh(positions.data(),
+                             hasNormals ? normals.data() : nullptr,
+                             hasTextureCoordinates ? textureCoordinates.data() : nullptr,
+                             vertexCount, source.data(), source.size(), target, simplified);
+
+                if (simplified.empty() || simplified.size() >= source.size())
+                    break;
+
+                ModelMeshPart::LevelOfDetail lod = {};
+                lod.startIndex = static_cast<uint32_t>(lodIndices.size());
+                lod.indexCount = static_cast<uint32_t>(simplified.size());
+                part->lods.push_back(lod);
+
+                lodIndices.insert(lodIndices.end(), simplified.cbegin(), simplified.cend());
+
+                source.swap(simplified);
+            }
+
+            if (part->lods.empty())
+                continue;
+
+            // All the levels of a part share one index buffer, in the same format as the original.
+            std::vector<uint8_t> lodData(lodIndices.size() * indexSize);
+
+            if (is32bit)
+            {
+                memcpy(lodData.data(), lodIndices.data(), lodData.size());
+            }
+            else
+            {
+                auto shortIndices = reinterpret_cast<uint16_t*>(lodData.data());
+
+                for (size_t i = 0; i < lodIndices.size(); i++)
+                {
+                    shortIndices[i] = static_cast<uint16_t>(lodIndices[i]);
+                }
+            }
+
+            partData.lodIndices = MakeBufferData(std::move(lodData));
+        }
+    }
+}
+
+
+_Use_decl_annotations_
+void Model::GenerateLODs(ID3D11DeviceContext* deviceContext, size_t levels, float ratio)
+{
+    assert(deviceContext != nullptr);
+
+    ComPtr<ID3D11Device> device;
+    deviceContext->GetDevice(&device);
+
+    ModelHelpers::ModelData data;
+    ModelHelpers::ReadBackModelData(deviceContext, *this, data);
+
+    ModelHelpers::GenerateLODs(*this, data, levels, ratio);
+    ModelHelpers::CreateModelBuffers(device.Get(), *this, data);
+}
+
+
+_Use_decl_annotations_
+void ModelHelpers::ComputeTangentFrames(ID3D11Device* device, Model& model, ModelData& data, bool recomputeNormals)
+{
+    assert(device != nullptr);
+
+    // Tangents are per vertex, so all the parts drawn from one vertex buffer are processed together.
+    std::map<BufferData*, std::vector<std::pair<ModelMesh*, ModelMeshPart*>>> groups;
+
+    for (auto mit = model.meshes.cbegin(); mit != model.meshes.cend(); ++mit)
+    {
+        auto mesh = mit->get();
+        assert(mesh != nullptr);
+
+        for (auto it = mesh->meshParts.cbegin(); it != mesh->meshParts.cend(); ++it)
+        {
+            auto part = it->get();
+            assert(part != nullptr);
+
+            auto pit = data.find(part);
+            if (pit != data.end() && pit->second.vertices)
+                groups[pit->second.vertices.get()].push_back(std::make_pair(mesh, part));
+        }
+    }
+
+    for (auto git = groups.cbegin(); git != groups.cend(); ++git)
+    {
+        auto const& parts = git->second;
+        auto first = parts.front().second;
+
+        bool compatible = (first->vbDecl && first->vertexStride > 0);
+        bool hasTriangles = false;
+
+        for (auto it = parts.cbegin(); it != parts.cend() && compatible; ++it)
+        {
+            auto part = it->second;
+
+            compatible = (part->vbDecl == first->vbDecl) && (part->vertexStride == first->vertexStride);
+
+            if (part->primitiveType == D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST && data[part].indices)
+                hasTriangles = true;
+        }
+
+        if (!compatible || !hasTriangles)
+            continue;
+
+        auto const& decl = *first->vbDecl;
+        uint32_t stride = first->vertexStride;
+
+        auto elementFits = [&](const D3D11_INPUT_ELEMENT_DESC* element, uint32_t offset)
+        {
+            return element && (offset + LoaderHelpers::BitsPerPixel(element->Format) / 8 <= stride);
+        };
+
+        uint32_t positionOffset, normalOffset, textureOffset, tangentOffset;
+        auto positionElement = FindVertexElement(decl, "SV_Position", 0, &positionOffset);
+        auto normalElement = FindVertexElement(decl, "NORMAL", 0, &normalOffset);
+        auto textureElement = FindVertexElement(decl, "TEXCOORD", 0, &textureOffset);
+        auto tangentElement = FindVertexElement(decl, "TANGENT", 0, &tangentOffset);
+
+        if (!elementFits(positionElement, positionOffset) || !elementFits(textureElement, textureOffset))
+            continue;
+
+        bool hasNormals = elementFits(normalElement, normalOffset);
+        bool hasTangents = elementFits(tangentElement, tangentOffset);
+
+        if (!hasTangents && decl.size() >= D3D11_IA_VERTEX_INPUT_STRUCTURE_ELEMENT_COUNT)
+            continue;
+
+        auto const& vertexData = *git->first;
+
+        size_t vertexCount = vertexData.size / stride;
+        if (!vertexCount)
+            continue;
+
+        std::vector<XMFLOAT3> positions(vertexCount);
+        std::vector<XMFLOAT3> normals(vertexCount);
+        std::vector<XMFLOAT2> textureCoordinates(vertexCount);
+
+        bool supported = true;
+
+        for (size_t i = 0; i < vertexCount && supported; i++)
+        {
+            auto vertex = vertexData.data + i * stride;
+
+            XMVECTOR value;
+            supported = LoadVertexElement(vertex + positionOffset, positionElement->Format, &value);
+            XMStoreFloat3(&positions[i], value);
+
+            supported &= LoadVertexElement(vertex + textureOffset, textureElement->Format, &value);
+            XMStoreFloat2(&textureCoordinates[i], value);
+
+            if (hasNormals)
+            {
+                hasNormals = LoadVertexDirection(vertex + normalOffset, normalElement->Format, &value);
+                XMStoreFloat3(&normals[i], value);
+            }
+        }
+
+        if (!supported)
+            continue;
+
+        // Gather the triangles of every part, made relative to the start of the vertex buffer.
+        std::vector<uint32_t> indices;
+        bool ccw = parts.front().first->ccw;
+
+        for (auto it = parts.cbegin(); it != parts.cend(); ++it)
+        {
+            auto part = it->second;
+            auto const& indexData = data[part].indices;
+
+            if (part->primitiveType != D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST || !indexData)
+                continue;
+
+            bool is32bit = (part->indexFormat == DXGI_FORMAT_R32_UINT);
+            size_t indexSize = is32bit ? sizeof(uint32_t) : sizeof(uint16_t);
+
+            if ((uint64_t(part->startIndex) + part->indexCount) * indexSize > indexData->size)
+                throw std::exception("Model mesh part index data is invalid");
+
+            for (size_t i = 0; i + 2 < part->indexCount; i += 3)
+            {
+                for (size_t j = 0; j < 3; j++)
+                {
+                    uint64_t index = part->vertexOffset;
+                    index += is32bit
+                        ? reinterpret_cast<const uint32_t*>(indexData->data)[part->startIndex + i + j]
+                        : reinterpret_cast<const uint16_t*>(indexData->data)[part->startIndex + i + j];
+
+                    if (index >= vertexCount)
+                        throw std::exception("Model mesh part vertex data is invalid");
+
+                    indices.push_back(static_cast<uint32_t>(index));
+                }
+            }
+        }
+
+        size_t faceCount = indices.size() / 3;
+        if (!faceCount)
+            continue;
+
+        // Recomputed normals keep the facing of any existing ones; otherwise the culling mode gives the winding.
+        bool writeNormals = false;
+
+        if (!hasNormals || recomputeNormals)
+        {
+            std::vector<XMFLOAT3> computed(vertexCount);
+            ComputeNormals(indices.data(), faceCount, positions.data(), vertexCount, false, computed.data());
+
+            bool flip = ccw;
+
+            if (hasNormals)
+            {
+                size_t agree = 0;
+                size_t disagree = 0;
+
+                for (size_t i = 0; i < vertexCount; i++)
+                {
+                    float d = XMVectorGetX(XMVector3Dot(XMLoadFloat3(&computed[i]), XMLoadFloat3(&normals[i])));
+                    if (d > 0.f)
+                        ++agree;
+                    else if (d < 0.f)
+                        ++disagree;
+                }
+
+                flip = (disagree > agree);
+            }
+
+            if (flip)
+            {
+                for (auto nit = computed.begin(); nit != computed.end(); ++nit)
+                {
+                    XMStoreFloat3(&*nit, XMVectorNegate(XMLoadFloat3(&*nit)));
+                }
+            }
+
+            normals.swap(computed);
+            writeNormals = hasNormals;
+        }
+
+        std::vector<XMFLOAT4> tangents(vertexCount);
+        ComputeTangentFrame(indices.data(), faceCount, positions.data(), normals.data(), textureCoordinates.data(), vertexCount,
+                            tangents.data());
+
+        // Write the results, appending a full precision tangent to each vertex if the layout has none.
+        auto newDecl = first->vbDecl;
+        uint32_t newStride = stride;
+
+        if (!hasTangents)
+        {
+            newDecl = std::make_shared<std::vector<D3D11_INPUT_ELEMENT_DESC>>(decl);
+
+            const D3D11_INPUT_ELEMENT_DESC tangent = { "TANGENT", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, stride, D3D11_INPUT_PER_VERTEX_DATA, 0 };
+            newDecl->push_back(tangent);
+
+            tangentElement = &newDecl->back();
+            tangentOffset = stride;
+            newStride += sizeof(XMFLOAT4);
+        }
+
+        std::vector<uint8_t> newVertexData(vertexCount * newStride);
+
+        for (size_t i = 0; i < vertexCount; i++)
+        {
+            auto src = vertexData.data + i * stride;
+            auto dest = newVertexData.data() + i * newStride;
+
+            memcpy(dest, src, stride);
+
+            if (!StoreVertexDirection(dest + tangentOffset, tangentElement->Format, XMLoadFloat4(&tangents[i])))
+                throw std::exception("Model mesh part tangent format is not supported");
+
+            if (writeNormals)
+            {
+                StoreVertexDirection(dest + normalOffset, normalElement->Format, XMLoadFloat3(&normals[i]));
+            }
+        }
+
+        auto newVertices = MakeBufferData(std::move(newVertexData));
+
+        for (auto it = parts.cbegin(); it != parts.cend(); ++it)
+        {
+            auto part = it->second;
+
+            data[part].vertices = newVertices;
+            part->vertexStride = newStride;
+            part->vbDecl = newDecl;
+
+            if (part->effect)
+            {
+                part->CreateInputLayout(device, part->effect.get(), part->inputLayout.ReleaseAndGetAddressOf());
+            }
+        }
+    }
+}
+
+
+_Use_decl_annotations_
+void Model::ComputeTangentFrames(ID3D11DeviceContext* deviceContext, bool recomputeNormals)
+{
+    assert(deviceContext != nullptr);
+
+    ComPtr<ID3D11Device> device;
+    deviceContext->GetDevice(&device);
+
+    // Compiled draw packets refer to the input layouts the pass recreates.
+    bool compiled = IsCompiled();
+    mDrawPackets.clear();
+
+    ModelHelpers::ModelData data;
+    ModelHelpers::ReadBackModelData(deviceContext, *this, data);
+
+    ModelHelpers::ComputeTangentFrames(device.Get(), *this, data, recomputeNormals);
+    ModelHelpers::CreateModelBuffers(device.Get(), *this, data);
+
+    if (compiled)
+    {
+        Compile();
+    }
+}
+
+
+_Use_decl_annotations_
+void Model::ShareBuffers(ID3D11DeviceContext* deviceContext, Model* const* models, size_t count, size_t maxBufferSize)
+{
+    assert(deviceContext != nullptr);
+
+    if (count && !models)
+        throw std::exception("Models cannot be null");
+
+    ComPtr<ID3D11Device> device;
+    deviceContext->GetDevice(&device);
+
+    VertexPackers vertexPackers;
+    IndexPackers indexPackers;
+
+    for (size_t i = 0; i < count; i++)
+    {
+        assert(models[i] != nullptr);
+
+        for (auto mit = models[i]->meshes.cbegin(); mit != models[i]->meshes.cend(); ++mit)
+        {
+            for (auto it = (*mit)->meshParts.cbegin(); it != (*mit)->meshParts.cend(); ++it)
+            {
+                auto part = it->get();
+                assert(part != nullptr);
+
+                if (part->vertexBuffer && part->vertexStride)
+                {
+                    GetPacker(vertexPackers, part->vertexStride, part->vertexStride, maxBufferSize)
+                        .Add(deviceContext, part->vertexBuffer.Get(), D3D11_BIND_VERTEX_BUFFER);
+                }
+
+                auto& indexPacker = GetPacker(indexPackers, part->indexFormat, GetIndexSize(part->indexFormat), maxBufferSize);
+
+                if (part->indexBuffer)
+                {
+                    indexPacker.Add(deviceContext, part->indexBuffer.Get(), D3D11_BIND_INDEX_BUFFER);
+                }
+
+                for (auto lit = part->lods.cbegin(); lit != part->lods.cend(); ++lit)
+                {
+                    if (lit->indexBuffer)
+                    {
+                        indexPacker.Add(deviceContext, lit->indexBuffer.Get(), D3D11_BIND_INDEX_BUFFER);
+                    }
+                }
+            }
+        }
+    }
+
+    std::map<uint32_t, std::vector<ComPtr<ID3D11Buffer>>> vertexBuffers;
+    std::map<DXGI_FORMAT, std::vector<ComPtr<ID3D11Buffer>>> indexBuffers;
+
+    for (auto it = vertexPackers.cbegin(); it != vertexPackers.cend(); ++it)
+    {
+        it->second.CreateBuffers(device.Get(), D3D11_BIND_VERTEX_BUFFER, vertexBuffers[it->first]);
+    }
+
+    for (auto it = indexPackers.cbegin(); it != indexPackers.cend(); ++it)
+    {
+        it->second.CreateBuffers(device.Get(), D3D11_BIND_INDEX_BUFFER, indexBuffers[it->first]);
+    }
+
+    // Index values stay relative to the vertex offset of their part, so only the offsets and start indices move.
+    for (size_t i = 0; i < count; i++)
+    {
+        auto model = models[i];
+
+        for (auto mit = model->meshes.cbegin(); mit != model->meshes.cend(); ++mit)
+        {
+            for (auto it = (*mit)->meshParts.cbegin(); it != (*mit)->meshParts.cend(); ++it)
+            {
+                auto part = it->get();
+
+                if (part->vertexBuffer && part->vertexStride)
+                {
+                    auto placement = vertexPackers.find(part->vertexStride)->second.Find(part->vertexBuffer.Get());
+                    if (placement)
+                    {
+                        part->vertexBuffer = vertexBuffers[part->vertexStride][placement->bufferIndex];
+                        part->vertexOffset += placement->firstElement;
+                    }
+                }
+
+                auto& indexPacker = indexPackers.find(part->indexFormat)->second;
+                auto& formatBuffers = indexBuffers[part->indexFormat];
+
+                if (part->indexBuffer)
+                {
+                    auto placement = indexPacker.Find(part->indexBuffer.Get());
+                    if (placement)
+                    {
+                        part->indexBuffer = formatBuffers[placement->bufferIndex];
+                        part->startIndex += placement->firstElement;
+                    }
+                }
+
+                for (auto lit = part->lods.begin(); lit != part->lods.end(); ++lit)
+                {
+                    if (lit->indexBuffer)
+                    {
+                        auto placement = indexPacker.Find(lit->indexBuffer.Get());
+                        if (placement)
+                        {
+                            lit->indexBuffer = formatBuffers[placement->bufferIndex];
+                            lit->startIndex += placement->firstElement;
+                        }
+                    }
+                }
+            }
+        }
+
+        // Draw packets are ordered by buffer, so they need rebuilding.
+        if (model->IsCompiled())
+        {
+            model->Compile();
+        }
+    }
+}
+
+
+_Use_decl_annotations_
+void Model::ShareBuffers(ID3D11DeviceContext* deviceContext, size_t maxBufferSize)
+{
+    Model* model = this;
+    ShareBuffers(deviceContext, &model, 1, maxBufferSize);
+}
+
+
+//--------------------------------------------------------------------------------------
+// ModelBufferPool
+//--------------------------------------------------------------------------------------
+
+class ModelBufferPool::Impl
+{
+public:
+    explicit Impl(size_t maxBufferSize) :
+        mMaxBufferSize(maxBufferSize)
+    {
+    }
+
+    void Add(Model& model, ModelHelpers::ModelData& data);
+    void CreateBuffers(_In_ ID3D11Device* device);
+
+private:
+    enum TargetKind
+    {
+        TARGET_VERTICES,
+        TARGET_INDICES,
+        TARGET_LOD_INDICES,
+    };
+
+    // A part waiting for a pool buffer. The mesh is held weakly, so models released before CreateBuffers are skipped.
+    struct Target
+    {
+        std::weak_ptr<ModelMesh>    mesh;
+        ModelMeshPart*              part;
+        TargetKind                  kind;
+        const BufferPacker*         packer;
+        size_t                      bufferIndex;
+    };
+
+    std::mutex              mMutex;
+    size_t                  mMaxBufferSize;
+    VertexPackers           mVertexPackers;
+    IndexPackers            mIndexPackers;
+    std::vector<Target>     mTargets;
+};
+
+
+void ModelBufferPool::Impl::Add(Model& model, ModelHelpers::ModelData& data)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    // Parts drawn from the same data share its placement.
+    std::map<std::pair<const BufferPacker*, const ModelHelpers::BufferData*>, BufferPacker::Placement> placements;
+
+    auto place = [&](BufferPacker& packer, ModelHelpers::BufferData const& bufferData) -> BufferPacker::Placement
+    {
+        auto key = std::make_pair(&packer, &bufferData);
+
+        auto it = placements.find(key);
+        if (it == placements.end())
+        {
+            it = placements.insert(std::make_pair(key, packer.Place(bufferData.data, bufferData.size))).first;
+        }
+
+        return it->second;
+    };
+
+    for (auto mit = model.meshes.cbegin(); mit != model.meshes.cend(); ++mit)
+    {
+        for (auto it = (*mit)->meshParts.cbegin(); it != (*mit)->meshParts.cend(); ++it)
+        {
+            auto part = it->get();
+            assert(part != nullptr);
+
+            auto pit = data.find(part);
+            if (pit == data.end())
+                continue;
+
+            auto const& partData = pit->second;
+
+            // Index values stay relative to the vertex offset of their part, so only the offsets and start indices move.
+            if (partData.vertices && part->vertexStride)
+            {
+                auto& packer = GetPacker(mVertexPackers, part->vertexStride, part->vertexStride, mMaxBufferSize);
+                auto placement = place(packer, *partData.vertices);
+
+                part->vertexOffset += placement.firstElement;
+
+                Target target = { *mit, part, TARGET_VERTICES, &packer, placement.bufferIndex };
+                mTargets.push_back(target);
+            }
+
+            auto& indexPacker = GetPacker(mIndexPackers, part->indexFormat, GetIndexSize(part->indexFormat), mMaxBufferSize);
+
+            if (partData.indices)
+            {
+                auto placement = place(indexPacker, *partData.indices);
+
+                part->startIndex += placement.firstElement;
+
+                Target target = { *mit, part, TARGET_INDICES, &indexPacker, placement.bufferIndex };
+                mTargets.push_back(target);
+            }
+
+            if (partData.lodIndices)
+            {
+                auto placement = place(indexPacker, *partData.lodIndices);
+
+                for (auto lit = part->lods.begin(); lit != part->lods.end(); ++lit)
+                {
+                    lit->startIndex += placement.firstElement;
+                }
+
+                Target target = { *mit, part, TARGET_LOD_INDICES, &indexPacker, placement.bufferIndex };
+                mTargets.push_back(target);
+            }
+        }
+    }
+}
+
+
+_Use_decl_annotations_
+void ModelBufferPool::Impl::CreateBuffers(ID3D11Device* device)
+{
+    assert(device != nullptr);
+
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    std::map<const BufferPacker*, std::vector<ComPtr<ID3D11Buffer>>> buffers;
+
+    for (auto it = mVertexPackers.cbegin(); it != mVertexPackers.cend(); ++it)
+    {
+        it->second.CreateBuffers(device, D3D11_BIND_VERTEX_BUFFER, buffers[&it->second]);
+    }
+
+    for (auto it = mIndexPackers.cbegin(); it != mIndexPackers.cend(); ++it)
+    {
+        it->second.CreateBuffers(device, D3D11_BIND_INDEX_BUFFER, buffers[&it->second]);
+    }
+
+    for (auto it = mTargets.cbegin(); it != mTargets.cend(); ++it)
+    {
+        auto mesh = it->mesh.lock();
+        if (!mesh)
+            continue;
+
+        auto const& buffer = buffers[it->packer][it->bufferIndex];
+        auto part = it->part;
+
+        switch (it->kind)
+        {
+            case TARGET_VERTICES:
+                part->vertexBuffer = buffer;
+                break;
+
+            case TARGET_INDICES:
+                part->indexBuffer = buffer;
+                break;
+
+            case TARGET_LOD_INDICES:
+                for (auto lit = part->lods.begin(); lit != part->lods.end(); ++lit)
+                {
+                    lit->indexBuffer = buffer;
+                }
+                break;
+        }
+    }
+
+    // The buffers are complete, so data added later starts new ones.
+    mVertexPackers.clear();
+    mIndexPackers.clear();
+    mTargets.clear();
+}
+
+
+// Public constructor.
+ModelBufferPool::ModelBufferPool(size_t maxBufferSize)
+    : pImpl(std::make_unique<Impl>(maxBufferSize))
+{
+}
+
+
+// Move constructor.
+ModelBufferPool::ModelBufferPool(ModelBufferPool&& moveFrom) noexcept
+    : pImpl(std::move(moveFrom.pImpl))
+{
+}
+
+
+// Move assignment.
+ModelBufferPool& ModelBufferPool::operator= (ModelBufferPool&& moveFrom) noexcept
+{
+    pImpl = std::move(moveFrom.pImpl);
+    return *this;
+}
+
+
+// Public destructor.
+ModelBufferPool::~ModelBufferPool()
+{
+}
+
+
+_Use_decl_annotations_
+void ModelBufferPool::CreateBuffers(ID3D11Device* device)
+{
+    pImpl->CreateBuffers(device);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Loader pipeline
+//--------------------------------------------------------------------------------------
+
+_Use_decl_annotations_
+void ModelHelpers::ReadBackModelData(ID3D11DeviceContext* deviceContext, const Model& model, ModelData& data)
+{
+    assert(deviceContext != nullptr);
+
+    // Mesh parts usually share buffers, so each one is only read back once.
+    std::map<ID3D11Buffer*, std::shared_ptr<BufferData>> buffers;
+
+    auto readBack = [&](ID3D11Buffer* buffer) -> std::shared_ptr<BufferData>
+    {
+        if (!buffer)
+            return nullptr;
+
+        auto it = buffers.find(buffer);
+        if (it == buffers.end())
+        {
+            std::vector<uint8_t> contents;
+            ReadBackBuffer(deviceContext, buffer, contents);
+
+            auto bufferData = MakeBufferData(std::move(contents));
+            bufferData->buffer = buffer;
+
+            it = buffers.insert(std::make_pair(buffer, bufferData)).first;
+        }
+
+        return it->second;
+    };
+
+    for (auto mit = model.meshes.cbegin(); mit != model.meshes.cend(); ++mit)
+    {
+        for (auto it = (*mit)->meshParts.cbegin(); it != (*mit)->meshParts.cend(); ++it)
+        {
+            auto part = it->get();
+            assert(part != nullptr);
+
+            auto& partData = data[part];
+            partData.vertices = readBack(part->vertexBuffer.Get());
+            partData.indices = readBack(part->indexBuffer.Get());
+        }
+    }
+}
+
+
+_Use_decl_annotations_
+void ModelHelpers::CreateModelBuffers(ID3D11Device* device, Model& model, ModelData& data)
+{
+    assert(device != nullptr);
+
+    auto createBuffer = [device](BufferData& bufferData, UINT bindFlags)
+    {
+        if (bufferData.buffer)
+            return;
+
+        if (bufferData.size > (D3D11_REQ_RESOURCE_SIZE_IN_MEGABYTES_EXPRESSION_A_TERM * 1024u * 1024u))
+            throw std::exception((bindFlags == D3D11_BIND_VERTEX_BUFFER) ? "VB too large for DirectX 11" : "IB too large for DirectX 11");
+
+        D3D11_BUFFER_DESC desc = {};
+        desc.Usage = D3D11_USAGE_DEFAULT;
+        desc.ByteWidth = static_cast<UINT>(bufferData.size);
+        desc.BindFlags = bindFlags;
+
+        D3D11_SUBRESOURCE_DATA initData = {};
+        initData.pSysMem = bufferData.data;
+
+        ThrowIfFailed(
+            device->CreateBuffer(&desc, &initData, bufferData.buffer.GetAddressOf())
+        );
+
+        SetDebugObjectName(bufferData.buffer.Get(), "ModelPart");
+    };
+
+    for (auto mit = model.meshes.cbegin(); mit != model.meshes.cend(); ++mit)
+    {
+        for (auto it = (*mit)->meshParts.cbegin(); it != (*mit)->meshParts.cend(); ++it)
+        {
+            auto part = it->get();
+            assert(part != nullptr);
+
+            auto pit = data.find(part);
+            if (pit == data.end())
+                continue;
+
+            auto& partData = pit->second;
+
+            if (partData.vertices)
+            {
+                createBuffer(*partData.vertices, D3D11_BIND_VERTEX_BUFFER);
+                part->vertexBuffer = partData.vertices->buffer;
+            }
+
+            if (partData.indices)
+            {
+                createBuffer(*partData.indices, D3D11_BIND_INDEX_BUFFER);
+                part->indexBuffer = partData.indices->buffer;
+            }
+
+            if (partData.lodIndices)
+            {
+                createBuffer(*partData.lodIndices, D3D11_BIND_INDEX_BUFFER);
+
+                for (auto lit = part->lods.begin(); lit != part->lods.end(); ++lit)
+                {
+                    lit->indexBuffer = partData.lodIndices->buffer;
+                }
+            }
+        }
+    }
+}
+
+
+_Use_decl_annotations_
+void ModelHelpers::FinishLoading(ID3D11Device* device, Model& model, ModelData& data, const ModelLoaderOptions& options)
+{
+    // Tangents come first, so that the levels of detail are simplified with any recomputed normals.
+    if (options.computeTangentFrames)
+    {
+        ComputeTangentFrames(device, model, data, options.recomputeNormals);
+    }
+
+    if (options.lodLevels)
+    {
+        GenerateLODs(model, data, options.lodLevels, options.lodRatio);
+    }
+
+    // Built before a pool moves the vertex offsets and start indices of the parts away from this data.
+    if (options.createBVHs)
+    {
+        CreateBVHs(model, data);
+    }
+
+    if (options.bufferPool)
+    {
+        options.bufferPool->GetImpl()->Add(model, data);
+    }
+    else
+    {
+        CreateModelBuffers(device, model, data);
     }
 }
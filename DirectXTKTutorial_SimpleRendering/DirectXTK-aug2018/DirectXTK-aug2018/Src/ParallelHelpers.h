@@ -0,0 +1,72 @@
+//--------------------------------------------------------------------------------------
+// File: ParallelHelpers.h
+//
+// Helper functions for splitting mesh processing across threads
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+
+namespace DirectX
+{
+    namespace ParallelHelpers
+    {
+        //--------------------------------------------------------------------------------------
+        // Calls func(begin, end) for chunks covering [0, count), spread across the available
+        // hardware threads. Counts below minChunk are processed on the calling thread only.
+        //--------------------------------------------------------------------------------------
+        template<typename TFunc>
+        void ParallelFor(size_t count, size_t minChunk, TFunc const& func)
+        {
+            size_t threads = std::max<size_t>(1, std::thread::hardware_concurrency());
+            threads = std::min(threads, (count + minChunk - 1) / minChunk);
+
+            if (threads <= 1)
+            {
+                func(size_t(0), count);
+                return;
+            }
+
+            size_t chunk = (count + threads - 1) / threads;
+
+            std::vector<std::thread> workers;
+            workers.reserve(threads - 1);
+
+            try
+            {
+                for (size_t t = 1; t < threads; t++)
+                {
+                    size_t begin = t * chunk;
+                    size_t end = std::min(count, begin + chunk);
+
+                    workers.emplace_back([&func, begin, end]() { func(begin, end); });
+                }
+
+                func(size_t(0), chunk);
+            }
+            catch (...)
+            {
+                for (auto it = workers.begin(); it != workers.end(); ++it)
+                {
+                    it->join();
+                }
+
+                throw;
+            }
+
+            for (auto it = workers.begin(); it != workers.end(); ++it)
+            {
+                it->join();
+            }
+        }
+    }
+}
@@ -86,6 +86,15 @@ call :CompileShader%1 BasicEffect vs VSBasicPixelLightingTxBn
 call :CompileShader%1 BasicEffect vs VSBasicPixelLightingTxVc
 call :CompileShader%1 BasicEffect vs VSBasicPixelLightingTxVcBn
 
+call :CompileShaderSM4%1 BasicEffect vs VSBasicPixelLightingInst
+call :CompileShaderSM4%1 BasicEffect vs VSBasicPixelLightingBnInst
+call :CompileShaderSM4%1 BasicEffect vs VSBasicPixelLightingVcInst
+call :CompileShaderSM4%1 BasicEffect vs VSBasicPixelLightingVcBnInst
+call :CompileShaderSM4%1 BasicEffect vs VSBasicPixelLightingTxInst
+call :CompileShaderSM4%1 BasicEffect vs VSBasicPixelLightingTxBnInst
+call :CompileShaderSM4%1 BasicEffect vs VSBasicPixelLightingTxVcInst
+call :CompileShaderSM4%1 BasicEffect vs VSBasicPixelLightingTxVcBnInst
+
 call :CompileShader%1 BasicEffect ps PSBasic
 call :CompileShader%1 BasicEffect ps PSBasicNoFog
 call :CompileShader%1 BasicEffect ps PSBasicTx
@@ -157,11 +166,21 @@ call :CompileShaderSM4%1 NormalMapEffect vs VSNormalPixelLightingTxBn
 call :CompileShaderSM4%1 NormalMapEffect vs VSNormalPixelLightingTxVc
 call :CompileShaderSM4%1 NormalMapEffect vs VSNormalPixelLightingTxVcBn
 
+call :CompileShaderSM4%1 NormalMapEffect vs VSNormalPixelLightingTxInst
+call :CompileShaderSM4%1 NormalMapEffect vs VSNormalPixelLightingTxBnInst
+call :CompileShaderSM4%1 NormalMapEffect vs VSNormalPixelLightingTxVcInst
+call :CompileShaderSM4%1 NormalMapEffect vs VSNormalPixelLightingTxVcBnInst
+
 call :CompileShaderSM4%1 NormalMapEffect ps PSNormalPixelLightingTx
 call :CompileShaderSM4%1 NormalMapEffect ps PSNormalPixelLightingTxNoFog
 call :CompileShaderSM4%1 NormalMapEffect ps PSNormalPixelLightingTxNoSpec
 call :CompileShaderSM4%1 NormalMapEffect ps PSNormalPixelLightingTxNoFogSpec
 
+call :CompileShaderSM5%1 NormalMapEffectClustered ps PSClusteredLightingTx
+call :CompileShaderSM5%1 NormalMapEffectClustered ps PSClusteredLightingTxNoFog
+call :CompileShaderSM5%1 NormalMapEffectClustered ps PSClusteredLightingTxNoSpec
+call :CompileShaderSM5%1 NormalMapEffectClustered ps PSClusteredLightingTxNoFogSpec
+
 call :CompileShaderSM4%1 PBREffect vs VSConstant
 call :CompileShaderSM4%1 PBREffect vs VSConstantVelocity
 call :CompileShaderSM4%1 PBREffect vs VSConstantBn
@@ -270,6 +289,13 @@ echo %fxc%
 %fxc% || set error=1
 exit /b
 
+:CompileShaderSM5
+set fxc=%PCFXC% %1.fx %FXCOPTS% /T%2_5_0 /E%3 /FhCompiled\%1_%3.inc /FdCompiled\%1_%3.pdb /Vn%1_%3
+echo.
+echo %fxc%
+%fxc% || set error=1
+exit /b
+
 :CompileShaderHLSL
 set fxc=%PCFXC% %1.hlsl %FXCOPTS% /T%2_4_0_level_9_1 /E%3 /FhCompiled\%1_%3.inc /FdCompiled\%1_%3.pdb /Vn%1_%3
 echo.
@@ -279,6 +305,7 @@ exit /b
 
 :CompileShaderxbox
 :CompileShaderSM4xbox
+:CompileShaderSM5xbox
 set fxc=%XBOXFXC% %1.fx %FXCOPTS% /T%2_5_0 %XBOXOPTS% /E%3 /FhCompiled\XboxOne%1_%3.inc /FdCompiled\XboxOne%1_%3.pdb /Vn%1_%3
 echo.
 echo %fxc%
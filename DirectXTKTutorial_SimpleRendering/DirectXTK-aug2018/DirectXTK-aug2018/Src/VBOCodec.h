@@ -0,0 +1,32 @@
+//--------------------------------------------------------------------------------------
+// File: VBOCodec.h
+//
+// Encoder and decoder for the compressed version 2 of the VBO file format
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+
+#include "VertexTypes.h"
+
+
+namespace VBO
+{
+    // Returns true if the data starts with a version 2 header.
+    bool IsCompressed(_In_reads_bytes_(dataSize) const uint8_t* meshData, size_t dataSize);
+
+    // Decodes a version 2 file. Vertices are decoded 16 at a time using SSE2 where available.
+    void Decompress(_In_reads_bytes_(dataSize) const uint8_t* meshData, size_t dataSize,
+                    std::vector<DirectX::VertexPositionNormalTexture>& vertices, std::vector<uint16_t>& indices);
+
+    // Encodes a mesh as a version 2 file.
+    void Compress(_In_reads_(nVerts) const DirectX::VertexPositionNormalTexture* vertices, size_t nVerts,
+                  _In_reads_(nIndices) const uint16_t* indices, size_t nIndices,
+                  std::vector<uint8_t>& meshData);
+}
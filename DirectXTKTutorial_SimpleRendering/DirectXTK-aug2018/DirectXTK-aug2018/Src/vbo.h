@@ -27,9 +27,38 @@ namespace VBO
         uint32_t numIndices;
     };
 
+    // Version 2 stores the same mesh compressed. Vertices are quantized (positions and texture coordinates
+    // to 16 bits within their bounds, normals to 16-bit octahedral), then delta coded per byte in blocks
+    // of 16 vertices, with each byte lane of a block packed into 0, 2, 4, or 8 bits per vertex. Indices are
+    // delta coded as zigzag varints. The magic value can't start a version 1 file of the same size.
+    const uint32_t VBO2_MAGIC = 0x324F4256; // "VBO2"
+    const uint32_t VBO2_BLOCK_SIZE = 16;
+
+    struct header2_t
+    {
+        uint32_t magic;
+        uint32_t numVertices;
+        uint32_t numIndices;
+        uint32_t vertexDataSize;
+        uint32_t indexDataSize;
+        float    positionMin[3];
+        float    positionScale[3];
+        float    textureMin[2];
+        float    textureScale[2];
+    };
+
+    struct packed_vertex_t
+    {
+        uint16_t position[3];
+        int16_t  normal[2];
+        uint16_t textureCoordinate[2];
+    };
+
 #pragma pack(pop)
 
 } // namespace
 
 static_assert(sizeof(VBO::header_t) == 8, "VBO header size mismatch");
+static_assert(sizeof(VBO::header2_t) == 60, "VBO2 header size mismatch");
+static_assert(sizeof(VBO::packed_vertex_t) == 14, "VBO2 vertex size mismatch");
 
@@ -0,0 +1,65 @@
+//--------------------------------------------------------------------------------------
+// File: ModelLoader.h
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include "Model.h"
+
+#include <future>
+#include <memory>
+
+
+namespace DirectX
+{
+    // Loads models on a pool of worker threads. File reads, parsing, and buffer creation run on the workers,
+    // and each future is ready as soon as its geometry and effects exist. Textures are loaded in the background,
+    // shared between all models that reference them, and bound to the effects by Update.
+    class ModelLoader
+    {
+    public:
+        ModelLoader(_In_ ID3D11Device* device, IEffectFactory& fxFactory, size_t threadCount = 0);
+        ModelLoader(ModelLoader&& moveFrom) noexcept;
+        ModelLoader& operator= (ModelLoader&& moveFrom) noexcept;
+
+        ModelLoader(ModelLoader const&) = delete;
+        ModelLoader& operator= (ModelLoader const&) = delete;
+
+        // Work still queued when the loader is destroyed is abandoned, and its futures report std::future_error.
+        virtual ~ModelLoader();
+
+        // Queue a model for loading. Errors are reported when the future is read. The options are processed on the worker.
+        std::future<std::unique_ptr<Model>> __cdecl LoadCMO(_In_z_ const wchar_t* szFileName, bool ccw = true, bool pmalpha = false,
+                                                            const ModelLoaderOptions& options = ModelLoaderOptions());
+        std::future<std::unique_ptr<Model>> __cdecl LoadSDKMESH(_In_z_ const wchar_t* szFileName, bool ccw = false, bool pmalpha = false,
+                                                                const ModelLoaderOptions& options = ModelLoaderOptions());
+        std::future<std::unique_ptr<Model>> __cdecl LoadVBO(_In_z_ const wchar_t* szFileName, std::shared_ptr<IEffect> ieffect = nullptr, bool ccw = false, bool pmalpha = false,
+                                                            const ModelLoaderOptions& options = ModelLoaderOptions());
+        std::future<std::unique_ptr<Model>> __cdecl LoadBMDL(_In_z_ const wchar_t* szFileName);
+
+        // Binds textures that have finished loading to their effects. Effects are not thread-safe, so call this
+        // from the thread that renders with them. Returns the number of effects still waiting on textures.
+        size_t __cdecl Update();
+
+        // Blocks until all queued models and textures are loaded. Call Update afterwards to bind the textures.
+        void __cdecl WaitForAll();
+
+        // Settings.
+        void __cdecl ReleaseCache();
+
+        void __cdecl EnableForceSRGB(bool forceSRGB);
+
+        void __cdecl SetDirectory(_In_opt_z_ const wchar_t* path);
+
+    private:
+        // Private implementation.
+        class Impl;
+
+        std::unique_ptr<Impl> pImpl;
+    };
+}
@@ -0,0 +1,68 @@
+//--------------------------------------------------------------------------------------
+// File: TransparentQueue.h
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#if defined(_XBOX_ONE) && defined(_TITLE)
+#include <d3d11_x.h>
+#else
+#include <d3d11_1.h>
+#endif
+
+#include <DirectXMath.h>
+
+#include <functional>
+#include <memory>
+
+
+namespace DirectX
+{
+    class CommonStates;
+    class Model;
+    class ModelMesh;
+
+    // Collects the alpha parts of meshes from any number of models, and draws them back to front by the centers
+    // of the mesh bounding spheres, after all the opaque geometry is drawn. The parts of each mesh keep their order.
+    // Meshes are referenced rather than copied, so they must outlive the queue's next Clear.
+    class TransparentQueue
+    {
+    public:
+        TransparentQueue() noexcept(false);
+        TransparentQueue(TransparentQueue&& moveFrom) noexcept;
+        TransparentQueue& operator= (TransparentQueue&& moveFrom) noexcept;
+
+        TransparentQueue(TransparentQueue const&) = delete;
+        TransparentQueue& operator= (TransparentQueue const&) = delete;
+
+        virtual ~TransparentQueue();
+
+        // Queue the meshes of a model that have alpha parts, or a single mesh, placed by world. Model::Draw with a
+        // queue submits only the meshes that pass its frustum culling.
+        void XM_CALLCONV Submit(const Model& model, FXMMATRIX world);
+        void XM_CALLCONV Submit(const ModelMesh& mesh, FXMMATRIX world);
+
+        // Order the queued meshes from the farthest to the nearest, by the depth of their centers in clip space.
+        void XM_CALLCONV Sort(FXMMATRIX view, CXMMATRIX projection);
+
+        // Sort and draw the alpha parts of the queued meshes. The queue is kept, so call Clear before the next frame.
+        void XM_CALLCONV Draw(_In_ ID3D11DeviceContext* deviceContext, const CommonStates& states, FXMMATRIX view, CXMMATRIX projection,
+                              bool wireframe = false, _In_opt_ std::function<void __cdecl()> setCustomState = nullptr);
+
+        void __cdecl Clear();
+
+        // Number of queued meshes.
+        size_t __cdecl GetCount() const;
+
+    private:
+        // Private implementation.
+        class Impl;
+
+        std::unique_ptr<Impl> pImpl;
+    };
+}
@@ -42,12 +42,16 @@ struct BasicEffectTraits
 {
     using ConstantBufferType = BasicEffectConstants;
 
-    static const int VertexShaderCount = 32;
+    static const int VertexShaderCount = 40;
     static const int PixelShaderCount = 10;
-    static const int ShaderPermutationCount = 56;
+    static const int ShaderPermutationCount = 64;
 };
 
 
+// Permutations from this one on use the instanced vertex shaders, which need Shader Model 4.0.
+static const int InstancedPermutationStart = 56;
+
+
 // Internal BasicEffect implementation class.
 class BasicEffect::Impl : public EffectBase<BasicEffectTraits>
 {
@@ -59,6 +63,8 @@ public:
     bool vertexColorEnabled;
     bool textureEnabled;
     bool biasedVertexNormals;
+    bool instancingEnabled;
+    bool instancingSupported;
 
     EffectLights lights;
 
@@ -68,6 +74,18 @@ public:
 };
 
 
+// The instanced shaders need Shader Model 4.0, and are built in once CompileShaders has generated them.
+#if !defined(BASICEFFECT_INSTANCED_SHADERS) && defined(__has_include)
+#if defined(_XBOX_ONE) && defined(_TITLE)
+#if __has_include("Shaders/Compiled/XboxOneBasicEffect_VSBasicPixelLightingInst.inc")
+#define BASICEFFECT_INSTANCED_SHADERS
+#endif
+#elif __has_include("Shaders/Compiled/BasicEffect_VSBasicPixelLightingInst.inc")
+#define BASICEFFECT_INSTANCED_SHADERS
+#endif
+#endif
+
+
 // Include the precompiled shader code.
 namespace
 {
@@ -111,6 +129,18 @@ namespace
     #include "Shaders/Compiled/XboxOneBasicEffect_VSBasicPixelLightingTxBn.inc"
     #include "Shaders/Compiled/XboxOneBasicEffect_VSBasicPixelLightingTxVcBn.inc"
 
+    #if defined(BASICEFFECT_INSTANCED_SHADERS)
+    #include "Shaders/Compiled/XboxOneBasicEffect_VSBasicPixelLightingInst.inc"
+    #include "Shaders/Compiled/XboxOneBasicEffect_VSBasicPixelLightingVcInst.inc"
+    #include "Shaders/Compiled/XboxOneBasicEffect_VSBasicPixelLightingTxInst.inc"
+    #include "Shaders/Compiled/XboxOneBasicEffect_VSBasicPixelLightingTxVcInst.inc"
+
+    #include "Shaders/Compiled/XboxOneBasicEffect_VSBasicPixelLightingBnInst.inc"
+    #include "Shaders/Compiled/XboxOneBasicEffect_VSBasicPixelLightingVcBnInst.inc"
+    #include "Shaders/Compiled/XboxOneBasicEffect_VSBasicPixelLightingTxBnInst.inc"
+    #include "Shaders/Compiled/XboxOneBasicEffect_VSBasicPixelLightingTxVcBnInst.inc"
+    #endif
+
     #include "Shaders/Compiled/XboxOneBasicEffect_PSBasic.inc"
     #include "Shaders/Compiled/XboxOneBasicEffect_PSBasicNoFog.inc"
     #include "Shaders/Compiled/XboxOneBasicEffect_PSBasicTx.inc"
@@ -163,6 +193,18 @@ namespace
     #include "Shaders/Compiled/BasicEffect_VSBasicPixelLightingTxBn.inc"
     #include "Shaders/Compiled/BasicEffect_VSBasicPixelLightingTxVcBn.inc"
 
+    #if defined(BASICEFFECT_INSTANCED_SHADERS)
+    #include "Shaders/Compiled/BasicEffect_VSBasicPixelLightingInst.inc"
+    #include "Shaders/Compiled/BasicEffect_VSBasicPixelLightingVcInst.inc"
+    #include "Shaders/Compiled/BasicEffect_VSBasicPixelLightingTxInst.inc"
+    #include "Shaders/Compiled/BasicEffect_VSBasicPixelLightingTxVcInst.inc"
+
+    #include "Shaders/Compiled/BasicEffect_VSBasicPixelLightingBnInst.inc"
+    #include "Shaders/Compiled/BasicEffect_VSBasicPixelLightingVcBnInst.inc"
+    #include "Shaders/Compiled/BasicEffect_VSBasicPixelLightingTxBnInst.inc"
+    #include "Shaders/Compiled/BasicEffect_VSBasicPixelLightingTxVcBnInst.inc"
+    #endif
+
     #include "Shaders/Compiled/BasicEffect_PSBasic.inc"
     #include "Shaders/Compiled/BasicEffect_PSBasicNoFog.inc"
     #include "Shaders/Compiled/BasicEffect_PSBasicTx.inc"
@@ -220,6 +262,28 @@ const ShaderBytecode EffectBase<BasicEffectTraits>::VertexShaderBytecode[] =
     { BasicEffect_VSBasicPixelLightingVcBn,    sizeof(BasicEffect_VSBasicPixelLightingVcBn)    },
     { BasicEffect_VSBasicPixelLightingTxBn,    sizeof(BasicEffect_VSBasicPixelLightingTxBn)    },
     { BasicEffect_VSBasicPixelLightingTxVcBn,  sizeof(BasicEffect_VSBasicPixelLightingTxVcBn)  },
+
+#if defined(BASICEFFECT_INSTANCED_SHADERS)
+    { BasicEffect_VSBasicPixelLightingInst,       sizeof(BasicEffect_VSBasicPixelLightingInst)       },
+    { BasicEffect_VSBasicPixelLightingVcInst,     sizeof(BasicEffect_VSBasicPixelLightingVcInst)     },
+    { BasicEffect_VSBasicPixelLightingTxInst,     sizeof(BasicEffect_VSBasicPixelLightingTxInst)     },
+    { BasicEffect_VSBasicPixelLightingTxVcInst,   sizeof(BasicEffect_VSBasicPixelLightingTxVcInst)   },
+
+    { BasicEffect_VSBasicPixelLightingBnInst,     sizeof(BasicEffect_VSBasicPixelLightingBnInst)     },
+    { BasicEffect_VSBasicPixelLightingVcBnInst,   sizeof(BasicEffect_VSBasicPixelLightingVcBnInst)   },
+    { BasicEffect_VSBasicPixelLightingTxBnInst,   sizeof(BasicEffect_VSBasicPixelLightingTxBnInst)   },
+    { BasicEffect_VSBasicPixelLightingTxVcBnInst, sizeof(BasicEffect_VSBasicPixelLightingTxVcBnInst) },
+#else
+    // Never created, as instancing is reported unsupported without its shaders.
+    { nullptr, 0 },
+    { nullptr, 0 },
+    { nullptr, 0 },
+    { nullptr, 0 },
+    { nullptr, 0 },
+    { nullptr, 0 },
+    { nullptr, 0 },
+    { nullptr, 0 },
+#endif
 };
 
 
@@ -288,6 +352,15 @@ const int EffectBase<BasicEffectTraits>::VertexShaderIndices[] =
     30,     // pixel lighting (biased vertex normals) + texture, no fog
     31,     // pixel lighting (biased vertex normals) + texture + vertex color
     31,     // pixel lighting (biased vertex normals) + texture + vertex color, no fog
+
+    32,     // instancing
+    33,     // instancing + vertex color
+    34,     // instancing + texture
+    35,     // instancing + texture + vertex color
+    36,     // instancing (biased vertex normals)
+    37,     // instancing (biased vertex normals) + vertex color
+    38,     // instancing (biased vertex normals) + texture
+    39,     // instancing (biased vertex normals) + texture + vertex color
 };
 
 
@@ -374,6 +447,15 @@ const int EffectBase<BasicEffectTraits>::PixelShaderIndices[] =
     9,      // pixel lighting (biased vertex normals) + texture, no fog
     9,      // pixel lighting (biased vertex normals) + texture + vertex color
     9,      // pixel lighting (biased vertex normals) + texture + vertex color, no fog
+
+    8,      // instancing
+    8,      // instancing + vertex color
+    9,      // instancing + texture
+    9,      // instancing + texture + vertex color
+    8,      // instancing (biased vertex normals)
+    8,      // instancing (biased vertex normals) + vertex color
+    9,      // instancing (biased vertex normals) + texture
+    9,      // instancing (biased vertex normals) + texture + vertex color
 };
 
 
@@ -389,7 +471,13 @@ BasicEffect::Impl::Impl(_In_ ID3D11Device* device)
     preferPerPixelLighting(false),
     vertexColorEnabled(false),
     textureEnabled(false),
-    biasedVertexNormals(false)
+    biasedVertexNormals(false),
+    instancingEnabled(false),
+#if defined(BASICEFFECT_INSTANCED_SHADERS)
+    instancingSupported(device->GetFeatureLevel() >= D3D_FEATURE_LEVEL_10_0)
+#else
+    instancingSupported(false)
+#endif
 {
     static_assert(_countof(EffectBase<BasicEffectTraits>::VertexShaderIndices) == BasicEffectTraits::ShaderPermutationCount, "array/max mismatch");
     static_assert(_countof(EffectBase<BasicEffectTraits>::VertexShaderBytecode) == BasicEffectTraits::VertexShaderCount, "array/max mismatch");
@@ -402,6 +490,34 @@ BasicEffect::Impl::Impl(_In_ ID3D11Device* device)
 
 int BasicEffect::Impl::GetCurrentShaderPermutation() const
 {
+    if (instancingEnabled)
+    {
+        // Instances are lit per pixel, reading their world matrices in the vertex shader.
+        if (!lightingEnabled)
+        {
+            throw std::exception("BasicEffect instancing requires lighting to be enabled");
+        }
+
+        int permutation = InstancedPermutationStart;
+
+        if (vertexColorEnabled)
+        {
+            permutation += 1;
+        }
+
+        if (textureEnabled)
+        {
+            permutation += 2;
+        }
+
+        if (biasedVertexNormals)
+        {
+            permutation += 4;
+        }
+
+        return permutation;
+    }
+
     int permutation = 0;
 
     // Use optimized shaders if fog is disabled.
@@ -466,7 +582,7 @@ void BasicEffect::Impl::Apply(_In_ ID3D11DeviceContext* deviceContext)
     {
         ID3D11ShaderResourceView* textures[1] = { texture.Get() };
 
-        deviceContext->PSSetShaderResources(0, 1, textures);
+        StateFilter::PSSetShaderResources(deviceContext, 0, 1, textures);
     }
 
     // Set shaders and constant buffers.
@@ -515,6 +631,27 @@ void BasicEffect::GetVertexShaderBytecode(_Out_ void const** pShaderByteCode, _O
 }
 
 
+void BasicEffect::CreateShaders(bool allPermutations)
+{
+    if (!allPermutations)
+    {
+        pImpl->CreateShaders(pImpl->GetCurrentShaderPermutation());
+    }
+    else if (pImpl->instancingSupported)
+    {
+        pImpl->CreateShaders(-1);
+    }
+    else
+    {
+        // The instanced shaders can't be created below Feature Level 10.0, or when they weren't built in.
+        for (int permutation = 0; permutation < InstancedPermutationStart; ++permutation)
+        {
+            pImpl->CreateShaders(permutation);
+        }
+    }
+}
+
+
 // Camera settings.
 void XM_CALLCONV BasicEffect::SetWorld(FXMMATRIX value)
 {
@@ -550,6 +687,14 @@ void XM_CALLCONV BasicEffect::SetMatrices(FXMMATRIX world, CXMMATRIX view, CXMMA
 }
 
 
+void BasicEffect::SetDerivedMatrices(const EffectDerivedMatrices& value)
+{
+    pImpl->matrices.SetDerived(pImpl->dirtyFlags, value, pImpl->constants.worldViewProj);
+
+    EffectMatrices::SetDerivedWorldConstants(pImpl->dirtyFlags, value, pImpl->constants.world, pImpl->constants.worldInverseTranspose);
+}
+
+
 // Material settings.
 void XM_CALLCONV BasicEffect::SetDiffuseColor(FXMVECTOR value)
 {
@@ -728,3 +873,15 @@ void BasicEffect::SetBiasedVertexNormals(bool value)
 {
     pImpl->biasedVertexNormals = value;
 }
+
+
+// Instancing settings.
+void BasicEffect::SetInstancingEnabled(bool value)
+{
+    if (value && !pImpl->instancingSupported)
+    {
+        throw std::exception("BasicEffect instancing requires Feature Level 10.0 or later, and its shaders built by CompileShaders");
+    }
+
+    pImpl->instancingEnabled = value;
+}
@@ -1128,29 +1128,250 @@ namespace
 {
 #include "TeapotData.inc"
 
-    // Tessellates the specified bezier patch.
-    void XM_CALLCONV TessellatePatch(VertexCollection& vertices, IndexCollection& indices, TeapotPatch const& patch, size_t tessellation, FXMVECTOR scale, bool isMirrored)
+    // A bicubic bezier patch ready for tessellation. The control point indices identify
+    // the edges shared between neighboring patches.
+    struct PatchInstance
     {
-        // Look up the 16 control points for this patch.
-        XMVECTOR controlPoints[16];
+        XMFLOAT3 controlPoints[16];
+        uint32_t indices[16];
+        bool isMirrored;
+        size_t tessellation;
+    };
+
+    typedef std::array<uint32_t, 4> PatchEdge;
+
+
+    // Control points along each edge of a patch, in order: u = 0, u = 1, v = 0, v = 1.
+    const size_t PatchEdgeControlPoints[4][4] =
+    {
+        { 0, 4, 8, 12 },
+        { 3, 7, 11, 15 },
+        { 0, 1, 2, 3 },
+        { 12, 13, 14, 15 },
+    };
+
+
+    // Looks up the key identifying an edge, which is independent of the direction it is walked in.
+    PatchEdge GetPatchEdge(PatchInstance const& patch, size_t edge)
+    {
+        PatchEdge key;
 
-        for (int i = 0; i < 16; i++)
+        for (size_t i = 0; i < 4; i++)
         {
-            controlPoints[i] = XMVectorMultiply(TeapotControlPoints[patch.indices[i]], scale);
+            key[i] = patch.indices[PatchEdgeControlPoints[edge][i]];
         }
 
-        // Create the index data.
-        size_t vbase = vertices.size();
-        Bezier::CreatePatchIndices(tessellation, isMirrored, [&](size_t index)
-                                   {
-                                       index_push_back(indices, vbase + index);
-                                   });
-
-                                   // Create the vertex data.
-        Bezier::CreatePatchVertices(controlPoints, tessellation, isMirrored, [&](FXMVECTOR position, FXMVECTOR normal, FXMVECTOR textureCoordinate)
-                                    {
-                                        vertices.push_back(VertexPositionNormalTexture(position, normal, textureCoordinate));
-                                    });
+        if (std::lexicographical_compare(key.rbegin(), key.rend(), key.begin(), key.end()))
+        {
+            std::reverse(key.begin(), key.end());
+        }
+
+        return key;
+    }
+
+
+    // Picks the power-of-two tessellation that keeps a patch within the given distance of its
+    // true surface, using Wang's formula on the second differences of the rows and columns.
+    size_t ComputePatchTessellation(PatchInstance const& patch, float tolerance, size_t maxTessellation)
+    {
+        XMVECTOR maxLength = g_XMZero;
+
+        for (size_t i = 0; i < 4; i++)
+        {
+            for (size_t j = 0; j < 2; j++)
+            {
+                XMVECTOR r0 = XMLoadFloat3(&patch.controlPoints[i * 4 + j]);
+                XMVECTOR r1 = XMLoadFloat3(&patch.controlPoints[i * 4 + j + 1]);
+                XMVECTOR r2 = XMLoadFloat3(&patch.controlPoints[i * 4 + j + 2]);
+
+                XMVECTOR c0 = XMLoadFloat3(&patch.controlPoints[j * 4 + i]);
+                XMVECTOR c1 = XMLoadFloat3(&patch.controlPoints[(j + 1) * 4 + i]);
+                XMVECTOR c2 = XMLoadFloat3(&patch.controlPoints[(j + 2) * 4 + i]);
+
+                XMVECTOR rowDelta = XMVectorAdd(XMVectorSubtract(r0, XMVectorAdd(r1, r1)), r2);
+                XMVECTOR columnDelta = XMVectorAdd(XMVectorSubtract(c0, XMVectorAdd(c1, c1)), c2);
+
+                maxLength = XMVectorMax(maxLength, XMVectorMax(XMVector3Length(rowDelta), XMVector3Length(columnDelta)));
+            }
+        }
+
+        // Segments needed for a cubic is sqrt(n * (n - 1) / 8 * maxLength / tolerance), with n = 3.
+        float segments = sqrtf(0.75f * XMVectorGetX(maxLength) / tolerance);
+
+        size_t tessellation = 1;
+
+        while (tessellation * 2 <= maxTessellation && float(tessellation) < segments)
+        {
+            tessellation *= 2;
+        }
+
+        return tessellation;
+    }
+
+
+    // Moves the vertices along one edge of a patch onto the coarser polyline of its neighbor,
+    // so that patches tessellated at different levels do not crack apart.
+    void SnapPatchEdge(VertexCollection& vertices, size_t vbase, size_t tessellation, size_t edge, size_t edgeTessellation)
+    {
+        if (edgeTessellation >= tessellation)
+            return;
+
+        size_t stride = tessellation + 1;
+        size_t step = tessellation / edgeTessellation;
+
+        auto vertexIndex = [=](size_t k) -> size_t
+        {
+            switch (edge)
+            {
+                case 0:  return vbase + k;
+                case 1:  return vbase + tessellation * stride + k;
+                case 2:  return vbase + k * stride;
+                default: return vbase + k * stride + tessellation;
+            }
+        };
+
+        for (size_t k = 0; k < tessellation; k += step)
+        {
+            auto const& start = vertices[vertexIndex(k)];
+            auto const& end = vertices[vertexIndex(k + step)];
+
+            XMVECTOR p0 = XMLoadFloat3(&start.position);
+            XMVECTOR p1 = XMLoadFloat3(&end.position);
+            XMVECTOR n0 = XMLoadFloat3(&start.normal);
+            XMVECTOR n1 = XMLoadFloat3(&end.normal);
+
+            for (size_t i = 1; i < step; i++)
+            {
+                float t = float(i) / step;
+
+                auto& vertex = vertices[vertexIndex(k + i)];
+
+                XMStoreFloat3(&vertex.position, XMVectorLerp(p0, p1, t));
+                XMStoreFloat3(&vertex.normal, XMVector3Normalize(XMVectorLerp(n0, n1, t)));
+            }
+        }
+    }
+
+
+    // Tessellates the specified bezier patches, each at its own level. Edges shared by two
+    // patches use the coarser of the two levels.
+    void TessellatePatches(VertexCollection& vertices, IndexCollection& indices, std::vector<PatchInstance> const& patches)
+    {
+        std::map<PatchEdge, size_t> edgeTessellation;
+
+        for (auto it = patches.cbegin(); it != patches.cend(); ++it)
+        {
+            for (size_t edge = 0; edge < 4; edge++)
+            {
+                auto result = edgeTessellation.insert(std::make_pair(GetPatchEdge(*it, edge), it->tessellation));
+
+                if (!result.second)
+                {
+                    result.first->second = std::min(result.first->second, it->tessellation);
+                }
+            }
+        }
+
+        // Basis tables are shared by all the patches tessellated at the same level.
+        std::map<size_t, std::unique_ptr<Bezier::BasisTable>> basisTables;
+
+        for (auto it = patches.cbegin(); it != patches.cend(); ++it)
+        {
+            auto& basis = basisTables[it->tessellation];
+
+            if (!basis)
+            {
+                basis = std::make_unique<Bezier::BasisTable>(it->tessellation);
+            }
+
+            XMVECTOR controlPoints[16];
+
+            for (size_t i = 0; i < 16; i++)
+            {
+                controlPoints[i] = XMLoadFloat3(&it->controlPoints[i]);
+            }
+
+            // Create the index data.
+            size_t vbase = vertices.size();
+            Bezier::CreatePatchIndices(it->tessellation, it->isMirrored, [&](size_t index)
+                                       {
+                                           index_push_back(indices, vbase + index);
+                                       });
+
+            // Create the vertex data.
+            Bezier::CreatePatchVertices(controlPoints, *basis, it->isMirrored, [&](FXMVECTOR position, FXMVECTOR normal, FXMVECTOR textureCoordinate)
+                                        {
+                                            vertices.push_back(VertexPositionNormalTexture(position, normal, textureCoordinate));
+                                        });
+
+            for (size_t edge = 0; edge < 4; edge++)
+            {
+                SnapPatchEdge(vertices, vbase, it->tessellation, edge, edgeTessellation[GetPatchEdge(*it, edge)]);
+            }
+        }
+    }
+
+
+    // Adds a copy of the specified teapot patch to the list.
+    void XM_CALLCONV AddTeapotPatch(std::vector<PatchInstance>& patches, TeapotPatch const& patch, FXMVECTOR scale, bool isMirrored)
+    {
+        PatchInstance instance = {};
+
+        for (size_t i = 0; i < 16; i++)
+        {
+            XMStoreFloat3(&instance.controlPoints[i], XMVectorMultiply(TeapotControlPoints[patch.indices[i]], scale));
+            instance.indices[i] = static_cast<uint32_t>(patch.indices[i]);
+        }
+
+        instance.isMirrored = isMirrored;
+
+        patches.push_back(instance);
+    }
+
+
+    // Creates the full set of teapot patches.
+    void CreateTeapotPatches(std::vector<PatchInstance>& patches, float size)
+    {
+        XMVECTOR scaleVector = XMVectorReplicate(size);
+
+        XMVECTOR scaleNegateX = XMVectorMultiply(scaleVector, g_XMNegateX);
+        XMVECTOR scaleNegateZ = XMVectorMultiply(scaleVector, g_XMNegateZ);
+        XMVECTOR scaleNegateXZ = XMVectorMultiply(scaleVector, XMVectorMultiply(g_XMNegateX, g_XMNegateZ));
+
+        for (size_t i = 0; i < _countof(TeapotPatches); i++)
+        {
+            TeapotPatch const& patch = TeapotPatches[i];
+
+            // Because the teapot is symmetrical from left to right, we only store
+            // data for one side, then tessellate each patch twice, mirroring in X.
+            AddTeapotPatch(patches, patch, scaleVector, false);
+            AddTeapotPatch(patches, patch, scaleNegateX, true);
+
+            if (patch.mirrorZ)
+            {
+                // Some parts of the teapot (the body, lid, and rim, but not the
+                // handle or spout) are also symmetrical from front to back, so
+                // we tessellate them four times, mirroring in Z as well as X.
+                AddTeapotPatch(patches, patch, scaleNegateZ, true);
+                AddTeapotPatch(patches, patch, scaleNegateXZ, false);
+            }
+        }
+    }
+
+
+    // Assigns each patch a tessellation level from its flatness.
+    void ComputeAdaptiveTessellation(std::vector<PatchInstance>& patches, float tolerance, size_t maxTessellation)
+    {
+        if (tolerance <= 0)
+            throw std::out_of_range("tolerance parameter out of range");
+
+        if (maxTessellation < 1)
+            throw std::out_of_range("tesselation parameter out of range");
+
+        for (auto it = patches.begin(); it != patches.end(); ++it)
+        {
+            it->tessellation = ComputePatchTessellation(*it, tolerance, maxTessellation);
+        }
     }
 }
 
@@ -1164,31 +1385,78 @@ void DirectX::ComputeTeapot(VertexCollection& vertices, IndexCollection& indices
     if (tessellation < 1)
         throw std::out_of_range("tesselation parameter out of range");
 
-    XMVECTOR scaleVector = XMVectorReplicate(size);
+    std::vector<PatchInstance> patches;
+    CreateTeapotPatches(patches, size);
 
-    XMVECTOR scaleNegateX = XMVectorMultiply(scaleVector, g_XMNegateX);
-    XMVECTOR scaleNegateZ = XMVectorMultiply(scaleVector, g_XMNegateZ);
-    XMVECTOR scaleNegateXZ = XMVectorMultiply(scaleVector, XMVectorMultiply(g_XMNegateX, g_XMNegateZ));
-
-    for (size_t i = 0; i < _countof(TeapotPatches); i++)
+    for (auto it = patches.begin(); it != patches.end(); ++it)
     {
-        TeapotPatch const& patch = TeapotPatches[i];
+        it->tessellation = tessellation;
+    }
 
-        // Because the teapot is symmetrical from left to right, we only store
-        // data for one side, then tessellate each patch twice, mirroring in X.
-        TessellatePatch(vertices, indices, patch, tessellation, scaleVector, false);
-        TessellatePatch(vertices, indices, patch, tessellation, scaleNegateX, true);
+    TessellatePatches(vertices, indices, patches);
 
-        if (patch.mirrorZ)
+    // Built RH above
+    if (!rhcoords)
+        ReverseWinding(indices, vertices);
+}
+
+
+// Creates a teapot primitive, tessellating each patch only as finely as its curvature requires.
+void DirectX::ComputeTeapotAdaptive(VertexCollection& vertices, IndexCollection& indices, float size, float tolerance, size_t maxTessellation, bool rhcoords)
+{
+    vertices.clear();
+    indices.clear();
+
+    std::vector<PatchInstance> patches;
+    CreateTeapotPatches(patches, size);
+
+    ComputeAdaptiveTessellation(patches, tolerance, maxTessellation);
+
+    TessellatePatches(vertices, indices, patches);
+
+    // Built RH above
+    if (!rhcoords)
+        ReverseWinding(indices, vertices);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Bezier patches
+//--------------------------------------------------------------------------------------
+
+// Creates a mesh from user-supplied bicubic bezier patches, 16 control point indices per patch.
+void DirectX::ComputeBezierPatches(VertexCollection& vertices, IndexCollection& indices, const XMFLOAT3* controlPoints, size_t controlPointCount, const uint32_t* patchIndices, size_t patchCount, float tolerance, size_t maxTessellation, bool rhcoords)
+{
+    vertices.clear();
+    indices.clear();
+
+    if (!controlPointCount || !patchCount)
+        throw std::exception("Requires both control points and patches");
+
+    std::vector<PatchInstance> patches(patchCount);
+
+    for (size_t j = 0; j < patchCount; j++)
+    {
+        auto& patch = patches[j];
+
+        for (size_t i = 0; i < 16; i++)
         {
-            // Some parts of the teapot (the body, lid, and rim, but not the
-            // handle or spout) are also symmetrical from front to back, so
-            // we tessellate them four times, mirroring in Z as well as X.
-            TessellatePatch(vertices, indices, patch, tessellation, scaleNegateZ, true);
-            TessellatePatch(vertices, indices, patch, tessellation, scaleNegateXZ, false);
+            uint32_t index = patchIndices[j * 16 + i];
+
+            if (index >= controlPointCount)
+                throw std::exception("Index not in control points list");
+
+            patch.controlPoints[i] = controlPoints[index];
+            patch.indices[i] = index;
         }
+
+        patch.isMirrored = false;
     }
 
+    ComputeAdaptiveTessellation(patches, tolerance, maxTessellation);
+
+    TessellatePatches(vertices, indices, patches);
+
     // Built RH above
     if (!rhcoords)
         ReverseWinding(indices, vertices);
@@ -0,0 +1,599 @@
+//--------------------------------------------------------------------------------------
+// File: LightClusters.cpp
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#include "pch.h"
+#include "LightClusters.h"
+#include "DirectXHelpers.h"
+#include "PlatformHelpers.h"
+
+using namespace DirectX;
+using Microsoft::WRL::ComPtr;
+
+
+namespace
+{
+    const uint32_t MaxClusters = 1u << 20;
+
+    // Light as the shaders read it, matching ClusterLight in Shaders/LightClusters.fxh. Spot attenuation is
+    // saturate(dot(-L, direction) * spotScale + spotOffset), which is always 1 for point lights.
+    struct ClusterLight
+    {
+        XMFLOAT3 position;
+        float range;
+        XMFLOAT3 color;
+        float spotScale;
+        XMFLOAT3 direction;
+        float spotOffset;
+    };
+
+    static_assert(sizeof(ClusterLight) == 48, "ClusterLight must match the shader structure");
+
+
+    // Dynamic structured buffer, grown as needed, and rewritten in full by each upload.
+    class DynamicStructuredBuffer
+    {
+    public:
+        DynamicStructuredBuffer() noexcept
+            : mCapacity(0)
+        {
+        }
+
+        void Upload(_In_ ID3D11Device* device, _In_ ID3D11DeviceContext* deviceContext, _In_reads_bytes_(count * stride) const void* data, size_t count, size_t stride)
+        {
+            if (count > mCapacity || !mBuffer)
+            {
+                size_t capacity = std::max<size_t>(std::max<size_t>(count, mCapacity * 2), 64);
+
+                uint64_t bytes = uint64_t(capacity) * stride;
+                if (bytes > uint64_t(D3D11_REQ_RESOURCE_SIZE_IN_MEGABYTES_EXPRESSION_A_TERM * 1024u * 1024u))
+                    throw std::exception("LightClusters buffer too large for DirectX 11");
+
+                D3D11_BUFFER_DESC desc = {};
+                desc.ByteWidth = static_cast<UINT>(bytes);
+                desc.Usage = D3D11_USAGE_DYNAMIC;
+                desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+                desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+                desc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+                desc.StructureByteStride = static_cast<UINT>(stride);
+
+                ThrowIfFailed(device->CreateBuffer(&desc, nullptr, mBuffer.ReleaseAndGetAddressOf()));
+
+                SetDebugObjectName(mBuffer.Get(), "DirectXTK:LightClusters");
+
+                ThrowIfFailed(device->CreateShaderResourceView(mBuffer.Get(), nullptr, mView.ReleaseAndGetAddressOf()));
+
+                SetDebugObjectName(mView.Get(), "DirectXTK:LightClusters");
+
+                mCapacity = capacity;
+            }
+
+            if (!count)
+                return;
+
+            D3D11_MAPPED_SUBRESOURCE mapped;
+            ThrowIfFailed(deviceContext->Map(mBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped));
+
+            memcpy(mapped.pData, data, count * stride);
+
+            deviceContext->Unmap(mBuffer.Get(), 0);
+        }
+
+        ID3D11ShaderResourceView* GetView() const { return mView.Get(); }
+
+    private:
+        ComPtr<ID3D11Buffer> mBuffer;
+        ComPtr<ID3D11ShaderResourceView> mView;
+        size_t mCapacity;
+    };
+}
+
+
+//--------------------------------------------------------------------------------------
+// LightClusters::Impl
+//--------------------------------------------------------------------------------------
+
+class LightClusters::Impl
+{
+public:
+    Impl(_In_ ID3D11Device* device, uint32_t clustersX, uint32_t clustersY, uint32_t clustersZ);
+
+    void XM_CALLCONV SetProjection(FXMMATRIX projection, float viewportWidth, float viewportHeight, float nearZ, float farZ);
+
+    void XM_CALLCONV AddLight(FXMVECTOR position, FXMVECTOR direction, float range, float spotScale, float spotOffset, GXMVECTOR color, HXMVECTOR bounds);
+
+    void XM_CALLCONV Bin(FXMMATRIX view);
+
+    void Upload(_In_ ID3D11DeviceContext* deviceContext);
+
+    // Grid layout.
+    uint32_t mClustersX;
+    uint32_t mClustersY;
+    uint32_t mClustersZ;
+    uint32_t mTileCount;
+    uint32_t mTileBlocks;
+
+    // Projection terms that map a view space distance and NDC position back to view space.
+    bool mHasProjection;
+    XMFLOAT4X4 mProjection;
+    float mViewportWidth;
+    float mViewportHeight;
+    float mNearZ;
+    float mFarZ;
+    float mDepthScale;
+    float mDepthBias;
+
+    // View space bounds of every cluster. X and y bounds are held for four tiles at a time per slice, so each
+    // light is tested against four clusters at once. Padding tiles have empty bounds.
+    std::vector<XMFLOAT4> mMinX;
+    std::vector<XMFLOAT4> mMaxX;
+    std::vector<XMFLOAT4> mMinY;
+    std::vector<XMFLOAT4> mMaxY;
+    std::vector<XMFLOAT2> mSliceZ;
+
+    // Lights, and their world space bounding spheres.
+    std::vector<ClusterLight> mLights;
+    std::vector<XMFLOAT4> mBounds;
+
+    // Offset and count into mIndices for each cluster.
+    std::vector<XMUINT2> mClusters;
+    std::vector<uint32_t> mIndices;
+
+    // Scratch space for the cluster and light of each overlap.
+    std::vector<uint32_t> mPairClusters;
+    std::vector<uint32_t> mPairLights;
+
+    DynamicStructuredBuffer mLightBuffer;
+    DynamicStructuredBuffer mClusterBuffer;
+    DynamicStructuredBuffer mIndexBuffer;
+
+private:
+    ComPtr<ID3D11Device> mDevice;
+
+    uint32_t SliceOf(float distance) const
+    {
+        float slice = std::log2(distance) * mDepthScale + mDepthBias;
+
+        return std::min(static_cast<uint32_t>(std::max(slice, 0.f)), mClustersZ - 1);
+    }
+};
+
+
+_Use_decl_annotations_
+LightClusters::Impl::Impl(ID3D11Device* device, uint32_t clustersX, uint32_t clustersY, uint32_t clustersZ)
+    : mClustersX(clustersX),
+    mClustersY(clustersY),
+    mClustersZ(clustersZ),
+    mTileCount(0),
+    mTileBlocks(0),
+    mHasProjection(false),
+    mProjection{},
+    mViewportWidth(0),
+    mViewportHeight(0),
+    mNearZ(0),
+    mFarZ(0),
+    mDepthScale(0),
+    mDepthBias(0),
+    mDevice(device)
+{
+    if (!device)
+        throw std::exception("Direct3D device is null");
+
+    if (!clustersX || !clustersY || !clustersZ
+        || uint64_t(clustersX) * clustersY * clustersZ > MaxClusters)
+    {
+        throw std::out_of_range("Cluster counts out of range");
+    }
+
+    mTileCount = clustersX * clustersY;
+    mTileBlocks = (mTileCount + 3) / 4;
+}
+
+
+// Cluster bounds come from unprojecting the corners of each tile at the near and far distance of each slice. With
+// v the view space position, a perspective projection gives clip w = v.z * _34, so a point at NDC x and distance d
+// has v.x = (x * d - v.z * _31 - _41) / _11, and likewise for y. Both left and right-handed projections work.
+void XM_CALLCONV LightClusters::Impl::SetProjection(FXMMATRIX projection, float viewportWidth, float viewportHeight, float nearZ, float farZ)
+{
+    XMFLOAT4X4 p;
+    XMStoreFloat4x4(&p, projection);
+
+    if (p._34 == 0 || p._44 != 0 || p._11 == 0 || p._22 == 0)
+        throw std::exception("LightClusters requires a perspective projection");
+
+    if (viewportWidth <= 0 || viewportHeight <= 0)
+        throw std::out_of_range("Viewport size must be positive");
+
+    if (nearZ <= 0 || farZ <= nearZ)
+        throw std::out_of_range("Cluster depth range must satisfy 0 < nearZ < farZ");
+
+    mProjection = p;
+    mViewportWidth = viewportWidth;
+    mViewportHeight = viewportHeight;
+    mNearZ = nearZ;
+    mFarZ = farZ;
+
+    // Slice k starts at nearZ * (farZ / nearZ) ^ (k / clustersZ), so slice = log2(d) * scale + bias.
+    float logRange = std::log2(farZ / nearZ);
+    mDepthScale = float(mClustersZ) / logRange;
+    mDepthBias = -float(mClustersZ) * std::log2(nearZ) / logRange;
+
+    mMinX.assign(size_t(mClustersZ) * mTileBlocks, XMFLOAT4(FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX));
+    mMaxX.assign(size_t(mClustersZ) * mTileBlocks, XMFLOAT4(-FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX));
+    mMinY.assign(size_t(mClustersZ) * mTileBlocks, XMFLOAT4(FLT_MAX, FLT_MAX, FLT_MAX, FLT_MAX));
+    mMaxY.assign(size_t(mClustersZ) * mTileBlocks, XMFLOAT4(-FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX));
+    mSliceZ.resize(mClustersZ);
+
+    for (uint32_t z = 0; z < mClustersZ; ++z)
+    {
+        float distances[2] =
+        {
+            nearZ * std::pow(farZ / nearZ, float(z) / float(mClustersZ)),
+            nearZ * std::pow(farZ / nearZ, float(z + 1) / float(mClustersZ)),
+        };
+
+        float viewZ[2] = { distances[0] / p._34, distances[1] / p._34 };
+
+        mSliceZ[z] = XMFLOAT2(std::min(viewZ[0], viewZ[1]), std::max(viewZ[0], viewZ[1]));
+
+        for (uint32_t tile = 0; tile < mTileCount; ++tile)
+        {
+            uint32_t x = tile % mClustersX;
+            uint32_t y = tile / mClustersX;
+
+            // Tile rows count down from the top of the viewport, where NDC y is 1.
+            float ndcX[2] = { 2.f * float(x) / float(mClustersX) - 1.f, 2.f * float(x + 1) / float(mClustersX) - 1.f };
+            float ndcY[2] = { 1.f - 2.f * float(y + 1) / float(mClustersY), 1.f - 2.f * float(y) / float(mClustersY) };
+
+            float minX = FLT_MAX, maxX = -FLT_MAX, minY = FLT_MAX, maxY = -FLT_MAX;
+
+            for (int d = 0; d < 2; ++d)
+            {
+                for (int corner = 0; corner < 2; ++corner)
+                {
+                    float vx = (ndcX[corner] * distances[d] - viewZ[d] * p._31 - p._41) / p._11;
+                    float vy = (ndcY[corner] * distances[d] - viewZ[d] * p._32 - p._42) / p._22;
+
+                    minX = std::min(minX, vx);
+                    maxX = std::max(maxX, vx);
+                    minY = std::min(minY, vy);
+                    maxY = std::max(maxY, vy);
+                }
+            }
+
+            size_t block = size_t(z) * mTileBlocks + tile / 4;
+            uint32_t lane = tile % 4;
+
+            (&mMinX[block].x)[lane] = minX;
+            (&mMaxX[block].x)[lane] = maxX;
+            (&mMinY[block].x)[lane] = minY;
+            (&mMaxY[block].x)[lane] = maxY;
+        }
+    }
+
+    mHasProjection = true;
+}
+
+
+void XM_CALLCONV LightClusters::Impl::AddLight(FXMVECTOR position, FXMVECTOR direction, float range, float spotScale, float spotOffset, GXMVECTOR color, HXMVECTOR bounds)
+{
+    if (mLights.size() >= UINT32_MAX)
+        throw std::out_of_range("Too many lights in LightClusters");
+
+    ClusterLight light;
+    XMStoreFloat3(&light.position, position);
+    light.range = range;
+    XMStoreFloat3(&light.color, color);
+    light.spotScale = spotScale;
+    XMStoreFloat3(&light.direction, direction);
+    light.spotOffset = spotOffset;
+
+    mLights.push_back(light);
+
+    XMFLOAT4 sphere;
+    XMStoreFloat4(&sphere, bounds);
+    mBounds.push_back(sphere);
+}
+
+
+// Each light's bounding sphere is tested against the clusters of the slices its depth range covers, four tiles at a
+// time, with the squared distance from the sphere center to each cluster's bounds. Overlaps are collected, then
+// sorted into per-cluster lists with a counting sort, keeping the lights of each cluster in order.
+void XM_CALLCONV LightClusters::Impl::Bin(FXMMATRIX view)
+{
+    if (!mHasProjection)
+        throw std::exception("LightClusters::SetProjection must be called before binning");
+
+    mPairClusters.clear();
+    mPairLights.clear();
+
+    float depthSign = mProjection._34;
+
+    for (size_t i = 0; i < mBounds.size(); ++i)
+    {
+        XMVECTOR sphere = XMLoadFloat4(&mBounds[i]);
+        XMVECTOR center = XMVector3Transform(sphere, view);
+
+        float radius = XMVectorGetW(sphere);
+        float distance = XMVectorGetZ(center) * depthSign;
+
+        if (distance + radius < mNearZ || distance - radius > mFarZ)
+            continue;
+
+        uint32_t firstSlice = SliceOf(std::max(distance - radius, mNearZ));
+        uint32_t lastSlice = SliceOf(std::min(distance + radius, mFarZ));
+
+        float radiusSq = radius * radius;
+
+        XMVECTOR cx = XMVectorSplatX(center);
+        XMVECTOR cy = XMVectorSplatY(center);
+        float cz = XMVectorGetZ(center);
+
+        XMVECTOR r2 = XMVectorReplicate(radiusSq);
+
+        for (uint32_t z = firstSlice; z <= lastSlice; ++z)
+        {
+            float dz = std::max(std::max(mSliceZ[z].x - cz, cz - mSliceZ[z].y), 0.f);
+            float dzSq = dz * dz;
+
+            if (dzSq > radiusSq)
+                continue;
+
+            XMVECTOR dz2 = XMVectorReplicate(dzSq);
+
+            size_t base = size_t(z) * mTileBlocks;
+
+            for (uint32_t block = 0; block < mTileBlocks; ++block)
+            {
+                XMVECTOR dx = XMVectorMax(XMVectorSubtract(XMLoadFloat4(&mMinX[base + block]), cx), XMVectorSubtract(cx, XMLoadFloat4(&mMaxX[base + block])));
+                XMVECTOR dy = XMVectorMax(XMVectorSubtract(XMLoadFloat4(&mMinY[base + block]), cy), XMVectorSubtract(cy, XMLoadFloat4(&mMaxY[base + block])));
+
+                dx = XMVectorMax(dx, g_XMZero);
+                dy = XMVectorMax(dy, g_XMZero);
+
+                XMVECTOR distSq = XMVectorMultiplyAdd(dx, dx, XMVectorMultiplyAdd(dy, dy, dz2));
+
+                uint32_t record;
+                XMVECTOR overlap = XMVectorGreaterOrEqualR(&record, r2, distSq);
+
+                if (!XMComparisonAnyTrue(record))
+                    continue;
+
+                uint32_t lanes[4];
+                XMStoreInt4(lanes, overlap);
+
+                for (uint32_t lane = 0; lane < 4; ++lane)
+                {
+                    if (lanes[lane])
+                    {
+                        mPairClusters.push_back(z * mTileCount + block * 4 + lane);
+                        mPairLights.push_back(static_cast<uint32_t>(i));
+                    }
+                }
+            }
+        }
+    }
+
+    size_t clusterCount = size_t(mTileCount) * mClustersZ;
+
+    mClusters.assign(clusterCount, XMUINT2(0, 0));
+
+    for (auto it = mPairClusters.cbegin(); it != mPairClusters.cend(); ++it)
+    {
+        ++mClusters[*it].y;
+    }
+
+    uint32_t offset = 0;
+    for (auto it = mClusters.begin(); it != mClusters.end(); ++it)
+    {
+        it->x = offset;
+        offset += it->y;
+        it->y = 0;
+    }
+
+    mIndices.resize(mPairClusters.size());
+
+    for (size_t j = 0; j < mPairClusters.size(); ++j)
+    {
+        auto& cluster = mClusters[mPairClusters[j]];
+
+        mIndices[cluster.x + cluster.y] = mPairLights[j];
+        ++cluster.y;
+    }
+}
+
+
+_Use_decl_annotations_
+void LightClusters::Impl::Upload(ID3D11DeviceContext* deviceContext)
+{
+    mLightBuffer.Upload(mDevice.Get(), deviceContext, mLights.data(), mLights.size(), sizeof(ClusterLight));
+    mClusterBuffer.Upload(mDevice.Get(), deviceContext, mClusters.data(), mClusters.size(), sizeof(XMUINT2));
+    mIndexBuffer.Upload(mDevice.Get(), deviceContext, mIndices.data(), mIndices.size(), sizeof(uint32_t));
+}
+
+
+//--------------------------------------------------------------------------------------
+// LightClusters
+//--------------------------------------------------------------------------------------
+
+// Public constructor.
+_Use_decl_annotations_
+LightClusters::LightClusters(ID3D11Device* device, uint32_t clustersX, uint32_t clustersY, uint32_t clustersZ)
+    : pImpl(std::make_unique<Impl>(device, clustersX, clustersY, clustersZ))
+{
+}
+
+
+// Move constructor.
+LightClusters::LightClusters(LightClusters&& moveFrom) noexcept
+    : pImpl(std::move(moveFrom.pImpl))
+{
+}
+
+
+// Move assignment.
+LightClusters& LightClusters::operator= (LightClusters&& moveFrom) noexcept
+{
+    pImpl = std::move(moveFrom.pImpl);
+    return *this;
+}
+
+
+// Public destructor.
+LightClusters::~LightClusters()
+{
+}
+
+
+void XM_CALLCONV LightClusters::SetProjection(FXMMATRIX projection, float viewportWidth, float viewportHeight, float nearZ, float farZ)
+{
+    pImpl->SetProjection(projection, viewportWidth, viewportHeight, nearZ, farZ);
+}
+
+
+void XM_CALLCONV LightClusters::AddPointLight(FXMVECTOR position, float range, FXMVECTOR color)
+{
+    if (!(range > 0))
+        throw std::out_of_range("Light range must be positive");
+
+    pImpl->AddLight(position, g_XMZero, range, 0.f, 1.f, color, XMVectorSetW(position, range));
+}
+
+
+// Spot lights are bounded by the smallest sphere around their cone: for wide cones, the circle at the end of the
+// cone, and for narrow ones, the sphere through the apex centered on the axis at range / (2 cos angle).
+void XM_CALLCONV LightClusters::AddSpotLight(FXMVECTOR position, FXMVECTOR direction, float range, float innerAngle, float outerAngle, GXMVECTOR color)
+{
+    if (!(range > 0))
+        throw std::out_of_range("Light range must be positive");
+
+    if (innerAngle < 0 || outerAngle < innerAngle || outerAngle > XM_PI)
+        throw std::out_of_range("Spot light angles must satisfy 0 <= innerAngle <= outerAngle <= pi");
+
+    XMVECTOR axis = XMVector3Normalize(direction);
+
+    float cosInner = std::cos(innerAngle);
+    float cosOuter = std::cos(outerAngle);
+
+    float spotScale = 1.f / std::max(cosInner - cosOuter, 1e-4f);
+    float spotOffset = -cosOuter * spotScale;
+
+    XMVECTOR bounds;
+
+    if (outerAngle >= XM_PIDIV2)
+    {
+        bounds = XMVectorSetW(position, range);
+    }
+    else if (outerAngle > XM_PIDIV4)
+    {
+        bounds = XMVectorSetW(XMVectorMultiplyAdd(axis, XMVectorReplicate(range * cosOuter), position), range * std::sin(outerAngle));
+    }
+    else
+    {
+        float radius = range / (2.f * cosOuter);
+
+        bounds = XMVectorSetW(XMVectorMultiplyAdd(axis, XMVectorReplicate(radius), position), radius);
+    }
+
+    pImpl->AddLight(position, axis, range, spotScale, spotOffset, color, bounds);
+}
+
+
+void LightClusters::ClearLights()
+{
+    pImpl->mLights.clear();
+    pImpl->mBounds.clear();
+}
+
+
+size_t LightClusters::GetLightCount() const
+{
+    return pImpl->mLights.size();
+}
+
+
+_Use_decl_annotations_
+void XM_CALLCONV LightClusters::Update(ID3D11DeviceContext* deviceContext, FXMMATRIX view)
+{
+    assert(deviceContext != nullptr);
+
+    pImpl->Bin(view);
+    pImpl->Upload(deviceContext);
+}
+
+
+void XM_CALLCONV LightClusters::Bin(FXMMATRIX view)
+{
+    pImpl->Bin(view);
+}
+
+
+size_t LightClusters::GetClusterCount() const
+{
+    return size_t(pImpl->mTileCount) * pImpl->mClustersZ;
+}
+
+
+_Use_decl_annotations_
+const uint32_t* LightClusters::GetClusterLights(size_t cluster, size_t* count) const
+{
+    assert(count != nullptr);
+
+    if (cluster >= GetClusterCount())
+        throw std::out_of_range("Cluster index out of range");
+
+    if (pImpl->mClusters.empty())
+    {
+        *count = 0;
+        return nullptr;
+    }
+
+    auto& range = pImpl->mClusters[cluster];
+
+    *count = range.y;
+    return range.y ? &pImpl->mIndices[range.x] : nullptr;
+}
+
+
+size_t LightClusters::GetLightIndexCount() const
+{
+    return pImpl->mIndices.size();
+}
+
+
+LightClustersConstants LightClusters::GetShaderConstants() const
+{
+    LightClustersConstants constants;
+
+    constants.tileAndDepthScale = XMFLOAT4(pImpl->mHasProjection ? float(pImpl->mClustersX) / pImpl->mViewportWidth : 0.f,
+                                           pImpl->mHasProjection ? float(pImpl->mClustersY) / pImpl->mViewportHeight : 0.f,
+                                           pImpl->mDepthScale,
+                                           pImpl->mDepthBias);
+
+    constants.clusterCounts = XMUINT4(pImpl->mClustersX, pImpl->mClustersY, pImpl->mClustersZ, static_cast<uint32_t>(pImpl->mLights.size()));
+
+    return constants;
+}
+
+
+ID3D11ShaderResourceView* LightClusters::GetLightBuffer() const
+{
+    return pImpl->mLightBuffer.GetView();
+}
+
+
+ID3D11ShaderResourceView* LightClusters::GetClusterBuffer() const
+{
+    return pImpl->mClusterBuffer.GetView();
+}
+
+
+ID3D11ShaderResourceView* LightClusters::GetLightIndexBuffer() const
+{
+    return pImpl->mIndexBuffer.GetView();
+}
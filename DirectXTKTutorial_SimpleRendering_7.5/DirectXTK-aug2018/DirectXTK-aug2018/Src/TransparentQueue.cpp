@@ -0,0 +1,313 @@
+//--------------------------------------------------------------------------------------
+// File: TransparentQueue.cpp
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#include "pch.h"
+#include "TransparentQueue.h"
+#include "Model.h"
+#include "CommonStates.h"
+
+using namespace DirectX;
+
+
+namespace
+{
+    // Mesh centers are stored in blocks of four, one array per coordinate, for computing depths four at a time.
+    struct CenterBlock
+    {
+        XMFLOAT4 x;
+        XMFLOAT4 y;
+        XMFLOAT4 z;
+    };
+
+
+    bool HasAlphaParts(ModelMesh const& mesh)
+    {
+        for (auto it = mesh.meshParts.cbegin(); it != mesh.meshParts.cend(); ++it)
+        {
+            if ((*it)->isAlpha)
+                return true;
+        }
+
+        return false;
+    }
+
+
+    // Stable least significant digit radix sort of keys and values, one byte per pass. Passes where every key
+    // has the same byte are skipped, so keys that differ only in their high bits take a single pass.
+    void RadixSort(std::vector<uint32_t>& keys, std::vector<uint32_t>& values, std::vector<uint32_t>& tempKeys, std::vector<uint32_t>& tempValues)
+    {
+        size_t count = keys.size();
+        if (count < 2)
+            return;
+
+        tempKeys.resize(count);
+        tempValues.resize(count);
+
+        uint32_t histograms[4][256] = {};
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            uint32_t key = keys[i];
+
+            ++histograms[0][key & 0xff];
+            ++histograms[1][(key >> 8) & 0xff];
+            ++histograms[2][(key >> 16) & 0xff];
+            ++histograms[3][key >> 24];
+        }
+
+        for (uint32_t pass = 0; pass < 4; ++pass)
+        {
+            uint32_t shift = pass * 8;
+            auto histogram = histograms[pass];
+
+            if (histogram[(keys[0] >> shift) & 0xff] == count)
+                continue;
+
+            uint32_t offset = 0;
+            for (size_t b = 0; b < 256; ++b)
+            {
+                uint32_t n = histogram[b];
+                histogram[b] = offset;
+                offset += n;
+            }
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                uint32_t dest = histogram[(keys[i] >> shift) & 0xff]++;
+
+                tempKeys[dest] = keys[i];
+                tempValues[dest] = values[i];
+            }
+
+            keys.swap(tempKeys);
+            values.swap(tempValues);
+        }
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// TransparentQueue::Impl
+//--------------------------------------------------------------------------------------
+
+class TransparentQueue::Impl
+{
+public:
+    void XM_CALLCONV AddMesh(ModelMesh const& mesh, uint32_t worldIndex, FXMMATRIX world);
+
+    void XM_CALLCONV Sort(FXMMATRIX view, CXMMATRIX projection);
+
+    void Clear();
+
+    std::vector<const ModelMesh*> mMeshes;
+    std::vector<uint32_t> mWorldIndices;
+    std::vector<XMFLOAT4X4> mWorlds;
+    std::vector<CenterBlock> mCenters;
+
+    // Sorted order of the queued meshes, and scratch space for sorting.
+    std::vector<uint32_t> mOrder;
+    std::vector<uint32_t> mKeys;
+    std::vector<uint32_t> mTempKeys;
+    std::vector<uint32_t> mTempOrder;
+};
+
+
+void XM_CALLCONV TransparentQueue::Impl::AddMesh(ModelMesh const& mesh, uint32_t worldIndex, FXMMATRIX world)
+{
+    size_t index = mMeshes.size();
+
+    if (index >= UINT32_MAX)
+        throw std::out_of_range("Too many meshes in TransparentQueue");
+
+    mMeshes.push_back(&mesh);
+    mWorldIndices.push_back(worldIndex);
+
+    if (index / 4 >= mCenters.size())
+    {
+        mCenters.push_back(CenterBlock());
+    }
+
+    XMFLOAT3 center;
+    XMStoreFloat3(&center, XMVector3Transform(XMLoadFloat3(&mesh.boundingSphere.Center), world));
+
+    auto& block = mCenters[index / 4];
+    (&block.x.x)[index % 4] = center.x;
+    (&block.y.x)[index % 4] = center.y;
+    (&block.z.x)[index % 4] = center.z;
+}
+
+
+// Clip space z is linear in the world position, and grows with the distance from the camera for both left and
+// right-handed projections, orthographic or perspective, so it is computed with one multiply-add per coordinate.
+void XM_CALLCONV TransparentQueue::Impl::Sort(FXMMATRIX view, CXMMATRIX projection)
+{
+    size_t count = mMeshes.size();
+
+    mKeys.resize(count);
+    mOrder.resize(count);
+
+    XMMATRIX viewProjection = XMMatrixMultiply(view, projection);
+
+    XMVECTOR column = XMVectorSet(XMVectorGetZ(viewProjection.r[0]), XMVectorGetZ(viewProjection.r[1]),
+                                  XMVectorGetZ(viewProjection.r[2]), XMVectorGetZ(viewProjection.r[3]));
+
+    XMVECTOR zx = XMVectorSplatX(column);
+    XMVECTOR zy = XMVectorSplatY(column);
+    XMVECTOR zz = XMVectorSplatZ(column);
+    XMVECTOR zw = XMVectorSplatW(column);
+
+    for (size_t block = 0; block < mCenters.size(); ++block)
+    {
+        auto& centers = mCenters[block];
+
+        XMVECTOR depth = XMVectorMultiplyAdd(XMLoadFloat4(&centers.x), zx, zw);
+        depth = XMVectorMultiplyAdd(XMLoadFloat4(&centers.y), zy, depth);
+        depth = XMVectorMultiplyAdd(XMLoadFloat4(&centers.z), zz, depth);
+
+        // Turn the float bits into keys that sort ascending from the greatest depth: positive values have all but
+        // the sign bit flipped, and negative values, whose bits already grow with their magnitude, are kept.
+        XMVECTOR flip = XMVectorSelect(g_XMAbsMask, XMVectorZero(), XMVectorLess(depth, XMVectorZero()));
+
+        uint32_t keys[4];
+        XMStoreInt4(keys, XMVectorXorInt(depth, flip));
+
+        size_t first = block * 4;
+        for (size_t j = 0; j < 4 && first + j < count; ++j)
+        {
+            mKeys[first + j] = keys[j];
+            mOrder[first + j] = static_cast<uint32_t>(first + j);
+        }
+    }
+
+    RadixSort(mKeys, mOrder, mTempKeys, mTempOrder);
+}
+
+
+void TransparentQueue::Impl::Clear()
+{
+    mMeshes.clear();
+    mWorldIndices.clear();
+    mWorlds.clear();
+    mCenters.clear();
+    mOrder.clear();
+}
+
+
+//--------------------------------------------------------------------------------------
+// TransparentQueue
+//--------------------------------------------------------------------------------------
+
+// Public constructor.
+TransparentQueue::TransparentQueue() noexcept(false)
+    : pImpl(std::make_unique<Impl>())
+{
+}
+
+
+// Move constructor.
+TransparentQueue::TransparentQueue(TransparentQueue&& moveFrom) noexcept
+    : pImpl(std::move(moveFrom.pImpl))
+{
+}
+
+
+// Move assignment.
+TransparentQueue& TransparentQueue::operator= (TransparentQueue&& moveFrom) noexcept
+{
+    pImpl = std::move(moveFrom.pImpl);
+    return *this;
+}
+
+
+// Public destructor.
+TransparentQueue::~TransparentQueue()
+{
+}
+
+
+void XM_CALLCONV TransparentQueue::Submit(const Model& model, FXMMATRIX world)
+{
+    auto worldIndex = static_cast<uint32_t>(pImpl->mWorlds.size());
+    bool added = false;
+
+    for (auto it = model.meshes.cbegin(); it != model.meshes.cend(); ++it)
+    {
+        auto mesh = it->get();
+        assert(mesh != nullptr);
+
+        if (HasAlphaParts(*mesh))
+        {
+            pImpl->AddMesh(*mesh, worldIndex, world);
+            added = true;
+        }
+    }
+
+    if (added)
+    {
+        XMFLOAT4X4 transform;
+        XMStoreFloat4x4(&transform, world);
+        pImpl->mWorlds.push_back(transform);
+    }
+}
+
+
+void XM_CALLCONV TransparentQueue::Submit(const ModelMesh& mesh, FXMMATRIX world)
+{
+    if (!HasAlphaParts(mesh))
+        return;
+
+    pImpl->AddMesh(mesh, static_cast<uint32_t>(pImpl->mWorlds.size()), world);
+
+    XMFLOAT4X4 transform;
+    XMStoreFloat4x4(&transform, world);
+    pImpl->mWorlds.push_back(transform);
+}
+
+
+void XM_CALLCONV TransparentQueue::Sort(FXMMATRIX view, CXMMATRIX projection)
+{
+    pImpl->Sort(view, projection);
+}
+
+
+_Use_decl_annotations_
+void XM_CALLCONV TransparentQueue::Draw(
+    ID3D11DeviceContext* deviceContext,
+    const CommonStates& states,
+    FXMMATRIX view,
+    CXMMATRIX projection,
+    bool wireframe,
+    std::function<void()> setCustomState)
+{
+    assert(deviceContext != nullptr);
+
+    pImpl->Sort(view, projection);
+
+    for (auto it = pImpl->mOrder.cbegin(); it != pImpl->mOrder.cend(); ++it)
+    {
+        auto mesh = pImpl->mMeshes[*it];
+        XMMATRIX world = XMLoadFloat4x4(&pImpl->mWorlds[pImpl->mWorldIndices[*it]]);
+
+        mesh->PrepareForRendering(deviceContext, states, true, wireframe);
+
+        mesh->Draw(deviceContext, world, view, projection, true, setCustomState);
+    }
+}
+
+
+void TransparentQueue::Clear()
+{
+    pImpl->Clear();
+}
+
+
+size_t TransparentQueue::GetCount() const
+{
+    return pImpl->mMeshes.size();
+}
@@ -0,0 +1,681 @@
+//--------------------------------------------------------------------------------------
+// File: VBOCodec.cpp
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#include "pch.h"
+#include "VBOCodec.h"
+
+#include "vbo.h"
+
+using namespace DirectX;
+
+
+namespace
+{
+    const size_t LaneCount = sizeof(VBO::packed_vertex_t);
+    const size_t BlockSize = VBO::VBO2_BLOCK_SIZE;
+
+    static_assert(BlockSize == 16, "Block decoding works on 16 byte vectors");
+
+
+    inline uint8_t ZigZag(uint8_t delta)
+    {
+        return static_cast<uint8_t>((delta << 1) ^ static_cast<uint8_t>(static_cast<int8_t>(delta) >> 7));
+    }
+
+
+    // Bytes of payload for each lane mode: deltas of 0, 2, 4, and 8 bits.
+    const size_t ModeBytes[4] = { 0, 4, 8, 16 };
+
+
+    //----------------------------------------------------------------------------------
+    // Quantization
+    //----------------------------------------------------------------------------------
+
+    inline uint16_t QuantizeUnorm16(float value, float minimum, float scale)
+    {
+        if (scale <= 0.f)
+            return 0;
+
+        float q = (value - minimum) / scale + 0.5f;
+        return static_cast<uint16_t>(std::min(std::max(q, 0.f), 65535.f));
+    }
+
+
+    inline int16_t QuantizeSnorm16(float value)
+    {
+        value = std::min(std::max(value, -1.f), 1.f) * 32767.f;
+        return static_cast<int16_t>(value + ((value >= 0.f) ? 0.5f : -0.5f));
+    }
+
+
+    // Octahedral mapping of a unit vector onto the [-1,1] square.
+    void EncodeOctahedral(XMFLOAT3 const& normal, _Out_ int16_t* result)
+    {
+        float x = normal.x;
+        float y = normal.y;
+        float z = normal.z;
+
+        float sum = fabsf(x) + fabsf(y) + fabsf(z);
+        if (sum <= 0.f)
+        {
+            result[0] = result[1] = 0;
+            return;
+        }
+
+        x /= sum;
+        y /= sum;
+
+        if (z < 0.f)
+        {
+            float fx = (1.f - fabsf(y)) * ((x >= 0.f) ? 1.f : -1.f);
+            float fy = (1.f - fabsf(x)) * ((y >= 0.f) ? 1.f : -1.f);
+            x = fx;
+            y = fy;
+        }
+
+        result[0] = QuantizeSnorm16(x);
+        result[1] = QuantizeSnorm16(y);
+    }
+
+
+    //----------------------------------------------------------------------------------
+    // Block decoding. Each block holds 16 vertices as 14 byte lanes: lane k holds byte k
+    // of every packed vertex, stored as zigzag deltas from the previous vertex.
+    //----------------------------------------------------------------------------------
+
+    struct DecodeParameters
+    {
+        float positionMin[3];
+        float positionScale[3];
+        float textureMin[2];
+        float textureScale[2];
+    };
+
+
+#if !defined(_XM_SSE_INTRINSICS_)
+    inline uint8_t UnZigZag(uint8_t value)
+    {
+        return static_cast<uint8_t>((value >> 1) ^ static_cast<uint8_t>(-(value & 1)));
+    }
+
+
+    // Reads the payload of one lane, returning the zigzag deltas.
+    inline void ReadLaneScalar(unsigned mode, _In_reads_(ModeBytes[mode]) const uint8_t* payload, _Out_writes_(16) uint8_t* deltas)
+    {
+        switch (mode)
+        {
+            case 0:
+                memset(deltas, 0, BlockSize);
+                break;
+
+            case 1:
+                for (size_t i = 0; i < BlockSize; ++i)
+                    deltas[i] = (payload[i % 4] >> (2 * (i / 4))) & 0x3;
+                break;
+
+            case 2:
+                for (size_t i = 0; i < BlockSize; ++i)
+                    deltas[i] = (payload[i % 8] >> (4 * (i / 8))) & 0xF;
+                break;
+
+            default:
+                memcpy(deltas, payload, BlockSize);
+                break;
+        }
+    }
+#endif
+
+
+    void DequantizeScalar(_In_reads_(LaneCount) const uint8_t (*lanes)[BlockSize], size_t count,
+                          DecodeParameters const& params, _Out_writes_(count) VertexPositionNormalTexture* vertices)
+    {
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto value = [&](size_t lane) -> uint16_t
+            {
+                return static_cast<uint16_t>(lanes[lane][i] | (lanes[lane + 1][i] << 8));
+            };
+
+            auto& vertex = vertices[i];
+
+            vertex.position.x = float(value(0)) * params.positionScale[0] + params.positionMin[0];
+            vertex.position.y = float(value(2)) * params.positionScale[1] + params.positionMin[1];
+            vertex.position.z = float(value(4)) * params.positionScale[2] + params.positionMin[2];
+
+            float x = std::max(float(static_cast<int16_t>(value(6))) / 32767.f, -1.f);
+            float y = std::max(float(static_cast<int16_t>(value(8))) / 32767.f, -1.f);
+            float z = 1.f - fabsf(x) - fabsf(y);
+            float t = std::max(-z, 0.f);
+            x += (x >= 0.f) ? -t : t;
+            y += (y >= 0.f) ? -t : t;
+
+            float invLength = 1.f / sqrtf(x * x + y * y + z * z);
+            vertex.normal.x = x * invLength;
+            vertex.normal.y = y * invLength;
+            vertex.normal.z = z * invLength;
+
+            vertex.textureCoordinate.x = float(value(10)) * params.textureScale[0] + params.textureMin[0];
+            vertex.textureCoordinate.y = float(value(12)) * params.textureScale[1] + params.textureMin[1];
+        }
+    }
+
+
+#if defined(_XM_SSE_INTRINSICS_)
+    inline __m128i ReadLaneSSE(unsigned mode, _In_reads_(ModeBytes[mode]) const uint8_t* payload)
+    {
+        switch (mode)
+        {
+            case 0:
+                return _mm_setzero_si128();
+
+            case 1:
+            {
+                // Byte j holds deltas j, j + 4, j + 8, and j + 12 in successive bit pairs.
+                uint32_t bits;
+                memcpy(&bits, payload, sizeof(bits));
+
+                __m128i v = _mm_cvtsi32_si128(static_cast<int>(bits));
+                __m128i v01 = _mm_unpacklo_epi32(v, _mm_srli_epi32(v, 2));
+                __m128i v23 = _mm_unpacklo_epi32(_mm_srli_epi32(v, 4), _mm_srli_epi32(v, 6));
+                return _mm_and_si128(_mm_unpacklo_epi64(v01, v23), _mm_set1_epi8(0x3));
+            }
+
+            case 2:
+            {
+                // Byte j holds deltas j and j + 8 in its low and high nibbles.
+                __m128i v = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(payload));
+                return _mm_and_si128(_mm_unpacklo_epi64(v, _mm_srli_epi16(v, 4)), _mm_set1_epi8(0xF));
+            }
+
+            default:
+                return _mm_loadu_si128(reinterpret_cast<const __m128i*>(payload));
+        }
+    }
+
+
+    // Undoes the zigzag and delta coding of one lane, continuing from the last value of the previous block.
+    inline __m128i DecodeLaneSSE(__m128i deltas, uint8_t previous)
+    {
+        __m128i one = _mm_set1_epi8(1);
+        __m128i value = _mm_xor_si128(
+            _mm_and_si128(_mm_srli_epi16(deltas, 1), _mm_set1_epi8(0x7F)),
+            _mm_sub_epi8(_mm_setzero_si128(), _mm_and_si128(deltas, one)));
+
+        // Prefix sum across the 16 bytes.
+        value = _mm_add_epi8(value, _mm_slli_si128(value, 1));
+        value = _mm_add_epi8(value, _mm_slli_si128(value, 2));
+        value = _mm_add_epi8(value, _mm_slli_si128(value, 4));
+        value = _mm_add_epi8(value, _mm_slli_si128(value, 8));
+
+        return _mm_add_epi8(value, _mm_set1_epi8(static_cast<char>(previous)));
+    }
+
+
+    inline void XM_CALLCONV DecodeOctahedralSSE(__m128 x, __m128 y, _Out_ __m128* nx, _Out_ __m128* ny, _Out_ __m128* nz)
+    {
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 signMask = _mm_set1_ps(-0.f);
+
+        x = _mm_max_ps(x, _mm_set1_ps(-1.f));
+        y = _mm_max_ps(y, _mm_set1_ps(-1.f));
+
+        __m128 z = _mm_sub_ps(_mm_sub_ps(_mm_set1_ps(1.f), _mm_andnot_ps(signMask, x)), _mm_andnot_ps(signMask, y));
+        __m128 t = _mm_max_ps(_mm_sub_ps(zero, z), zero);
+
+        // Move toward zero by t, folding the lower hemisphere back out.
+        x = _mm_add_ps(x, _mm_xor_ps(t, _mm_and_ps(_mm_cmpge_ps(x, zero), signMask)));
+        y = _mm_add_ps(y, _mm_xor_ps(t, _mm_and_ps(_mm_cmpge_ps(y, zero), signMask)));
+
+        __m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+        __m128 invLength = _mm_div_ps(_mm_set1_ps(1.f), _mm_sqrt_ps(lengthSq));
+
+        *nx = _mm_mul_ps(x, invLength);
+        *ny = _mm_mul_ps(y, invLength);
+        *nz = _mm_mul_ps(z, invLength);
+    }
+
+
+    // Dequantizes a full block of 16 vertices, four at a time, and transposes them into vertex order.
+    void DequantizeSSE(_In_reads_(LaneCount) const __m128i* lanes, DecodeParameters const& params, _Out_writes_(BlockSize) VertexPositionNormalTexture* vertices)
+    {
+        static_assert(sizeof(VertexPositionNormalTexture) == 8 * sizeof(float), "Vertex layout mismatch");
+
+        const __m128i zero = _mm_setzero_si128();
+
+        const __m128 positionScale[3] = { _mm_set1_ps(params.positionScale[0]), _mm_set1_ps(params.positionScale[1]), _mm_set1_ps(params.positionScale[2]) };
+        const __m128 positionMin[3] = { _mm_set1_ps(params.positionMin[0]), _mm_set1_ps(params.positionMin[1]), _mm_set1_ps(params.positionMin[2]) };
+        const __m128 textureScale[2] = { _mm_set1_ps(params.textureScale[0]), _mm_set1_ps(params.textureScale[1]) };
+        const __m128 textureMin[2] = { _mm_set1_ps(params.textureMin[0]), _mm_set1_ps(params.textureMin[1]) };
+        const __m128 snormScale = _mm_set1_ps(1.f / 32767.f);
+
+        auto output = reinterpret_cast<float*>(vertices);
+
+        for (size_t half = 0; half < 2; ++half)
+        {
+            // Join the low and high byte lanes of each component into 8 16-bit values.
+            __m128i values[7];
+            for (size_t c = 0; c < 7; ++c)
+            {
+                values[c] = half ? _mm_unpackhi_epi8(lanes[2 * c], lanes[2 * c + 1])
+                                 : _mm_unpacklo_epi8(lanes[2 * c], lanes[2 * c + 1]);
+            }
+
+            for (size_t quarter = 0; quarter < 2; ++quarter)
+            {
+                auto unsignedFloat = [&](__m128i v) -> __m128
+                {
+                    return _mm_cvtepi32_ps(quarter ? _mm_unpackhi_epi16(v, zero) : _mm_unpacklo_epi16(v, zero));
+                };
+
+                auto signedFloat = [&](__m128i v) -> __m128
+                {
+                    return _mm_cvtepi32_ps(_mm_srai_epi32(quarter ? _mm_unpackhi_epi16(zero, v) : _mm_unpacklo_epi16(zero, v), 16));
+                };
+
+                __m128 px = _mm_add_ps(_mm_mul_ps(unsignedFloat(values[0]), positionScale[0]), positionMin[0]);
+                __m128 py = _mm_add_ps(_mm_mul_ps(unsignedFloat(values[1]), positionScale[1]), positionMin[1]);
+                __m128 pz = _mm_add_ps(_mm_mul_ps(unsignedFloat(values[2]), positionScale[2]), positionMin[2]);
+
+                __m128 nx, ny, nz;
+                DecodeOctahedralSSE(_mm_mul_ps(signedFloat(values[3]), snormScale),
+                                    _mm_mul_ps(signedFloat(values[4]), snormScale),
+                                    &nx, &ny, &nz);
+
+                __m128 tu = _mm_add_ps(_mm_mul_ps(unsignedFloat(values[5]), textureScale[0]), textureMin[0]);
+                __m128 tv = _mm_add_ps(_mm_mul_ps(unsignedFloat(values[6]), textureScale[1]), textureMin[1]);
+
+                // Rows become the first and second halves of four vertices.
+                _MM_TRANSPOSE4_PS(px, py, pz, nx);
+                _MM_TRANSPOSE4_PS(ny, nz, tu, tv);
+
+                float* dest = output + (half * 8 + quarter * 4) * 8;
+                _mm_storeu_ps(dest, px);
+                _mm_storeu_ps(dest + 4, ny);
+                _mm_storeu_ps(dest + 8, py);
+                _mm_storeu_ps(dest + 12, nz);
+                _mm_storeu_ps(dest + 16, pz);
+                _mm_storeu_ps(dest + 20, tu);
+                _mm_storeu_ps(dest + 24, nx);
+                _mm_storeu_ps(dest + 28, tv);
+            }
+        }
+    }
+#endif
+
+
+    void DecodeVertices(_In_reads_bytes_(dataSize) const uint8_t* data, size_t dataSize,
+                        DecodeParameters const& params, size_t nVerts, _Out_writes_(nVerts) VertexPositionNormalTexture* vertices)
+    {
+        const uint8_t* end = data + dataSize;
+
+        uint8_t previous[LaneCount] = {};
+
+    #if defined(_XM_SSE_INTRINSICS_)
+        __m128i lanes[LaneCount];
+    #else
+        uint8_t lanes[LaneCount][BlockSize];
+    #endif
+
+        for (size_t base = 0; base < nVerts; base += BlockSize)
+        {
+            if (size_t(end - data) < sizeof(uint32_t))
+                throw std::exception("End of file");
+
+            uint32_t modes;
+            memcpy(&modes, data, sizeof(modes));
+            data += sizeof(modes);
+
+            for (size_t k = 0; k < LaneCount; ++k)
+            {
+                unsigned mode = (modes >> (2 * k)) & 0x3;
+
+                if (size_t(end - data) < ModeBytes[mode])
+                    throw std::exception("End of file");
+
+            #if defined(_XM_SSE_INTRINSICS_)
+                lanes[k] = DecodeLaneSSE(ReadLaneSSE(mode, data), previous[k]);
+                previous[k] = static_cast<uint8_t>(_mm_cvtsi128_si32(_mm_srli_si128(lanes[k], 15)));
+            #else
+                uint8_t deltas[BlockSize];
+                ReadLaneScalar(mode, data, deltas);
+
+                uint8_t value = previous[k];
+                for (size_t i = 0; i < BlockSize; ++i)
+                {
+                    value = static_cast<uint8_t>(value + UnZigZag(deltas[i]));
+                    lanes[k][i] = value;
+                }
+
+                previous[k] = value;
+            #endif
+
+                data += ModeBytes[mode];
+            }
+
+            size_t count = std::min(BlockSize, nVerts - base);
+
+        #if defined(_XM_SSE_INTRINSICS_)
+            if (count == BlockSize)
+            {
+                DequantizeSSE(lanes, params, vertices + base);
+            }
+            else
+            {
+                uint8_t laneBytes[LaneCount][BlockSize];
+                for (size_t k = 0; k < LaneCount; ++k)
+                {
+                    _mm_storeu_si128(reinterpret_cast<__m128i*>(laneBytes[k]), lanes[k]);
+                }
+
+                DequantizeScalar(laneBytes, count, params, vertices + base);
+            }
+        #else
+            DequantizeScalar(lanes, count, params, vertices + base);
+        #endif
+        }
+    }
+
+
+    //----------------------------------------------------------------------------------
+    // Index coding
+    //----------------------------------------------------------------------------------
+
+    void WriteVarint(uint32_t value, std::vector<uint8_t>& data)
+    {
+        while (value >= 0x80)
+        {
+            data.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+
+        data.push_back(static_cast<uint8_t>(value));
+    }
+
+
+    inline uint32_t ReadVarint(const uint8_t*& data, const uint8_t* end)
+    {
+        // Most codes fit in one byte.
+        if (data < end && *data < 0x80)
+            return *data++;
+
+        uint32_t value = 0;
+
+        for (unsigned shift = 0; shift < 32; shift += 7)
+        {
+            if (data >= end)
+                throw std::exception("End of file");
+
+            uint8_t byte = *data++;
+            value |= uint32_t(byte & 0x7F) << shift;
+
+            if (!(byte & 0x80))
+                return value;
+        }
+
+        throw std::exception("Invalid index data");
+    }
+
+
+    // Candidate references for the next index: the indices of the previous triangle, and one past the highest
+    // index so far. Meshes ordered for the vertex cache mostly reuse a neighbor or take the next new vertex.
+    struct IndexPredictor
+    {
+        static const uint32_t ReferenceCount = 4;
+
+        int32_t references[ReferenceCount];
+        int32_t triangle[3];
+
+        IndexPredictor() : references{}, triangle{} {}
+
+        void Add(size_t position, int32_t index)
+        {
+            triangle[position % 3] = index;
+
+            if ((position % 3) == 2)
+            {
+                references[0] = triangle[0];
+                references[1] = triangle[1];
+                references[2] = triangle[2];
+            }
+
+            references[3] = std::max(references[3], index + 1);
+        }
+    };
+}
+
+
+//--------------------------------------------------------------------------------------
+_Use_decl_annotations_
+bool VBO::IsCompressed(const uint8_t* meshData, size_t dataSize)
+{
+    if (dataSize < sizeof(header2_t))
+        return false;
+
+    uint32_t magic;
+    memcpy(&magic, meshData, sizeof(magic));
+
+    return magic == VBO2_MAGIC;
+}
+
+
+_Use_decl_annotations_
+void VBO::Decompress(const uint8_t* meshData, size_t dataSize,
+                     std::vector<VertexPositionNormalTexture>& vertices, std::vector<uint16_t>& indices)
+{
+    if (!IsCompressed(meshData, dataSize))
+        throw std::exception("Not a compressed VBO file");
+
+    auto header = reinterpret_cast<const header2_t*>(meshData);
+
+    if (dataSize < sizeof(header2_t) + uint64_t(header->vertexDataSize) + header->indexDataSize)
+        throw std::exception("End of file");
+
+    // Each index takes at least a byte, and each block of vertices at least its lane modes.
+    if (header->numIndices > header->indexDataSize
+        || (header->numVertices + BlockSize - 1) / BlockSize > header->vertexDataSize / sizeof(uint32_t))
+        throw std::exception("End of file");
+
+    DecodeParameters params;
+    memcpy(params.positionMin, header->positionMin, sizeof(params.positionMin));
+    memcpy(params.positionScale, header->positionScale, sizeof(params.positionScale));
+    memcpy(params.textureMin, header->textureMin, sizeof(params.textureMin));
+    memcpy(params.textureScale, header->textureScale, sizeof(params.textureScale));
+
+    auto vertexData = meshData + sizeof(header2_t);
+
+    vertices.resize(header->numVertices);
+    DecodeVertices(vertexData, header->vertexDataSize, params, header->numVertices, vertices.data());
+
+    auto indexData = vertexData + header->vertexDataSize;
+    auto indexEnd = indexData + header->indexDataSize;
+
+    indices.resize(header->numIndices);
+
+    IndexPredictor predictor;
+
+    for (size_t i = 0; i < header->numIndices; ++i)
+    {
+        uint32_t code = ReadVarint(indexData, indexEnd);
+        uint32_t zz = code >> 2;
+        int32_t index = predictor.references[code & 0x3] + static_cast<int32_t>((zz >> 1) ^ (0u - (zz & 1)));
+
+        if (index < 0 || index > UINT16_MAX)
+            throw std::exception("Invalid index data");
+
+        indices[i] = static_cast<uint16_t>(index);
+
+        predictor.Add(i, index);
+    }
+}
+
+
+_Use_decl_annotations_
+void VBO::Compress(const VertexPositionNormalTexture* vertices, size_t nVerts,
+                   const uint16_t* indices, size_t nIndices,
+                   std::vector<uint8_t>& meshData)
+{
+    if (!vertices || !indices || !nVerts || !nIndices)
+        throw std::exception("No vertices or indices found");
+
+    if (nVerts >= UINT32_MAX || nIndices >= UINT32_MAX)
+        throw std::out_of_range("Too many vertices or indices");
+
+    header2_t header = {};
+    header.magic = VBO2_MAGIC;
+    header.numVertices = static_cast<uint32_t>(nVerts);
+    header.numIndices = static_cast<uint32_t>(nIndices);
+
+    // Quantization ranges
+    float positionMax[3];
+    float textureMax[2];
+
+    for (size_t c = 0; c < 3; ++c)
+    {
+        header.positionMin[c] = positionMax[c] = (&vertices[0].position.x)[c];
+    }
+
+    for (size_t c = 0; c < 2; ++c)
+    {
+        header.textureMin[c] = textureMax[c] = (&vertices[0].textureCoordinate.x)[c];
+    }
+
+    for (size_t i = 1; i < nVerts; ++i)
+    {
+        for (size_t c = 0; c < 3; ++c)
+        {
+            float value = (&vertices[i].position.x)[c];
+            header.positionMin[c] = std::min(header.positionMin[c], value);
+            positionMax[c] = std::max(positionMax[c], value);
+        }
+
+        for (size_t c = 0; c < 2; ++c)
+        {
+            float value = (&vertices[i].textureCoordinate.x)[c];
+            header.textureMin[c] = std::min(header.textureMin[c], value);
+            textureMax[c] = std::max(textureMax[c], value);
+        }
+    }
+
+    for (size_t c = 0; c < 3; ++c)
+    {
+        header.positionScale[c] = (positionMax[c] - header.positionMin[c]) / 65535.f;
+    }
+
+    for (size_t c = 0; c < 2; ++c)
+    {
+        header.textureScale[c] = (textureMax[c] - header.textureMin[c]) / 65535.f;
+    }
+
+    std::vector<packed_vertex_t> packed(nVerts);
+
+    for (size_t i = 0; i < nVerts; ++i)
+    {
+        auto& vertex = vertices[i];
+
+        packed[i].position[0] = QuantizeUnorm16(vertex.position.x, header.positionMin[0], header.positionScale[0]);
+        packed[i].position[1] = QuantizeUnorm16(vertex.position.y, header.positionMin[1], header.positionScale[1]);
+        packed[i].position[2] = QuantizeUnorm16(vertex.position.z, header.positionMin[2], header.positionScale[2]);
+        EncodeOctahedral(vertex.normal, packed[i].normal);
+        packed[i].textureCoordinate[0] = QuantizeUnorm16(vertex.textureCoordinate.x, header.textureMin[0], header.textureScale[0]);
+        packed[i].textureCoordinate[1] = QuantizeUnorm16(vertex.textureCoordinate.y, header.textureMin[1], header.textureScale[1]);
+    }
+
+    // Vertex blocks, padded with copies of the last vertex so the padding costs nothing.
+    std::vector<uint8_t> vertexData;
+    uint8_t previous[LaneCount] = {};
+
+    for (size_t base = 0; base < nVerts; base += BlockSize)
+    {
+        uint8_t deltas[LaneCount][BlockSize];
+
+        for (size_t i = 0; i < BlockSize; ++i)
+        {
+            auto bytes = reinterpret_cast<const uint8_t*>(&packed[std::min(base + i, nVerts - 1)]);
+
+            for (size_t k = 0; k < LaneCount; ++k)
+            {
+                deltas[k][i] = ZigZag(static_cast<uint8_t>(bytes[k] - previous[k]));
+                previous[k] = bytes[k];
+            }
+        }
+
+        uint32_t modes = 0;
+        size_t modesOffset = vertexData.size();
+        vertexData.resize(modesOffset + sizeof(modes));
+
+        for (size_t k = 0; k < LaneCount; ++k)
+        {
+            uint8_t largest = *std::max_element(deltas[k], deltas[k] + BlockSize);
+
+            unsigned mode = (largest == 0) ? 0 : (largest < 4) ? 1 : (largest < 16) ? 2 : 3;
+            modes |= mode << (2 * k);
+
+            uint8_t payload[BlockSize] = {};
+
+            switch (mode)
+            {
+                case 1:
+                    for (size_t i = 0; i < BlockSize; ++i)
+                        payload[i % 4] |= static_cast<uint8_t>(deltas[k][i] << (2 * (i / 4)));
+                    break;
+
+                case 2:
+                    for (size_t i = 0; i < BlockSize; ++i)
+                        payload[i % 8] |= static_cast<uint8_t>(deltas[k][i] << (4 * (i / 8)));
+                    break;
+
+                case 3:
+                    memcpy(payload, deltas[k], BlockSize);
+                    break;
+
+                default:
+                    break;
+            }
+
+            vertexData.insert(vertexData.end(), payload, payload + ModeBytes[mode]);
+        }
+
+        memcpy(vertexData.data() + modesOffset, &modes, sizeof(modes));
+    }
+
+    // Indices, each coded against the nearest of its candidate references.
+    std::vector<uint8_t> indexData;
+    indexData.reserve(nIndices);
+
+    IndexPredictor predictor;
+
+    for (size_t i = 0; i < nIndices; ++i)
+    {
+        int32_t index = indices[i];
+
+        uint32_t best = 0;
+        for (uint32_t r = 1; r < IndexPredictor::ReferenceCount; ++r)
+        {
+            if (abs(index - predictor.references[r]) < abs(index - predictor.references[best]))
+                best = r;
+        }
+
+        int32_t delta = index - predictor.references[best];
+        uint32_t zz = (static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31);
+        WriteVarint((zz << 2) | best, indexData);
+
+        predictor.Add(i, index);
+    }
+
+    if (vertexData.size() >= UINT32_MAX || indexData.size() >= UINT32_MAX)
+        throw std::out_of_range("Compressed data too large");
+
+    header.vertexDataSize = static_cast<uint32_t>(vertexData.size());
+    header.indexDataSize = static_cast<uint32_t>(indexData.size());
+
+    meshData.resize(sizeof(header));
+    memcpy(meshData.data(), &header, sizeof(header));
+    meshData.insert(meshData.end(), vertexData.cbegin(), vertexData.cend());
+    meshData.insert(meshData.end(), indexData.cbegin(), indexData.cend());
+}
@@ -0,0 +1,107 @@
+//--------------------------------------------------------------------------------------
+// File: MeshClusters.h
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#if defined(_XBOX_ONE) && defined(_TITLE)
+#include <d3d11_x.h>
+#else
+#include <d3d11_1.h>
+#endif
+
+#include <DirectXMath.h>
+#include <DirectXCollision.h>
+
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <stdint.h>
+
+
+namespace DirectX
+{
+    class IEffect;
+    class ModelMeshPart;
+
+    //----------------------------------------------------------------------------------
+    // A small group of adjacent triangles with its own bounds, used for culling below mesh granularity.
+    struct MeshCluster
+    {
+        BoundingSphere  boundingSphere;
+        XMFLOAT3        coneAxis;       // Average of the triangle normals, from the cross product of the first two edges
+        float           coneCutoff;     // Sine of the cone half-angle, or greater than 1 if the cluster can't be backface culled
+        uint32_t        startIndex;
+        uint32_t        indexCount;
+    };
+
+    // A run of consecutive visible clusters, suitable for a single DrawIndexed call.
+    struct MeshClusterRange
+    {
+        uint32_t        startIndex;
+        uint32_t        indexCount;
+    };
+
+
+    //----------------------------------------------------------------------------------
+    // Splits a triangle list into clusters, and culls them against the view frustum and their normal cones.
+    class MeshClusters
+    {
+    public:
+        static const size_t MaxVertices = 64;
+        static const size_t MaxTriangles = 124;
+
+        MeshClusters(MeshClusters&& moveFrom) noexcept;
+        MeshClusters& operator= (MeshClusters&& moveFrom) noexcept;
+
+        MeshClusters(MeshClusters const&) = delete;
+        MeshClusters& operator= (MeshClusters const&) = delete;
+
+        virtual ~MeshClusters();
+
+        // Factory methods. Positions are read with the given byte stride; triangles are reordered so each cluster is contiguous.
+        // The ccw flag has the same meaning as ModelMesh::ccw, and selects which faces the normal cone test treats as back faces.
+        static std::unique_ptr<MeshClusters> __cdecl Create(_In_reads_(vertexCount) const XMFLOAT3* positions, size_t positionStride, size_t vertexCount,
+                                                            _In_reads_(indexCount) const uint16_t* indices, size_t indexCount,
+                                                            bool ccw = true, size_t maxVertices = MaxVertices, size_t maxTriangles = MaxTriangles);
+        static std::unique_ptr<MeshClusters> __cdecl Create(_In_reads_(vertexCount) const XMFLOAT3* positions, size_t positionStride, size_t vertexCount,
+                                                            _In_reads_(indexCount) const uint32_t* indices, size_t indexCount,
+                                                            bool ccw = true, size_t maxVertices = MaxVertices, size_t maxTriangles = MaxTriangles);
+
+        // Reads back the buffers of a triangle list mesh part, and creates an index buffer holding the clustered indices.
+        static std::unique_ptr<MeshClusters> __cdecl CreateFromMeshPart(_In_ ID3D11DeviceContext* deviceContext, const ModelMeshPart& part,
+                                                                        bool ccw = true, size_t maxVertices = MaxVertices, size_t maxTriangles = MaxTriangles);
+
+        // Clustered index data. Index values are unchanged, only their order differs from the source.
+        const std::vector<MeshCluster>& __cdecl GetClusters() const;
+        const std::vector<uint32_t>& __cdecl GetIndices() const;
+
+        // Creates an index buffer from the clustered indices, needed to draw ranges returned by Cull.
+        void __cdecl CreateIndexBuffer(_In_ ID3D11Device* device);
+        ID3D11Buffer* __cdecl GetIndexBuffer() const;
+        DXGI_FORMAT __cdecl GetIndexFormat() const;
+
+        // Culls clusters, returning the number visible. The normal cone test assumes uniform scaling,
+        // and is skipped for orthographic projections.
+        size_t XM_CALLCONV Cull(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection, std::vector<MeshClusterRange>& ranges) const;
+        size_t XM_CALLCONV Cull(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection, std::vector<uint32_t>& indices) const;
+
+        // Draws visible ranges using the vertex buffer of the mesh part these clusters were built from.
+        void __cdecl Draw(_In_ ID3D11DeviceContext* deviceContext, const ModelMeshPart& part, _In_ IEffect* ieffect, _In_ ID3D11InputLayout* iinputLayout,
+                          const std::vector<MeshClusterRange>& ranges, _In_opt_ std::function<void __cdecl()> setCustomState = nullptr) const;
+
+    private:
+        MeshClusters() noexcept(false);
+
+        // Private implementation.
+        class Impl;
+
+        std::unique_ptr<Impl> pImpl;
+    };
+}
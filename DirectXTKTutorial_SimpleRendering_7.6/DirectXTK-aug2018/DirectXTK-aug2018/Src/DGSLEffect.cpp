@@ -360,8 +360,8 @@ void DGSLEffect::Impl::Apply(_In_ ID3D11DeviceContext* deviceContext)
         pixelShader = mDeviceResources->GetPixelShader(GetCurrentPSPermutation());
     }
 
-    deviceContext->VSSetShader(vertexShader, nullptr, 0);
-    deviceContext->PSSetShader(pixelShader, nullptr, 0);
+    StateFilter::VSSetShader(deviceContext, vertexShader, nullptr, 0);
+    StateFilter::PSSetShader(deviceContext, pixelShader, nullptr, 0);
 
     // Check for any required matrices updates
     if (dirtyFlags & EffectDirtyFlags::WorldViewProj)
@@ -440,28 +440,28 @@ void DGSLEffect::Impl::Apply(_In_ ID3D11DeviceContext* deviceContext)
     // Make sure the constant buffers are up to date.
     if (dirtyFlags & EffectDirtyFlags::ConstantBufferMaterial)
     {
-        mCBMaterial.SetData(deviceContext, constants.material);
+        EffectConstantBufferCounters::Count(mCBMaterial.SetDataIfChanged(deviceContext, constants.material));
 
         dirtyFlags &= ~EffectDirtyFlags::ConstantBufferMaterial;
     }
 
     if (dirtyFlags & EffectDirtyFlags::ConstantBufferLight)
     {
-        mCBLight.SetData(deviceContext, constants.light);
+        EffectConstantBufferCounters::Count(mCBLight.SetDataIfChanged(deviceContext, constants.light));
 
         dirtyFlags &= ~EffectDirtyFlags::ConstantBufferLight;
     }
 
     if (dirtyFlags & EffectDirtyFlags::ConstantBufferObject)
     {
-        mCBObject.SetData(deviceContext, constants.object);
+        EffectConstantBufferCounters::Count(mCBObject.SetDataIfChanged(deviceContext, constants.object));
 
         dirtyFlags &= ~EffectDirtyFlags::ConstantBufferObject;
     }
 
     if (dirtyFlags & EffectDirtyFlags::ConstantBufferMisc)
     {
-        mCBMisc.SetData(deviceContext, constants.misc);
+        EffectConstantBufferCounters::Count(mCBMisc.SetDataIfChanged(deviceContext, constants.misc));
 
         dirtyFlags &= ~EffectDirtyFlags::ConstantBufferMisc;
     }
@@ -470,7 +470,7 @@ void DGSLEffect::Impl::Apply(_In_ ID3D11DeviceContext* deviceContext)
     {
         if (dirtyFlags & EffectDirtyFlags::ConstantBufferBones)
         {
-            mCBBone.SetData(deviceContext, constants.bones);
+            EffectConstantBufferCounters::Count(mCBBone.SetDataIfChanged(deviceContext, constants.bones));
 
             dirtyFlags &= ~EffectDirtyFlags::ConstantBufferBones;
         }
@@ -478,15 +478,15 @@ void DGSLEffect::Impl::Apply(_In_ ID3D11DeviceContext* deviceContext)
         ID3D11Buffer* buffers[5] = { mCBMaterial.GetBuffer(), mCBLight.GetBuffer(), mCBObject.GetBuffer(),
                                      mCBMisc.GetBuffer(), mCBBone.GetBuffer() };
 
-        deviceContext->VSSetConstantBuffers(0, 5, buffers);
-        deviceContext->PSSetConstantBuffers(0, 4, buffers);
+        StateFilter::VSSetConstantBuffers(deviceContext, 0, 5, buffers);
+        StateFilter::PSSetConstantBuffers(deviceContext, 0, 4, buffers);
     }
     else
     {
         ID3D11Buffer* buffers[4] = { mCBMaterial.GetBuffer(), mCBLight.GetBuffer(), mCBObject.GetBuffer(), mCBMisc.GetBuffer() };
 
-        deviceContext->VSSetConstantBuffers(0, 4, buffers);
-        deviceContext->PSSetConstantBuffers(0, 4, buffers);
+        StateFilter::VSSetConstantBuffers(deviceContext, 0, 4, buffers);
+        StateFilter::PSSetConstantBuffers(deviceContext, 0, 4, buffers);
     }
 #endif
 
@@ -495,12 +495,12 @@ void DGSLEffect::Impl::Apply(_In_ ID3D11DeviceContext* deviceContext)
     {
         ID3D11ShaderResourceView* txt[MaxTextures] = { textures[0].Get(), textures[1].Get(), textures[2].Get(), textures[3].Get(),
                                                        textures[4].Get(), textures[5].Get(), textures[6].Get(), textures[7].Get() };
-        deviceContext->PSSetShaderResources(0, MaxTextures, txt);
+        StateFilter::PSSetShaderResources(deviceContext, 0, MaxTextures, txt);
     }
     else
     {
         ID3D11ShaderResourceView* txt[MaxTextures] = { mDeviceResources->GetDefaultTexture(), nullptr };
-        deviceContext->PSSetShaderResources(0, MaxTextures, txt);
+        StateFilter::PSSetShaderResources(deviceContext, 0, MaxTextures, txt);
     }
 }
 
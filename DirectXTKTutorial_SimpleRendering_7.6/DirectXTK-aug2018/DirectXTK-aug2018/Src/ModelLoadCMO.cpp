@@ -15,6 +15,7 @@
 #include "VertexTypes.h"
 
 #include "DirectXHelpers.h"
+#include "ModelHelpers.h"
 #include "PlatformHelpers.h"
 #include "BinaryReader.h"
 
@@ -194,6 +195,18 @@ namespace
             texture{} {}
     };
 
+    struct ClipRecordCMO
+    {
+        std::wstring                                name;
+        float                                       startTime;
+        float                                       endTime;
+        std::vector<ModelAnimationClip::Keyframe>   keys;
+
+        ClipRecordCMO() noexcept :
+            startTime(0.f),
+            endTime(0.f) {}
+    };
+
     // Helper for creating a D3D input layout.
     void CreateInputLayout(_In_ ID3D11Device* device, IEffect* effect, _Out_ ID3D11InputLayout** pInputLayout, bool skinning)
     {
@@ -254,7 +267,8 @@ namespace
 //======================================================================================
 
 _Use_decl_annotations_
-std::unique_ptr<Model> DirectX::Model::CreateFromCMO(ID3D11Device* d3dDevice, const uint8_t* meshData, size_t dataSize, IEffectFactory& fxFactory, bool ccw, bool pmalpha)
+std::unique_ptr<Model> DirectX::Model::CreateFromCMO(ID3D11Device* d3dDevice, const uint8_t* meshData, size_t dataSize, IEffectFactory& fxFactory, bool ccw, bool pmalpha,
+                                                     const ModelLoaderOptions& options)
 {
     if (!InitOnceExecuteOnce(&g_InitOnce, InitializeDecl, nullptr, nullptr))
         throw std::exception("One-time initialization failed");
@@ -275,6 +289,11 @@ std::unique_ptr<Model> DirectX::Model::CreateFromCMO(ID3D11Device* d3dDevice, co
 
     std::unique_ptr<Model> model(new Model());
 
+    // Clips of the same name in different meshes animate different bones, so they are merged.
+    std::vector<ClipRecordCMO> clips;
+
+    ModelHelpers::ModelData modelData;
+
     for (UINT meshIndex = 0; meshIndex < *nMesh; ++meshIndex)
     {
         // Mesh name
@@ -410,7 +429,7 @@ std::unique_ptr<Model> DirectX::Model::CreateFromCMO(ID3D11Device* d3dDevice, co
         std::vector<IBData> ibData;
         ibData.reserve(*nIBs);
 
-        std::vector<ComPtr<ID3D11Buffer>> ibs;
+        std::vector<std::shared_ptr<ModelHelpers::BufferData>> ibs;
         ibs.resize(*nIBs);
 
         for (UINT j = 0; j < *nIBs; ++j)
@@ -440,19 +459,7 @@ std::unique_ptr<Model> DirectX::Model::CreateFromCMO(ID3D11Device* d3dDevice, co
             ib.ptr = indexes;
             ibData.emplace_back(ib);
 
-            D3D11_BUFFER_DESC desc = {};
-            desc.Usage = D3D11_USAGE_DEFAULT;
-            desc.ByteWidth = static_cast<UINT>(ibBytes);
-            desc.BindFlags = D3D11_BIND_INDEX_BUFFER;
-
-            D3D11_SUBRESOURCE_DATA initData = {};
-            initData.pSysMem = indexes;
-
-            ThrowIfFailed(
-                d3dDevice->CreateBuffer(&desc, &initData, &ibs[j])
-            );
-
-            SetDebugObjectName(ibs[j].Get(), "ModelCMO");
+            ibs[j] = ModelHelpers::ReferenceBufferData(indexes, ibBytes);
         }
 
         assert(ibData.size() == *nIBs);
@@ -552,8 +559,7 @@ std::unique_ptr<Model> DirectX::Model::CreateFromCMO(ID3D11Device* d3dDevice, co
         XMVECTOR max = XMVectorSet(extents->MaxX, extents->MaxY, extents->MaxZ, 0.f);
         BoundingBox::CreateFromPoints(mesh->boundingBox, min, max);
 
-    #if 0
-            // Animation data
+        // Animation data
         if (*bSkeleton)
         {
             // Bones
@@ -565,6 +571,10 @@ std::unique_ptr<Model> DirectX::Model::CreateFromCMO(ID3D11Device* d3dDevice, co
             if (!*nBones)
                 throw std::exception("Animation bone data is missing\n");
 
+            std::vector<std::wstring> boneNames(*nBones);
+            std::vector<const VSD3DStarter::Bone*> bones(*nBones);
+            std::vector<uint32_t> boneParents(*nBones);
+
             for (UINT j = 0; j < *nBones; ++j)
             {
                 // Bone name
@@ -579,17 +589,43 @@ std::unique_ptr<Model> DirectX::Model::CreateFromCMO(ID3D11Device* d3dDevice, co
                 if (dataSize < usedSize)
                     throw std::exception("End of file");
 
-                // TODO - What to do with bone name?
-                boneName;
+                boneNames[j].assign(boneName, *nName);
 
                 // Bone settings
-                auto bones = reinterpret_cast<const VSD3DStarter::Bone*>(meshData + usedSize);
+                bones[j] = reinterpret_cast<const VSD3DStarter::Bone*>(meshData + usedSize);
                 usedSize += sizeof(VSD3DStarter::Bone);
                 if (dataSize < usedSize)
                     throw std::exception("End of file");
 
-                // TODO - What to do with bone data?
-                bones;
+                if (bones[j]->ParentIndex >= INT(*nBones))
+                    throw std::exception("Invalid bone parent index");
+
+                boneParents[j] = (bones[j]->ParentIndex < 0) ? ModelSkeleton::c_Invalid : uint32_t(bones[j]->ParentIndex);
+            }
+
+            // Append the bones to the model skeleton with parents first, remapping the blend indices of this mesh.
+            std::vector<uint32_t> order;
+            ModelHelpers::SortBonesParentFirst(boneParents.data(), boneParents.size(), order);
+
+            auto& skeleton = model->skeleton;
+            auto baseBone = static_cast<uint32_t>(skeleton.GetBoneCount());
+
+            mesh->boneInfluences.resize(*nBones);
+
+            for (UINT j = 0; j < *nBones; ++j)
+            {
+                mesh->boneInfluences[order[j]] = baseBone + j;
+            }
+
+            for (UINT j = 0; j < *nBones; ++j)
+            {
+                auto bone = bones[order[j]];
+                auto parent = boneParents[order[j]];
+
+                skeleton.boneNames.push_back(boneNames[order[j]]);
+                skeleton.parentIndices.push_back((parent != ModelSkeleton::c_Invalid) ? mesh->boneInfluences[parent] : ModelSkeleton::c_Invalid);
+                skeleton.bindPoseTransforms.push_back(bone->LocalTransform);
+                skeleton.invBindPoseTransforms.push_back(bone->InvBindPos);
             }
 
             // Animation Clips
@@ -612,9 +648,6 @@ std::unique_ptr<Model> DirectX::Model::CreateFromCMO(ID3D11Device* d3dDevice, co
                 if (dataSize < usedSize)
                     throw std::exception("End of file");
 
-                // TODO - What to do with clip name?
-                clipName;
-
                 auto clip = reinterpret_cast<const VSD3DStarter::Clip*>(meshData + usedSize);
                 usedSize += sizeof(VSD3DStarter::Clip);
                 if (dataSize < usedSize)
@@ -628,18 +661,56 @@ std::unique_ptr<Model> DirectX::Model::CreateFromCMO(ID3D11Device* d3dDevice, co
                 if (dataSize < usedSize)
                     throw std::exception("End of file");
 
-                // TODO - What to do with keys and clip->StartTime, clip->EndTime?
-                keys;
+                std::wstring name(clipName, *nName);
+
+                auto cit = std::find_if(clips.begin(), clips.end(), [&](ClipRecordCMO const& c) { return c.name == name; });
+                if (cit == clips.end())
+                {
+                    ClipRecordCMO record;
+                    record.name = name;
+                    record.startTime = clip->StartTime;
+                    record.endTime = clip->EndTime;
+                    clips.push_back(record);
+                    cit = clips.end() - 1;
+                }
+                else
+                {
+                    cit->startTime = std::min(cit->startTime, clip->StartTime);
+                    cit->endTime = std::max(cit->endTime, clip->EndTime);
+                }
+
+                // Keyframes hold local bone matrices, which are interpolated as scale, rotation, and translation.
+                for (UINT k = 0; k < clip->keys; ++k)
+                {
+                    if (keys[k].BoneIndex >= *nBones)
+                        throw std::exception("Invalid keyframe bone index");
+
+                    XMMATRIX transform = XMLoadFloat4x4(&keys[k].Transform);
+
+                    XMVECTOR scale, rotation, translation;
+                    if (!XMMatrixDecompose(&scale, &rotation, &translation, transform))
+                    {
+                        scale = g_XMOne;
+                        rotation = XMQuaternionRotationMatrix(transform);
+                        translation = transform.r[3];
+                    }
+
+                    ModelAnimationClip::Keyframe key;
+                    key.boneIndex = mesh->boneInfluences[keys[k].BoneIndex];
+                    key.time = keys[k].Time;
+                    XMStoreFloat3(&key.scale, scale);
+                    XMStoreFloat4(&key.rotation, rotation);
+                    XMStoreFloat3(&key.translation, translation);
+
+                    cit->keys.push_back(key);
+                }
             }
         }
-    #else
-        UNREFERENCED_PARAMETER(bSkeleton);
-    #endif
 
         bool enableSkinning = (*nSkinVBs) != 0;
 
-        // Build vertex buffers
-        std::vector<ComPtr<ID3D11Buffer>> vbs;
+        // Build vertex buffer data
+        std::vector<std::shared_ptr<ModelHelpers::BufferData>> vbs;
         vbs.resize(*nVBs);
 
         const size_t stride = enableSkinning ? sizeof(VertexPositionNormalTangentColorTextureSkinning)
@@ -655,27 +726,15 @@ std::unique_ptr<Model> DirectX::Model::CreateFromCMO(ID3D11Device* d3dDevice, co
 
             size_t bytes = static_cast<size_t>(sizeInBytes);
 
-            D3D11_BUFFER_DESC desc = {};
-            desc.Usage = D3D11_USAGE_DEFAULT;
-            desc.ByteWidth = static_cast<UINT>(bytes);
-            desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-
             if (fxFactoryDGSL && !enableSkinning)
             {
                 // Can use CMO vertex data directly
-                D3D11_SUBRESOURCE_DATA initData = {};
-                initData.pSysMem = vbData[j].ptr;
-
-                ThrowIfFailed(
-                    d3dDevice->CreateBuffer(&desc, &initData, &vbs[j])
-                );
+                vbs[j] = ModelHelpers::ReferenceBufferData(vbData[j].ptr, bytes);
             }
             else
             {
-                std::unique_ptr<uint8_t[]> temp(new uint8_t[bytes + (sizeof(UINT) * nVerts)]);
-
-                auto visited = reinterpret_cast<UINT*>(temp.get() + bytes);
-                memset(visited, 0xff, sizeof(UINT) * nVerts);
+                std::vector<uint8_t> temp(bytes);
+                std::vector<UINT> visited(nVerts, UINT(-1));
 
                 assert(vbData[j].ptr != nullptr);
 
@@ -685,7 +744,7 @@ std::unique_ptr<Model> DirectX::Model::CreateFromCMO(ID3D11Device* d3dDevice, co
                     auto skinptr = vbData[j].skinPtr;
                     assert(skinptr != nullptr);
 
-                    uint8_t* ptr = temp.get();
+                    uint8_t* ptr = temp.data();
 
                     auto sptr = vbData[j].ptr;
 
@@ -702,7 +761,7 @@ std::unique_ptr<Model> DirectX::Model::CreateFromCMO(ID3D11Device* d3dDevice, co
                 }
                 else
                 {
-                    memcpy(temp.get(), vbData[j].ptr, bytes);
+                    memcpy(temp.data(), vbData[j].ptr, bytes);
                 }
 
                 if (!fxFactoryDGSL)
@@ -732,7 +791,7 @@ std::unique_ptr<Model> DirectX::Model::CreateFromCMO(ID3D11Device* d3dDevice, co
                             if (v >= nVerts)
                                 throw std::exception("Invalid index found\n");
 
-                            auto verts = reinterpret_cast<VertexPositionNormalTangentColorTexture*>(temp.get() + (v * stride));
+                            auto verts = reinterpret_cast<VertexPositionNormalTangentColorTexture*>(temp.data() + (v * stride));
                             if (visited[v] == UINT(-1))
                             {
                                 visited[v] = sm.MaterialIndex;
@@ -763,16 +822,8 @@ std::unique_ptr<Model> DirectX::Model::CreateFromCMO(ID3D11Device* d3dDevice, co
                     }
                 }
 
-                // Create vertex buffer from temporary buffer
-                D3D11_SUBRESOURCE_DATA initData = {};
-                initData.pSysMem = temp.get();
-
-                ThrowIfFailed(
-                    d3dDevice->CreateBuffer(&desc, &initData, &vbs[j])
-                );
+                vbs[j] = ModelHelpers::MakeBufferData(std::move(temp));
             }
-
-            SetDebugObjectName(vbs[j].Get(), "ModelCMO");
         }
 
         assert(vbs.size() == *nVBs);
@@ -851,35 +902,51 @@ std::unique_ptr<Model> DirectX::Model::CreateFromCMO(ID3D11Device* d3dDevice, co
             part->startIndex = sm.StartIndex;
             part->vertexStride = static_cast<UINT>(stride);
             part->inputLayout = mat.il;
-            part->indexBuffer = ibs[sm.IndexBufferIndex];
-            part->vertexBuffer = vbs[sm.VertexBufferIndex];
             part->effect = mat.effect;
             part->vbDecl = enableSkinning ? g_vbdeclSkinning : g_vbdecl;
 
+            auto& partData = modelData[part];
+            partData.vertices = vbs[sm.VertexBufferIndex];
+            partData.indices = ibs[sm.IndexBufferIndex];
+
             mesh->meshParts.emplace_back(part);
         }
 
         model->meshes.emplace_back(mesh);
     }
 
+    ModelHelpers::FinishLoading(d3dDevice, *model, modelData, options);
+
+    for (auto it = clips.cbegin(); it != clips.cend(); ++it)
+    {
+        ModelAnimationClip clip;
+        clip.name = it->name;
+        clip.startTime = it->startTime;
+        clip.endTime = it->endTime;
+        clip.SetKeyframes(it->keys.data(), it->keys.size(), model->skeleton.GetBoneCount());
+
+        model->animationClips.push_back(std::move(clip));
+    }
+
     return model;
 }
 
 
 //--------------------------------------------------------------------------------------
 _Use_decl_annotations_
-std::unique_ptr<Model> DirectX::Model::CreateFromCMO(ID3D11Device* d3dDevice, const wchar_t* szFileName, IEffectFactory& fxFactory, bool ccw, bool pmalpha)
+std::unique_ptr<Model> DirectX::Model::CreateFromCMO(ID3D11Device* d3dDevice, const wchar_t* szFileName, IEffectFactory& fxFactory, bool ccw, bool pmalpha,
+                                                     const ModelLoaderOptions& options)
 {
     size_t dataSize = 0;
-    std::unique_ptr<uint8_t[]> data;
-    HRESULT hr = BinaryReader::ReadEntireFile(szFileName, data, &dataSize);
+    ScopedMappedView data;
+    HRESULT hr = BinaryReader::MapEntireFile(szFileName, data, &dataSize);
     if (FAILED(hr))
     {
         DebugTrace("ERROR: CreateFromCMO failed (%08X) loading '%ls'\n", hr, szFileName);
         throw std::exception("CreateFromCMO");
     }
 
-    auto model = CreateFromCMO(d3dDevice, data.get(), dataSize, fxFactory, ccw, pmalpha);
+    auto model = CreateFromCMO(d3dDevice, data.get(), dataSize, fxFactory, ccw, pmalpha, options);
 
     model->name = szFileName;
 
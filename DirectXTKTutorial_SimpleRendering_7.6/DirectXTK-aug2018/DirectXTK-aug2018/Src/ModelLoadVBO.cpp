@@ -14,10 +14,12 @@
 #include "VertexTypes.h"
 
 #include "DirectXHelpers.h"
+#include "ModelHelpers.h"
 #include "PlatformHelpers.h"
 #include "BinaryReader.h"
 
 #include "vbo.h"
+#include "VBOCodec.h"
 
 using namespace DirectX;
 using Microsoft::WRL::ComPtr;
@@ -49,7 +51,8 @@ namespace
 //--------------------------------------------------------------------------------------
 _Use_decl_annotations_
 std::unique_ptr<Model> DirectX::Model::CreateFromVBO(ID3D11Device* d3dDevice, const uint8_t* meshData, size_t dataSize,
-                                                     std::shared_ptr<IEffect> ieffect, bool ccw, bool pmalpha)
+                                                     std::shared_ptr<IEffect> ieffect, bool ccw, bool pmalpha,
+                                                     const ModelLoaderOptions& options)
 {
     if (!InitOnceExecuteOnce(&g_InitOnce, InitializeDecl, nullptr, nullptr))
         throw std::exception("One-time initialization failed");
@@ -57,69 +60,58 @@ std::unique_ptr<Model> DirectX::Model::CreateFromVBO(ID3D11Device* d3dDevice, co
     if (!d3dDevice || !meshData)
         throw std::exception("Device and meshData cannot be null");
 
-    // File Header
-    if (dataSize < sizeof(VBO::header_t))
-        throw std::exception("End of file");
-    auto header = reinterpret_cast<const VBO::header_t*>(meshData);
-
-    if (!header->numVertices || !header->numIndices)
-        throw std::exception("No vertices or indices found");
-
-    uint64_t sizeInBytes = uint64_t(header->numVertices) * sizeof(VertexPositionNormalTexture);
-    if (sizeInBytes > uint64_t(D3D11_REQ_RESOURCE_SIZE_IN_MEGABYTES_EXPRESSION_A_TERM * 1024u * 1024u))
-        throw std::exception("VB too large for DirectX 11");
-
-    auto vertSize = static_cast<size_t>(sizeInBytes);
+    std::vector<VertexPositionNormalTexture> decodedVertices;
+    std::vector<uint16_t> decodedIndices;
 
-    if (dataSize < (vertSize + sizeof(VBO::header_t)))
-        throw std::exception("End of file");
-    auto verts = reinterpret_cast<const VertexPositionNormalTexture*>(meshData + sizeof(VBO::header_t));
+    const VertexPositionNormalTexture* verts;
+    const uint16_t* indices;
+    uint32_t numVertices;
+    uint32_t numIndices;
 
-    sizeInBytes = uint64_t(header->numIndices) * sizeof(uint16_t);
-    if (sizeInBytes > uint64_t(D3D11_REQ_RESOURCE_SIZE_IN_MEGABYTES_EXPRESSION_A_TERM * 1024u * 1024u))
-        throw std::exception("IB too large for DirectX 11");
-
-    auto indexSize = static_cast<size_t>(sizeInBytes);
-
-    if (dataSize < (sizeof(VBO::header_t) + vertSize + indexSize))
-        throw std::exception("End of file");
-    auto indices = reinterpret_cast<const uint16_t*>(meshData + sizeof(VBO::header_t) + vertSize);
+    if (VBO::IsCompressed(meshData, dataSize))
+    {
+        VBO::Decompress(meshData, dataSize, decodedVertices, decodedIndices);
 
-    // Create vertex buffer
-    ComPtr<ID3D11Buffer> vb;
+        verts = decodedVertices.data();
+        indices = decodedIndices.data();
+        numVertices = static_cast<uint32_t>(decodedVertices.size());
+        numIndices = static_cast<uint32_t>(decodedIndices.size());
+    }
+    else
     {
-        D3D11_BUFFER_DESC desc = {};
-        desc.Usage = D3D11_USAGE_DEFAULT;
-        desc.ByteWidth = static_cast<UINT>(vertSize);
-        desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
+        // File Header
+        if (dataSize < sizeof(VBO::header_t))
+            throw std::exception("End of file");
+        auto header = reinterpret_cast<const VBO::header_t*>(meshData);
 
-        D3D11_SUBRESOURCE_DATA initData = {};
-        initData.pSysMem = verts;
+        numVertices = header->numVertices;
+        numIndices = header->numIndices;
 
-        ThrowIfFailed(
-            d3dDevice->CreateBuffer(&desc, &initData, vb.GetAddressOf())
-        );
+        uint64_t fileSize = sizeof(VBO::header_t)
+            + uint64_t(numVertices) * sizeof(VertexPositionNormalTexture)
+            + uint64_t(numIndices) * sizeof(uint16_t);
 
-        SetDebugObjectName(vb.Get(), "ModelVBO");
+        if (dataSize < fileSize)
+            throw std::exception("End of file");
+
+        verts = reinterpret_cast<const VertexPositionNormalTexture*>(meshData + sizeof(VBO::header_t));
+        indices = reinterpret_cast<const uint16_t*>(meshData + sizeof(VBO::header_t) + numVertices * sizeof(VertexPositionNormalTexture));
     }
 
-    // Create index buffer
-    ComPtr<ID3D11Buffer> ib;
-    {
-        D3D11_BUFFER_DESC desc = {};
-        desc.Usage = D3D11_USAGE_DEFAULT;
-        desc.ByteWidth = static_cast<UINT>(indexSize);
-        desc.BindFlags = D3D11_BIND_INDEX_BUFFER;
+    if (!numVertices || !numIndices)
+        throw std::exception("No vertices or indices found");
 
-        D3D11_SUBRESOURCE_DATA initData = {};
-        initData.pSysMem = indices;
+    uint64_t sizeInBytes = uint64_t(numVertices) * sizeof(VertexPositionNormalTexture);
+    if (sizeInBytes > uint64_t(D3D11_REQ_RESOURCE_SIZE_IN_MEGABYTES_EXPRESSION_A_TERM * 1024u * 1024u))
+        throw std::exception("VB too large for DirectX 11");
 
-        ThrowIfFailed(
-            d3dDevice->CreateBuffer(&desc, &initData, ib.GetAddressOf())
-        );
+    auto vertSize = static_cast<size_t>(sizeInBytes);
 
-        SetDebugObjectName(ib.Get(), "ModelVBO");
-    }
+    sizeInBytes = uint64_t(numIndices) * sizeof(uint16_t);
+    if (sizeInBytes > uint64_t(D3D11_REQ_RESOURCE_SIZE_IN_MEGABYTES_EXPRESSION_A_TERM * 1024u * 1024u))
+        throw std::exception("IB too large for DirectX 11");
+
+    auto indexSize = static_cast<size_t>(sizeInBytes);
 
     // Create input layout and effect
     if (!ieffect)
@@ -148,25 +140,32 @@ std::unique_ptr<Model> DirectX::Model::CreateFromVBO(ID3D11Device* d3dDevice, co
     }
 
     auto part = new ModelMeshPart();
-    part->indexCount = header->numIndices;
+    part->indexCount = numIndices;
     part->startIndex = 0;
     part->vertexStride = static_cast<UINT>(sizeof(VertexPositionNormalTexture));
     part->inputLayout = il;
-    part->indexBuffer = ib;
-    part->vertexBuffer = vb;
     part->effect = ieffect;
     part->vbDecl = g_vbdecl;
 
     auto mesh = std::make_shared<ModelMesh>();
     mesh->ccw = ccw;
     mesh->pmalpha = pmalpha;
-    BoundingSphere::CreateFromPoints(mesh->boundingSphere, header->numVertices, &verts->position, sizeof(VertexPositionNormalTexture));
-    BoundingBox::CreateFromPoints(mesh->boundingBox, header->numVertices, &verts->position, sizeof(VertexPositionNormalTexture));
+    BoundingSphere::CreateFromPoints(mesh->boundingSphere, numVertices, &verts->position, sizeof(VertexPositionNormalTexture));
+    BoundingBox::CreateFromPoints(mesh->boundingBox, numVertices, &verts->position, sizeof(VertexPositionNormalTexture));
     mesh->meshParts.emplace_back(part);
 
     std::unique_ptr<Model> model(new Model());
     model->meshes.emplace_back(mesh);
 
+    // Create vertex and index buffers
+    ModelHelpers::ModelData data;
+
+    auto& partData = data[part];
+    partData.vertices = ModelHelpers::ReferenceBufferData(verts, vertSize);
+    partData.indices = ModelHelpers::ReferenceBufferData(indices, indexSize);
+
+    ModelHelpers::FinishLoading(d3dDevice, *model, data, options);
+
     return model;
 }
 
@@ -174,20 +173,85 @@ std::unique_ptr<Model> DirectX::Model::CreateFromVBO(ID3D11Device* d3dDevice, co
 //--------------------------------------------------------------------------------------
 _Use_decl_annotations_
 std::unique_ptr<Model> DirectX::Model::CreateFromVBO(ID3D11Device* d3dDevice, const wchar_t* szFileName,
-                                                     std::shared_ptr<IEffect> ieffect, bool ccw, bool pmalpha)
+                                                     std::shared_ptr<IEffect> ieffect, bool ccw, bool pmalpha,
+                                                     const ModelLoaderOptions& options)
 {
     size_t dataSize = 0;
-    std::unique_ptr<uint8_t[]> data;
-    HRESULT hr = BinaryReader::ReadEntireFile(szFileName, data, &dataSize);
+    ScopedMappedView data;
+    HRESULT hr = BinaryReader::MapEntireFile(szFileName, data, &dataSize);
     if (FAILED(hr))
     {
         DebugTrace("ERROR: CreateFromVBO failed (%08X) loading '%ls'\n", hr, szFileName);
         throw std::exception("CreateFromVBO");
     }
 
-    auto model = CreateFromVBO(d3dDevice, data.get(), dataSize, ieffect, ccw, pmalpha);
+    auto model = CreateFromVBO(d3dDevice, data.get(), dataSize, ieffect, ccw, pmalpha, options);
 
     model->name = szFileName;
 
     return model;
 }
+
+
+//--------------------------------------------------------------------------------------
+_Use_decl_annotations_
+void DirectX::Model::CompressVBO(const uint8_t* meshData, size_t dataSize, std::vector<uint8_t>& compressedData)
+{
+    if (!meshData)
+        throw std::exception("meshData cannot be null");
+
+    if (dataSize < sizeof(VBO::header_t))
+        throw std::exception("End of file");
+    auto header = reinterpret_cast<const VBO::header_t*>(meshData);
+
+    if (VBO::IsCompressed(meshData, dataSize))
+        throw std::exception("VBO file is already compressed");
+
+    uint64_t fileSize = sizeof(VBO::header_t)
+        + uint64_t(header->numVertices) * sizeof(VertexPositionNormalTexture)
+        + uint64_t(header->numIndices) * sizeof(uint16_t);
+
+    if (dataSize < fileSize)
+        throw std::exception("End of file");
+
+    auto verts = reinterpret_cast<const VertexPositionNormalTexture*>(meshData + sizeof(VBO::header_t));
+    auto indices = reinterpret_cast<const uint16_t*>(verts + header->numVertices);
+
+    VBO::Compress(verts, header->numVertices, indices, header->numIndices, compressedData);
+}
+
+
+_Use_decl_annotations_
+void DirectX::Model::CompressVBO(const wchar_t* szFileName, const wchar_t* szCompressedFileName)
+{
+    if (!szCompressedFileName)
+        throw std::exception("File name cannot be null");
+
+    size_t dataSize = 0;
+    ScopedMappedView data;
+    HRESULT hr = BinaryReader::MapEntireFile(szFileName, data, &dataSize);
+    if (FAILED(hr))
+    {
+        DebugTrace("ERROR: CompressVBO failed (%08X) loading '%ls'\n", hr, szFileName);
+        throw std::exception("CompressVBO");
+    }
+
+    std::vector<uint8_t> compressedData;
+    CompressVBO(data.get(), dataSize, compressedData);
+
+#if (_WIN32_WINNT >= _WIN32_WINNT_WIN8)
+    ScopedHandle hFile(safe_handle(CreateFile2(szCompressedFileName, GENERIC_WRITE, 0, CREATE_ALWAYS, nullptr)));
+#else
+    ScopedHandle hFile(safe_handle(CreateFileW(szCompressedFileName, GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, 0, nullptr)));
+#endif
+
+    DWORD bytesWritten = 0;
+
+    if (!hFile
+        || !WriteFile(hFile.get(), compressedData.data(), static_cast<DWORD>(compressedData.size()), &bytesWritten, nullptr)
+        || bytesWritten != compressedData.size())
+    {
+        DebugTrace("ERROR: CompressVBO failed (%08X) writing '%ls'\n", HRESULT_FROM_WIN32(GetLastError()), szCompressedFileName);
+        throw std::exception("CompressVBO");
+    }
+}
@@ -16,6 +16,7 @@
 #include "DemandCreate.h"
 #include "DirectXHelpers.h"
 #include "SharedResourcePool.h"
+#include "StateFilter.h"
 
 using namespace DirectX;
 
@@ -219,22 +220,22 @@ void BasicPostProcess::Impl::Process(_In_ ID3D11DeviceContext* deviceContext, st
 {
     // Set the texture.
     ID3D11ShaderResourceView* textures[1] = { texture.Get() };
-    deviceContext->PSSetShaderResources(0, 1, textures);
+    StateFilter::PSSetShaderResources(deviceContext, 0, 1, textures);
 
     auto sampler = mDeviceResources->stateObjects.LinearClamp();
-    deviceContext->PSSetSamplers(0, 1, &sampler);
+    StateFilter::PSSetSamplers(deviceContext, 0, 1, &sampler);
 
     // Set state objects.
-    deviceContext->OMSetBlendState(mDeviceResources->stateObjects.Opaque(), nullptr, 0xffffffff);
-    deviceContext->OMSetDepthStencilState(mDeviceResources->stateObjects.DepthNone(), 0);
-    deviceContext->RSSetState(mDeviceResources->stateObjects.CullNone());
+    StateFilter::OMSetBlendState(deviceContext, mDeviceResources->stateObjects.Opaque(), nullptr, 0xffffffff);
+    StateFilter::OMSetDepthStencilState(deviceContext, mDeviceResources->stateObjects.DepthNone(), 0);
+    StateFilter::RSSetState(deviceContext, mDeviceResources->stateObjects.CullNone());
 
     // Set shaders.
     auto vertexShader = mDeviceResources->GetVertexShader();
     auto pixelShader = mDeviceResources->GetPixelShader(fx);
 
-    deviceContext->VSSetShader(vertexShader, nullptr, 0);
-    deviceContext->PSSetShader(pixelShader, nullptr, 0);
+    StateFilter::VSSetShader(deviceContext, vertexShader, nullptr, 0);
+    StateFilter::PSSetShader(deviceContext, pixelShader, nullptr, 0);
 
     // Set constants.
     if (mUseConstants)
@@ -291,18 +292,19 @@ void BasicPostProcess::Impl::Process(_In_ ID3D11DeviceContext* deviceContext, st
         // Set the constant buffer.
         auto buffer = mConstantBuffer.GetBuffer();
 
-        deviceContext->PSSetConstantBuffers(0, 1, &buffer);
+        StateFilter::PSSetConstantBuffers(deviceContext, 0, 1, &buffer);
 #endif
     }
 
     if (setCustomState)
     {
         setCustomState();
+        StateFilter::Invalidate(deviceContext);
     }
 
     // Draw quad.
-    deviceContext->IASetInputLayout(nullptr);
-    deviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    StateFilter::IASetInputLayout(deviceContext, nullptr);
+    StateFilter::IASetPrimitiveTopology(deviceContext, D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
 
     deviceContext->Draw(3, 0);
 }
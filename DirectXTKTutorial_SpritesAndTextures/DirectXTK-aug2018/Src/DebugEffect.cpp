@@ -270,6 +270,12 @@ void DebugEffect::GetVertexShaderBytecode(_Out_ void const** pShaderByteCode, _O
 }
 
 
+void DebugEffect::CreateShaders(bool allPermutations)
+{
+    pImpl->CreateShaders(allPermutations ? -1 : pImpl->GetCurrentShaderPermutation());
+}
+
+
 // Camera settings.
 void XM_CALLCONV DebugEffect::SetWorld(FXMMATRIX value)
 {
@@ -305,6 +311,14 @@ void XM_CALLCONV DebugEffect::SetMatrices(FXMMATRIX world, CXMMATRIX view, CXMMA
 }
 
 
+void DebugEffect::SetDerivedMatrices(const EffectDerivedMatrices& value)
+{
+    pImpl->matrices.SetDerived(pImpl->dirtyFlags, value, pImpl->constants.worldViewProj);
+
+    EffectMatrices::SetDerivedWorldConstants(pImpl->dirtyFlags, value, pImpl->constants.world, pImpl->constants.worldInverseTranspose);
+}
+
+
 // Material settings.
 void DebugEffect::SetMode(Mode debugMode)
 {
@@ -0,0 +1,301 @@
+//--------------------------------------------------------------------------------------
+// File: MeshNormals.cpp
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#include "pch.h"
+#include "MeshNormals.h"
+#include "ParallelHelpers.h"
+
+using namespace DirectX;
+using DirectX::ParallelHelpers::ParallelFor;
+
+
+namespace
+{
+    // Meshes smaller than this are processed on the calling thread only.
+    const size_t MinParallelChunk = 16384;
+
+
+    template<typename TIndex>
+    void ValidateIndices(_In_reads_(nFaces * 3) const TIndex* indices, size_t nFaces, size_t nVerts)
+    {
+        if (!indices)
+            throw std::exception("Indices are required");
+
+        if (nVerts >= UINT32_MAX || uint64_t(nFaces) * 3 >= UINT32_MAX)
+            throw std::out_of_range("Too many vertices or faces");
+
+        for (size_t i = 0; i < nFaces * 3; i++)
+        {
+            if (indices[i] >= nVerts)
+                throw std::out_of_range("Index not in vertices list");
+        }
+    }
+
+
+    // Builds the list of corners (face * 3 + corner) using each vertex.
+    template<typename TIndex>
+    void BuildCornerAdjacency(_In_reads_(nFaces * 3) const TIndex* indices, size_t nFaces, size_t nVerts,
+                              std::vector<uint32_t>& offsets, std::vector<uint32_t>& corners)
+    {
+        offsets.assign(nVerts + 1, 0);
+
+        for (size_t i = 0; i < nFaces * 3; i++)
+        {
+            offsets[indices[i] + 1]++;
+        }
+
+        for (size_t i = 0; i < nVerts; i++)
+        {
+            offsets[i + 1] += offsets[i];
+        }
+
+        corners.resize(nFaces * 3);
+
+        std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+
+        for (size_t i = 0; i < nFaces * 3; i++)
+        {
+            corners[fill[indices[i]]++] = static_cast<uint32_t>(i);
+        }
+    }
+
+
+    // Computes the unit normal of each face (zero if degenerate), and the angle at each of its corners.
+    template<typename TIndex>
+    void ComputeFaceAngles(_In_reads_(nFaces * 3) const TIndex* indices, size_t nFaces, _In_ const XMFLOAT3* positions,
+                           _Out_writes_opt_(nFaces) XMFLOAT3* faceNormals, _Out_writes_(nFaces * 3) float* cornerAngles)
+    {
+        ParallelFor(nFaces, MinParallelChunk, [=](size_t begin, size_t end)
+        {
+            for (size_t face = begin; face < end; face++)
+            {
+                XMVECTOR p0 = XMLoadFloat3(&positions[indices[face * 3]]);
+                XMVECTOR p1 = XMLoadFloat3(&positions[indices[face * 3 + 1]]);
+                XMVECTOR p2 = XMLoadFloat3(&positions[indices[face * 3 + 2]]);
+
+                XMVECTOR u = XMVectorSubtract(p1, p0);
+                XMVECTOR v = XMVectorSubtract(p2, p0);
+
+                XMVECTOR normal = XMVector3Cross(u, v);
+
+                if (XMVector3NearEqual(normal, g_XMZero, g_XMEpsilon))
+                {
+                    // Degenerate faces contribute nothing.
+                    if (faceNormals)
+                        faceNormals[face] = XMFLOAT3(0, 0, 0);
+
+                    cornerAngles[face * 3] = cornerAngles[face * 3 + 1] = cornerAngles[face * 3 + 2] = 0;
+                    continue;
+                }
+
+                if (faceNormals)
+                    XMStoreFloat3(&faceNormals[face], XMVector3Normalize(normal));
+
+                float a0 = XMVectorGetX(XMVector3AngleBetweenVectors(u, v));
+                float a1 = XMVectorGetX(XMVector3AngleBetweenVectors(XMVectorNegate(u), XMVectorSubtract(p2, p1)));
+
+                cornerAngles[face * 3] = a0;
+                cornerAngles[face * 3 + 1] = a1;
+                cornerAngles[face * 3 + 2] = std::max(XM_PI - a0 - a1, 0.f);
+            }
+        });
+    }
+
+
+    template<typename TIndex>
+    void ComputeNormalsImpl(_In_reads_(nFaces * 3) const TIndex* indices, size_t nFaces,
+                            _In_reads_(nVerts) const XMFLOAT3* positions, size_t nVerts,
+                            bool cw, _Out_writes_(nVerts) XMFLOAT3* normals)
+    {
+        if (!positions || !normals)
+            throw std::exception("Positions and normals are required");
+
+        ValidateIndices(indices, nFaces, nVerts);
+
+        std::vector<XMFLOAT3> faceNormals(nFaces);
+        std::vector<float> cornerAngles(nFaces * 3);
+
+        ComputeFaceAngles(indices, nFaces, positions, faceNormals.data(), cornerAngles.data());
+
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> corners;
+        BuildCornerAdjacency(indices, nFaces, nVerts, offsets, corners);
+
+        ParallelFor(nVerts, MinParallelChunk, [&](size_t begin, size_t end)
+        {
+            for (size_t vert = begin; vert < end; vert++)
+            {
+                XMVECTOR sum = XMVectorZero();
+
+                for (uint32_t j = offsets[vert]; j < offsets[vert + 1]; j++)
+                {
+                    uint32_t corner = corners[j];
+
+                    sum = XMVectorMultiplyAdd(XMLoadFloat3(&faceNormals[corner / 3]), XMVectorReplicate(cornerAngles[corner]), sum);
+                }
+
+                if (cw)
+                {
+                    sum = XMVectorNegate(sum);
+                }
+
+                XMStoreFloat3(&normals[vert], XMVector3Normalize(sum));
+            }
+        });
+    }
+
+
+    template<typename TIndex>
+    void ComputeTangentFrameImpl(_In_reads_(nFaces * 3) const TIndex* indices, size_t nFaces,
+                                 _In_reads_(nVerts) const XMFLOAT3* positions,
+                                 _In_reads_(nVerts) const XMFLOAT3* normals,
+                                 _In_reads_(nVerts) const XMFLOAT2* textureCoordinates, size_t nVerts,
+                                 _Out_writes_(nVerts) XMFLOAT4* tangents,
+                                 _Out_writes_opt_(nVerts) XMFLOAT3* bitangents)
+    {
+        if (!positions || !normals || !textureCoordinates || !tangents)
+            throw std::exception("Positions, normals, texture coordinates, and tangents are required");
+
+        ValidateIndices(indices, nFaces, nVerts);
+
+        std::vector<float> cornerAngles(nFaces * 3);
+
+        ComputeFaceAngles(indices, nFaces, positions, static_cast<XMFLOAT3*>(nullptr), cornerAngles.data());
+
+        // Face tangent and bitangent directions, from the texture coordinate gradients.
+        std::vector<XMFLOAT3> faceTangents(nFaces);
+        std::vector<XMFLOAT3> faceBitangents(nFaces);
+
+        ParallelFor(nFaces, MinParallelChunk, [&](size_t begin, size_t end)
+        {
+            for (size_t face = begin; face < end; face++)
+            {
+                auto i0 = indices[face * 3];
+                auto i1 = indices[face * 3 + 1];
+                auto i2 = indices[face * 3 + 2];
+
+                XMVECTOR p0 = XMLoadFloat3(&positions[i0]);
+                XMVECTOR e1 = XMVectorSubtract(XMLoadFloat3(&positions[i1]), p0);
+                XMVECTOR e2 = XMVectorSubtract(XMLoadFloat3(&positions[i2]), p0);
+
+                XMVECTOR t0 = XMLoadFloat2(&textureCoordinates[i0]);
+                XMVECTOR d1 = XMVectorSubtract(XMLoadFloat2(&textureCoordinates[i1]), t0);
+                XMVECTOR d2 = XMVectorSubtract(XMLoadFloat2(&textureCoordinates[i2]), t0);
+
+                // Signed area in texture space; (d1.x * d2.y - d2.x * d1.y)
+                float area = XMVectorGetX(XMVector2Cross(d1, d2));
+
+                if (area == 0.f)
+                {
+                    faceTangents[face] = faceBitangents[face] = XMFLOAT3(0, 0, 0);
+                    continue;
+                }
+
+                // Only the directions are kept, so dividing by the area reduces to flipping mirrored faces.
+                XMVECTOR scale = (area < 0.f) ? g_XMNegativeOne : g_XMOne;
+
+                XMVECTOR tangent = XMVectorSubtract(XMVectorMultiply(e1, XMVectorSplatY(d2)), XMVectorMultiply(e2, XMVectorSplatY(d1)));
+                XMVECTOR bitangent = XMVectorSubtract(XMVectorMultiply(e2, XMVectorSplatX(d1)), XMVectorMultiply(e1, XMVectorSplatX(d2)));
+
+                XMStoreFloat3(&faceTangents[face], XMVector3Normalize(XMVectorMultiply(tangent, scale)));
+                XMStoreFloat3(&faceBitangents[face], XMVector3Normalize(XMVectorMultiply(bitangent, scale)));
+            }
+        });
+
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> corners;
+        BuildCornerAdjacency(indices, nFaces, nVerts, offsets, corners);
+
+        ParallelFor(nVerts, MinParallelChunk, [&](size_t begin, size_t end)
+        {
+            for (size_t vert = begin; vert < end; vert++)
+            {
+                XMVECTOR normal = XMVector3Normalize(XMLoadFloat3(&normals[vert]));
+
+                XMVECTOR sumTangent = XMVectorZero();
+                XMVECTOR sumBitangent = XMVectorZero();
+
+                // Project each face direction onto the plane of the vertex normal before weighting.
+                for (uint32_t j = offsets[vert]; j < offsets[vert + 1]; j++)
+                {
+                    uint32_t corner = corners[j];
+                    XMVECTOR weight = XMVectorReplicate(cornerAngles[corner]);
+
+                    XMVECTOR t = XMLoadFloat3(&faceTangents[corner / 3]);
+                    XMVECTOR b = XMLoadFloat3(&faceBitangents[corner / 3]);
+
+                    t = XMVector3Normalize(XMVectorNegativeMultiplySubtract(normal, XMVector3Dot(normal, t), t));
+                    b = XMVector3Normalize(XMVectorNegativeMultiplySubtract(normal, XMVector3Dot(normal, b), b));
+
+                    sumTangent = XMVectorMultiplyAdd(t, weight, sumTangent);
+                    sumBitangent = XMVectorMultiplyAdd(b, weight, sumBitangent);
+                }
+
+                XMVECTOR tangent = XMVectorNegativeMultiplySubtract(normal, XMVector3Dot(normal, sumTangent), sumTangent);
+
+                if (XMVector3NearEqual(tangent, g_XMZero, g_XMEpsilon))
+                {
+                    // No usable texture mapping, so pick any direction perpendicular to the normal.
+                    XMVECTOR axis = (fabsf(XMVectorGetX(normal)) < 0.9f) ? g_XMIdentityR0 : g_XMIdentityR1;
+                    tangent = XMVector3Cross(normal, axis);
+                }
+
+                tangent = XMVector3Normalize(tangent);
+
+                XMVECTOR cross = XMVector3Cross(normal, tangent);
+                float sign = (XMVectorGetX(XMVector3Dot(cross, sumBitangent)) < 0) ? -1.f : 1.f;
+
+                XMStoreFloat4(&tangents[vert], XMVectorSetW(tangent, sign));
+
+                if (bitangents)
+                {
+                    XMStoreFloat3(&bitangents[vert], XMVectorScale(cross, sign));
+                }
+            }
+        });
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// Vertex normals
+//--------------------------------------------------------------------------------------
+
+_Use_decl_annotations_
+void DirectX::ComputeNormals(const uint16_t* indices, size_t nFaces, const XMFLOAT3* positions, size_t nVerts, bool cw, XMFLOAT3* normals)
+{
+    ComputeNormalsImpl(indices, nFaces, positions, nVerts, cw, normals);
+}
+
+
+_Use_decl_annotations_
+void DirectX::ComputeNormals(const uint32_t* indices, size_t nFaces, const XMFLOAT3* positions, size_t nVerts, bool cw, XMFLOAT3* normals)
+{
+    ComputeNormalsImpl(indices, nFaces, positions, nVerts, cw, normals);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Tangent frames
+//--------------------------------------------------------------------------------------
+
+_Use_decl_annotations_
+void DirectX::ComputeTangentFrame(const uint16_t* indices, size_t nFaces, const XMFLOAT3* positions, const XMFLOAT3* normals,
+                                  const XMFLOAT2* textureCoordinates, size_t nVerts, XMFLOAT4* tangents, XMFLOAT3* bitangents)
+{
+    ComputeTangentFrameImpl(indices, nFaces, positions, normals, textureCoordinates, nVerts, tangents, bitangents);
+}
+
+
+_Use_decl_annotations_
+void DirectX::ComputeTangentFrame(const uint32_t* indices, size_t nFaces, const XMFLOAT3* positions, const XMFLOAT3* normals,
+                                  const XMFLOAT2* textureCoordinates, size_t nVerts, XMFLOAT4* tangents, XMFLOAT3* bitangents)
+{
+    ComputeTangentFrameImpl(indices, nFaces, positions, normals, textureCoordinates, nVerts, tangents, bitangents);
+}
@@ -0,0 +1,28 @@
+//--------------------------------------------------------------------------------------
+// File: MeshSimplify.h
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <vector>
+
+
+namespace DirectX
+{
+    // Reduces an indexed triangle list to about targetIndexCount indices by collapsing edges onto
+    // existing vertices, so the result can be drawn with the original vertex buffer. Collapses are
+    // ordered by quadric error, plus a penalty for the normal and texture coordinate change when
+    // those are supplied. Mesh borders and attribute seams are left untouched.
+    void SimplifyMesh(_In_reads_(vertexCount) const XMFLOAT3* positions,
+                      _In_reads_opt_(vertexCount) const XMFLOAT3* normals,
+                      _In_reads_opt_(vertexCount) const XMFLOAT2* textureCoordinates,
+                      size_t vertexCount,
+                      _In_reads_(indexCount) const uint32_t* indices, size_t indexCount,
+                      size_t targetIndexCount,
+                      std::vector<uint32_t>& result);
+}
@@ -0,0 +1,626 @@
+//--------------------------------------------------------------------------------------
+// File: ModelLoader.cpp
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#include "pch.h"
+#include "ModelLoader.h"
+#include "Effects.h"
+#include "PlatformHelpers.h"
+
+#include "DDSTextureLoader.h"
+#include "WICTextureLoader.h"
+
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <thread>
+
+using namespace DirectX;
+using Microsoft::WRL::ComPtr;
+
+
+namespace
+{
+    enum TextureSlot
+    {
+        TextureSlot_Diffuse = 0,
+        TextureSlot_Specular,
+        TextureSlot_Normal,
+        TextureSlot_Count
+    };
+
+
+    // Binds a texture to whichever effect type uses it for the given role, matching the choices EffectFactory makes.
+    void ApplyTexture(_In_ IEffect* effect, TextureSlot slot, _In_ ID3D11ShaderResourceView* srv)
+    {
+        switch (slot)
+        {
+            case TextureSlot_Diffuse:
+                if (auto basic = dynamic_cast<BasicEffect*>(effect))
+                {
+                    basic->SetTexture(srv);
+                    basic->SetTextureEnabled(true);
+                }
+                else if (auto skinned = dynamic_cast<SkinnedEffect*>(effect))
+                {
+                    skinned->SetTexture(srv);
+                }
+                else if (auto dual = dynamic_cast<DualTextureEffect*>(effect))
+                {
+                    dual->SetTexture(srv);
+                }
+                else if (auto normalMap = dynamic_cast<NormalMapEffect*>(effect))
+                {
+                    normalMap->SetTexture(srv);
+                }
+                else if (auto dgsl = dynamic_cast<DGSLEffect*>(effect))
+                {
+                    dgsl->SetTexture(srv);
+                    dgsl->SetTextureEnabled(true);
+                }
+                break;
+
+            case TextureSlot_Specular:
+                if (auto dual = dynamic_cast<DualTextureEffect*>(effect))
+                {
+                    dual->SetTexture2(srv);
+                }
+                else if (auto normalMap = dynamic_cast<NormalMapEffect*>(effect))
+                {
+                    normalMap->SetSpecularTexture(srv);
+                }
+                break;
+
+            case TextureSlot_Normal:
+                if (auto normalMap = dynamic_cast<NormalMapEffect*>(effect))
+                {
+                    normalMap->SetNormalTexture(srv);
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+}
+
+
+// Internal ModelLoader implementation class.
+class ModelLoader::Impl
+{
+public:
+    Impl(_In_ ID3D11Device* device, IEffectFactory& fxFactory, size_t threadCount);
+
+    Impl(Impl const&) = delete;
+    Impl& operator= (Impl const&) = delete;
+
+    ~Impl();
+
+    typedef std::function<std::unique_ptr<Model>(ID3D11Device*, IEffectFactory&)> LoadFunction;
+
+    std::future<std::unique_ptr<Model>> QueueModel(LoadFunction load);
+    size_t Update();
+    void WaitForAll();
+    void ReleaseCache();
+    void EnableForceSRGB(bool forceSRGB);
+    void SetDirectory(_In_opt_z_ const wchar_t* path);
+
+private:
+    struct TextureEntry
+    {
+        TextureEntry() : ready(false) {}
+
+        ComPtr<ID3D11ShaderResourceView> srv;
+        bool ready;
+    };
+
+    struct PendingEffect
+    {
+        std::shared_ptr<IEffect> effect;
+        std::shared_ptr<TextureEntry> textures[TextureSlot_Count];
+    };
+
+    // Stands in for the application's factory on the worker threads: effects are created without their
+    // textures, which are queued instead and bound later by Update.
+    class DeferredEffectFactory : public IEffectFactory
+    {
+    public:
+        explicit DeferredEffectFactory(Impl* owner) : mOwner(owner) {}
+
+        virtual std::shared_ptr<IEffect> __cdecl CreateEffect(_In_ const EffectInfo& info, _In_opt_ ID3D11DeviceContext* deviceContext) override;
+        virtual void __cdecl CreateTexture(_In_z_ const wchar_t* name, _In_opt_ ID3D11DeviceContext* deviceContext, _Outptr_ ID3D11ShaderResourceView** textureView) override;
+
+    private:
+        Impl* mOwner;
+    };
+
+    void WorkerThread();
+    std::shared_ptr<TextureEntry> RequestTexture(_In_opt_z_ const wchar_t* name);
+    void LoadTexture(TextureEntry& entry, std::wstring const& name, std::wstring const& path, bool forceSRGB);
+
+    ComPtr<ID3D11Device> mDevice;
+    IEffectFactory* mFactory;
+    DeferredEffectFactory mDeferredFactory;
+    bool mFactoryDGSL;
+
+    // Texture settings. Each texture request takes a copy, so changes apply to later requests.
+    wchar_t mPath[MAX_PATH];
+    bool mForceSRGB;
+
+    // Guards the queues, texture cache, pending effects, and texture settings.
+    std::mutex mMutex;
+    std::condition_variable mWorkAvailable;
+    std::condition_variable mWorkDone;
+
+    // Guards the application's factory, which is not safe to call from several threads at once.
+    std::mutex mFactoryMutex;
+
+    std::deque<std::function<void()>> mModelQueue;
+    std::deque<std::function<void()>> mTextureQueue;
+    size_t mActiveTasks;
+    bool mShutdown;
+
+    std::map<std::wstring, std::shared_ptr<TextureEntry>> mTextureCache;
+    std::list<PendingEffect> mPendingEffects;
+
+    std::vector<std::thread> mThreads;
+};
+
+
+_Use_decl_annotations_
+ModelLoader::Impl::Impl(ID3D11Device* device, IEffectFactory& fxFactory, size_t threadCount)
+    : mDevice(device),
+    mFactory(&fxFactory),
+    mDeferredFactory(this),
+    mFactoryDGSL(dynamic_cast<DGSLEffectFactory*>(&fxFactory) != nullptr),
+    mPath{},
+    mForceSRGB(false),
+    mActiveTasks(0),
+    mShutdown(false)
+{
+    if (!device)
+        throw std::exception("Direct3D device is null");
+
+    if (!threadCount)
+    {
+        // Leave a hardware thread for the caller.
+        threadCount = std::max<size_t>(1, std::thread::hardware_concurrency()) - 1;
+        threadCount = std::max<size_t>(1, threadCount);
+    }
+
+    mThreads.reserve(threadCount);
+
+    for (size_t i = 0; i < threadCount; i++)
+    {
+        mThreads.emplace_back(&Impl::WorkerThread, this);
+    }
+}
+
+
+ModelLoader::Impl::~Impl()
+{
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mShutdown = true;
+
+        // Destroying the queued tasks breaks their promises.
+        mModelQueue.clear();
+        mTextureQueue.clear();
+    }
+
+    mWorkAvailable.notify_all();
+
+    for (auto& thread : mThreads)
+    {
+        thread.join();
+    }
+}
+
+
+void ModelLoader::Impl::WorkerThread()
+{
+    for (;;)
+    {
+        std::function<void()> task;
+
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mWorkAvailable.wait(lock, [this]() { return mShutdown || !mModelQueue.empty() || !mTextureQueue.empty(); });
+
+            if (mShutdown)
+                return;
+
+            // Geometry goes first, so models become usable as early as possible.
+            auto& queue = !mModelQueue.empty() ? mModelQueue : mTextureQueue;
+            task = std::move(queue.front());
+            queue.pop_front();
+
+            ++mActiveTasks;
+        }
+
+        task();
+
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            --mActiveTasks;
+        }
+
+        mWorkDone.notify_all();
+    }
+}
+
+
+std::future<std::unique_ptr<Model>> ModelLoader::Impl::QueueModel(LoadFunction load)
+{
+    auto task = std::make_shared<std::packaged_task<std::unique_ptr<Model>()>>([this, load]() -> std::unique_ptr<Model>
+    {
+        if (mFactoryDGSL)
+        {
+            // The CMO loader needs the DGSL factory itself to create shader designer materials, so those
+            // loads are serialized and their textures are created by the factory.
+            std::lock_guard<std::mutex> lock(mFactoryMutex);
+            return load(mDevice.Get(), *mFactory);
+        }
+
+        return load(mDevice.Get(), mDeferredFactory);
+    });
+
+    auto result = task->get_future();
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mModelQueue.emplace_back([task]() { (*task)(); });
+    }
+
+    mWorkAvailable.notify_one();
+
+    return result;
+}
+
+
+size_t ModelLoader::Impl::Update()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    for (auto it = mPendingEffects.begin(); it != mPendingEffects.end(); )
+    {
+        bool done = true;
+
+        for (size_t slot = 0; slot < TextureSlot_Count; slot++)
+        {
+            auto& texture = it->textures[slot];
+            if (!texture)
+                continue;
+
+            if (!texture->ready)
+            {
+                done = false;
+                continue;
+            }
+
+            if (texture->srv)
+            {
+                ApplyTexture(it->effect.get(), static_cast<TextureSlot>(slot), texture->srv.Get());
+            }
+
+            texture.reset();
+        }
+
+        if (done)
+            it = mPendingEffects.erase(it);
+        else
+            ++it;
+    }
+
+    return mPendingEffects.size();
+}
+
+
+void ModelLoader::Impl::WaitForAll()
+{
+    std::unique_lock<std::mutex> lock(mMutex);
+    mWorkDone.wait(lock, [this]() { return mModelQueue.empty() && mTextureQueue.empty() && !mActiveTasks; });
+}
+
+
+void ModelLoader::Impl::ReleaseCache()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    // Textures still loading stay referenced by their pending effects.
+    mTextureCache.clear();
+}
+
+
+void ModelLoader::Impl::EnableForceSRGB(bool forceSRGB)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mForceSRGB = forceSRGB;
+}
+
+
+_Use_decl_annotations_
+void ModelLoader::Impl::SetDirectory(const wchar_t* path)
+{
+    wchar_t newPath[MAX_PATH] = {};
+
+    if (path && *path != 0)
+    {
+        wcscpy_s(newPath, path);
+        size_t len = wcsnlen(newPath, MAX_PATH);
+        if (len > 0 && len < (MAX_PATH - 1))
+        {
+            // Ensure it has a trailing slash
+            if (newPath[len - 1] != L'\\')
+            {
+                newPath[len] = L'\\';
+                newPath[len + 1] = 0;
+            }
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    wcscpy_s(mPath, newPath);
+}
+
+
+_Use_decl_annotations_
+std::shared_ptr<ModelLoader::Impl::TextureEntry> ModelLoader::Impl::RequestTexture(const wchar_t* name)
+{
+    if (!name || !*name)
+        return nullptr;
+
+    std::wstring textureName(name);
+
+    std::shared_ptr<TextureEntry> entry;
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        auto it = mTextureCache.find(textureName);
+        if (it != mTextureCache.end())
+            return it->second;
+
+        entry = std::make_shared<TextureEntry>();
+        mTextureCache.insert(std::make_pair(textureName, entry));
+
+        std::wstring path(mPath);
+        bool forceSRGB = mForceSRGB;
+
+        mTextureQueue.emplace_back([this, entry, textureName, path, forceSRGB]()
+        {
+            LoadTexture(*entry, textureName, path, forceSRGB);
+        });
+    }
+
+    mWorkAvailable.notify_one();
+
+    return entry;
+}
+
+
+void ModelLoader::Impl::LoadTexture(TextureEntry& entry, std::wstring const& name, std::wstring const& path, bool forceSRGB)
+{
+    ComPtr<ID3D11ShaderResourceView> srv;
+
+    wchar_t fullName[MAX_PATH] = {};
+    wcscpy_s(fullName, path.c_str());
+    wcscat_s(fullName, name.c_str());
+
+    WIN32_FILE_ATTRIBUTE_DATA fileAttr = {};
+    if (!GetFileAttributesExW(fullName, GetFileExInfoStandard, &fileAttr))
+    {
+        // Try Current Working Directory (CWD)
+        wcscpy_s(fullName, name.c_str());
+        if (!GetFileAttributesExW(fullName, GetFileExInfoStandard, &fileAttr))
+        {
+            DebugTrace("ERROR: ModelLoader could not find texture file '%ls'\n", name.c_str());
+            *fullName = 0;
+        }
+    }
+
+    if (*fullName)
+    {
+        wchar_t ext[_MAX_EXT];
+        _wsplitpath_s(name.c_str(), nullptr, 0, nullptr, 0, nullptr, 0, ext, _MAX_EXT);
+
+        // Only the device is used here, which is free-threaded, so textures load in parallel.
+        HRESULT hr;
+        if (_wcsicmp(ext, L".dds") == 0)
+        {
+            hr = CreateDDSTextureFromFileEx(
+                mDevice.Get(), fullName, 0,
+                D3D11_USAGE_DEFAULT, D3D11_BIND_SHADER_RESOURCE, 0, 0,
+                forceSRGB, nullptr, srv.GetAddressOf());
+        }
+        else
+        {
+            hr = CreateWICTextureFromFileEx(
+                mDevice.Get(), fullName, 0,
+                D3D11_USAGE_DEFAULT, D3D11_BIND_SHADER_RESOURCE, 0, 0,
+                forceSRGB ? WIC_LOADER_FORCE_SRGB : WIC_LOADER_DEFAULT, nullptr, srv.GetAddressOf());
+        }
+
+        if (FAILED(hr))
+        {
+            DebugTrace("ERROR: ModelLoader failed (%08X) to load texture '%ls'\n", hr, fullName);
+            srv.Reset();
+        }
+    }
+
+    // A texture that failed to load leaves its effects untextured rather than failing the models.
+    std::lock_guard<std::mutex> lock(mMutex);
+    entry.srv = srv;
+    entry.ready = true;
+}
+
+
+_Use_decl_annotations_
+std::shared_ptr<IEffect> ModelLoader::Impl::DeferredEffectFactory::CreateEffect(const EffectInfo& info, ID3D11DeviceContext* deviceContext)
+{
+    UNREFERENCED_PARAMETER(deviceContext);
+
+    EffectInfo deferred = info;
+    deferred.diffuseTexture = nullptr;
+    deferred.specularTexture = nullptr;
+    deferred.normalTexture = nullptr;
+
+    PendingEffect pending;
+
+    {
+        std::lock_guard<std::mutex> lock(mOwner->mFactoryMutex);
+        pending.effect = mOwner->mFactory->CreateEffect(deferred, nullptr);
+    }
+
+    pending.textures[TextureSlot_Diffuse] = mOwner->RequestTexture(info.diffuseTexture);
+    pending.textures[TextureSlot_Specular] = mOwner->RequestTexture(info.specularTexture);
+    pending.textures[TextureSlot_Normal] = mOwner->RequestTexture(info.normalTexture);
+
+    if (pending.textures[TextureSlot_Diffuse] || pending.textures[TextureSlot_Specular] || pending.textures[TextureSlot_Normal])
+    {
+        std::lock_guard<std::mutex> lock(mOwner->mMutex);
+        mOwner->mPendingEffects.push_back(pending);
+    }
+
+    return pending.effect;
+}
+
+
+_Use_decl_annotations_
+void ModelLoader::Impl::DeferredEffectFactory::CreateTexture(const wchar_t* name, ID3D11DeviceContext* deviceContext, ID3D11ShaderResourceView** textureView)
+{
+    UNREFERENCED_PARAMETER(deviceContext);
+
+    std::lock_guard<std::mutex> lock(mOwner->mFactoryMutex);
+    mOwner->mFactory->CreateTexture(name, nullptr, textureView);
+}
+
+
+//--------------------------------------------------------------------------------------
+// ModelLoader
+//--------------------------------------------------------------------------------------
+
+// Public constructor.
+_Use_decl_annotations_
+ModelLoader::ModelLoader(ID3D11Device* device, IEffectFactory& fxFactory, size_t threadCount)
+    : pImpl(std::make_unique<Impl>(device, fxFactory, threadCount))
+{
+}
+
+
+// Move constructor.
+ModelLoader::ModelLoader(ModelLoader&& moveFrom) noexcept
+    : pImpl(std::move(moveFrom.pImpl))
+{
+}
+
+
+// Move assignment.
+ModelLoader& ModelLoader::operator= (ModelLoader&& moveFrom) noexcept
+{
+    pImpl = std::move(moveFrom.pImpl);
+    return *this;
+}
+
+
+// Public destructor.
+ModelLoader::~ModelLoader()
+{
+}
+
+
+_Use_decl_annotations_
+std::future<std::unique_ptr<Model>> ModelLoader::LoadCMO(const wchar_t* szFileName, bool ccw, bool pmalpha, const ModelLoaderOptions& options)
+{
+    if (!szFileName)
+        throw std::exception("File name cannot be null");
+
+    std::wstring fileName(szFileName);
+
+    return pImpl->QueueModel([fileName, ccw, pmalpha, options](ID3D11Device* device, IEffectFactory& fxFactory)
+    {
+        return Model::CreateFromCMO(device, fileName.c_str(), fxFactory, ccw, pmalpha, options);
+    });
+}
+
+
+_Use_decl_annotations_
+std::future<std::unique_ptr<Model>> ModelLoader::LoadSDKMESH(const wchar_t* szFileName, bool ccw, bool pmalpha, const ModelLoaderOptions& options)
+{
+    if (!szFileName)
+        throw std::exception("File name cannot be null");
+
+    std::wstring fileName(szFileName);
+
+    return pImpl->QueueModel([fileName, ccw, pmalpha, options](ID3D11Device* device, IEffectFactory& fxFactory)
+    {
+        return Model::CreateFromSDKMESH(device, fileName.c_str(), fxFactory, ccw, pmalpha, options);
+    });
+}
+
+
+_Use_decl_annotations_
+std::future<std::unique_ptr<Model>> ModelLoader::LoadVBO(const wchar_t* szFileName, std::shared_ptr<IEffect> ieffect, bool ccw, bool pmalpha,
+                                                         const ModelLoaderOptions& options)
+{
+    if (!szFileName)
+        throw std::exception("File name cannot be null");
+
+    std::wstring fileName(szFileName);
+
+    return pImpl->QueueModel([fileName, ieffect, ccw, pmalpha, options](ID3D11Device* device, IEffectFactory&)
+    {
+        return Model::CreateFromVBO(device, fileName.c_str(), ieffect, ccw, pmalpha, options);
+    });
+}
+
+
+_Use_decl_annotations_
+std::future<std::unique_ptr<Model>> ModelLoader::LoadBMDL(const wchar_t* szFileName)
+{
+    if (!szFileName)
+        throw std::exception("File name cannot be null");
+
+    std::wstring fileName(szFileName);
+
+    return pImpl->QueueModel([fileName](ID3D11Device* device, IEffectFactory& fxFactory)
+    {
+        return Model::CreateFromBMDL(device, fileName.c_str(), fxFactory);
+    });
+}
+
+
+size_t ModelLoader::Update()
+{
+    return pImpl->Update();
+}
+
+
+void ModelLoader::WaitForAll()
+{
+    pImpl->WaitForAll();
+}
+
+
+void ModelLoader::ReleaseCache()
+{
+    pImpl->ReleaseCache();
+}
+
+
+void ModelLoader::EnableForceSRGB(bool forceSRGB)
+{
+    pImpl->EnableForceSRGB(forceSRGB);
+}
+
+
+_Use_decl_annotations_
+void ModelLoader::SetDirectory(const wchar_t* path)
+{
+    pImpl->SetDirectory(path);
+}
@@ -9,6 +9,7 @@
 
 #include "pch.h"
 #include "EffectCommon.h"
+#include "LightClusters.h"
 
 using namespace DirectX;
 
@@ -42,12 +43,21 @@ struct NormalMapEffectTraits
 {
     using ConstantBufferType = NormalMapEffectConstants;
 
-    static const int VertexShaderCount = 4;
-    static const int PixelShaderCount = 4;
-    static const int ShaderPermutationCount = 16;
+    static const int VertexShaderCount = 8;
+    static const int PixelShaderCount = 8;
+    static const int ShaderPermutationCount = 64;
 };
 
 
+// Permutations from this one on use the clustered lighting pixel shaders, which need Shader Model 5.0.
+static const int ClusteredPermutationStart = 16;
+
+// Permutations from this one on use the instanced vertex shaders, repeating the others in the same order.
+static const int InstancedPermutationStart = 32;
+
+static_assert(sizeof(LightClustersConstants) == 32, "LightClustersConstants must match the shader");
+
+
 // Internal NormalMapEffect implementation class.
 class NormalMapEffect::Impl : public EffectBase<NormalMapEffectTraits>
 {
@@ -59,15 +69,46 @@ public:
 
     bool vertexColorEnabled;
     bool biasedVertexNormals;
+    bool instancingEnabled;
+    bool instancingSupported;
   
     EffectLights lights;
 
+    // Clustered lighting, with its constant buffer created on first use.
+    const LightClusters* lightClusters;
+    bool clusteredLightingSupported;
+    Microsoft::WRL::ComPtr<ID3D11Device> device;
+    ConstantBuffer<LightClustersConstants> clusterConstantBuffer;
+
     int GetCurrentShaderPermutation() const;
 
     void Apply(_In_ ID3D11DeviceContext* deviceContext);
 };
 
 
+// The clustered lighting shaders need Shader Model 5.0, and are built in once CompileShaders has generated them.
+#if !defined(NORMALMAPEFFECT_CLUSTERED_SHADERS) && defined(__has_include)
+#if defined(_XBOX_ONE) && defined(_TITLE)
+#if __has_include("Shaders/Compiled/XboxOneNormalMapEffectClustered_PSClusteredLightingTx.inc")
+#define NORMALMAPEFFECT_CLUSTERED_SHADERS
+#endif
+#elif __has_include("Shaders/Compiled/NormalMapEffectClustered_PSClusteredLightingTx.inc")
+#define NORMALMAPEFFECT_CLUSTERED_SHADERS
+#endif
+#endif
+
+// Likewise the instanced shaders, which are generated with the others of NormalMapEffect.fx.
+#if !defined(NORMALMAPEFFECT_INSTANCED_SHADERS) && defined(__has_include)
+#if defined(_XBOX_ONE) && defined(_TITLE)
+#if __has_include("Shaders/Compiled/XboxOneNormalMapEffect_VSNormalPixelLightingTxInst.inc")
+#define NORMALMAPEFFECT_INSTANCED_SHADERS
+#endif
+#elif __has_include("Shaders/Compiled/NormalMapEffect_VSNormalPixelLightingTxInst.inc")
+#define NORMALMAPEFFECT_INSTANCED_SHADERS
+#endif
+#endif
+
+
 // Include the precompiled shader code.
 namespace
 {
@@ -78,10 +119,25 @@ namespace
     #include "Shaders/Compiled/XboxOneNormalMapEffect_VSNormalPixelLightingTxBn.inc"
     #include "Shaders/Compiled/XboxOneNormalMapEffect_VSNormalPixelLightingTxVcBn.inc"
 
+    #if defined(NORMALMAPEFFECT_INSTANCED_SHADERS)
+    #include "Shaders/Compiled/XboxOneNormalMapEffect_VSNormalPixelLightingTxInst.inc"
+    #include "Shaders/Compiled/XboxOneNormalMapEffect_VSNormalPixelLightingTxVcInst.inc"
+
+    #include "Shaders/Compiled/XboxOneNormalMapEffect_VSNormalPixelLightingTxBnInst.inc"
+    #include "Shaders/Compiled/XboxOneNormalMapEffect_VSNormalPixelLightingTxVcBnInst.inc"
+    #endif
+
     #include "Shaders/Compiled/XboxOneNormalMapEffect_PSNormalPixelLightingTx.inc"
     #include "Shaders/Compiled/XboxOneNormalMapEffect_PSNormalPixelLightingTxNoFog.inc"
     #include "Shaders/Compiled/XboxOneNormalMapEffect_PSNormalPixelLightingTxNoSpec.inc"
     #include "Shaders/Compiled/XboxOneNormalMapEffect_PSNormalPixelLightingTxNoFogSpec.inc"
+
+    #if defined(NORMALMAPEFFECT_CLUSTERED_SHADERS)
+    #include "Shaders/Compiled/XboxOneNormalMapEffectClustered_PSClusteredLightingTx.inc"
+    #include "Shaders/Compiled/XboxOneNormalMapEffectClustered_PSClusteredLightingTxNoFog.inc"
+    #include "Shaders/Compiled/XboxOneNormalMapEffectClustered_PSClusteredLightingTxNoSpec.inc"
+    #include "Shaders/Compiled/XboxOneNormalMapEffectClustered_PSClusteredLightingTxNoFogSpec.inc"
+    #endif
 #else    
     #include "Shaders/Compiled/NormalMapEffect_VSNormalPixelLightingTx.inc"
     #include "Shaders/Compiled/NormalMapEffect_VSNormalPixelLightingTxVc.inc"
@@ -89,10 +145,25 @@ namespace
     #include "Shaders/Compiled/NormalMapEffect_VSNormalPixelLightingTxBn.inc"
     #include "Shaders/Compiled/NormalMapEffect_VSNormalPixelLightingTxVcBn.inc"
 
+    #if defined(NORMALMAPEFFECT_INSTANCED_SHADERS)
+    #include "Shaders/Compiled/NormalMapEffect_VSNormalPixelLightingTxInst.inc"
+    #include "Shaders/Compiled/NormalMapEffect_VSNormalPixelLightingTxVcInst.inc"
+
+    #include "Shaders/Compiled/NormalMapEffect_VSNormalPixelLightingTxBnInst.inc"
+    #include "Shaders/Compiled/NormalMapEffect_VSNormalPixelLightingTxVcBnInst.inc"
+    #endif
+
     #include "Shaders/Compiled/NormalMapEffect_PSNormalPixelLightingTx.inc"
     #include "Shaders/Compiled/NormalMapEffect_PSNormalPixelLightingTxNoFog.inc"
     #include "Shaders/Compiled/NormalMapEffect_PSNormalPixelLightingTxNoSpec.inc"
     #include "Shaders/Compiled/NormalMapEffect_PSNormalPixelLightingTxNoFogSpec.inc"
+
+    #if defined(NORMALMAPEFFECT_CLUSTERED_SHADERS)
+    #include "Shaders/Compiled/NormalMapEffectClustered_PSClusteredLightingTx.inc"
+    #include "Shaders/Compiled/NormalMapEffectClustered_PSClusteredLightingTxNoFog.inc"
+    #include "Shaders/Compiled/NormalMapEffectClustered_PSClusteredLightingTxNoSpec.inc"
+    #include "Shaders/Compiled/NormalMapEffectClustered_PSClusteredLightingTxNoFogSpec.inc"
+    #endif
 #endif
 }
 
@@ -105,6 +176,20 @@ const ShaderBytecode EffectBase<NormalMapEffectTraits>::VertexShaderBytecode[] =
 
     { NormalMapEffect_VSNormalPixelLightingTxBn,   sizeof(NormalMapEffect_VSNormalPixelLightingTxBn)   },
     { NormalMapEffect_VSNormalPixelLightingTxVcBn, sizeof(NormalMapEffect_VSNormalPixelLightingTxVcBn) },
+
+#if defined(NORMALMAPEFFECT_INSTANCED_SHADERS)
+    { NormalMapEffect_VSNormalPixelLightingTxInst,     sizeof(NormalMapEffect_VSNormalPixelLightingTxInst)     },
+    { NormalMapEffect_VSNormalPixelLightingTxVcInst,   sizeof(NormalMapEffect_VSNormalPixelLightingTxVcInst)   },
+
+    { NormalMapEffect_VSNormalPixelLightingTxBnInst,   sizeof(NormalMapEffect_VSNormalPixelLightingTxBnInst)   },
+    { NormalMapEffect_VSNormalPixelLightingTxVcBnInst, sizeof(NormalMapEffect_VSNormalPixelLightingTxVcBnInst) },
+#else
+    // Never created, as instancing is reported unsupported without its shaders.
+    { nullptr, 0 },
+    { nullptr, 0 },
+    { nullptr, 0 },
+    { nullptr, 0 },
+#endif
 };
 
 
@@ -130,6 +215,66 @@ const int EffectBase<NormalMapEffectTraits>::VertexShaderIndices[] =
     2,      // pixel lighting (biased vertex normal) + texture, no fog or specular
     3,      // pixel lighting (biased vertex normal) + texture + vertex color, no specular
     3,      // pixel lighting (biased vertex normal) + texture + vertex color, no fog or specular
+
+    0,      // clustered lighting + texture
+    0,      // clustered lighting + texture, no fog
+    1,      // clustered lighting + texture + vertex color
+    1,      // clustered lighting + texture + vertex color, no fog
+
+    0,      // clustered lighting + texture, no specular
+    0,      // clustered lighting + texture, no fog or specular
+    1,      // clustered lighting + texture + vertex color, no specular
+    1,      // clustered lighting + texture + vertex color, no fog or specular
+
+    2,      // clustered lighting (biased vertex normal) + texture
+    2,      // clustered lighting (biased vertex normal) + texture, no fog
+    3,      // clustered lighting (biased vertex normal) + texture + vertex color
+    3,      // clustered lighting (biased vertex normal) + texture + vertex color, no fog
+
+    2,      // clustered lighting (biased vertex normal) + texture, no specular
+    2,      // clustered lighting (biased vertex normal) + texture, no fog or specular
+    3,      // clustered lighting (biased vertex normal) + texture + vertex color, no specular
+    3,      // clustered lighting (biased vertex normal) + texture + vertex color, no fog or specular
+
+    4,      // instancing + pixel lighting + texture
+    4,      // instancing + pixel lighting + texture, no fog
+    5,      // instancing + pixel lighting + texture + vertex color
+    5,      // instancing + pixel lighting + texture + vertex color, no fog
+
+    4,      // instancing + pixel lighting + texture, no specular
+    4,      // instancing + pixel lighting + texture, no fog or specular
+    5,      // instancing + pixel lighting + texture + vertex color, no specular
+    5,      // instancing + pixel lighting + texture + vertex color, no fog or specular
+
+    6,      // instancing + pixel lighting (biased vertex normal) + texture
+    6,      // instancing + pixel lighting (biased vertex normal) + texture, no fog
+    7,      // instancing + pixel lighting (biased vertex normal) + texture + vertex color
+    7,      // instancing + pixel lighting (biased vertex normal) + texture + vertex color, no fog
+
+    6,      // instancing + pixel lighting (biased vertex normal) + texture, no specular
+    6,      // instancing + pixel lighting (biased vertex normal) + texture, no fog or specular
+    7,      // instancing + pixel lighting (biased vertex normal) + texture + vertex color, no specular
+    7,      // instancing + pixel lighting (biased vertex normal) + texture + vertex color, no fog or specular
+
+    4,      // instancing + clustered lighting + texture
+    4,      // instancing + clustered lighting + texture, no fog
+    5,      // instancing + clustered lighting + texture + vertex color
+    5,      // instancing + clustered lighting + texture + vertex color, no fog
+
+    4,      // instancing + clustered lighting + texture, no specular
+    4,      // instancing + clustered lighting + texture, no fog or specular
+    5,      // instancing + clustered lighting + texture + vertex color, no specular
+    5,      // instancing + clustered lighting + texture + vertex color, no fog or specular
+
+    6,      // instancing + clustered lighting (biased vertex normal) + texture
+    6,      // instancing + clustered lighting (biased vertex normal) + texture, no fog
+    7,      // instancing + clustered lighting (biased vertex normal) + texture + vertex color
+    7,      // instancing + clustered lighting (biased vertex normal) + texture + vertex color, no fog
+
+    6,      // instancing + clustered lighting (biased vertex normal) + texture, no specular
+    6,      // instancing + clustered lighting (biased vertex normal) + texture, no fog or specular
+    7,      // instancing + clustered lighting (biased vertex normal) + texture + vertex color, no specular
+    7,      // instancing + clustered lighting (biased vertex normal) + texture + vertex color, no fog or specular
 };
 
 
@@ -140,6 +285,19 @@ const ShaderBytecode EffectBase<NormalMapEffectTraits>::PixelShaderBytecode[] =
     { NormalMapEffect_PSNormalPixelLightingTxNoFog,     sizeof(NormalMapEffect_PSNormalPixelLightingTxNoFog)     },
     { NormalMapEffect_PSNormalPixelLightingTxNoSpec,    sizeof(NormalMapEffect_PSNormalPixelLightingTxNoSpec)    },
     { NormalMapEffect_PSNormalPixelLightingTxNoFogSpec, sizeof(NormalMapEffect_PSNormalPixelLightingTxNoFogSpec) },
+
+#if defined(NORMALMAPEFFECT_CLUSTERED_SHADERS)
+    { NormalMapEffectClustered_PSClusteredLightingTx,          sizeof(NormalMapEffectClustered_PSClusteredLightingTx)          },
+    { NormalMapEffectClustered_PSClusteredLightingTxNoFog,     sizeof(NormalMapEffectClustered_PSClusteredLightingTxNoFog)     },
+    { NormalMapEffectClustered_PSClusteredLightingTxNoSpec,    sizeof(NormalMapEffectClustered_PSClusteredLightingTxNoSpec)    },
+    { NormalMapEffectClustered_PSClusteredLightingTxNoFogSpec, sizeof(NormalMapEffectClustered_PSClusteredLightingTxNoFogSpec) },
+#else
+    // Never created, as clustered lighting is reported unsupported without its shaders.
+    { nullptr, 0 },
+    { nullptr, 0 },
+    { nullptr, 0 },
+    { nullptr, 0 },
+#endif
 };
 
 
@@ -165,6 +323,66 @@ const int EffectBase<NormalMapEffectTraits>::PixelShaderIndices[] =
     3,      // pixel lighting (biased vertex normal) + texture, no fog or specular
     2,      // pixel lighting (biased vertex normal) + texture + vertex color, no specular
     3,      // pixel lighting (biased vertex normal) + texture + vertex color, no fog or specular
+
+    4,      // clustered lighting + texture
+    5,      // clustered lighting + texture, no fog
+    4,      // clustered lighting + texture + vertex color
+    5,      // clustered lighting + texture + vertex color, no fog
+
+    6,      // clustered lighting + texture, no specular
+    7,      // clustered lighting + texture, no fog or specular
+    6,      // clustered lighting + texture + vertex color, no specular
+    7,      // clustered lighting + texture + vertex color, no fog or specular
+
+    4,      // clustered lighting (biased vertex normal) + texture
+    5,      // clustered lighting (biased vertex normal) + texture, no fog
+    4,      // clustered lighting (biased vertex normal) + texture + vertex color
+    5,      // clustered lighting (biased vertex normal) + texture + vertex color, no fog
+
+    6,      // clustered lighting (biased vertex normal) + texture, no specular
+    7,      // clustered lighting (biased vertex normal) + texture, no fog or specular
+    6,      // clustered lighting (biased vertex normal) + texture + vertex color, no specular
+    7,      // clustered lighting (biased vertex normal) + texture + vertex color, no fog or specular
+
+    0,      // instancing + pixel lighting + texture
+    1,      // instancing + pixel lighting + texture, no fog
+    0,      // instancing + pixel lighting + texture + vertex color
+    1,      // instancing + pixel lighting + texture + vertex color, no fog
+
+    2,      // instancing + pixel lighting + texture, no specular
+    3,      // instancing + pixel lighting + texture, no fog or specular
+    2,      // instancing + pixel lighting + texture + vertex color, no specular
+    3,      // instancing + pixel lighting + texture + vertex color, no fog or specular
+
+    0,      // instancing + pixel lighting (biased vertex normal) + texture
+    1,      // instancing + pixel lighting (biased vertex normal) + texture, no fog
+    0,      // instancing + pixel lighting (biased vertex normal) + texture + vertex color
+    1,      // instancing + pixel lighting (biased vertex normal) + texture + vertex color, no fog
+
+    2,      // instancing + pixel lighting (biased vertex normal) + texture, no specular
+    3,      // instancing + pixel lighting (biased vertex normal) + texture, no fog or specular
+    2,      // instancing + pixel lighting (biased vertex normal) + texture + vertex color, no specular
+    3,      // instancing + pixel lighting (biased vertex normal) + texture + vertex color, no fog or specular
+
+    4,      // instancing + clustered lighting + texture
+    5,      // instancing + clustered lighting + texture, no fog
+    4,      // instancing + clustered lighting + texture + vertex color
+    5,      // instancing + clustered lighting + texture + vertex color, no fog
+
+    6,      // instancing + clustered lighting + texture, no specular
+    7,      // instancing + clustered lighting + texture, no fog or specular
+    6,      // instancing + clustered lighting + texture + vertex color, no specular
+    7,      // instancing + clustered lighting + texture + vertex color, no fog or specular
+
+    4,      // instancing + clustered lighting (biased vertex normal) + texture
+    5,      // instancing + clustered lighting (biased vertex normal) + texture, no fog
+    4,      // instancing + clustered lighting (biased vertex normal) + texture + vertex color
+    5,      // instancing + clustered lighting (biased vertex normal) + texture + vertex color, no fog
+
+    6,      // instancing + clustered lighting (biased vertex normal) + texture, no specular
+    7,      // instancing + clustered lighting (biased vertex normal) + texture, no fog or specular
+    6,      // instancing + clustered lighting (biased vertex normal) + texture + vertex color, no specular
+    7,      // instancing + clustered lighting (biased vertex normal) + texture + vertex color, no fog or specular
 };
 
 
@@ -177,7 +395,20 @@ SharedResourcePool<ID3D11Device*, EffectBase<NormalMapEffectTraits>::DeviceResou
 NormalMapEffect::Impl::Impl(_In_ ID3D11Device* device)
     : EffectBase(device),
     vertexColorEnabled(false),
-    biasedVertexNormals(false)
+    biasedVertexNormals(false),
+    instancingEnabled(false),
+#if defined(NORMALMAPEFFECT_INSTANCED_SHADERS)
+    instancingSupported(true),
+#else
+    instancingSupported(false),
+#endif
+    lightClusters(nullptr),
+#if defined(NORMALMAPEFFECT_CLUSTERED_SHADERS)
+    clusteredLightingSupported(device->GetFeatureLevel() >= D3D_FEATURE_LEVEL_11_0),
+#else
+    clusteredLightingSupported(false),
+#endif
+    device(device)
 {
     if (device->GetFeatureLevel() < D3D_FEATURE_LEVEL_10_0)
     {
@@ -221,6 +452,18 @@ int NormalMapEffect::Impl::GetCurrentShaderPermutation() const
         permutation += 8;
     }
 
+    if (lightClusters)
+    {
+        // Point and spot lights are read from the clusters in the pixel shader.
+        permutation += ClusteredPermutationStart;
+    }
+
+    if (instancingEnabled)
+    {
+        // World matrices are read per instance in the vertex shader.
+        permutation += InstancedPermutationStart;
+    }
+
     return permutation;
 }
 
@@ -237,8 +480,37 @@ void NormalMapEffect::Impl::Apply(_In_ ID3D11DeviceContext* deviceContext)
 
     // Set the textures
     ID3D11ShaderResourceView* textures[] = { texture.Get(), specularTexture.Get(), normalTexture.Get()};
-    deviceContext->PSSetShaderResources(0, _countof(textures), textures);
-    
+    StateFilter::PSSetShaderResources(deviceContext, 0, _countof(textures), textures);
+
+    if (lightClusters)
+    {
+        // Set the clustered lights, which follow the textures.
+        ID3D11ShaderResourceView* clusterBuffers[] =
+        {
+            lightClusters->GetLightBuffer(),
+            lightClusters->GetClusterBuffer(),
+            lightClusters->GetLightIndexBuffer()
+        };
+        StateFilter::PSSetShaderResources(deviceContext, _countof(textures), _countof(clusterBuffers), clusterBuffers);
+
+        auto clusterConstants = lightClusters->GetShaderConstants();
+
+    #if defined(_XBOX_ONE) && defined(_TITLE)
+        void *grfxMemory;
+        clusterConstantBuffer.SetData(deviceContext, clusterConstants, &grfxMemory);
+
+        Microsoft::WRL::ComPtr<ID3D11DeviceContextX> deviceContextX;
+        ThrowIfFailed(deviceContext->QueryInterface(IID_GRAPHICS_PPV_ARGS(deviceContextX.GetAddressOf())));
+
+        deviceContextX->PSSetPlacementConstantBuffer(1, clusterConstantBuffer.GetBuffer(), grfxMemory);
+    #else
+        EffectConstantBufferCounters::Count(clusterConstantBuffer.SetDataIfChanged(deviceContext, clusterConstants));
+
+        ID3D11Buffer* buffer = clusterConstantBuffer.GetBuffer();
+        StateFilter::PSSetConstantBuffers(deviceContext, 1, 1, &buffer);
+    #endif
+    }
+
     // Set shaders and constant buffers.
     ApplyShaders(deviceContext, GetCurrentShaderPermutation());
 }
@@ -285,6 +557,34 @@ void NormalMapEffect::GetVertexShaderBytecode(_Out_ void const** pShaderByteCode
 }
 
 
+void NormalMapEffect::CreateShaders(bool allPermutations)
+{
+    if (!allPermutations)
+    {
+        pImpl->CreateShaders(pImpl->GetCurrentShaderPermutation());
+    }
+    else if (pImpl->clusteredLightingSupported && pImpl->instancingSupported)
+    {
+        pImpl->CreateShaders(-1);
+    }
+    else
+    {
+        // The clustered lighting shaders can't be created below Feature Level 11.0, and neither they nor the
+        // instanced shaders can be when they weren't built in.
+        for (int permutation = 0; permutation < NormalMapEffectTraits::ShaderPermutationCount; ++permutation)
+        {
+            if ((permutation >= InstancedPermutationStart && !pImpl->instancingSupported)
+                || ((permutation % InstancedPermutationStart) >= ClusteredPermutationStart && !pImpl->clusteredLightingSupported))
+            {
+                continue;
+            }
+
+            pImpl->CreateShaders(permutation);
+        }
+    }
+}
+
+
 // Camera settings.
 void XM_CALLCONV NormalMapEffect::SetWorld(FXMMATRIX value)
 {
@@ -320,6 +620,14 @@ void XM_CALLCONV NormalMapEffect::SetMatrices(FXMMATRIX world, CXMMATRIX view, C
 }
 
 
+void NormalMapEffect::SetDerivedMatrices(const EffectDerivedMatrices& value)
+{
+    pImpl->matrices.SetDerived(pImpl->dirtyFlags, value, pImpl->constants.worldViewProj);
+
+    EffectMatrices::SetDerivedWorldConstants(pImpl->dirtyFlags, value, pImpl->constants.world, pImpl->constants.worldInverseTranspose);
+}
+
+
 // Material settings.
 void XM_CALLCONV NormalMapEffect::SetDiffuseColor(FXMVECTOR value)
 {
@@ -505,3 +813,32 @@ void NormalMapEffect::SetBiasedVertexNormals(bool value)
 {
     pImpl->biasedVertexNormals = value;
 }
+
+
+// Clustered lighting settings.
+void NormalMapEffect::SetLightClusters(_In_opt_ const LightClusters* value)
+{
+    if (value && !pImpl->clusteredLightingSupported)
+    {
+        throw std::exception("NormalMapEffect clustered lighting requires Feature Level 11.0 or later, and its shaders built by CompileShaders");
+    }
+
+    if (value && !pImpl->clusterConstantBuffer.GetBuffer())
+    {
+        pImpl->clusterConstantBuffer.Create(pImpl->device.Get());
+    }
+
+    pImpl->lightClusters = value;
+}
+
+
+// Instancing settings.
+void NormalMapEffect::SetInstancingEnabled(bool value)
+{
+    if (value && !pImpl->instancingSupported)
+    {
+        throw std::exception("NormalMapEffect instancing requires its shaders built by CompileShaders");
+    }
+
+    pImpl->instancingEnabled = value;
+}
@@ -348,7 +348,7 @@ void SkinnedEffect::Impl::Apply(_In_ ID3D11DeviceContext* deviceContext)
     if (!textures)
         textures = GetDefaultTexture();
 
-    deviceContext->PSSetShaderResources(0, 1, &textures);
+    StateFilter::PSSetShaderResources(deviceContext, 0, 1, &textures);
 
     // Set shaders and constant buffers.
     ApplyShaders(deviceContext, GetCurrentShaderPermutation());
@@ -396,6 +396,12 @@ void SkinnedEffect::GetVertexShaderBytecode(_Out_ void const** pShaderByteCode,
 }
 
 
+void SkinnedEffect::CreateShaders(bool allPermutations)
+{
+    pImpl->CreateShaders(allPermutations ? -1 : pImpl->GetCurrentShaderPermutation());
+}
+
+
 // Camera settings.
 void XM_CALLCONV SkinnedEffect::SetWorld(FXMMATRIX value)
 {
@@ -431,6 +437,14 @@ void XM_CALLCONV SkinnedEffect::SetMatrices(FXMMATRIX world, CXMMATRIX view, CXM
 }
 
 
+void SkinnedEffect::SetDerivedMatrices(const EffectDerivedMatrices& value)
+{
+    pImpl->matrices.SetDerived(pImpl->dirtyFlags, value, pImpl->constants.worldViewProj);
+
+    EffectMatrices::SetDerivedWorldConstants(pImpl->dirtyFlags, value, pImpl->constants.world, pImpl->constants.worldInverseTranspose);
+}
+
+
 // Material settings.
 void XM_CALLCONV SkinnedEffect::SetDiffuseColor(FXMVECTOR value)
 {
@@ -0,0 +1,175 @@
+//--------------------------------------------------------------------------------------
+// File: BMDL.h
+//
+// The BMDL file format is a baked form of the models loaded from .CMO, .SDKMESH, and .VBO
+// files, written by Model::ConvertToBMDL. Everything is stored ready to use: vertex
+// declarations are already in Direct3D 11 form, materials match IEffectFactory::EffectInfo,
+// and vertex and index data are stored as they go into the buffers.
+//
+// All offsets are in bytes from the start of the file, and every table and buffer starts
+// on a 64-byte boundary, so the file can be used in place from a single read or mapping.
+// String offsets refer to null-terminated wide strings, with 0 meaning no string.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <DirectXMath.h>
+
+#include <stdint.h>
+
+
+namespace BMDL
+{
+    const uint32_t FILE_VERSION = 1;
+    const uint32_t ALIGNMENT = 64;
+
+    // Semantic names are stored as an index into this table.
+    const char* const SEMANTIC_NAMES[] =
+    {
+        "SV_Position",
+        "NORMAL",
+        "TANGENT",
+        "BINORMAL",
+        "COLOR",
+        "TEXCOORD",
+        "BLENDINDICES",
+        "BLENDWEIGHT",
+        "POSITION",
+        "PSIZE",
+    };
+
+    enum MATERIAL_FLAGS
+    {
+        MATERIAL_PER_VERTEX_COLOR = 0x1,
+        MATERIAL_SKINNING = 0x2,
+        MATERIAL_DUAL_TEXTURE = 0x4,
+        MATERIAL_NORMAL_MAPS = 0x8,
+        MATERIAL_BIASED_VERTEX_NORMALS = 0x10,
+    };
+
+    enum MESH_FLAGS
+    {
+        MESH_CCW = 0x1,
+        MESH_PMALPHA = 0x2,
+    };
+
+    enum PART_FLAGS
+    {
+        PART_ALPHA = 0x1,
+    };
+
+#pragma pack(push,4)
+
+    struct Table
+    {
+        uint32_t Offset;
+        uint32_t Count;
+    };
+
+    struct Header
+    {
+        char     Magic[8];          // "DXTKBMDL"
+        uint32_t Version;
+        uint32_t FileSize;
+        Table    InputElements;     // InputElement
+        Table    VertexDecls;       // VertexDecl
+        Table    Materials;         // Material
+        Table    Meshes;            // Mesh
+        Table    Parts;             // Part
+        Table    Buffers;           // Buffer
+    };
+
+    struct InputElement
+    {
+        uint32_t Semantic;          // Index into SEMANTIC_NAMES
+        uint32_t SemanticIndex;
+        uint32_t Format;
+        uint32_t InputSlot;
+        uint32_t AlignedByteOffset;
+        uint32_t InputSlotClass;
+        uint32_t InstanceDataStepRate;
+    };
+
+    struct VertexDecl
+    {
+        uint32_t FirstElement;
+        uint32_t ElementCount;
+    };
+
+    struct Material
+    {
+        uint32_t          Name;
+        uint32_t          Flags;    // MATERIAL_FLAGS
+        float             SpecularPower;
+        float             Alpha;
+        DirectX::XMFLOAT3 AmbientColor;
+        DirectX::XMFLOAT3 DiffuseColor;
+        DirectX::XMFLOAT3 SpecularColor;
+        DirectX::XMFLOAT3 EmissiveColor;
+        uint32_t          Textures[3];      // Diffuse, specular, normal
+        uint32_t          TextureHashes[3]; // FNV-1a of the lower case names, for keying texture caches without the strings
+    };
+
+    struct Mesh
+    {
+        uint32_t          Name;
+        uint32_t          Flags;    // MESH_FLAGS
+        uint32_t          FirstPart;
+        uint32_t          PartCount;
+        DirectX::XMFLOAT3 SphereCenter;
+        float             SphereRadius;
+        DirectX::XMFLOAT3 BoxCenter;
+        DirectX::XMFLOAT3 BoxExtents;
+    };
+
+    struct Part
+    {
+        uint32_t Material;
+        uint32_t VertexDecl;
+        uint32_t VertexBuffer;      // Index into the buffer table
+        uint32_t IndexBuffer;       // Index into the buffer table
+        uint32_t IndexCount;
+        uint32_t StartIndex;
+        uint32_t VertexOffset;
+        uint32_t VertexStride;
+        uint32_t PrimitiveType;
+        uint32_t IndexFormat;
+        uint32_t Flags;             // PART_FLAGS
+    };
+
+    struct Buffer
+    {
+        uint32_t Offset;
+        uint32_t Size;
+        uint32_t BindFlags;
+    };
+
+#pragma pack(pop)
+
+    inline uint32_t HashTextureName(_In_z_ const wchar_t* name)
+    {
+        uint32_t hash = 2166136261u;
+
+        for (; *name; ++name)
+        {
+            hash ^= static_cast<uint32_t>(towlower(*name));
+            hash *= 16777619u;
+        }
+
+        return hash;
+    }
+
+} // namespace
+
+static_assert(sizeof(BMDL::Header) == 64, "BMDL header size mismatch");
+static_assert(sizeof(BMDL::InputElement) == 28, "BMDL input element size mismatch");
+static_assert(sizeof(BMDL::VertexDecl) == 8, "BMDL vertex decl size mismatch");
+static_assert(sizeof(BMDL::Material) == 88, "BMDL material size mismatch");
+static_assert(sizeof(BMDL::Mesh) == 56, "BMDL mesh size mismatch");
+static_assert(sizeof(BMDL::Part) == 44, "BMDL part size mismatch");
+static_assert(sizeof(BMDL::Buffer) == 12, "BMDL buffer size mismatch");
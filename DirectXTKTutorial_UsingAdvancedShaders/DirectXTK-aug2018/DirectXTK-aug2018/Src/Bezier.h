@@ -12,6 +12,7 @@
 
 #include <array>
 #include <algorithm>
+#include <vector>
 #include <DirectXMath.h>
 
 
@@ -79,86 +80,204 @@ namespace Bezier
     }
 
 
-    // Creates vertices for a patch that is tessellated at the specified level.
+    // Precomputed cubic Bernstein weights and tangent weights for the parameter values
+    // 0, 1/tessellation, ... 1. Values are stored four parameters to a vector, so that a
+    // patch can be evaluated at four points along v with a single set of multiply-adds.
+    class BasisTable
+    {
+    public:
+        explicit BasisTable(size_t tessellation) :
+            mTessellation(tessellation),
+            mValues(GetGroupCount() * GroupStride)
+        {
+            for (size_t i = 0; i <= tessellation; i++)
+            {
+                float t = float(i) / tessellation;
+
+                float* group = &mValues[(i / 4) * GroupStride + (i % 4)];
+
+                // Same weights as CubicInterpolate and CubicTangent.
+                group[0]  = (1 - t) * (1 - t) * (1 - t);
+                group[4]  = 3 * t * (1 - t) * (1 - t);
+                group[8]  = 3 * t * t * (1 - t);
+                group[12] = t * t * t;
+
+                group[16] = -1 + 2 * t - t * t;
+                group[20] = 1 - 4 * t + 3 * t * t;
+                group[24] = 2 * t - 3 * t * t;
+                group[28] = t * t;
+            }
+        }
+
+        size_t GetTessellation() const { return mTessellation; }
+
+        size_t GetGroupCount() const { return mTessellation / 4 + 1; }
+
+        // Weight of control point k (0-3) for the four parameters in the specified group.
+        DirectX::XMVECTOR GetWeight(size_t group, size_t k) const
+        {
+            return DirectX::XMLoadFloat4(reinterpret_cast<DirectX::XMFLOAT4 const*>(&mValues[group * GroupStride + k * 4]));
+        }
+
+        // Tangent weight of control point k (0-3) for the four parameters in the specified group.
+        DirectX::XMVECTOR GetTangentWeight(size_t group, size_t k) const
+        {
+            return DirectX::XMLoadFloat4(reinterpret_cast<DirectX::XMFLOAT4 const*>(&mValues[group * GroupStride + 16 + k * 4]));
+        }
+
+    private:
+        static const size_t GroupStride = 32;
+
+        size_t mTessellation;
+        std::vector<float> mValues;
+    };
+
+
+    // Sums four weight vectors multiplied by four (splatted) values.
+    inline DirectX::XMVECTOR WeightedSum(_In_reads_(4) DirectX::XMVECTOR const* weights, _In_reads_(4) DirectX::XMVECTOR const* values)
+    {
+        using namespace DirectX;
+
+        XMVECTOR Result = XMVectorMultiply(weights[0], values[0]);
+        Result = XMVectorMultiplyAdd(weights[1], values[1], Result);
+        Result = XMVectorMultiplyAdd(weights[2], values[2], Result);
+        Result = XMVectorMultiplyAdd(weights[3], values[3], Result);
+
+        return Result;
+    }
+
+
+    // Creates vertices for a patch that is tessellated at the level of the specified basis table.
     // Calls the specified outputVertex function for each generated vertex,
     // passing the position, normal, and texture coordinate as parameters.
     template<typename TOutputFunc>
-    void CreatePatchVertices(_In_reads_(16) DirectX::XMVECTOR patch[16], size_t tessellation, bool isMirrored, TOutputFunc outputVertex)
+    void CreatePatchVertices(_In_reads_(16) DirectX::XMVECTOR patch[16], BasisTable const& basis, bool isMirrored, TOutputFunc outputVertex)
     {
         using namespace DirectX;
 
+        size_t tessellation = basis.GetTessellation();
+
         for (size_t i = 0; i <= tessellation; i++)
         {
             float u = float(i) / tessellation;
 
-            for (size_t j = 0; j <= tessellation; j++)
+            // Perform four horizontal bezier interpolations between the control points
+            // of this patch, which reduces it to a single curve along v. The horizontal
+            // tangents are reduced the same way, giving a curve of tangents along v.
+            XMVECTOR px[4], py[4], pz[4];
+            XMVECTOR tx[4], ty[4], tz[4];
+
+            for (size_t row = 0; row < 4; row++)
             {
-                float v = float(j) / tessellation;
-
-                // Perform four horizontal bezier interpolations
-                // between the control points of this patch.
-                XMVECTOR p1 = CubicInterpolate(patch[0], patch[1], patch[2], patch[3], u);
-                XMVECTOR p2 = CubicInterpolate(patch[4], patch[5], patch[6], patch[7], u);
-                XMVECTOR p3 = CubicInterpolate(patch[8], patch[9], patch[10], patch[11], u);
-                XMVECTOR p4 = CubicInterpolate(patch[12], patch[13], patch[14], patch[15], u);
-
-                // Perform a vertical interpolation between the results of the
-                // previous horizontal interpolations, to compute the position.
-                XMVECTOR position = CubicInterpolate(p1, p2, p3, p4, v);
-
-                // Perform another four bezier interpolations between the control
-                // points, but this time vertically rather than horizontally.
-                XMVECTOR q1 = CubicInterpolate(patch[0], patch[4], patch[8], patch[12], v);
-                XMVECTOR q2 = CubicInterpolate(patch[1], patch[5], patch[9], patch[13], v);
-                XMVECTOR q3 = CubicInterpolate(patch[2], patch[6], patch[10], patch[14], v);
-                XMVECTOR q4 = CubicInterpolate(patch[3], patch[7], patch[11], patch[15], v);
-
-                // Compute vertical and horizontal tangent vectors.
-                XMVECTOR tangent1 = CubicTangent(p1, p2, p3, p4, v);
-                XMVECTOR tangent2 = CubicTangent(q1, q2, q3, q4, u);
+                XMVECTOR const* p = &patch[row * 4];
 
-                // Cross the two tangent vectors to compute the normal.
-                XMVECTOR normal = XMVector3Cross(tangent1, tangent2);
+                XMVECTOR point = CubicInterpolate(p[0], p[1], p[2], p[3], u);
+                XMVECTOR tangent = CubicTangent(p[0], p[1], p[2], p[3], u);
 
-                if (!XMVector3NearEqual(normal, XMVectorZero(), g_XMEpsilon))
-                {
-                    normal = XMVector3Normalize(normal);
+                px[row] = XMVectorSplatX(point);
+                py[row] = XMVectorSplatY(point);
+                pz[row] = XMVectorSplatZ(point);
+
+                tx[row] = XMVectorSplatX(tangent);
+                ty[row] = XMVectorSplatY(tangent);
+                tz[row] = XMVectorSplatZ(tangent);
+            }
+
+            float mirroredU = isMirrored ? 1 - u : u;
+
+            // Evaluate four vertices at a time, with one vector per component.
+            for (size_t group = 0; group < basis.GetGroupCount(); group++)
+            {
+                XMVECTOR weights[4];
+                XMVECTOR tangentWeights[4];
 
-                    // If this patch is mirrored, we must invert the normal.
-                    if (isMirrored)
-                    {
-                        normal = XMVectorNegate(normal);
-                    }
+                for (size_t k = 0; k < 4; k++)
+                {
+                    weights[k] = basis.GetWeight(group, k);
+                    tangentWeights[k] = basis.GetTangentWeight(group, k);
                 }
-                else
+
+                // Vertical interpolation gives the position, and the vertical tangent.
+                XMVECTOR positionX = WeightedSum(weights, px);
+                XMVECTOR positionY = WeightedSum(weights, py);
+                XMVECTOR positionZ = WeightedSum(weights, pz);
+
+                XMVECTOR tangent1X = WeightedSum(tangentWeights, px);
+                XMVECTOR tangent1Y = WeightedSum(tangentWeights, py);
+                XMVECTOR tangent1Z = WeightedSum(tangentWeights, pz);
+
+                // Interpolating the horizontal tangents gives the horizontal tangent.
+                XMVECTOR tangent2X = WeightedSum(weights, tx);
+                XMVECTOR tangent2Y = WeightedSum(weights, ty);
+                XMVECTOR tangent2Z = WeightedSum(weights, tz);
+
+                // Cross the two tangent vectors to compute the normal.
+                XMVECTOR normalX = XMVectorNegativeMultiplySubtract(tangent1Z, tangent2Y, XMVectorMultiply(tangent1Y, tangent2Z));
+                XMVECTOR normalY = XMVectorNegativeMultiplySubtract(tangent1X, tangent2Z, XMVectorMultiply(tangent1Z, tangent2X));
+                XMVECTOR normalZ = XMVectorNegativeMultiplySubtract(tangent1Y, tangent2X, XMVectorMultiply(tangent1X, tangent2Y));
+
+                // In a tidy and well constructed bezier patch, the preceding
+                // normal computation will always work. But the classic teapot
+                // model is not tidy or well constructed! At the top and bottom
+                // of the teapot, it contains degenerate geometry where a patch
+                // has several control points in the same place, which causes
+                // the tangent computation to fail and produce a zero normal.
+                // We 'fix' these cases by just hard-coding a normal that points
+                // either straight up or straight down, depending on whether we
+                // are on the top or bottom of the teapot. This is not a robust
+                // solution for all possible degenerate bezier patches, but hey,
+                // it's good enough to make the teapot work correctly!
+                XMVECTOR degenerate = XMVectorAndInt(XMVectorInBounds(normalX, g_XMEpsilon),
+                                                     XMVectorAndInt(XMVectorInBounds(normalY, g_XMEpsilon), XMVectorInBounds(normalZ, g_XMEpsilon)));
+
+                XMVECTOR upOrDown = XMVectorSelect(g_XMOne, g_XMNegativeOne, XMVectorLess(positionY, g_XMZero));
+
+                // If this patch is mirrored, we must invert the normal.
+                XMVECTOR scale = XMVectorReciprocalSqrt(XMVectorMultiplyAdd(normalX, normalX, XMVectorMultiplyAdd(normalY, normalY, XMVectorMultiply(normalZ, normalZ))));
+
+                if (isMirrored)
                 {
-                    // In a tidy and well constructed bezier patch, the preceding
-                    // normal computation will always work. But the classic teapot
-                    // model is not tidy or well constructed! At the top and bottom
-                    // of the teapot, it contains degenerate geometry where a patch
-                    // has several control points in the same place, which causes
-                    // the tangent computation to fail and produce a zero normal.
-                    // We 'fix' these cases by just hard-coding a normal that points
-                    // either straight up or straight down, depending on whether we
-                    // are on the top or bottom of the teapot. This is not a robust
-                    // solution for all possible degenerate bezier patches, but hey,
-                    // it's good enough to make the teapot work correctly!
-
-                    normal = XMVectorSelect(g_XMIdentityR1, g_XMNegIdentityR1, XMVectorLess(position, XMVectorZero()));
+                    scale = XMVectorNegate(scale);
                 }
 
-                // Compute the texture coordinate.
-                float mirroredU = isMirrored ? 1 - u : u;
+                normalX = XMVectorSelect(XMVectorMultiply(normalX, scale), g_XMZero, degenerate);
+                normalY = XMVectorSelect(XMVectorMultiply(normalY, scale), upOrDown, degenerate);
+                normalZ = XMVectorSelect(XMVectorMultiply(normalZ, scale), g_XMZero, degenerate);
 
-                XMVECTOR textureCoordinate = XMVectorSet(mirroredU, v, 0, 0);
+                // Transpose back to one vector per vertex.
+                XMMATRIX positions = XMMatrixTranspose(XMMATRIX(positionX, positionY, positionZ, g_XMZero));
+                XMMATRIX normals = XMMatrixTranspose(XMMATRIX(normalX, normalY, normalZ, g_XMZero));
 
-                // Output this vertex.
-                outputVertex(position, normal, textureCoordinate);
+                for (size_t lane = 0; lane < 4; lane++)
+                {
+                    size_t j = group * 4 + lane;
+
+                    if (j > tessellation)
+                        break;
+
+                    float v = float(j) / tessellation;
+
+                    // Compute the texture coordinate.
+                    XMVECTOR textureCoordinate = XMVectorSet(mirroredU, v, 0, 0);
+
+                    // Output this vertex.
+                    outputVertex(positions.r[lane], normals.r[lane], textureCoordinate);
+                }
             }
         }
     }
 
 
+    // Creates vertices for a patch that is tessellated at the specified level.
+    // Calls the specified outputVertex function for each generated vertex,
+    // passing the position, normal, and texture coordinate as parameters.
+    template<typename TOutputFunc>
+    void CreatePatchVertices(_In_reads_(16) DirectX::XMVECTOR patch[16], size_t tessellation, bool isMirrored, TOutputFunc outputVertex)
+    {
+        CreatePatchVertices(patch, BasisTable(tessellation), isMirrored, outputVertex);
+    }
+
+
     // Creates indices for a patch that is tessellated at the specified level.
     // Calls the specified outputIndex function for each generated index value.
     template<typename TOutputFunc>
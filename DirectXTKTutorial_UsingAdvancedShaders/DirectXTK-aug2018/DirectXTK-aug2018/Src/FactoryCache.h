@@ -0,0 +1,215 @@
+//--------------------------------------------------------------------------------------
+// File: FactoryCache.h
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <array>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+namespace DirectX
+{
+    // Thread-safe cache of named factory objects, such as effects, textures, and shaders. Names are hashed once
+    // and spread over independently locked shards, so loads of different objects rarely contend. An object that
+    // several threads ask for at once is created only by the first of them, and the others wait for its result
+    // instead of creating their own copy. A failed creation is not cached, and its exception is rethrown to every
+    // thread that was waiting for it.
+    template<typename TValue>
+    class FactoryCache
+    {
+    public:
+        FactoryCache() = default;
+
+        FactoryCache(FactoryCache const&) = delete;
+        FactoryCache& operator= (FactoryCache const&) = delete;
+
+        // Looks up the object for a name, or creates it with create() if this is the first request for it.
+        template<typename TCreate>
+        TValue GetOrCreate(_In_z_ const wchar_t* name, TCreate create)
+        {
+            Key key(name);
+            auto& shard = mShards[key.hash % ShardCount];
+
+            std::promise<TValue> promise;
+            std::shared_future<TValue> existing;
+            uint64_t id = 0;
+
+            {
+                std::lock_guard<std::mutex> lock(shard.mutex);
+
+                auto it = shard.entries.find(key);
+                if (it != shard.entries.end())
+                {
+                    if (it->second.ready)
+                        return it->second.result;
+
+                    existing = it->second.value;
+                }
+                else
+                {
+                    id = ++shard.nextId;
+
+                    Entry entry = { promise.get_future().share(), TValue(), id, false };
+                    shard.entries.emplace(key, std::move(entry));
+                }
+            }
+
+            if (existing.valid())
+                return existing.get();
+
+            TValue value;
+
+            try
+            {
+                value = create();
+            }
+            catch (...)
+            {
+                promise.set_exception(std::current_exception());
+
+                // Forget the failed entry so that later requests try again, unless a Clear has already removed it
+                // and another request for the name has started since.
+                std::lock_guard<std::mutex> lock(shard.mutex);
+
+                auto it = shard.entries.find(key);
+                if (it != shard.entries.end() && it->second.id == id)
+                {
+                    shard.entries.erase(it);
+                }
+
+                throw;
+            }
+
+            promise.set_value(value);
+
+            std::lock_guard<std::mutex> lock(shard.mutex);
+
+            auto it = shard.entries.find(key);
+            if (it != shard.entries.end() && it->second.id == id)
+            {
+                // Completed entries hold the object alone, so a cache reference is counted only once.
+                it->second.result = value;
+                it->second.value = std::shared_future<TValue>();
+                it->second.ready = true;
+            }
+
+            return value;
+        }
+
+        // Removes the object for a name if it is the given one, so that a replacement loaded after a Clear is kept.
+        // Returns false if the name has no completed object, or a different one.
+        bool Remove(_In_z_ const wchar_t* name, TValue const& value)
+        {
+            Key key(name);
+            auto& shard = mShards[key.hash % ShardCount];
+
+            std::lock_guard<std::mutex> lock(shard.mutex);
+
+            auto it = shard.entries.find(key);
+            if (it == shard.entries.end() || !it->second.ready || !(it->second.result == value))
+                return false;
+
+            shard.entries.erase(it);
+            return true;
+        }
+
+        // Removes the completed objects for which pred returns true, such as ones nothing outside the cache uses.
+        // Returns the number removed. The objects are released after the shard locks are dropped.
+        template<typename TPredicate>
+        size_t RemoveIf(TPredicate pred)
+        {
+            std::vector<TValue> removed;
+
+            for (auto sit = mShards.begin(); sit != mShards.end(); ++sit)
+            {
+                std::lock_guard<std::mutex> lock(sit->mutex);
+
+                for (auto it = sit->entries.begin(); it != sit->entries.end();)
+                {
+                    if (it->second.ready && pred(it->second.result))
+                    {
+                        removed.push_back(std::move(it->second.result));
+                        it = sit->entries.erase(it);
+                    }
+                    else
+                    {
+                        ++it;
+                    }
+                }
+            }
+
+            return removed.size();
+        }
+
+        // Removes every object. Creations still in flight complete for the threads waiting on them, but are
+        // not cached.
+        void Clear()
+        {
+            for (auto it = mShards.begin(); it != mShards.end(); ++it)
+            {
+                std::lock_guard<std::mutex> lock(it->mutex);
+                it->entries.clear();
+            }
+        }
+
+    private:
+        static const size_t ShardCount = 16;
+
+        struct Key
+        {
+            explicit Key(_In_z_ const wchar_t* str)
+                : hash(14695981039346656037ull),
+                name(str)
+            {
+                // FNV-1a, computed once per lookup rather than comparing strings at each level of a tree.
+                for (auto it = name.cbegin(); it != name.cend(); ++it)
+                {
+                    hash ^= static_cast<uint64_t>(*it);
+                    hash *= 1099511628211ull;
+                }
+            }
+
+            bool operator== (Key const& other) const
+            {
+                return hash == other.hash && name == other.name;
+            }
+
+            uint64_t hash;
+            std::wstring name;
+        };
+
+        struct KeyHash
+        {
+            size_t operator() (Key const& key) const { return static_cast<size_t>(key.hash); }
+        };
+
+        struct Entry
+        {
+            std::shared_future<TValue> value;
+            TValue result;
+            uint64_t id;
+            bool ready;
+        };
+
+        struct Shard
+        {
+            Shard() : nextId(0) {}
+
+            std::mutex mutex;
+            std::unordered_map<Key, Entry, KeyHash> entries;
+            uint64_t nextId;
+        };
+
+        std::array<Shard, ShardCount> mShards;
+    };
+}
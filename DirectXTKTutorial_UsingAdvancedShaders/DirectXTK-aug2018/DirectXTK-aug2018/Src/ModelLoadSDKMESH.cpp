@@ -14,6 +14,7 @@
 #include "VertexTypes.h"
 
 #include "DirectXHelpers.h"
+#include "ModelHelpers.h"
 #include "PlatformHelpers.h"
 #include "BinaryReader.h"
 
@@ -332,7 +333,8 @@ namespace
 //======================================================================================
 
 _Use_decl_annotations_
-std::unique_ptr<Model> DirectX::Model::CreateFromSDKMESH(ID3D11Device* d3dDevice, const uint8_t* meshData, size_t dataSize, IEffectFactory& fxFactory, bool ccw, bool pmalpha)
+std::unique_ptr<Model> DirectX::Model::CreateFromSDKMESH(ID3D11Device* d3dDevice, const uint8_t* meshData, size_t dataSize, IEffectFactory& fxFactory, bool ccw, bool pmalpha,
+                                                         const ModelLoaderOptions& options)
 {
     if (!d3dDevice || !meshData)
         throw std::exception("Device and meshData cannot be null");
@@ -396,7 +398,7 @@ std::unique_ptr<Model> DirectX::Model::CreateFromSDKMESH(ID3D11Device* d3dDevice
     if (dataSize < header->FrameDataOffset
         || (dataSize < (header->FrameDataOffset + uint64_t(header->NumFrames) * sizeof(DXUT::SDKMESH_FRAME))))
         throw std::exception("End of file");
-    // TODO - auto frameArray = reinterpret_cast<const DXUT::SDKMESH_FRAME*>( meshData + header->FrameDataOffset );
+    auto frameArray = reinterpret_cast<const DXUT::SDKMESH_FRAME*>(meshData + header->FrameDataOffset);
 
     if (dataSize < header->MaterialDataOffset
         || (dataSize < (header->MaterialDataOffset + uint64_t(header->NumMaterials) * sizeof(DXUT::SDKMESH_MATERIAL))))
@@ -410,8 +412,8 @@ std::unique_ptr<Model> DirectX::Model::CreateFromSDKMESH(ID3D11Device* d3dDevice
         throw std::exception("End of file");
     const uint8_t* bufferData = meshData + bufferDataOffset;
 
-    // Create vertex buffers
-    std::vector<ComPtr<ID3D11Buffer>> vbs;
+    // Vertex buffer data, created as buffers once the model is complete
+    std::vector<std::shared_ptr<ModelHelpers::BufferData>> vbs;
     vbs.resize(header->NumVertexBuffers);
 
     std::vector<std::shared_ptr<std::vector<D3D11_INPUT_ELEMENT_DESC>>> vbDecls;
@@ -447,23 +449,11 @@ std::unique_ptr<Model> DirectX::Model::CreateFromSDKMESH(ID3D11Device* d3dDevice
 
         auto verts = bufferData + (vh.DataOffset - bufferDataOffset);
 
-        D3D11_BUFFER_DESC desc = {};
-        desc.Usage = D3D11_USAGE_DEFAULT;
-        desc.ByteWidth = static_cast<UINT>(vh.SizeBytes);
-        desc.BindFlags = D3D11_BIND_VERTEX_BUFFER;
-
-        D3D11_SUBRESOURCE_DATA initData = {};
-        initData.pSysMem = verts;
-
-        ThrowIfFailed(
-            d3dDevice->CreateBuffer(&desc, &initData, &vbs[j])
-        );
-
-        SetDebugObjectName(vbs[j].Get(), "ModelSDKMESH");
+        vbs[j] = ModelHelpers::ReferenceBufferData(verts, static_cast<size_t>(vh.SizeBytes));
     }
 
-    // Create index buffers
-    std::vector<ComPtr<ID3D11Buffer>> ibs;
+    // Index buffer data
+    std::vector<std::shared_ptr<ModelHelpers::BufferData>> ibs;
     ibs.resize(header->NumIndexBuffers);
 
     for (UINT j = 0; j < header->NumIndexBuffers; ++j)
@@ -482,19 +472,7 @@ std::unique_ptr<Model> DirectX::Model::CreateFromSDKMESH(ID3D11Device* d3dDevice
 
         auto indices = bufferData + (ih.DataOffset - bufferDataOffset);
 
-        D3D11_BUFFER_DESC desc = {};
-        desc.Usage = D3D11_USAGE_DEFAULT;
-        desc.ByteWidth = static_cast<UINT>(ih.SizeBytes);
-        desc.BindFlags = D3D11_BIND_INDEX_BUFFER;
-
-        D3D11_SUBRESOURCE_DATA initData = {};
-        initData.pSysMem = indices;
-
-        ThrowIfFailed(
-            d3dDevice->CreateBuffer(&desc, &initData, &ibs[j])
-        );
-
-        SetDebugObjectName(ibs[j].Get(), "ModelSDKMESH");
+        ibs[j] = ModelHelpers::ReferenceBufferData(indices, static_cast<size_t>(ih.SizeBytes));
     }
 
     // Create meshes
@@ -504,6 +482,67 @@ std::unique_ptr<Model> DirectX::Model::CreateFromSDKMESH(ID3D11Device* d3dDevice
     std::unique_ptr<Model> model(new Model());
     model->meshes.reserve(header->NumMeshes);
 
+    ModelHelpers::ModelData modelData;
+
+    // Frames become the skeleton, sorted so that parents come first.
+    std::vector<uint32_t> frameBones(header->NumFrames);
+
+    if (header->NumFrames > 0)
+    {
+        std::vector<uint32_t> frameParents(header->NumFrames);
+
+        for (UINT j = 0; j < header->NumFrames; ++j)
+        {
+            auto parent = frameArray[j].ParentFrame;
+            if (parent != DXUT::INVALID_FRAME && parent >= header->NumFrames)
+                throw std::exception("Invalid frame found");
+
+            frameParents[j] = parent;
+        }
+
+        std::vector<uint32_t> order;
+        ModelHelpers::SortBonesParentFirst(frameParents.data(), frameParents.size(), order);
+
+        for (UINT j = 0; j < header->NumFrames; ++j)
+        {
+            frameBones[order[j]] = j;
+        }
+
+        auto& skeleton = model->skeleton;
+        skeleton.boneNames.resize(header->NumFrames);
+        skeleton.parentIndices.resize(header->NumFrames);
+        skeleton.bindPoseTransforms.resize(header->NumFrames);
+        skeleton.invBindPoseTransforms.resize(header->NumFrames);
+
+        for (UINT j = 0; j < header->NumFrames; ++j)
+        {
+            auto& frame = frameArray[order[j]];
+
+            char name[DXUT::MAX_FRAME_NAME];
+            strncpy_s(name, frame.Name, _TRUNCATE);
+
+            wchar_t frameName[DXUT::MAX_FRAME_NAME] = {};
+            MultiByteToWideChar(CP_ACP, MB_PRECOMPOSED, name, -1, frameName, DXUT::MAX_FRAME_NAME);
+
+            skeleton.boneNames[j] = frameName;
+            skeleton.parentIndices[j] = (frame.ParentFrame != DXUT::INVALID_FRAME) ? frameBones[frame.ParentFrame] : ModelSkeleton::c_Invalid;
+            skeleton.bindPoseTransforms[j] = frame.Matrix;
+        }
+
+        // The frame matrices are the bind pose, so skinning uses the inverse of their concatenation.
+        std::unique_ptr<XMMATRIX[], aligned_deleter> bindPose(
+            reinterpret_cast<XMMATRIX*>(_aligned_malloc(sizeof(XMMATRIX) * header->NumFrames, 16)));
+        if (!bindPose)
+            throw std::bad_alloc();
+
+        skeleton.GetBindPose(bindPose.get());
+
+        for (UINT j = 0; j < header->NumFrames; ++j)
+        {
+            XMStoreFloat4x4(&skeleton.invBindPoseTransforms[j], XMMatrixInverse(nullptr, bindPose[j]));
+        }
+    }
+
     for (UINT meshIndex = 0; meshIndex < header->NumMeshes; ++meshIndex)
     {
         auto& mh = meshArray[meshIndex];
@@ -527,8 +566,6 @@ std::unique_ptr<Model> DirectX::Model::CreateFromSDKMESH(ID3D11Device* d3dDevice
             if (dataSize < mh.FrameInfluenceOffset
                 || (dataSize < mh.FrameInfluenceOffset + uint64_t(mh.NumFrameInfluences) * sizeof(UINT)))
                 throw std::exception("End of file");
-
-            // TODO - auto influences = reinterpret_cast<const UINT*>( meshData + mh.FrameInfluenceOffset );
         }
 
         auto mesh = std::make_shared<ModelMesh>();
@@ -538,6 +575,31 @@ std::unique_ptr<Model> DirectX::Model::CreateFromSDKMESH(ID3D11Device* d3dDevice
         mesh->ccw = ccw;
         mesh->pmalpha = pmalpha;
 
+        // Bones
+        if (mh.NumFrameInfluences > 0)
+        {
+            auto influences = reinterpret_cast<const UINT*>(meshData + mh.FrameInfluenceOffset);
+
+            mesh->boneInfluences.resize(mh.NumFrameInfluences);
+
+            for (UINT j = 0; j < mh.NumFrameInfluences; ++j)
+            {
+                if (influences[j] >= header->NumFrames)
+                    throw std::exception("Invalid frame influence found");
+
+                mesh->boneInfluences[j] = frameBones[influences[j]];
+            }
+        }
+
+        for (UINT j = 0; j < header->NumFrames; ++j)
+        {
+            if (frameArray[j].Mesh == meshIndex)
+            {
+                mesh->boneIndex = frameBones[j];
+                break;
+            }
+        }
+
         // Extents
         mesh->boundingBox.Center = mh.BoundingBoxCenter;
         mesh->boundingBox.Extents = mh.BoundingBoxExtents;
@@ -602,37 +664,160 @@ std::unique_ptr<Model> DirectX::Model::CreateFromSDKMESH(ID3D11Device* d3dDevice
             part->indexFormat = (ibArray[mh.IndexBuffer].IndexType == DXUT::IT_32BIT) ? DXGI_FORMAT_R32_UINT : DXGI_FORMAT_R16_UINT;
             part->primitiveType = primType;
             part->inputLayout = il;
-            part->indexBuffer = ibs[mh.IndexBuffer];
-            part->vertexBuffer = vbs[mh.VertexBuffers[0]];
             part->effect = mat.effect;
             part->vbDecl = vbDecls[mh.VertexBuffers[0]];
 
+            auto& partData = modelData[part];
+            partData.vertices = vbs[mh.VertexBuffers[0]];
+            partData.indices = ibs[mh.IndexBuffer];
+
             mesh->meshParts.emplace_back(part);
         }
 
         model->meshes.emplace_back(mesh);
     }
 
+    ModelHelpers::FinishLoading(d3dDevice, *model, modelData, options);
+
     return model;
 }
 
 
 //--------------------------------------------------------------------------------------
 _Use_decl_annotations_
-std::unique_ptr<Model> DirectX::Model::CreateFromSDKMESH(ID3D11Device* d3dDevice, const wchar_t* szFileName, IEffectFactory& fxFactory, bool ccw, bool pmalpha)
+std::unique_ptr<Model> DirectX::Model::CreateFromSDKMESH(ID3D11Device* d3dDevice, const wchar_t* szFileName, IEffectFactory& fxFactory, bool ccw, bool pmalpha,
+                                                         const ModelLoaderOptions& options)
 {
     size_t dataSize = 0;
-    std::unique_ptr<uint8_t[]> data;
-    HRESULT hr = BinaryReader::ReadEntireFile(szFileName, data, &dataSize);
+    ScopedMappedView data;
+    HRESULT hr = BinaryReader::MapEntireFile(szFileName, data, &dataSize);
     if (FAILED(hr))
     {
         DebugTrace("ERROR: CreateFromSDKMESH failed (%08X) loading '%ls'\n", hr, szFileName);
         throw std::exception("CreateFromSDKMESH");
     }
 
-    auto model = CreateFromSDKMESH(d3dDevice, data.get(), dataSize, fxFactory, ccw, pmalpha);
+    auto model = CreateFromSDKMESH(d3dDevice, data.get(), dataSize, fxFactory, ccw, pmalpha, options);
 
     model->name = szFileName;
 
     return model;
 }
+
+
+//--------------------------------------------------------------------------------------
+// Animation Loader
+//--------------------------------------------------------------------------------------
+
+_Use_decl_annotations_
+size_t DirectX::Model::LoadSDKMESHAnimation(const uint8_t* animData, size_t dataSize)
+{
+    if (!animData)
+        throw std::exception("animData cannot be null");
+
+    // File Header
+    if (dataSize < sizeof(DXUT::SDKANIMATION_FILE_HEADER))
+        throw std::exception("End of file");
+    auto header = reinterpret_cast<const DXUT::SDKANIMATION_FILE_HEADER*>(animData);
+
+    if (header->Version != DXUT::SDKMESH_FILE_VERSION)
+        throw std::exception("Not a supported SDKMESH_ANIM version");
+
+    if (header->IsBigEndian)
+        throw std::exception("Loading BigEndian SDKMESH_ANIM files not supported");
+
+    if (!header->NumFrames || !header->NumAnimationKeys)
+        throw std::exception("No animation data found");
+
+    if (!header->AnimationFPS)
+        throw std::exception("Invalid animation frame rate");
+
+    uint64_t endOfData = sizeof(DXUT::SDKANIMATION_FILE_HEADER) + header->AnimationDataSize;
+    if (dataSize < endOfData)
+        throw std::exception("End of file");
+
+    if (endOfData < header->AnimationDataOffset
+        || (endOfData < (header->AnimationDataOffset + uint64_t(header->NumFrames) * sizeof(DXUT::SDKANIMATION_FRAME_DATA))))
+        throw std::exception("End of file");
+    auto frameDataArray = reinterpret_cast<const DXUT::SDKANIMATION_FRAME_DATA*>(animData + header->AnimationDataOffset);
+
+    // Keys are sampled at a fixed rate. As with DXUT, the first key is a rest pose that is skipped unless it is the only one,
+    // and scaling is ignored.
+    UINT firstKey = (header->NumAnimationKeys > 1) ? 1 : 0;
+    float secondsPerKey = 1.f / float(header->AnimationFPS);
+
+    std::vector<ModelAnimationClip::Keyframe> keys;
+
+    for (UINT j = 0; j < header->NumFrames; ++j)
+    {
+        auto& frameData = frameDataArray[j];
+
+        // Frame data offsets are relative to the end of the file header.
+        uint64_t dataOffset = sizeof(DXUT::SDKANIMATION_FILE_HEADER) + frameData.DataOffset;
+        if (endOfData < dataOffset
+            || (endOfData < (dataOffset + uint64_t(header->NumAnimationKeys) * sizeof(DXUT::SDKANIMATION_DATA))))
+            throw std::exception("End of file");
+
+        char name[DXUT::MAX_FRAME_NAME];
+        strncpy_s(name, frameData.FrameName, _TRUNCATE);
+
+        wchar_t frameName[DXUT::MAX_FRAME_NAME] = {};
+        MultiByteToWideChar(CP_ACP, MB_PRECOMPOSED, name, -1, frameName, DXUT::MAX_FRAME_NAME);
+
+        auto bone = std::find(skeleton.boneNames.cbegin(), skeleton.boneNames.cend(), frameName);
+        if (bone == skeleton.boneNames.cend())
+        {
+            DebugTrace("WARNING: LoadSDKMESHAnimation found no frame named '%ls' in the model\n", frameName);
+            continue;
+        }
+
+        auto animationData = reinterpret_cast<const DXUT::SDKANIMATION_DATA*>(animData + dataOffset);
+
+        for (UINT k = firstKey; k < header->NumAnimationKeys; ++k)
+        {
+            auto& data = animationData[k];
+
+            XMVECTOR rotation = XMLoadFloat4(&data.Orientation);
+            rotation = XMVector4Equal(rotation, g_XMZero) ? XMQuaternionIdentity() : XMQuaternionNormalize(rotation);
+
+            ModelAnimationClip::Keyframe key;
+            key.boneIndex = static_cast<uint32_t>(bone - skeleton.boneNames.cbegin());
+            key.time = float(k - firstKey) * secondsPerKey;
+            key.scale = XMFLOAT3(1.f, 1.f, 1.f);
+            XMStoreFloat4(&key.rotation, rotation);
+            key.translation = data.Translation;
+
+            keys.push_back(key);
+        }
+    }
+
+    ModelAnimationClip clip;
+    clip.startTime = 0.f;
+    clip.endTime = float(header->NumAnimationKeys - firstKey) * secondsPerKey;
+    clip.SetKeyframes(keys.data(), keys.size(), skeleton.GetBoneCount());
+
+    animationClips.push_back(std::move(clip));
+
+    return animationClips.size() - 1;
+}
+
+
+//--------------------------------------------------------------------------------------
+_Use_decl_annotations_
+size_t DirectX::Model::LoadSDKMESHAnimation(const wchar_t* szFileName)
+{
+    size_t dataSize = 0;
+    ScopedMappedView data;
+    HRESULT hr = BinaryReader::MapEntireFile(szFileName, data, &dataSize);
+    if (FAILED(hr))
+    {
+        DebugTrace("ERROR: LoadSDKMESHAnimation failed (%08X) loading '%ls'\n", hr, szFileName);
+        throw std::exception("LoadSDKMESHAnimation");
+    }
+
+    size_t index = LoadSDKMESHAnimation(data.get(), dataSize);
+
+    animationClips[index].name = szFileName;
+
+    return index;
+}
@@ -0,0 +1,637 @@
+//--------------------------------------------------------------------------------------
+// File: StateFilter.cpp
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#include "pch.h"
+#include "StateFilter.h"
+
+#include <atomic>
+
+using namespace DirectX;
+using Microsoft::WRL::ComPtr;
+
+
+namespace
+{
+    // Device contexts that can have a filter attached at once.
+    const size_t MaxAttachedContexts = 8;
+
+    // Pixel shader resource slots that are tracked. Calls that reach past them are always issued.
+    const UINT TrackedShaderResources = 16;
+
+
+    // The value bound to a slot, if known.
+    template<typename T>
+    struct Tracked
+    {
+        T value;
+        bool known;
+
+        // Records a value, returning whether it differs from the bound one.
+        bool Update(T const& newValue)
+        {
+            if (known && value == newValue)
+                return false;
+
+            value = newValue;
+            known = true;
+            return true;
+        }
+    };
+
+
+    struct BlendBinding
+    {
+        ID3D11BlendState* state;
+        float factor[4];
+        UINT sampleMask;
+
+        bool operator== (BlendBinding const& other) const
+        {
+            return state == other.state
+                && factor[0] == other.factor[0] && factor[1] == other.factor[1]
+                && factor[2] == other.factor[2] && factor[3] == other.factor[3]
+                && sampleMask == other.sampleMask;
+        }
+    };
+
+
+    struct DepthStencilBinding
+    {
+        ID3D11DepthStencilState* state;
+        UINT stencilRef;
+
+        bool operator== (DepthStencilBinding const& other) const
+        {
+            return state == other.state && stencilRef == other.stencilRef;
+        }
+    };
+
+
+    struct BufferBinding
+    {
+        ID3D11Buffer* buffer;
+        UINT strideOrFormat;
+        UINT offset;
+
+        bool operator== (BufferBinding const& other) const
+        {
+            return buffer == other.buffer && strideOrFormat == other.strideOrFormat && offset == other.offset;
+        }
+    };
+
+
+    // Records the values for a range of slots, and narrows the range to the first and last slots that change,
+    // relative to startSlot. Slots past the tracked ones always count as changing. Returns false if none change.
+    template<typename T, size_t N>
+    bool UpdateRange(Tracked<T> (&slots)[N], UINT startSlot, UINT count, _In_reads_opt_(count) const T* values, UINT& first, UINT& last)
+    {
+        bool changed = false;
+
+        for (UINT i = 0; i < count; ++i)
+        {
+            size_t slot = size_t(startSlot) + i;
+
+            T value = values ? values[i] : T();
+
+            if (slot >= N || slots[slot].Update(value))
+            {
+                if (!changed)
+                {
+                    first = i;
+                    changed = true;
+                }
+
+                last = i;
+            }
+        }
+
+        return changed;
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// StateFilter::Impl
+//--------------------------------------------------------------------------------------
+
+class StateFilter::Impl
+{
+public:
+    explicit Impl(_In_ ID3D11DeviceContext* deviceContext);
+
+    Impl(Impl const&) = delete;
+    Impl& operator= (Impl const&) = delete;
+
+    ~Impl();
+
+    // Returns the filter attached to a device context, or nullptr.
+    static Impl* Find(_In_ ID3D11DeviceContext* deviceContext)
+    {
+        if (!attachedCount.load(std::memory_order_acquire))
+            return nullptr;
+
+        for (size_t i = 0; i < MaxAttachedContexts; ++i)
+        {
+            if (attachedContexts[i].load(std::memory_order_acquire) == deviceContext)
+                return attachedFilters[i].load(std::memory_order_acquire);
+        }
+
+        return nullptr;
+    }
+
+    // Counts a call, returning whether it should be issued.
+    bool Issue(bool changed)
+    {
+        if (changed)
+        {
+            ++mStatistics.issued;
+        }
+        else
+        {
+            ++mStatistics.filtered;
+        }
+
+        return changed;
+    }
+
+    void Invalidate()
+    {
+        mState = State();
+    }
+
+    struct State
+    {
+        Tracked<BlendBinding> blend;
+        Tracked<DepthStencilBinding> depthStencil;
+        Tracked<ID3D11RasterizerState*> rasterizer;
+        Tracked<ID3D11InputLayout*> inputLayout;
+        Tracked<D3D11_PRIMITIVE_TOPOLOGY> topology;
+        Tracked<BufferBinding> indexBuffer;
+        Tracked<BufferBinding> vertexBuffers[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+        Tracked<ID3D11VertexShader*> vertexShader;
+        Tracked<ID3D11Buffer*> vertexConstantBuffers[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT];
+        Tracked<ID3D11PixelShader*> pixelShader;
+        Tracked<ID3D11Buffer*> pixelConstantBuffers[D3D11_COMMONSHADER_CONSTANT_BUFFER_API_SLOT_COUNT];
+        Tracked<ID3D11ShaderResourceView*> pixelShaderResources[TrackedShaderResources];
+        Tracked<ID3D11SamplerState*> pixelSamplers[D3D11_COMMONSHADER_SAMPLER_SLOT_COUNT];
+    };
+
+    ComPtr<ID3D11DeviceContext> mDeviceContext;
+    State mState;
+    StateFilter::Statistics mStatistics;
+
+private:
+    static std::atomic<size_t> attachedCount;
+    static std::atomic<ID3D11DeviceContext*> attachedContexts[MaxAttachedContexts];
+    static std::atomic<Impl*> attachedFilters[MaxAttachedContexts];
+    static std::mutex attachMutex;
+};
+
+
+// Global registry of attached filters, searched without locking on each call.
+std::atomic<size_t> StateFilter::Impl::attachedCount;
+std::atomic<ID3D11DeviceContext*> StateFilter::Impl::attachedContexts[MaxAttachedContexts];
+std::atomic<StateFilter::Impl*> StateFilter::Impl::attachedFilters[MaxAttachedContexts];
+std::mutex StateFilter::Impl::attachMutex;
+
+
+_Use_decl_annotations_
+StateFilter::Impl::Impl(ID3D11DeviceContext* deviceContext)
+    : mDeviceContext(deviceContext),
+    mState{},
+    mStatistics{}
+{
+    if (!deviceContext)
+        throw std::exception("Direct3D device context is null");
+
+    std::lock_guard<std::mutex> lock(attachMutex);
+
+    size_t free = MaxAttachedContexts;
+
+    for (size_t i = 0; i < MaxAttachedContexts; ++i)
+    {
+        auto context = attachedContexts[i].load();
+
+        if (context == deviceContext)
+            throw std::exception("Device context already has a StateFilter");
+
+        if (!context && free == MaxAttachedContexts)
+            free = i;
+    }
+
+    if (free == MaxAttachedContexts)
+        throw std::out_of_range("Too many device contexts with a StateFilter");
+
+    attachedFilters[free].store(this, std::memory_order_release);
+    attachedContexts[free].store(deviceContext, std::memory_order_release);
+    ++attachedCount;
+}
+
+
+StateFilter::Impl::~Impl()
+{
+    std::lock_guard<std::mutex> lock(attachMutex);
+
+    for (size_t i = 0; i < MaxAttachedContexts; ++i)
+    {
+        if (attachedFilters[i].load() == this)
+        {
+            attachedContexts[i].store(nullptr, std::memory_order_release);
+            attachedFilters[i].store(nullptr, std::memory_order_release);
+            --attachedCount;
+        }
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// StateFilter
+//--------------------------------------------------------------------------------------
+
+// Public constructor.
+_Use_decl_annotations_
+StateFilter::StateFilter(ID3D11DeviceContext* deviceContext)
+    : pImpl(std::make_unique<Impl>(deviceContext))
+{
+}
+
+
+// Move constructor.
+StateFilter::StateFilter(StateFilter&& moveFrom) noexcept
+    : pImpl(std::move(moveFrom.pImpl))
+{
+}
+
+
+// Move assignment.
+StateFilter& StateFilter::operator= (StateFilter&& moveFrom) noexcept
+{
+    pImpl = std::move(moveFrom.pImpl);
+    return *this;
+}
+
+
+// Public destructor.
+StateFilter::~StateFilter()
+{
+}
+
+
+void StateFilter::Invalidate()
+{
+    pImpl->Invalidate();
+}
+
+
+StateFilter::Statistics StateFilter::GetStatistics() const
+{
+    return pImpl->mStatistics;
+}
+
+
+void StateFilter::ResetStatistics()
+{
+    pImpl->mStatistics = {};
+}
+
+
+ID3D11DeviceContext* StateFilter::GetDeviceContext() const
+{
+    return pImpl->mDeviceContext.Get();
+}
+
+
+//--------------------------------------------------------------------------------------
+// Setters
+//--------------------------------------------------------------------------------------
+
+_Use_decl_annotations_
+void StateFilter::OMSetBlendState(ID3D11DeviceContext* deviceContext, ID3D11BlendState* blendState, const float blendFactor[4], UINT sampleMask)
+{
+    auto filter = Impl::Find(deviceContext);
+
+    if (filter)
+    {
+        // A null blend factor means one for every channel.
+        BlendBinding binding = { blendState, { 1.f, 1.f, 1.f, 1.f }, sampleMask };
+
+        if (blendFactor)
+        {
+            std::copy(blendFactor, blendFactor + 4, binding.factor);
+        }
+
+        if (!filter->Issue(filter->mState.blend.Update(binding)))
+            return;
+    }
+
+    deviceContext->OMSetBlendState(blendState, blendFactor, sampleMask);
+}
+
+
+_Use_decl_annotations_
+void StateFilter::OMSetDepthStencilState(ID3D11DeviceContext* deviceContext, ID3D11DepthStencilState* depthStencilState, UINT stencilRef)
+{
+    auto filter = Impl::Find(deviceContext);
+
+    if (filter)
+    {
+        DepthStencilBinding binding = { depthStencilState, stencilRef };
+
+        if (!filter->Issue(filter->mState.depthStencil.Update(binding)))
+            return;
+    }
+
+    deviceContext->OMSetDepthStencilState(depthStencilState, stencilRef);
+}
+
+
+// Binding a render target unbinds any shader resource views of the same resource, so these are forgotten.
+_Use_decl_annotations_
+void StateFilter::OMSetRenderTargets(ID3D11DeviceContext* deviceContext, UINT numViews, ID3D11RenderTargetView* const* renderTargetViews, ID3D11DepthStencilView* depthStencilView)
+{
+    auto filter = Impl::Find(deviceContext);
+
+    if (filter)
+    {
+        filter->Issue(true);
+
+        for (size_t i = 0; i < TrackedShaderResources; ++i)
+        {
+            filter->mState.pixelShaderResources[i].known = false;
+        }
+    }
+
+    deviceContext->OMSetRenderTargets(numViews, renderTargetViews, depthStencilView);
+}
+
+
+_Use_decl_annotations_
+void StateFilter::RSSetState(ID3D11DeviceContext* deviceContext, ID3D11RasterizerState* rasterizerState)
+{
+    auto filter = Impl::Find(deviceContext);
+
+    if (filter && !filter->Issue(filter->mState.rasterizer.Update(rasterizerState)))
+        return;
+
+    deviceContext->RSSetState(rasterizerState);
+}
+
+
+_Use_decl_annotations_
+void StateFilter::IASetInputLayout(ID3D11DeviceContext* deviceContext, ID3D11InputLayout* inputLayout)
+{
+    auto filter = Impl::Find(deviceContext);
+
+    if (filter && !filter->Issue(filter->mState.inputLayout.Update(inputLayout)))
+        return;
+
+    deviceContext->IASetInputLayout(inputLayout);
+}
+
+
+_Use_decl_annotations_
+void StateFilter::IASetPrimitiveTopology(ID3D11DeviceContext* deviceContext, D3D11_PRIMITIVE_TOPOLOGY topology)
+{
+    auto filter = Impl::Find(deviceContext);
+
+    if (filter && !filter->Issue(filter->mState.topology.Update(topology)))
+        return;
+
+    deviceContext->IASetPrimitiveTopology(topology);
+}
+
+
+_Use_decl_annotations_
+void StateFilter::IASetVertexBuffers(ID3D11DeviceContext* deviceContext, UINT startSlot, UINT numBuffers, ID3D11Buffer* const* vertexBuffers, const UINT* strides, const UINT* offsets)
+{
+    auto filter = Impl::Find(deviceContext);
+
+    if (filter && startSlot < D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT
+        && numBuffers <= D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT - startSlot)
+    {
+        BufferBinding bindings[D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT];
+
+        for (UINT i = 0; i < numBuffers; ++i)
+        {
+            bindings[i].buffer = vertexBuffers ? vertexBuffers[i] : nullptr;
+            bindings[i].strideOrFormat = strides ? strides[i] : 0;
+            bindings[i].offset = offsets ? offsets[i] : 0;
+        }
+
+        UINT first = 0;
+        UINT last = 0;
+        if (!filter->Issue(UpdateRange(filter->mState.vertexBuffers, startSlot, numBuffers, bindings, first, last)))
+            return;
+
+        deviceContext->IASetVertexBuffers(startSlot + first, last - first + 1,
+                                          vertexBuffers ? vertexBuffers + first : nullptr,
+                                          strides ? strides + first : nullptr,
+                                          offsets ? offsets + first : nullptr);
+        return;
+    }
+
+    if (filter)
+    {
+        filter->Issue(true);
+
+        for (UINT i = 0; i < numBuffers && size_t(startSlot) + i < D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT; ++i)
+        {
+            filter->mState.vertexBuffers[startSlot + i].known = false;
+        }
+    }
+
+    deviceContext->IASetVertexBuffers(startSlot, numBuffers, vertexBuffers, strides, offsets);
+}
+
+
+_Use_decl_annotations_
+void StateFilter::IASetIndexBuffer(ID3D11DeviceContext* deviceContext, ID3D11Buffer* indexBuffer, DXGI_FORMAT format, UINT offset)
+{
+    auto filter = Impl::Find(deviceContext);
+
+    if (filter)
+    {
+        BufferBinding binding = { indexBuffer, static_cast<UINT>(format), offset };
+
+        if (!filter->Issue(filter->mState.indexBuffer.Update(binding)))
+            return;
+    }
+
+    deviceContext->IASetIndexBuffer(indexBuffer, format, offset);
+}
+
+
+// Calls with class instances are always issued, and leave the shader unknown.
+_Use_decl_annotations_
+void StateFilter::VSSetShader(ID3D11DeviceContext* deviceContext, ID3D11VertexShader* vertexShader, ID3D11ClassInstance* const* classInstances, UINT numClassInstances)
+{
+    auto filter = Impl::Find(deviceContext);
+
+    if (filter)
+    {
+        if (numClassInstances)
+        {
+            filter->Issue(true);
+            filter->mState.vertexShader.known = false;
+        }
+        else if (!filter->Issue(filter->mState.vertexShader.Update(vertexShader)))
+        {
+            return;
+        }
+    }
+
+    deviceContext->VSSetShader(vertexShader, classInstances, numClassInstances);
+}
+
+
+_Use_decl_annotations_
+void StateFilter::PSSetShader(ID3D11DeviceContext* deviceContext, ID3D11PixelShader* pixelShader, ID3D11ClassInstance* const* classInstances, UINT numClassInstances)
+{
+    auto filter = Impl::Find(deviceContext);
+
+    if (filter)
+    {
+        if (numClassInstances)
+        {
+            filter->Issue(true);
+            filter->mState.pixelShader.known = false;
+        }
+        else if (!filter->Issue(filter->mState.pixelShader.Update(pixelShader)))
+        {
+            return;
+        }
+    }
+
+    deviceContext->PSSetShader(pixelShader, classInstances, numClassInstances);
+}
+
+
+// On Xbox One, effects bind placement constant buffers that bypass the filter, so constant buffers are not tracked.
+_Use_decl_annotations_
+void StateFilter::VSSetConstantBuffers(ID3D11DeviceContext* deviceContext, UINT startSlot, UINT numBuffers, ID3D11Buffer* const* constantBuffers)
+{
+    auto filter = Impl::Find(deviceContext);
+
+    if (filter)
+    {
+    #if defined(_XBOX_ONE) && defined(_TITLE)
+        filter->Issue(true);
+    #else
+        UINT first = 0;
+        UINT last = 0;
+        if (!filter->Issue(UpdateRange(filter->mState.vertexConstantBuffers, startSlot, numBuffers, constantBuffers, first, last)))
+            return;
+
+        deviceContext->VSSetConstantBuffers(startSlot + first, last - first + 1, constantBuffers ? constantBuffers + first : nullptr);
+        return;
+    #endif
+    }
+
+    deviceContext->VSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+}
+
+
+_Use_decl_annotations_
+void StateFilter::PSSetConstantBuffers(ID3D11DeviceContext* deviceContext, UINT startSlot, UINT numBuffers, ID3D11Buffer* const* constantBuffers)
+{
+    auto filter = Impl::Find(deviceContext);
+
+    if (filter)
+    {
+    #if defined(_XBOX_ONE) && defined(_TITLE)
+        filter->Issue(true);
+    #else
+        UINT first = 0;
+        UINT last = 0;
+        if (!filter->Issue(UpdateRange(filter->mState.pixelConstantBuffers, startSlot, numBuffers, constantBuffers, first, last)))
+            return;
+
+        deviceContext->PSSetConstantBuffers(startSlot + first, last - first + 1, constantBuffers ? constantBuffers + first : nullptr);
+        return;
+    #endif
+    }
+
+    deviceContext->PSSetConstantBuffers(startSlot, numBuffers, constantBuffers);
+}
+
+
+_Use_decl_annotations_
+void StateFilter::PSSetShaderResources(ID3D11DeviceContext* deviceContext, UINT startSlot, UINT numViews, ID3D11ShaderResourceView* const* shaderResourceViews)
+{
+    auto filter = Impl::Find(deviceContext);
+
+    if (filter)
+    {
+        UINT first = 0;
+        UINT last = 0;
+        if (!filter->Issue(UpdateRange(filter->mState.pixelShaderResources, startSlot, numViews, shaderResourceViews, first, last)))
+            return;
+
+        deviceContext->PSSetShaderResources(startSlot + first, last - first + 1, shaderResourceViews ? shaderResourceViews + first : nullptr);
+        return;
+    }
+
+    deviceContext->PSSetShaderResources(startSlot, numViews, shaderResourceViews);
+}
+
+
+_Use_decl_annotations_
+void StateFilter::PSSetSamplers(ID3D11DeviceContext* deviceContext, UINT startSlot, UINT numSamplers, ID3D11SamplerState* const* samplers)
+{
+    auto filter = Impl::Find(deviceContext);
+
+    if (filter)
+    {
+        UINT first = 0;
+        UINT last = 0;
+        if (!filter->Issue(UpdateRange(filter->mState.pixelSamplers, startSlot, numSamplers, samplers, first, last)))
+            return;
+
+        deviceContext->PSSetSamplers(startSlot + first, last - first + 1, samplers ? samplers + first : nullptr);
+        return;
+    }
+
+    deviceContext->PSSetSamplers(startSlot, numSamplers, samplers);
+}
+
+
+_Use_decl_annotations_
+void StateFilter::Invalidate(ID3D11DeviceContext* deviceContext)
+{
+    auto filter = Impl::Find(deviceContext);
+
+    if (filter)
+    {
+        filter->Invalidate();
+    }
+}
+
+
+_Use_decl_annotations_
+void StateFilter::InvalidateVertexBuffer(ID3D11DeviceContext* deviceContext, UINT slot)
+{
+    auto filter = Impl::Find(deviceContext);
+
+    if (filter && slot < D3D11_IA_VERTEX_INPUT_RESOURCE_SLOT_COUNT)
+    {
+        filter->mState.vertexBuffers[slot].known = false;
+    }
+}
+
+
+_Use_decl_annotations_
+void StateFilter::InvalidateIndexBuffer(ID3D11DeviceContext* deviceContext)
+{
+    auto filter = Impl::Find(deviceContext);
+
+    if (filter)
+    {
+        filter->mState.indexBuffer.known = false;
+    }
+}
@@ -16,7 +16,9 @@
 #endif
 
 #include <DirectXMath.h>
+#include <future>
 #include <memory>
+#include <vector>
 
 
 namespace DirectX
@@ -43,6 +45,49 @@ namespace DirectX
     };
 
 
+    // Counts of the constant buffer uploads made by effects when applied, and of those skipped because the
+    // constants matched the ones the effect last uploaded, across all effects and threads. Xbox One effects write
+    // their constants to per-frame memory on every Apply, and are not counted.
+    struct EffectConstantBufferStatistics
+    {
+        size_t  uploads;
+        size_t  uploadsSkipped;
+    };
+
+    EffectConstantBufferStatistics __cdecl GetEffectConstantBufferStatistics();
+    void __cdecl ResetEffectConstantBufferStatistics();
+
+
+    // Counts and timings of the shader objects created for effects, across all devices. shadersShared counts the
+    // permutations that found their shader already created from the same bytecode, such as by another effect type.
+    struct EffectShaderStatistics
+    {
+        size_t  shadersCreated;
+        size_t  shadersShared;
+        double  createMilliseconds;
+        double  maxCreateMilliseconds;
+    };
+
+    EffectShaderStatistics __cdecl GetEffectShaderStatistics();
+    void __cdecl ResetEffectShaderStatistics();
+
+
+    // Matrices the built-in effects derive from a world matrix and the view and projection matrices when applied.
+    // worldInverseTranspose transforms normals; only its upper 3x3 is computed, so it assumes an affine world matrix.
+    struct EffectDerivedMatrices
+    {
+        XMMATRIX world;
+        XMMATRIX worldView;
+        XMMATRIX worldViewProj;
+        XMMATRIX worldInverseTranspose;
+    };
+
+    // Computes the derived matrices of many objects for one view and projection at once, for IEffectMatrices::
+    // SetDerivedMatrices. The arrays must be 16-byte aligned. Large batches are split across the hardware threads.
+    void XM_CALLCONV ComputeEffectMatrices(_In_reads_(count) const XMMATRIX* worlds, size_t count, FXMMATRIX view, CXMMATRIX projection,
+                                           _Out_writes_(count) EffectDerivedMatrices* results);
+
+
     // Abstract interface for effects with world, view, and projection matrices.
     class IEffectMatrices
     {
@@ -60,11 +105,41 @@ namespace DirectX
         virtual void XM_CALLCONV SetProjection(FXMMATRIX value) = 0;
         virtual void XM_CALLCONV SetMatrices(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection);
 
+        // Sets the world matrix along with the matrices derived from it by ComputeEffectMatrices, which must have been
+        // given the effect's current view and projection. The built-in effects then skip deriving them on Apply.
+        virtual void __cdecl SetDerivedMatrices(const EffectDerivedMatrices& value);
+
     protected:
         IEffectMatrices() = default;
     };
 
 
+    // Abstract interface for effects that can create their shaders ahead of first use, rather than stalling the frame
+    // that first applies a new combination of settings.
+    class IEffectWarmUp
+    {
+    public:
+        virtual ~IEffectWarmUp() = default;
+
+        IEffectWarmUp(const IEffectWarmUp&) = delete;
+        IEffectWarmUp& operator=(const IEffectWarmUp&) = delete;
+
+        IEffectWarmUp(IEffectWarmUp&&) = delete;
+        IEffectWarmUp& operator=(IEffectWarmUp&&) = delete;
+
+        // Creates the shaders for the effect's current settings, or for every combination of settings.
+        virtual void __cdecl CreateShaders(bool allPermutations) = 0;
+
+    protected:
+        IEffectWarmUp() = default;
+    };
+
+    // Calls CreateShaders on a background thread for each of the effects that support IEffectWarmUp. The future is
+    // ready once the shaders exist, and reports any failure to create them. The effects' settings must not change
+    // until then. Shader objects are shared with all the other effects of the same type on the device.
+    std::future<void> __cdecl CreateEffectShadersAsync(std::vector<std::shared_ptr<IEffect>> effects, bool allPermutations = false);
+
+
     // Abstract interface for effects which support directional lighting.
     class IEffectLights
     {
@@ -141,7 +216,7 @@ namespace DirectX
 
     //----------------------------------------------------------------------------------
     // Built-in shader supports optional texture mapping, vertex coloring, directional lighting, and fog.
-    class BasicEffect : public IEffect, public IEffectMatrices, public IEffectLights, public IEffectFog
+    class BasicEffect : public IEffect, public IEffectWarmUp, public IEffectMatrices, public IEffectLights, public IEffectFog
     {
     public:
         explicit BasicEffect(_In_ ID3D11Device* device);
@@ -158,11 +233,15 @@ namespace DirectX
 
         void __cdecl GetVertexShaderBytecode(_Out_ void const** pShaderByteCode, _Out_ size_t* pByteCodeLength) override;
 
+        // IEffectWarmUp methods.
+        void __cdecl CreateShaders(bool allPermutations) override;
+
         // Camera settings.
         void XM_CALLCONV SetWorld(FXMMATRIX value) override;
         void XM_CALLCONV SetView(FXMMATRIX value) override;
         void XM_CALLCONV SetProjection(FXMMATRIX value) override;
         void XM_CALLCONV SetMatrices(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection) override;
+        void __cdecl SetDerivedMatrices(const EffectDerivedMatrices& value) override;
 
         // Material settings.
         void XM_CALLCONV SetDiffuseColor(FXMVECTOR value);
@@ -201,6 +280,11 @@ namespace DirectX
         // Normal compression settings.
         void __cdecl SetBiasedVertexNormals(bool value);
 
+        // Instancing settings. Reads each world matrix from the InstMatrix elements of Model::InstanceInputElements,
+        // applied ahead of the effect world matrix, and lights per pixel. Throws below Feature Level 10.0, or if the
+        // library was built without the instanced shaders, which CompileShaders generates; drawing also needs lighting.
+        void __cdecl SetInstancingEnabled(bool value);
+
     private:
         // Private implementation.
         class Impl;
@@ -211,7 +295,7 @@ namespace DirectX
 
 
     // Built-in shader supports per-pixel alpha testing.
-    class AlphaTestEffect : public IEffect, public IEffectMatrices, public IEffectFog
+    class AlphaTestEffect : public IEffect, public IEffectWarmUp, public IEffectMatrices, public IEffectFog
     {
     public:
         explicit AlphaTestEffect(_In_ ID3D11Device* device);
@@ -228,11 +312,15 @@ namespace DirectX
 
         void __cdecl GetVertexShaderBytecode(_Out_ void const** pShaderByteCode, _Out_ size_t* pByteCodeLength) override;
 
+        // IEffectWarmUp methods.
+        void __cdecl CreateShaders(bool allPermutations) override;
+
         // Camera settings.
         void XM_CALLCONV SetWorld(FXMMATRIX value) override;
         void XM_CALLCONV SetView(FXMMATRIX value) override;
         void XM_CALLCONV SetProjection(FXMMATRIX value) override;
         void XM_CALLCONV SetMatrices(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection) override;
+        void __cdecl SetDerivedMatrices(const EffectDerivedMatrices& value) override;
 
         // Material settings.
         void XM_CALLCONV SetDiffuseColor(FXMVECTOR value);
@@ -265,7 +353,7 @@ namespace DirectX
 
 
     // Built-in shader supports two layer multitexturing (eg. for lightmaps or detail textures).
-    class DualTextureEffect : public IEffect, public IEffectMatrices, public IEffectFog
+    class DualTextureEffect : public IEffect, public IEffectWarmUp, public IEffectMatrices, public IEffectFog
     {
     public:
         explicit DualTextureEffect(_In_ ID3D11Device* device);
@@ -282,11 +370,15 @@ namespace DirectX
 
         void __cdecl GetVertexShaderBytecode(_Out_ void const** pShaderByteCode, _Out_ size_t* pByteCodeLength) override;
 
+        // IEffectWarmUp methods.
+        void __cdecl CreateShaders(bool allPermutations) override;
+
         // Camera settings.
         void XM_CALLCONV SetWorld(FXMMATRIX value) override;
         void XM_CALLCONV SetView(FXMMATRIX value) override;
         void XM_CALLCONV SetProjection(FXMMATRIX value) override;
         void XM_CALLCONV SetMatrices(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection) override;
+        void __cdecl SetDerivedMatrices(const EffectDerivedMatrices& value) override;
 
         // Material settings.
         void XM_CALLCONV SetDiffuseColor(FXMVECTOR value);
@@ -316,7 +408,7 @@ namespace DirectX
 
 
     // Built-in shader supports cubic environment mapping.
-    class EnvironmentMapEffect : public IEffect, public IEffectMatrices, public IEffectLights, public IEffectFog
+    class EnvironmentMapEffect : public IEffect, public IEffectWarmUp, public IEffectMatrices, public IEffectLights, public IEffectFog
     {
     public:
         explicit EnvironmentMapEffect(_In_ ID3D11Device* device);
@@ -333,11 +425,15 @@ namespace DirectX
 
         void __cdecl GetVertexShaderBytecode(_Out_ void const** pShaderByteCode, _Out_ size_t* pByteCodeLength) override;
 
+        // IEffectWarmUp methods.
+        void __cdecl CreateShaders(bool allPermutations) override;
+
         // Camera settings.
         void XM_CALLCONV SetWorld(FXMMATRIX value) override;
         void XM_CALLCONV SetView(FXMMATRIX value) override;
         void XM_CALLCONV SetProjection(FXMMATRIX value) override;
         void XM_CALLCONV SetMatrices(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection) override;
+        void __cdecl SetDerivedMatrices(const EffectDerivedMatrices& value) override;
 
         // Material settings.
         void XM_CALLCONV SetDiffuseColor(FXMVECTOR value);
@@ -387,7 +483,7 @@ namespace DirectX
 
 
     // Built-in shader supports skinned animation.
-    class SkinnedEffect : public IEffect, public IEffectMatrices, public IEffectLights, public IEffectFog, public IEffectSkinning
+    class SkinnedEffect : public IEffect, public IEffectWarmUp, public IEffectMatrices, public IEffectLights, public IEffectFog, public IEffectSkinning
     {
     public:
         explicit SkinnedEffect(_In_ ID3D11Device* device);
@@ -404,11 +500,15 @@ namespace DirectX
 
         void __cdecl GetVertexShaderBytecode(_Out_ void const** pShaderByteCode, _Out_ size_t* pByteCodeLength) override;
 
+        // IEffectWarmUp methods.
+        void __cdecl CreateShaders(bool allPermutations) override;
+
         // Camera settings.
         void XM_CALLCONV SetWorld(FXMMATRIX value) override;
         void XM_CALLCONV SetView(FXMMATRIX value) override;
         void XM_CALLCONV SetProjection(FXMMATRIX value) override;
         void XM_CALLCONV SetMatrices(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection) override;
+        void __cdecl SetDerivedMatrices(const EffectDerivedMatrices& value) override;
 
         // Material settings.
         void XM_CALLCONV SetDiffuseColor(FXMVECTOR value);
@@ -537,9 +637,11 @@ namespace DirectX
         void __cdecl SetPerPixelLighting(bool value) override;
     };
 
+    class LightClusters;
+
     //----------------------------------------------------------------------------------
     // Built-in shader extends BasicEffect with normal maps and optional specular maps
-    class NormalMapEffect : public IEffect, public IEffectMatrices, public IEffectLights, public IEffectFog
+    class NormalMapEffect : public IEffect, public IEffectWarmUp, public IEffectMatrices, public IEffectLights, public IEffectFog
     {
     public:
         explicit NormalMapEffect(_In_ ID3D11Device* device);
@@ -556,11 +658,15 @@ namespace DirectX
 
         void __cdecl GetVertexShaderBytecode(_Out_ void const** pShaderByteCode, _Out_ size_t* pByteCodeLength) override;
 
+        // IEffectWarmUp methods.
+        void __cdecl CreateShaders(bool allPermutations) override;
+
         // Camera settings.
         void XM_CALLCONV SetWorld(FXMMATRIX value) override;
         void XM_CALLCONV SetView(FXMMATRIX value) override;
         void XM_CALLCONV SetProjection(FXMMATRIX value) override;
         void XM_CALLCONV SetMatrices(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection) override;
+        void __cdecl SetDerivedMatrices(const EffectDerivedMatrices& value) override;
 
         // Material settings.
         void XM_CALLCONV SetDiffuseColor(FXMVECTOR value);
@@ -598,6 +704,16 @@ namespace DirectX
         // Normal compression settings.
         void __cdecl SetBiasedVertexNormals(bool value);
 
+        // Clustered lighting. Adds the point and spot lights binned by a LightClusters object, which must outlive
+        // its use here, to the directional lights. Its buffers and constants are read on each Apply, so update it
+        // for the frame's view first. Pass nullptr to turn it off. Throws below Feature Level 11.0, or if the library
+        // was built without the Shader Model 5.0 shaders of NormalMapEffectClustered.fx, which CompileShaders generates.
+        void __cdecl SetLightClusters(_In_opt_ const LightClusters* value);
+
+        // Instancing settings. Reads each world matrix from the InstMatrix elements of Model::InstanceInputElements,
+        // applied ahead of the effect world matrix. Throws if the library was built without the instanced shaders.
+        void __cdecl SetInstancingEnabled(bool value);
+
     private:
         // Private implementation.
         class Impl;
@@ -611,7 +727,7 @@ namespace DirectX
 
     //----------------------------------------------------------------------------------
     // Built-in shader for Physically-Based Rendering (Roughness/Metalness) with Image-based lighting
-    class PBREffect : public IEffect, public IEffectMatrices, public IEffectLights
+    class PBREffect : public IEffect, public IEffectWarmUp, public IEffectMatrices, public IEffectLights
     {
     public:
         explicit PBREffect(_In_ ID3D11Device* device);
@@ -628,11 +744,15 @@ namespace DirectX
 
         void __cdecl GetVertexShaderBytecode(_Out_ void const** pShaderByteCode, _Out_ size_t* pByteCodeLength) override;
 
+        // IEffectWarmUp methods.
+        void __cdecl CreateShaders(bool allPermutations) override;
+
         // Camera settings.
         void XM_CALLCONV SetWorld(FXMMATRIX value) override;
         void XM_CALLCONV SetView(FXMMATRIX value) override;
         void XM_CALLCONV SetProjection(FXMMATRIX value) override;
         void XM_CALLCONV SetMatrices(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection) override;
+        void __cdecl SetDerivedMatrices(const EffectDerivedMatrices& value) override;
 
         // Light settings.
         void __cdecl SetLightEnabled(int whichLight, bool value) override;
@@ -684,7 +804,7 @@ namespace DirectX
 
     //----------------------------------------------------------------------------------
     // Built-in shader for debug visualization of normals, tangents, etc.
-    class DebugEffect : public IEffect, public IEffectMatrices
+    class DebugEffect : public IEffect, public IEffectWarmUp, public IEffectMatrices
     {
     public:
         enum Mode
@@ -709,11 +829,15 @@ namespace DirectX
 
         void __cdecl GetVertexShaderBytecode(_Out_ void const** pShaderByteCode, _Out_ size_t* pByteCodeLength) override;
 
+        // IEffectWarmUp methods.
+        void __cdecl CreateShaders(bool allPermutations) override;
+
         // Camera settings.
         void XM_CALLCONV SetWorld(FXMMATRIX value) override;
         void XM_CALLCONV SetView(FXMMATRIX value) override;
         void XM_CALLCONV SetProjection(FXMMATRIX value) override;
         void XM_CALLCONV SetMatrices(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection) override;
+        void __cdecl SetDerivedMatrices(const EffectDerivedMatrices& value) override;
 
         // Debug Settings.
         void __cdecl SetMode(Mode debugMode);
@@ -819,6 +943,25 @@ namespace DirectX
 
         void __cdecl SetDirectory(_In_opt_z_ const wchar_t* path);
 
+        // Texture residency. With a nonzero budget in bytes, UpdateTextureResidency, called once per frame, counts
+        // cached textures still referenced outside the factory as used in that frame. While the cache exceeds the
+        // budget, it releases cached effects that only the factory holds, then evicts the least recently used
+        // unreferenced textures until the cache fits. While it does not fit, textures that are loaded are limited
+        // to reducedMaxSize on each side, if that is nonzero. Only shared textures are tracked, and views bound to
+        // the pipeline without being held elsewhere must not be evicted, so keep a reference to them.
+        struct TextureResidencyStatistics
+        {
+            size_t residentBytes;
+            size_t residentTextures;
+            size_t evictedTextures;
+            size_t reducedTextures;
+        };
+
+        void __cdecl SetTextureBudget(size_t budgetBytes, size_t reducedMaxSize = 0);
+        void __cdecl UpdateTextureResidency(uint64_t frame);
+
+        TextureResidencyStatistics __cdecl GetTextureResidencyStatistics() const;
+
         // Properties.
         ID3D11Device* GetDevice() const;
 
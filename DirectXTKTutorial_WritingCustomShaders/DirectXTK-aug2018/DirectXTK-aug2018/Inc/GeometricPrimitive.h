@@ -29,6 +29,12 @@ namespace DirectX
 
         using VertexType = VertexPositionNormalTexture;
 
+        // Bicubic bezier patch, as 16 indices into a list of control points.
+        struct BezierPatch
+        {
+            uint32_t indices[16];
+        };
+
         virtual ~GeometricPrimitive();
 
         // Factory methods.
@@ -46,6 +52,13 @@ namespace DirectX
         static std::unique_ptr<GeometricPrimitive> __cdecl CreateTeapot(_In_ ID3D11DeviceContext* deviceContext, float size = 1, size_t tessellation = 8, bool rhcoords = true);
         static std::unique_ptr<GeometricPrimitive> __cdecl CreateCustom(_In_ ID3D11DeviceContext* deviceContext, const std::vector<VertexType>& vertices, const std::vector<uint16_t>& indices);
 
+        // Factory methods for level-of-detail chains, which halve the tessellation for each successive level.
+        static std::unique_ptr<GeometricPrimitive> __cdecl CreateSphereLOD(_In_ ID3D11DeviceContext* deviceContext, float diameter = 1, size_t tessellation = 64, size_t levels = 4, bool rhcoords = true, bool invertn = false);
+        static std::unique_ptr<GeometricPrimitive> __cdecl CreateCylinderLOD(_In_ ID3D11DeviceContext* deviceContext, float height = 1, float diameter = 1, size_t tessellation = 64, size_t levels = 4, bool rhcoords = true);
+        static std::unique_ptr<GeometricPrimitive> __cdecl CreateConeLOD(_In_ ID3D11DeviceContext* deviceContext, float diameter = 1, float height = 1, size_t tessellation = 64, size_t levels = 4, bool rhcoords = true);
+        static std::unique_ptr<GeometricPrimitive> __cdecl CreateTorusLOD(_In_ ID3D11DeviceContext* deviceContext, float diameter = 1, float thickness = 0.333f, size_t tessellation = 64, size_t levels = 4, bool rhcoords = true);
+        static std::unique_ptr<GeometricPrimitive> __cdecl CreateTeapotLOD(_In_ ID3D11DeviceContext* deviceContext, float size = 1, size_t tessellation = 16, size_t levels = 4, bool rhcoords = true);
+
         static void __cdecl CreateCube(std::vector<VertexType>& vertices, std::vector<uint16_t>& indices, float size = 1, bool rhcoords = true);
         static void __cdecl CreateBox(std::vector<VertexType>& vertices, std::vector<uint16_t>& indices, const XMFLOAT3& size, bool rhcoords = true, bool invertn = false);
         static void __cdecl CreateSphere(std::vector<VertexType>& vertices, std::vector<uint16_t>& indices, float diameter = 1, size_t tessellation = 16, bool rhcoords = true, bool invertn = false);
@@ -59,13 +72,27 @@ namespace DirectX
         static void __cdecl CreateIcosahedron(std::vector<VertexType>& vertices, std::vector<uint16_t>& indices, float size = 1, bool rhcoords = true);
         static void __cdecl CreateTeapot(std::vector<VertexType>& vertices, std::vector<uint16_t>& indices, float size = 1, size_t tessellation = 8, bool rhcoords = true);
 
+        // Factory methods for bezier surfaces tessellated per patch, only as finely as needed to keep within
+        // 'tolerance' (in object space) of the true surface. Edges are stitched so patches don't crack apart.
+        static std::unique_ptr<GeometricPrimitive> __cdecl CreateTeapotAdaptive(_In_ ID3D11DeviceContext* deviceContext, float size = 1, float tolerance = 0.01f, size_t maxTessellation = 16, bool rhcoords = true);
+        static std::unique_ptr<GeometricPrimitive> __cdecl CreateBezierPatches(_In_ ID3D11DeviceContext* deviceContext, const std::vector<XMFLOAT3>& controlPoints, const std::vector<BezierPatch>& patches, float tolerance = 0.01f, size_t maxTessellation = 16, bool rhcoords = true);
+
+        static void __cdecl CreateTeapotAdaptive(std::vector<VertexType>& vertices, std::vector<uint16_t>& indices, float size = 1, float tolerance = 0.01f, size_t maxTessellation = 16, bool rhcoords = true);
+        static void __cdecl CreateBezierPatches(std::vector<VertexType>& vertices, std::vector<uint16_t>& indices, const std::vector<XMFLOAT3>& controlPoints, const std::vector<BezierPatch>& patches, float tolerance = 0.01f, size_t maxTessellation = 16, bool rhcoords = true);
+
         // Draw the primitive.
         void XM_CALLCONV Draw(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection, FXMVECTOR color = Colors::White, _In_opt_ ID3D11ShaderResourceView* texture = nullptr, bool wireframe = false,
                               _In_opt_ std::function<void __cdecl()> setCustomState = nullptr) const;
 
         // Draw the primitive using a custom effect.
         void __cdecl Draw(_In_ IEffect* effect, _In_ ID3D11InputLayout* inputLayout, bool alpha = false, bool wireframe = false,
-                          _In_opt_ std::function<void __cdecl()> setCustomState = nullptr) const;
+                          _In_opt_ std::function<void __cdecl()> setCustomState = nullptr, size_t lod = 0) const;
+
+        // Level-of-detail settings. Level 0 is drawn while the bounding sphere covers at least 'coverage'
+        // of the viewport height, and each successive level takes over at half the previous threshold.
+        size_t __cdecl GetLODCount() const;
+        size_t XM_CALLCONV SelectLOD(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection) const;
+        void __cdecl SetLODScreenCoverage(float coverage);
 
        // Create input layout for drawing with a custom effect.
         void __cdecl CreateInputLayout(_In_ IEffect* effect, _Outptr_ ID3D11InputLayout** inputLayout) const;
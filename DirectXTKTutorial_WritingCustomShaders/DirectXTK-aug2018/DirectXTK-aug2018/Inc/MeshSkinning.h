@@ -0,0 +1,31 @@
+//--------------------------------------------------------------------------------------
+// File: MeshSkinning.h
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#pragma once
+
+#include <DirectXMath.h>
+
+#include <stdint.h>
+
+
+namespace DirectX
+{
+    struct VertexPositionNormalTangentColorTextureSkinning;
+
+    // Applies a bone palette to skinned vertices on the CPU, blending the bones of the first weightsPerVertex
+    // (1, 2, or 4) blend indices and weights of each vertex, as SkinnedEffect does on the GPU. The palette is the
+    // same one given to SkinnedEffect::SetBoneTransforms, such as from ModelSkeleton::ComputeBonePalette, but may
+    // hold up to 256 bones, as many as the blend indices can address. Normals and tangents are renormalized, and
+    // the tangent w (the bitangent sign) is kept. Large meshes are split across the available hardware threads.
+    void __cdecl SkinVertices(_In_reads_(nVerts) const VertexPositionNormalTangentColorTextureSkinning* vertices, size_t nVerts,
+                              _In_reads_(boneCount) const XMMATRIX* bones, size_t boneCount, int weightsPerVertex,
+                              _Out_writes_(nVerts) XMFLOAT3* positions,
+                              _Out_writes_opt_(nVerts) XMFLOAT3* normals = nullptr,
+                              _Out_writes_opt_(nVerts) XMFLOAT4* tangents = nullptr);
+}
@@ -271,7 +271,7 @@ void AlphaTestEffect::Impl::Apply(_In_ ID3D11DeviceContext* deviceContext)
     // Set the texture.
     ID3D11ShaderResourceView* textures[1] = { texture.Get() };
 
-    deviceContext->PSSetShaderResources(0, 1, textures);
+    StateFilter::PSSetShaderResources(deviceContext, 0, 1, textures);
     
     // Set shaders and constant buffers.
     ApplyShaders(deviceContext, GetCurrentShaderPermutation());
@@ -319,6 +319,12 @@ void AlphaTestEffect::GetVertexShaderBytecode(_Out_ void const** pShaderByteCode
 }
 
 
+void AlphaTestEffect::CreateShaders(bool allPermutations)
+{
+    pImpl->CreateShaders(allPermutations ? -1 : pImpl->GetCurrentShaderPermutation());
+}
+
+
 // Camera settings.
 void XM_CALLCONV AlphaTestEffect::SetWorld(FXMMATRIX value)
 {
@@ -354,6 +360,12 @@ void XM_CALLCONV AlphaTestEffect::SetMatrices(FXMMATRIX world, CXMMATRIX view, C
 }
 
 
+void AlphaTestEffect::SetDerivedMatrices(const EffectDerivedMatrices& value)
+{
+    pImpl->matrices.SetDerived(pImpl->dirtyFlags, value, pImpl->constants.worldViewProj);
+}
+
+
 // Material settings
 void XM_CALLCONV AlphaTestEffect::SetDiffuseColor(FXMVECTOR value)
 {
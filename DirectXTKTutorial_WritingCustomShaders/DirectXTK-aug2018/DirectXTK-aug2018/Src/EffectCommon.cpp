@@ -10,11 +10,94 @@
 #include "pch.h"
 #include "EffectCommon.h"
 #include "DemandCreate.h"
+#include "ParallelHelpers.h"
+
+#include <chrono>
 
 using namespace DirectX;
+using DirectX::ParallelHelpers::ParallelFor;
 using Microsoft::WRL::ComPtr;
 
 
+namespace
+{
+    // Batches smaller than this are computed on the calling thread only.
+    const size_t MinParallelChunk = 4096;
+
+
+    // Shader caches shared by all the effects on each device.
+    SharedResourcePool<ID3D11Device*, EffectShaderCache> shaderCachePool;
+
+    // Totals behind GetEffectShaderStatistics.
+    std::mutex shaderStatisticsMutex;
+    EffectShaderStatistics shaderStatistics = {};
+
+
+    // Derives the matrices of four objects. The upper 3x3 of each world matrix is inverted through its cofactors,
+    // with the four objects' elements held one per lane, so each cross product and the determinant are computed
+    // for all four at once.
+    void XM_CALLCONV ComputeEffectMatrices4(_In_reads_(4) const XMMATRIX* worlds, FXMMATRIX view, CXMMATRIX projection,
+                                            _Out_writes_(count) EffectDerivedMatrices* results, size_t count)
+    {
+        // Rows 0, 1, and 2 of the world matrices, as x, y, and z components across the four objects.
+        XMMATRIX a = XMMatrixTranspose(XMMATRIX(worlds[0].r[0], worlds[1].r[0], worlds[2].r[0], worlds[3].r[0]));
+        XMMATRIX b = XMMatrixTranspose(XMMATRIX(worlds[0].r[1], worlds[1].r[1], worlds[2].r[1], worlds[3].r[1]));
+        XMMATRIX c = XMMatrixTranspose(XMMATRIX(worlds[0].r[2], worlds[1].r[2], worlds[2].r[2], worlds[3].r[2]));
+
+        // The rows of the inverse transpose are b x c, c x a, and a x b, divided by the determinant.
+        XMVECTOR n0x = XMVectorNegativeMultiplySubtract(b.r[2], c.r[1], XMVectorMultiply(b.r[1], c.r[2]));
+        XMVECTOR n0y = XMVectorNegativeMultiplySubtract(b.r[0], c.r[2], XMVectorMultiply(b.r[2], c.r[0]));
+        XMVECTOR n0z = XMVectorNegativeMultiplySubtract(b.r[1], c.r[0], XMVectorMultiply(b.r[0], c.r[1]));
+
+        XMVECTOR n1x = XMVectorNegativeMultiplySubtract(c.r[2], a.r[1], XMVectorMultiply(c.r[1], a.r[2]));
+        XMVECTOR n1y = XMVectorNegativeMultiplySubtract(c.r[0], a.r[2], XMVectorMultiply(c.r[2], a.r[0]));
+        XMVECTOR n1z = XMVectorNegativeMultiplySubtract(c.r[1], a.r[0], XMVectorMultiply(c.r[0], a.r[1]));
+
+        XMVECTOR n2x = XMVectorNegativeMultiplySubtract(a.r[2], b.r[1], XMVectorMultiply(a.r[1], b.r[2]));
+        XMVECTOR n2y = XMVectorNegativeMultiplySubtract(a.r[0], b.r[2], XMVectorMultiply(a.r[2], b.r[0]));
+        XMVECTOR n2z = XMVectorNegativeMultiplySubtract(a.r[1], b.r[0], XMVectorMultiply(a.r[0], b.r[1]));
+
+        XMVECTOR det = XMVectorMultiplyAdd(a.r[2], n0z, XMVectorMultiplyAdd(a.r[1], n0y, XMVectorMultiply(a.r[0], n0x)));
+        XMVECTOR invDet = XMVectorReciprocal(det);
+
+        // Back to one row per object, with zero in w.
+        XMMATRIX n0 = XMMatrixTranspose(XMMATRIX(XMVectorMultiply(n0x, invDet), XMVectorMultiply(n0y, invDet), XMVectorMultiply(n0z, invDet), g_XMZero));
+        XMMATRIX n1 = XMMatrixTranspose(XMMATRIX(XMVectorMultiply(n1x, invDet), XMVectorMultiply(n1y, invDet), XMVectorMultiply(n1z, invDet), g_XMZero));
+        XMMATRIX n2 = XMMatrixTranspose(XMMATRIX(XMVectorMultiply(n2x, invDet), XMVectorMultiply(n2y, invDet), XMVectorMultiply(n2z, invDet), g_XMZero));
+
+        for (size_t j = 0; j < count; ++j)
+        {
+            auto& result = results[j];
+
+            result.world = worlds[j];
+            result.worldView = XMMatrixMultiply(worlds[j], view);
+            result.worldViewProj = XMMatrixMultiply(result.worldView, projection);
+            result.worldInverseTranspose = XMMATRIX(n0.r[j], n1.r[j], n2.r[j], g_XMIdentityR3);
+        }
+    }
+}
+
+
+std::atomic<size_t> EffectConstantBufferCounters::uploads;
+std::atomic<size_t> EffectConstantBufferCounters::uploadsSkipped;
+
+
+EffectConstantBufferStatistics __cdecl DirectX::GetEffectConstantBufferStatistics()
+{
+    EffectConstantBufferStatistics stats;
+    stats.uploads = EffectConstantBufferCounters::uploads.load(std::memory_order_relaxed);
+    stats.uploadsSkipped = EffectConstantBufferCounters::uploadsSkipped.load(std::memory_order_relaxed);
+    return stats;
+}
+
+
+void __cdecl DirectX::ResetEffectConstantBufferStatistics()
+{
+    EffectConstantBufferCounters::uploads.store(0, std::memory_order_relaxed);
+    EffectConstantBufferCounters::uploadsSkipped.store(0, std::memory_order_relaxed);
+}
+
+
 // IEffectMatrices default method
 void XM_CALLCONV IEffectMatrices::SetMatrices(FXMMATRIX world, CXMMATRIX view, CXMMATRIX projection)
 {
@@ -24,6 +107,13 @@ void XM_CALLCONV IEffectMatrices::SetMatrices(FXMMATRIX world, CXMMATRIX view, C
 }
 
 
+// IEffectMatrices default method, for effects that derive their matrices themselves.
+void IEffectMatrices::SetDerivedMatrices(const EffectDerivedMatrices& value)
+{
+    SetWorld(value.world);
+}
+
+
 // Constructor initializes default matrix values.
 EffectMatrices::EffectMatrices() noexcept
 {
@@ -51,6 +141,70 @@ void EffectMatrices::SetConstants(int& dirtyFlags, XMMATRIX& worldViewProjConsta
 }
 
 
+// Stores precomputed matrices, leaving the world inverse transpose dirty for SetDerivedWorldConstants.
+_Use_decl_annotations_
+void EffectMatrices::SetDerived(int& dirtyFlags, EffectDerivedMatrices const& derived, XMMATRIX& worldViewProjConstant)
+{
+    world = derived.world;
+    worldView = derived.worldView;
+
+    worldViewProjConstant = XMMatrixTranspose(derived.worldViewProj);
+
+    dirtyFlags &= ~EffectDirtyFlags::WorldViewProj;
+    dirtyFlags |= EffectDirtyFlags::ConstantBuffer | EffectDirtyFlags::WorldInverseTranspose | EffectDirtyFlags::FogVector;
+}
+
+
+// Stores the world matrix and the rows of its inverse, as the shaders expect them.
+_Use_decl_annotations_
+void EffectMatrices::SetDerivedWorldConstants(int& dirtyFlags, EffectDerivedMatrices const& derived, XMMATRIX& worldConstant, XMVECTOR worldInverseTransposeConstant[3])
+{
+    worldConstant = XMMatrixTranspose(derived.world);
+
+    XMMATRIX worldInverse = XMMatrixTranspose(derived.worldInverseTranspose);
+
+    worldInverseTransposeConstant[0] = worldInverse.r[0];
+    worldInverseTransposeConstant[1] = worldInverse.r[1];
+    worldInverseTransposeConstant[2] = worldInverse.r[2];
+
+    dirtyFlags &= ~EffectDirtyFlags::WorldInverseTranspose;
+    dirtyFlags |= EffectDirtyFlags::ConstantBuffer;
+}
+
+
+_Use_decl_annotations_
+void XM_CALLCONV DirectX::ComputeEffectMatrices(const XMMATRIX* worlds, size_t count, FXMMATRIX view, CXMMATRIX projection, EffectDerivedMatrices* results)
+{
+    if (!count)
+        return;
+
+    if (!worlds || !results)
+        throw std::exception("Worlds and results are required");
+
+    XMMATRIX v = view;
+    XMMATRIX p = projection;
+
+    ParallelFor(count, MinParallelChunk, [=](size_t begin, size_t end)
+    {
+        size_t j = begin;
+
+        for (; j + 4 <= end; j += 4)
+        {
+            ComputeEffectMatrices4(&worlds[j], v, p, &results[j], 4);
+        }
+
+        if (j < end)
+        {
+            // Pad the last few objects out to four with identity matrices.
+            XMMATRIX padded[4] = { XMMatrixIdentity(), XMMatrixIdentity(), XMMatrixIdentity(), XMMatrixIdentity() };
+            std::copy(&worlds[j], &worlds[end], padded);
+
+            ComputeEffectMatrices4(padded, v, p, &results[j], end - j);
+        }
+    });
+}
+
+
 // Constructor initializes default fog settings.
 EffectFog::EffectFog() noexcept :
     enabled(false),
@@ -384,17 +538,146 @@ void EffectLights::EnableDefaultLighting(_In_ IEffectLights* effect)
 }
 
 
-// Gets or lazily creates the specified vertex shader permutation.
-ID3D11VertexShader* EffectDeviceResources::DemandCreateVertexShader(_Inout_ ComPtr<ID3D11VertexShader>& vertexShader, ShaderBytecode const& bytecode)
+EffectShaderStatistics __cdecl DirectX::GetEffectShaderStatistics()
 {
-    return DemandCreate(vertexShader, mMutex, [&](ID3D11VertexShader** pResult) -> HRESULT
+    std::lock_guard<std::mutex> lock(shaderStatisticsMutex);
+
+    return shaderStatistics;
+}
+
+
+void __cdecl DirectX::ResetEffectShaderStatistics()
+{
+    std::lock_guard<std::mutex> lock(shaderStatisticsMutex);
+
+    shaderStatistics = {};
+}
+
+
+std::future<void> __cdecl DirectX::CreateEffectShadersAsync(std::vector<std::shared_ptr<IEffect>> effects, bool allPermutations)
+{
+    return std::async(std::launch::async, [effects, allPermutations]()
     {
-        HRESULT hr = mDevice->CreateVertexShader(bytecode.code, bytecode.length, nullptr, pResult);
+        for (auto it = effects.cbegin(); it != effects.cend(); ++it)
+        {
+            auto warmUp = dynamic_cast<IEffectWarmUp*>(it->get());
+
+            if (warmUp)
+            {
+                warmUp->CreateShaders(allPermutations);
+            }
+        }
+    });
+}
+
+
+EffectShaderCache::BytecodeKey::BytecodeKey(ShaderBytecode const& bytecode) noexcept :
+    checksum{},
+    address(0),
+    length(bytecode.length)
+{
+    // A DXBC container starts with its magic number, followed by a 16-byte checksum of the rest.
+    if (bytecode.length >= 20 && memcmp(bytecode.code, "DXBC", 4) == 0)
+    {
+        memcpy(checksum, static_cast<const uint8_t*>(bytecode.code) + 4, sizeof(checksum));
+    }
+    else
+    {
+        address = reinterpret_cast<uintptr_t>(bytecode.code);
+    }
+}
 
-        if (SUCCEEDED(hr))
-            SetDebugObjectName(*pResult, "DirectXTK:Effect");
 
+// Looks up a shader by its bytecode, or creates it. Creation happens outside the lock, so different shaders can be
+// created on several threads at once; if two threads create the same one, the first to finish is kept.
+template<typename T, typename TCreateFunc>
+_Use_decl_annotations_
+HRESULT EffectShaderCache::GetShader(std::map<BytecodeKey, ComPtr<T>>& shaders, ShaderBytecode const& bytecode, T** pResult, TCreateFunc createFunc)
+{
+    *pResult = nullptr;
+
+    BytecodeKey key(bytecode);
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+
+        auto pos = shaders.find(key);
+
+        if (pos != shaders.end())
+        {
+            std::lock_guard<std::mutex> statisticsLock(shaderStatisticsMutex);
+
+            ++shaderStatistics.shadersShared;
+
+            return pos->second.CopyTo(pResult);
+        }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    ComPtr<T> shader;
+    HRESULT hr = createFunc(shader.GetAddressOf());
+
+    if (FAILED(hr))
         return hr;
+
+    double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    SetDebugObjectName(shader.Get(), "DirectXTK:Effect");
+
+    {
+        std::lock_guard<std::mutex> statisticsLock(shaderStatisticsMutex);
+
+        ++shaderStatistics.shadersCreated;
+        shaderStatistics.createMilliseconds += milliseconds;
+        shaderStatistics.maxCreateMilliseconds = std::max(shaderStatistics.maxCreateMilliseconds, milliseconds);
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    auto result = shaders.insert(std::make_pair(key, shader));
+
+    return result.first->second.CopyTo(pResult);
+}
+
+
+_Use_decl_annotations_
+HRESULT EffectShaderCache::GetVertexShader(ShaderBytecode const& bytecode, ID3D11VertexShader** pResult)
+{
+    return GetShader(mVertexShaders, bytecode, pResult, [&](ID3D11VertexShader** pShader) -> HRESULT
+    {
+        return mDevice->CreateVertexShader(bytecode.code, bytecode.length, nullptr, pShader);
+    });
+}
+
+
+_Use_decl_annotations_
+HRESULT EffectShaderCache::GetPixelShader(ShaderBytecode const& bytecode, ID3D11PixelShader** pResult)
+{
+    return GetShader(mPixelShaders, bytecode, pResult, [&](ID3D11PixelShader** pShader) -> HRESULT
+    {
+        return mDevice->CreatePixelShader(bytecode.code, bytecode.length, nullptr, pShader);
+    });
+}
+
+
+EffectShaderCache* EffectDeviceResources::GetShaderCache()
+{
+    if (!mShaderCache)
+    {
+        mShaderCache = shaderCachePool.DemandCreate(mDevice.Get());
+    }
+
+    return mShaderCache.get();
+}
+
+
+// Gets or lazily creates the specified vertex shader permutation.
+ID3D11VertexShader* EffectDeviceResources::DemandCreateVertexShader(_Inout_ ComPtr<ID3D11VertexShader>& vertexShader, ShaderBytecode const& bytecode)
+{
+    return DemandCreate(vertexShader, mMutex, [&](ID3D11VertexShader** pResult) -> HRESULT
+    {
+        return GetShaderCache()->GetVertexShader(bytecode, pResult);
     });
 }
 
@@ -404,12 +687,7 @@ ID3D11PixelShader* EffectDeviceResources::DemandCreatePixelShader(_Inout_ ComPtr
 {
     return DemandCreate(pixelShader, mMutex, [&](ID3D11PixelShader** pResult) -> HRESULT
     {
-        HRESULT hr = mDevice->CreatePixelShader(bytecode.code, bytecode.length, nullptr, pResult);
-
-        if (SUCCEEDED(hr))
-            SetDebugObjectName(*pResult, "DirectXTK:Effect");
-
-        return hr;
+        return GetShaderCache()->GetPixelShader(bytecode, pResult);
     });
 }
 
@@ -0,0 +1,233 @@
+//--------------------------------------------------------------------------------------
+// File: ModelAnimation.cpp
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+// Licensed under the MIT License.
+//
+// http://go.microsoft.com/fwlink/?LinkId=248929
+//--------------------------------------------------------------------------------------
+
+#include "pch.h"
+#include "Model.h"
+
+using namespace DirectX;
+
+
+namespace
+{
+    // Maps a time onto the range of the clip.
+    float ClipTime(ModelAnimationClip const& clip, float time, bool loop)
+    {
+        float duration = clip.endTime - clip.startTime;
+
+        if (loop && duration > 0.f)
+        {
+            time = fmodf(time - clip.startTime, duration);
+            if (time < 0.f)
+                time += duration;
+
+            return time + clip.startTime;
+        }
+
+        return std::min(std::max(time, clip.startTime), clip.endTime);
+    }
+
+
+    // Interpolates the keys of one bone, holding the first and last keys outside of their range.
+    XMMATRIX SampleBone(ModelAnimationClip const& clip, size_t bone, float time)
+    {
+        uint32_t first = clip.keyOffsets[bone];
+        uint32_t last = clip.keyOffsets[bone + 1] - 1;
+
+        auto times = clip.keyTimes.data();
+        auto next = static_cast<uint32_t>(std::upper_bound(times + first, times + last + 1, time) - times);
+
+        uint32_t k0 = (next > first) ? next - 1 : first;
+        uint32_t k1 = (next <= last) ? next : last;
+
+        XMVECTOR scale = XMLoadFloat3(&clip.keyScales[k0]);
+        XMVECTOR rotation = XMLoadFloat4(&clip.keyRotations[k0]);
+        XMVECTOR translation = XMLoadFloat3(&clip.keyTranslations[k0]);
+
+        if (k0 != k1)
+        {
+            float span = times[k1] - times[k0];
+            float t = (span > 0.f) ? (time - times[k0]) / span : 0.f;
+
+            scale = XMVectorLerp(scale, XMLoadFloat3(&clip.keyScales[k1]), t);
+            rotation = XMQuaternionSlerp(rotation, XMLoadFloat4(&clip.keyRotations[k1]), t);
+            translation = XMVectorLerp(translation, XMLoadFloat3(&clip.keyTranslations[k1]), t);
+        }
+
+        return XMMatrixAffineTransformation(scale, g_XMZero, rotation, translation);
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// ModelAnimationClip
+//--------------------------------------------------------------------------------------
+
+ModelAnimationClip::ModelAnimationClip() noexcept :
+    startTime(0.f),
+    endTime(0.f)
+{
+}
+
+
+_Use_decl_annotations_
+void ModelAnimationClip::SetKeyframes(const Keyframe* keys, size_t count, size_t boneCount)
+{
+    if (count && !keys)
+        throw std::exception("Keyframes cannot be null");
+
+    if (count >= UINT32_MAX || boneCount >= UINT32_MAX)
+        throw std::out_of_range("Too many keyframes or bones");
+
+    std::vector<uint32_t> sorted(count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (keys[i].boneIndex >= boneCount)
+            throw std::out_of_range("Keyframe bone index out of range");
+
+        sorted[i] = static_cast<uint32_t>(i);
+    }
+
+    std::stable_sort(sorted.begin(), sorted.end(), [keys](uint32_t a, uint32_t b) -> bool
+    {
+        if (keys[a].boneIndex != keys[b].boneIndex)
+            return keys[a].boneIndex < keys[b].boneIndex;
+
+        return keys[a].time < keys[b].time;
+    });
+
+    keyOffsets.assign(boneCount + 1, 0);
+    keyTimes.resize(count);
+    keyScales.resize(count);
+    keyRotations.resize(count);
+    keyTranslations.resize(count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        auto& key = keys[sorted[i]];
+
+        keyOffsets[key.boneIndex + 1]++;
+
+        keyTimes[i] = key.time;
+        keyScales[i] = key.scale;
+        keyTranslations[i] = key.translation;
+
+        // Keep neighboring rotations in the same hemisphere, so interpolation takes the short way around.
+        XMVECTOR rotation = XMQuaternionNormalize(XMLoadFloat4(&key.rotation));
+
+        if (i > 0 && keys[sorted[i - 1]].boneIndex == key.boneIndex)
+        {
+            if (XMVectorGetX(XMQuaternionDot(rotation, XMLoadFloat4(&keyRotations[i - 1]))) < 0.f)
+                rotation = XMVectorNegate(rotation);
+        }
+
+        XMStoreFloat4(&keyRotations[i], rotation);
+    }
+
+    for (size_t i = 0; i < boneCount; i++)
+    {
+        keyOffsets[i + 1] += keyOffsets[i];
+    }
+}
+
+
+//--------------------------------------------------------------------------------------
+// ModelSkeleton
+//--------------------------------------------------------------------------------------
+
+_Use_decl_annotations_
+void ModelSkeleton::GetBindPose(XMMATRIX* boneTransforms) const
+{
+    assert(boneTransforms != nullptr);
+
+    size_t boneCount = GetBoneCount();
+
+    for (size_t i = 0; i < boneCount; i++)
+    {
+        XMMATRIX transform = XMLoadFloat4x4(&bindPoseTransforms[i]);
+
+        uint32_t parent = parentIndices[i];
+        if (parent != c_Invalid)
+        {
+            if (parent >= i)
+                throw std::exception("Skeleton bones must be ordered with parents first");
+
+            transform = XMMatrixMultiply(transform, boneTransforms[parent]);
+        }
+
+        boneTransforms[i] = transform;
+    }
+}
+
+
+_Use_decl_annotations_
+void ModelSkeleton::Evaluate(const ModelAnimationClip& clip, float time, bool loop, XMMATRIX* boneTransforms) const
+{
+    assert(boneTransforms != nullptr);
+
+    size_t boneCount = GetBoneCount();
+
+    if (clip.keyOffsets.size() != boneCount + 1)
+        throw std::exception("Animation clip does not match the skeleton");
+
+    time = ClipTime(clip, time, loop);
+
+    // Parents come first, so their absolute transforms are ready when each child is reached.
+    for (size_t i = 0; i < boneCount; i++)
+    {
+        XMMATRIX transform = (clip.keyOffsets[i] != clip.keyOffsets[i + 1])
+            ? SampleBone(clip, i, time)
+            : XMLoadFloat4x4(&bindPoseTransforms[i]);
+
+        uint32_t parent = parentIndices[i];
+        if (parent != c_Invalid)
+        {
+            if (parent >= i)
+                throw std::exception("Skeleton bones must be ordered with parents first");
+
+            transform = XMMatrixMultiply(transform, boneTransforms[parent]);
+        }
+
+        boneTransforms[i] = transform;
+    }
+}
+
+
+_Use_decl_annotations_
+void ModelSkeleton::Evaluate(const ModelAnimationClip* const* clips, const float* times, size_t count, bool loop, XMMATRIX* boneTransforms) const
+{
+    assert(clips != nullptr && times != nullptr && boneTransforms != nullptr);
+
+    size_t boneCount = GetBoneCount();
+
+    for (size_t i = 0; i < count; i++)
+    {
+        assert(clips[i] != nullptr);
+
+        Evaluate(*clips[i], times[i], loop, boneTransforms + i * boneCount);
+    }
+}
+
+
+_Use_decl_annotations_
+void ModelSkeleton::ComputeBonePalette(const ModelMesh& mesh, const XMMATRIX* boneTransforms, XMMATRIX* palette) const
+{
+    assert(boneTransforms != nullptr && palette != nullptr);
+
+    size_t boneCount = GetBoneCount();
+
+    for (size_t i = 0; i < mesh.boneInfluences.size(); i++)
+    {
+        uint32_t bone = mesh.boneInfluences[i];
+        if (bone >= boneCount)
+            throw std::out_of_range("Mesh bone influence out of range");
+
+        palette[i] = XMMatrixMultiply(XMLoadFloat4x4(&invBindPoseTransforms[bone]), boneTransforms[bone]);
+    }
+}